@@ -559,6 +559,15 @@
  *                         ap_get_module_flags()
  * 20171014.1 (2.5.0-dev)  Add NOT_IN_DIR_CONTEXT replacing NOT_IN_DIR_LOC_FILE
  *                         semantics
+ * 20171014.2 (2.5.0-dev)  Add proxy_address, address fields to proxy_conn_rec,
+ *                         proxy_conn_pool and proxy_worker_shared, and
+ *                         ap_proxy_refresh_address() in mod_proxy.h
+ * 20171014.3 (2.5.0-dev)  Add warmup to proxy_worker_shared and
+ *                         ap_proxy_warmup_worker() in mod_proxy.h
+ * 20171014.4 (2.5.0-dev)  Add CONN_STATE_ASYNC_WAITIO to conn_state_e and
+ *                         AP_MPMQ_CAN_WAITIO
+ * 20171014.5 (2.5.0-dev)  Add ap_die_r(), and ap_proxy_suspended_done() in
+ *                         mod_proxy.h
  */
 
 #define MODULE_MAGIC_COOKIE 0x41503235UL /* "AP25" */
@@ -566,7 +575,7 @@
 #ifndef MODULE_MAGIC_NUMBER_MAJOR
 #define MODULE_MAGIC_NUMBER_MAJOR 20171014
 #endif
-#define MODULE_MAGIC_NUMBER_MINOR 1                 /* 0...n */
+#define MODULE_MAGIC_NUMBER_MINOR 5                 /* 0...n */
 
 /**
  * Determine if the server's current MODULE_MAGIC_NUMBER is at least a
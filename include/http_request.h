@@ -350,6 +350,17 @@ void ap_process_async_request(request_rec *r);
  */
 AP_DECLARE(void) ap_die(int type, request_rec *r);
 
+/**
+ * Kill the current request, with an explicit recursive error
+ * @param type Why the request is dieing
+ * @param r The current request
+ * @param recursive_error The status of the request when it failed, used
+ *        to detect errors while handling the error (HTTP_OK when the
+ *        request is completed outside of its handler, e.g. after resuming
+ *        a suspended request)
+ */
+AP_DECLARE(void) ap_die_r(int type, request_rec *r, int recursive_error);
+
 /**
  * Check whether a connection is still established and has data available,
  * optionnaly consuming blank lines ([CR]LF).
@@ -1239,6 +1239,10 @@ struct conn_slave_rec {
  * Enumeration of connection states
  * The two states CONN_STATE_LINGER_NORMAL and CONN_STATE_LINGER_SHORT may
  * only be set by the MPM. Use CONN_STATE_LINGER outside of the MPM.
+ * CONN_STATE_ASYNC_WAITIO can be set by a process_connection hook when the
+ * MPM supports it (AP_MPMQ_CAN_WAITIO), for the hooks to be run again once
+ * the socket is readable (or writable, per the sense) without holding a
+ * thread in the meantime.
  */
 typedef enum  {
     CONN_STATE_CHECK_REQUEST_LINE_READABLE,
@@ -1248,7 +1252,8 @@ typedef enum  {
     CONN_STATE_SUSPENDED,
     CONN_STATE_LINGER,          /* connection may be closed with lingering */
     CONN_STATE_LINGER_NORMAL,   /* MPM has started lingering close with normal timeout */
-    CONN_STATE_LINGER_SHORT     /* MPM has started lingering close with short timeout */
+    CONN_STATE_LINGER_SHORT,    /* MPM has started lingering close with short timeout */
+    CONN_STATE_ASYNC_WAITIO     /* return to the MPM to wait for IO (sense) */
 } conn_state_e;
 
 typedef enum  {
@@ -74,7 +74,7 @@ static void update_r_in_filters(ap_filter_t *f,
     }
 }
 
-static void ap_die_r(int type, request_rec *r, int recursive_error)
+AP_DECLARE(void) ap_die_r(int type, request_rec *r, int recursive_error)
 {
     char *custom_response;
     request_rec *r_1st_err = r;
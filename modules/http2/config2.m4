@@ -55,6 +55,7 @@ AC_DEFUN([APACHE_CHECK_NGHTTP2],[
     ap_nghttp2_found=""
     ap_nghttp2_base=""
     ap_nghttp2_libs=""
+    ap_nghttp2_includes=""
 
     dnl Determine the nghttp2 base directory, if any
     AC_MSG_CHECKING([for user-provided nghttp2 base directory])
@@ -104,6 +105,7 @@ AC_DEFUN([APACHE_CHECK_NGHTTP2],[
         pkglookup="`$PKGCONFIG --cflags-only-I libnghttp2`"
         APR_ADDTO(CPPFLAGS, [$pkglookup])
         APR_ADDTO(MOD_CFLAGS, [$pkglookup])
+        ap_nghttp2_includes="$pkglookup"
         pkglookup="`$PKGCONFIG $PKGCONFIG_LIBOPTS --libs-only-L libnghttp2`"
         APR_ADDTO(LDFLAGS, [$pkglookup])
         APR_ADDTO(MOD_LDFLAGS, [$pkglookup])
@@ -118,6 +120,7 @@ AC_DEFUN([APACHE_CHECK_NGHTTP2],[
     if test "x$ap_nghttp2_base" != "x" -a "x$ap_nghttp2_found" = "x"; then
       APR_ADDTO(CPPFLAGS, [-I$ap_nghttp2_base/include])
       APR_ADDTO(MOD_CFLAGS, [-I$ap_nghttp2_base/include])
+      ap_nghttp2_includes="-I$ap_nghttp2_base/include"
       APR_ADDTO(LDFLAGS, [-L$ap_nghttp2_base/lib])
       APR_ADDTO(MOD_LDFLAGS, [-L$ap_nghttp2_base/lib])
       if test "x$ap_platform_runtime_link_flag" != "x"; then
@@ -164,6 +167,14 @@ dnl # nghttp2 >= 1.14.0: invalid header callback
 dnl # nghttp2 >= 1.15.0: get/set stream window sizes
       AC_CHECK_FUNCS([nghttp2_session_get_stream_local_window_size], 
         [APR_ADDTO(MOD_CPPFLAGS, ["-DH2_NG2_LOCAL_WIN_SIZE"])], [])
+dnl # nghttp2 no-copy nv flags: submit header fields without copying them
+      AC_MSG_CHECKING([for nghttp2 no-copy header fields])
+      AC_TRY_COMPILE([#include <nghttp2/nghttp2.h>],[
+int flags = (NGHTTP2_NV_FLAG_NO_COPY_NAME|NGHTTP2_NV_FLAG_NO_COPY_VALUE);
+(void)flags;],
+        [AC_MSG_RESULT(yes)
+         APR_ADDTO(MOD_CPPFLAGS, ["-DH2_NG2_NO_COPY_NV"])],
+        [AC_MSG_RESULT(no)])
     else
       AC_MSG_WARN([nghttp2 version is too old])
     fi
@@ -175,6 +186,8 @@ dnl # nghttp2 >= 1.15.0: get/set stream window sizes
   ])
   if test "x$ac_cv_nghttp2" = "xyes"; then
     AC_DEFINE(HAVE_NGHTTP2, 1, [Define if nghttp2 is available])
+    dnl test/unit/h2_util.c includes nghttp2.h too
+    APR_ADDTO(UNITTEST_CFLAGS, [$ap_nghttp2_includes])
   fi
 ])
 
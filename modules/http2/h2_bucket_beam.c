@@ -29,6 +29,8 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
+
 #include <apr_lib.h>
 #include <apr_atomic.h>
 #include <apr_strings.h>
@@ -247,6 +249,50 @@ static apr_off_t bucket_mem_used(apr_bucket *b)
     }
 }
 
+static void heap_handed_over(void *data)
+{
+    /* memory is now owned by the receiver's bucket */
+    (void)data;
+}
+
+static int can_hand_over(apr_bucket *b)
+{
+    /* A heap bucket can change owner when no one else references its
+     * data and that data was not taken from the sender's bucket allocator,
+     * which must never be used from another thread. */
+    if (APR_BUCKET_IS_HEAP(b)) {
+        apr_bucket_heap *h = b->data;
+        return (h->free_func == free && h->refcount.refcount == 1);
+    }
+    return 0;
+}
+
+static apr_status_t copy_to_heap(apr_bucket **pb)
+{
+    apr_bucket *b = *pb, *nb;
+    const char *data;
+    apr_size_t len;
+    char *buf = NULL;
+    apr_status_t status;
+    
+    status = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
+    if (status != APR_SUCCESS) {
+        return status;
+    }
+    if (len > 0) {
+        buf = malloc(len);
+        if (!buf) {
+            return APR_ENOMEM;
+        }
+        memcpy(buf, data, len);
+    }
+    nb = apr_bucket_heap_create(buf, len, free, b->list);
+    APR_BUCKET_INSERT_BEFORE(b, nb);
+    apr_bucket_delete(b);
+    *pb = nb;
+    return APR_SUCCESS;
+}
+
 static int report_consumption(h2_bucket_beam *beam, h2_beam_lock *pbl)
 {
     int rv = 0;
@@ -329,6 +375,31 @@ static int buffer_is_empty(h2_bucket_beam *beam)
             && H2_BLIST_EMPTY(&beam->send_list));
 }
 
+static apr_status_t wait_change(h2_bucket_beam *beam, apr_thread_mutex_t *lock)
+{
+    apr_status_t rv;
+    
+    ++beam->waiting;
+    if (beam->timeout > 0) {
+        rv = apr_thread_cond_timedwait(beam->change, lock, beam->timeout);
+    }
+    else {
+        rv = apr_thread_cond_wait(beam->change, lock);
+    }
+    --beam->waiting;
+    return rv;
+}
+
+static void notify_change(h2_bucket_beam *beam)
+{
+    /* Only wake up if someone is listening. Sender and receiver mostly
+     * run without blocking on the beam and a broadcast for every
+     * send/receive/bucket destruction is then wasted. */
+    if (beam->waiting > 0) {
+        apr_thread_cond_broadcast(beam->change);
+    }
+}
+
 static apr_status_t wait_empty(h2_bucket_beam *beam, apr_read_type_e block,  
                                apr_thread_mutex_t *lock)
 {
@@ -338,11 +409,8 @@ static apr_status_t wait_empty(h2_bucket_beam *beam, apr_read_type_e block,
         if (APR_BLOCK_READ != block || !lock) {
             rv = APR_EAGAIN;
         }
-        else if (beam->timeout > 0) {
-            rv = apr_thread_cond_timedwait(beam->change, lock, beam->timeout);
-        }
         else {
-            rv = apr_thread_cond_wait(beam->change, lock);
+            rv = wait_change(beam, lock);
         }
     }
     return rv;
@@ -363,11 +431,8 @@ static apr_status_t wait_not_empty(h2_bucket_beam *beam, apr_read_type_e block,
         else if (APR_BLOCK_READ != block || !lock) {
             rv = APR_EAGAIN;
         }
-        else if (beam->timeout > 0) {
-            rv = apr_thread_cond_timedwait(beam->change, lock, beam->timeout);
-        }
         else {
-            rv = apr_thread_cond_wait(beam->change, lock);
+            rv = wait_change(beam, lock);
         }
     }
     return rv;
@@ -387,12 +452,7 @@ static apr_status_t wait_not_full(h2_bucket_beam *beam, apr_read_type_e block,
             rv = APR_EAGAIN;
         }
         else {
-            if (beam->timeout > 0) {
-                rv = apr_thread_cond_timedwait(beam->change, bl->mutex, beam->timeout);
-            }
-            else {
-                rv = apr_thread_cond_wait(beam->change, bl->mutex);
-            }
+            rv = wait_change(beam, bl->mutex);
         }
     }
     *pspace_left = left;
@@ -460,7 +520,7 @@ static void h2_beam_emitted(h2_bucket_beam *beam, h2_beam_proxy *proxy)
             r_purge_sent(beam);
         }
         else {
-            apr_thread_cond_broadcast(beam->change);
+            notify_change(beam);
         }
         leave_yellow(beam, &bl);
     }
@@ -480,7 +540,7 @@ static apr_status_t beam_close(h2_bucket_beam *beam)
 {
     if (!beam->closed) {
         beam->closed = 1;
-        apr_thread_cond_broadcast(beam->change);
+        notify_change(beam);
     }
     return APR_SUCCESS;
 }
@@ -719,7 +779,7 @@ void h2_beam_abort(h2_bucket_beam *beam)
             h2_blist_cleanup(&beam->send_list);
             report_consumption(beam, &bl);
         }
-        apr_thread_cond_broadcast(beam->change);
+        notify_change(beam);
         leave_yellow(beam, &bl);
     }
 }
@@ -844,10 +904,10 @@ static apr_status_t append_bucket(h2_bucket_beam *beam,
      * corrupt. */
     status = APR_ENOTIMPL;
     if (APR_BUCKET_IS_TRANSIENT(b)) {
-        /* this takes care of transient buckets and converts them
-         * into heap ones. Other bucket types might or might not be
-         * affected by this. */
-        status = apr_bucket_setaside(b, beam->send_pool);
+        /* transient data needs to be copied. Place it into memory
+         * that the receiver may own, so that the bucket can be handed
+         * over without proxy. */
+        status = copy_to_heap(&b);
     }
     else if (APR_BUCKET_IS_HEAP(b)) {
         /* For heap buckets read from a receiver thread is fine. The
@@ -860,11 +920,21 @@ static apr_status_t append_bucket(h2_bucket_beam *beam,
          * to morph themselves into heap buckets. That may happen anytime,
          * even after the bucket data pointer has been read. So at
          * any time inside the receiver thread, the pool bucket memory
-         * may disappear. yikes. */
-        status = apr_bucket_read(b, &data, &len, APR_BLOCK_READ);
-        if (status == APR_SUCCESS) {
-            apr_bucket_heap_make(b, data, len, NULL);
+         * may disappear. yikes. 
+         * Unless the pool outlives our sending side: the beam cleans
+         * up all sender buckets before that can happen. */
+        apr_bucket_pool *bp = b->data;
+        if (bp->pool && apr_pool_is_ancestor(bp->pool, beam->send_pool)) {
+            status = APR_SUCCESS;
         }
+        else {
+            status = copy_to_heap(&b);
+        }
+    }
+    else if (APR_BUCKET_IS_MMAP(b)) {
+        /* setting aside duplicates the mapping if needed, the data
+         * itself stays where it is. */
+        status = apr_bucket_setaside(b, beam->send_pool);
     }
     else if (APR_BUCKET_IS_FILE(b) && can_beam) {
         status = apr_bucket_setaside(b, beam->send_pool);
@@ -924,23 +994,32 @@ apr_status_t h2_beam_send(h2_bucket_beam *beam,
             rv = APR_ECONNABORTED;
         }
         else if (sender_bb) {
-            int force_report = !APR_BRIGADE_EMPTY(sender_bb);
+            /* The receiver only needs to hear about new data when it
+             * might have run out of it. As long as it has not taken
+             * everything we sent before, it will come back on its own. */
+            int need_report = 0;
             
             space_left = calc_space_left(beam);
             while (!APR_BRIGADE_EMPTY(sender_bb) && APR_SUCCESS == rv) {
                 if (space_left <= 0) {
-                    report_prod_io(beam, force_report, &bl);
+                    report_prod_io(beam, need_report, &bl);
+                    need_report = 0;
                     rv = wait_not_full(beam, block, &space_left, &bl);
                     if (APR_SUCCESS != rv) {
                         break;
                     }
                 }
+                if (H2_BLIST_EMPTY(&beam->send_list)) {
+                    need_report = 1;
+                }
                 b = APR_BRIGADE_FIRST(sender_bb);
                 rv = append_bucket(beam, b, block, &space_left, &bl);
             }
             
-            report_prod_io(beam, force_report, &bl);
-            apr_thread_cond_broadcast(beam->change);
+            if (need_report) {
+                report_prod_io(beam, 1, &bl);
+            }
+            notify_change(beam);
         }
         report_consumption(beam, &bl);
         leave_yellow(beam, &bl);
@@ -1049,6 +1128,29 @@ transfer:
                 ++transferred_buckets;
                 continue;
             }
+            else if (can_hand_over(bsender)) {
+                /* the receiver takes ownership of the data and frees it
+                 * without getting back to us. The emptied sender bucket
+                 * can go right away. */
+                apr_bucket_heap *h = bsender->data;
+                
+                brecv = apr_bucket_heap_create(h->base, h->alloc_len, free, 
+                                               bb->bucket_alloc);
+                brecv->start = bsender->start;
+                brecv->length = bsender->length;
+                h->free_func = heap_handed_over;
+                ++beam->buckets_handed;
+                
+                APR_BUCKET_REMOVE(bsender);
+                H2_BLIST_INSERT_TAIL(&beam->purge_list, bsender);
+                beam->received_bytes += bsender->length;
+                ++transferred_buckets;
+                
+                APR_BRIGADE_INSERT_TAIL(bb, brecv);
+                remain -= brecv->length;
+                ++transferred;
+                continue;
+            }
             else {
                 /* create a "receiver" standin bucket. we took care about the
                  * underlying sender bucket and its data when we placed it into
@@ -1122,7 +1224,7 @@ transfer:
         }
         
         if (transferred) {
-            apr_thread_cond_broadcast(beam->change);
+            notify_change(beam);
             status = APR_SUCCESS;
         }
         else {
@@ -1279,10 +1381,12 @@ void h2_beam_log(h2_bucket_beam *beam, conn_rec *c, int level, const char *msg)
 {
     if (beam && APLOG_C_IS_LEVEL(c,level)) {
         ap_log_cerror(APLOG_MARK, level, 0, c, 
-                      "beam(%ld-%d,%s,closed=%d,aborted=%d,empty=%d,buf=%ld): %s", 
+                      "beam(%ld-%d,%s,closed=%d,aborted=%d,empty=%d,buf=%ld,"
+                      "handed=%ld): %s", 
                       (c->master? c->master->id : c->id), beam->id, beam->tag, 
                       beam->closed, beam->aborted, h2_beam_empty(beam), 
-                      (long)h2_beam_get_buffered(beam), msg);
+                      (long)h2_beam_get_buffered(beam), 
+                      (long)beam->buckets_handed, msg);
     }
 }
 
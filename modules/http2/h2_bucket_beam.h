@@ -181,6 +181,7 @@ struct h2_bucket_beam {
 
     apr_size_t buckets_sent;  /* # of beam buckets sent */
     apr_size_t files_beamed;  /* how many file handles have been set aside */
+    apr_size_t buckets_handed;/* # of heap buckets handed over without proxy */
     
     unsigned int aborted : 1;
     unsigned int closed : 1;
@@ -189,6 +190,7 @@ struct h2_bucket_beam {
 
     struct apr_thread_mutex_t *lock;
     struct apr_thread_cond_t *change;
+    int waiting;                      /* # of threads waiting on change */
     
     apr_off_t cons_bytes_reported;    /* amount of bytes reported as consumed */
     h2_beam_ev_callback *cons_ev_cb;
@@ -237,6 +239,14 @@ apr_status_t h2_beam_destroy(h2_bucket_beam *beam);
  * internally as long as they have not been processed by the receiving side.
  * All accepted buckets are removed from the given brigade. Will return with
  * APR_EAGAIN on non-blocking sends when not all buckets could be accepted.
+ *
+ * Data that needs to be copied when sent (transient buckets, pool buckets
+ * from short-lived pools) is placed in malloc'ed heap buckets. Those are
+ * handed over to the receiver as plain heap buckets, without proxy, so
+ * that their destruction does not need to go back to the beam.
+ *
+ * The producer callback is only invoked when the beam had no data buffered
+ * before, e.g. when the receiver may have run dry and waits for news. 
  * 
  * Call from the sender side only.
  */
@@ -79,6 +79,7 @@ static h2_config defconf = {
     0,                      /* copy files across threads */
     NULL,                   /* push list */
     0,                      /* early hints, http status 103 */
+    0,                      /* inline streams */
 };
 
 void h2_config_init(apr_pool_t *pool)
@@ -113,6 +114,7 @@ static void *h2_config_create(apr_pool_t *pool,
     conf->copy_files           = DEF_VAL;
     conf->push_list            = NULL;
     conf->early_hints          = DEF_VAL;
+    conf->inline_streams       = DEF_VAL;
     return conf;
 }
 
@@ -164,6 +166,7 @@ static void *h2_config_merge(apr_pool_t *pool, void *basev, void *addv)
         n->push_list        = add->push_list? add->push_list : base->push_list;
     }
     n->early_hints          = H2_CONFIG_GET(add, base, early_hints);
+    n->inline_streams       = H2_CONFIG_GET(add, base, inline_streams);
     return n;
 }
 
@@ -219,6 +222,8 @@ apr_int64_t h2_config_geti64(const h2_config *conf, h2_config_var_t var)
             return H2_CONFIG_GET(conf, &defconf, copy_files);
         case H2_CONF_EARLY_HINTS:
             return H2_CONFIG_GET(conf, &defconf, early_hints);
+        case H2_CONF_INLINE_STREAMS:
+            return H2_CONFIG_GET(conf, &defconf, inline_streams);
         default:
             return DEF_VAL;
     }
@@ -619,6 +624,23 @@ static const char *h2_conf_set_early_hints(cmd_parms *parms,
     return "value must be On or Off";
 }
 
+static const char *h2_conf_set_inline_streams(cmd_parms *parms,
+                                              void *arg, const char *value)
+{
+    h2_config *cfg = (h2_config *)h2_config_sget(parms->server);
+    if (!strcasecmp(value, "On")) {
+        cfg->inline_streams = 1;
+        return NULL;
+    }
+    else if (!strcasecmp(value, "Off")) {
+        cfg->inline_streams = 0;
+        return NULL;
+    }
+    
+    (void)arg;
+    return "value must be On or Off";
+}
+
 #define AP_END_CMD     AP_INIT_TAKE1(NULL, NULL, NULL, RSRC_CONF, NULL)
 
 const command_rec h2_cmds[] = {
@@ -664,6 +686,8 @@ const command_rec h2_cmds[] = {
                    OR_FILEINFO, "add a resource to be pushed in this location/on this server."),
     AP_INIT_TAKE1("H2EarlyHints", h2_conf_set_early_hints, NULL,
                   RSRC_CONF, "on to enable interim status 103 responses"),
+    AP_INIT_TAKE1("H2InlineStreams", h2_conf_set_inline_streams, NULL,
+                  RSRC_CONF, "on to process simple requests on the connection thread"),
     AP_END_CMD
 };
 
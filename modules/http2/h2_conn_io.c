@@ -183,6 +183,7 @@ static void append_scratch(h2_conn_io *io)
         APR_BRIGADE_INSERT_TAIL(io->output, b);
         io->scratch = NULL;
         io->slen = io->ssize = 0;
+        ++io->records;
     }
 }
 
@@ -267,10 +268,12 @@ static apr_status_t pass_output(h2_conn_io *io, int flush)
     apr_off_t bblen;
     apr_status_t status;
     
-    append_scratch(io);
-    if (flush && !io->is_flushed) {
-        b = apr_bucket_flush_create(c->bucket_alloc);
-        APR_BRIGADE_INSERT_TAIL(bb, b);
+    if (flush) {
+        append_scratch(io);
+        if (!io->is_flushed) {
+            b = apr_bucket_flush_create(c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, b);
+        }
     }
     
     if (APR_BRIGADE_EMPTY(bb)) {
@@ -285,6 +288,7 @@ static apr_status_t pass_output(h2_conn_io *io, int flush)
     if (status == APR_SUCCESS) {
         io->bytes_written += (apr_size_t)bblen;
         io->last_write = apr_time_now();
+        ++io->writes;
         if (flush) {
             io->is_flushed = 1;
         }
@@ -314,6 +318,14 @@ int h2_conn_io_needs_flush(h2_conn_io *io)
     return 0;
 }
 
+apr_status_t h2_conn_io_send(h2_conn_io *io)
+{
+    apr_status_t status;
+    status = pass_output(io, 0);
+    check_write_size(io);
+    return status;
+}
+
 apr_status_t h2_conn_io_flush(h2_conn_io *io)
 {
     apr_status_t status;
@@ -367,8 +379,13 @@ apr_status_t h2_conn_io_pass(h2_conn_io *io, apr_bucket_brigade *bb)
         
         if (APR_BUCKET_IS_METADATA(b)) {
             /* need to finish any open scratch bucket, as meta data 
-             * needs to be forward "in order". */
-            append_scratch(io);
+             * needs to be forward "in order". The exception are stream
+             * EOS buckets: scratch holds copies only and stream
+             * resources may be released before it is written. Keeping
+             * it open avoids short TLS records for every stream ending. */
+            if (!H2_BUCKET_IS_H2EOS(b)) {
+                append_scratch(io);
+            }
             APR_BUCKET_REMOVE(b);
             APR_BRIGADE_INSERT_TAIL(io->output, b);
         }
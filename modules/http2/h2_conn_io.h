@@ -37,6 +37,8 @@ typedef struct {
     apr_time_t last_write;
     apr_int64_t bytes_read;
     apr_int64_t bytes_written;
+    apr_int64_t writes;          /* # of brigades passed to the filters */
+    apr_int64_t records;         /* # of write_size buffers passed */
     
     int buffer_output;
     apr_size_t flush_threshold;
@@ -62,9 +64,17 @@ apr_status_t h2_conn_io_write(h2_conn_io *io,
 apr_status_t h2_conn_io_pass(h2_conn_io *io, apr_bucket_brigade *bb);
 
 /**
- * Pass any buffered data on to the connection output filters.
+ * Pass buffered data on to the connection output filters, without
+ * flushing. A partially filled write buffer is kept back, so that
+ * more frames may be added to it before it is sent.
+ * @param io the connection io
+ */
+apr_status_t h2_conn_io_send(h2_conn_io *io);
+
+/**
+ * Pass any buffered data on to the connection output filters and
+ * flush them.
  * @param io the connection io
- * @param flush if a flush bucket should be appended to any output
  */
 apr_status_t h2_conn_io_flush(h2_conn_io *io);
 
@@ -54,6 +54,7 @@
 #include "h2_session.h"
 #include "h2_util.h"
 #include "h2_version.h"
+#include "h2_workers.h"
 
 #include "h2_filter.h"
 
@@ -386,6 +387,35 @@ static void add_streams(apr_bucket_brigade *bb, h2_session *s, int last)
     bbout(bb, "\n  }%s\n", last? "" : ",");
 }
 
+static void add_hist(apr_bucket_brigade *bb, const char *name,
+                     const apr_uint32_t *hist, long unit, int last)
+{
+    int i;
+    
+    /* keys are the (exclusive) upper bounds of the buckets */
+    bbout(bb, "    \"%s\": {", name);
+    for (i = 0; i < H2_WORKERS_HIST_LEN - 1; ++i) {
+        bbout(bb, "%s\"%ld\": %lu", i? ", " : "", unit << i, 
+              (unsigned long)hist[i]);
+    }
+    bbout(bb, ", \"inf\": %lu}%s\n", (unsigned long)hist[i], last? "" : ",");
+}
+
+static void add_workers(apr_bucket_brigade *bb, h2_mplx *m, int last) 
+{
+    h2_workers_stats stats;
+    int worker_count, queued;
+    
+    h2_workers_get_stats(m->workers, &stats, &worker_count, &queued);
+    bbout(bb, "  \"workers\": {\n");
+    bbout(bb, "    \"count\": %d,\n", worker_count);
+    bbout(bb, "    \"queued\": %d,\n", queued);
+    bbout(bb, "    \"scheduled\": %"APR_UINT64_T_FMT",\n", stats.scheduled);
+    add_hist(bb, "queueDepth", stats.queue_depth, 1, 0);
+    add_hist(bb, "waitMicros", stats.wait_time, H2_WORKERS_WAIT_UNIT_USECS, 1);
+    bbout(bb, "  }%s\n", last? "" : ",");
+}
+
 static void add_push(apr_bucket_brigade *bb, h2_session *s, 
                      h2_stream *stream, int last) 
 {
@@ -428,6 +458,10 @@ static void add_out(apr_bucket_brigade *bb, h2_session *s, int last)
     bbout(bb, "    \"out\": {\n");
     bbout(bb, "      \"responses\": %d,\n", s->responses_submitted);
     bbout(bb, "      \"frames\": %ld,\n", (long)s->frames_sent);
+    bbout(bb, "      \"writes\": %"APR_INT64_T_FMT",\n", s->io.writes);
+    bbout(bb, "      \"records\": %"APR_INT64_T_FMT",\n", s->io.records);
+    bbout(bb, "      \"framesPerWrite\": %.2f,\n", 
+          s->io.writes? ((double)s->frames_sent / s->io.writes) : 0.0);
     bbout(bb, "      \"octets\": %"APR_UINT64_T_FMT"\n", s->io.bytes_written);
     bbout(bb, "    }%s\n", last? "" : ",");
 }
@@ -475,6 +509,8 @@ static apr_status_t h2_status_insert(h2_task *task, apr_bucket *b)
 
     add_streams(bb, s, 0);
     
+    add_workers(bb, m, 0);
+    
     add_stats(bb, s, stream, 1);
     bbout(bb, "}\n");
     
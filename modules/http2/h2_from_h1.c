@@ -286,10 +286,9 @@ static h2_headers *create_response(h2_task *task, request_rec *r)
         apr_table_unset(r->headers_out, "Content-Length");
     }
     
-    headers = apr_table_make(r->pool, 10);
-    
-    set_basic_http_header(headers, r, r->pool);
     if (r->status == HTTP_NOT_MODIFIED) {
+        headers = apr_table_make(r->pool, 10);
+        set_basic_http_header(headers, r, r->pool);
         apr_table_do(copy_header, headers, r->headers_out,
                      "ETag",
                      "Content-Location",
@@ -304,7 +303,9 @@ static h2_headers *create_response(h2_task *task, request_rec *r)
                      NULL);
     }
     else {
-        apr_table_do(copy_header, headers, r->headers_out, NULL);
+        /* take all headers in one go, Date and Server are set on top */
+        headers = apr_table_copy(r->pool, r->headers_out);
+        set_basic_http_header(headers, r, r->pool);
     }
     
     return h2_headers_rcreate(r, r->status, headers, r->pool);
@@ -670,10 +670,19 @@ apr_status_t h2_mplx_reprioritize(h2_mplx *m, h2_stream_pri_cmp *cmp, void *ctx)
     return status;
 }
 
+/* Called with m->lock held, takes workers->lock: the opposite order of
+ * slot_pull_task() -> h2_mplx_pop_task(). This cannot deadlock because
+ * of the invariant: while m is queued at the workers, or popped by one
+ * that is about to call h2_mplx_pop_task(), m->is_registered is set, and
+ * only h2_mplx_pop_task() clears it, under m->lock. So with m->lock held
+ * and is_registered clear, no worker holding workers->lock waits for us.
+ */
 static void register_if_needed(h2_mplx *m) 
 {
     if (!m->aborted && !m->is_registered && !h2_iq_empty(m->q)) {
         apr_status_t status = h2_workers_register(m->workers, m); 
+        /* not registered, so not queued either, see above */
+        ap_assert(status != APR_EEXIST);
         if (status == APR_SUCCESS) {
             m->is_registered = 1;
         }
@@ -715,6 +724,50 @@ apr_status_t h2_mplx_process(h2_mplx *m, struct h2_stream *stream,
     return status;
 }
 
+static h2_task *stream_task(h2_mplx *m, h2_stream *stream)
+{
+    conn_rec *slave, **pslave;
+
+    if (!stream->task) {
+        /* a redone task keeps its slave */
+        pslave = (conn_rec **)apr_array_pop(m->spare_slaves);
+        if (pslave) {
+            slave = *pslave;
+            slave->aborted = 0;
+        }
+        else {
+            slave = h2_slave_create(m->c, stream->id, m->pool);
+        }
+
+        if (stream->id > m->max_stream_started) {
+            m->max_stream_started = stream->id;
+        }
+        if (stream->input) {
+            h2_beam_on_consumed(stream->input, stream_input_ev, 
+                                stream_input_consumed, stream);
+        }
+        
+        stream->task = h2_task_create(slave, stream->id, 
+                                      stream->request, m, stream->input, 
+                                      stream->session->s->timeout,
+                                      m->stream_max_mem);
+        if (!stream->task) {
+            ap_log_cerror(APLOG_MARK, APLOG_ERR, APR_ENOMEM, slave,
+                          H2_STRM_LOG(APLOGNO(02941), stream, 
+                          "create task"));
+            return NULL;
+        }
+        
+    }
+    else {
+        /* redone or handed over, busy again */
+        stream->task->worker_done = 0;
+    }
+    
+    ++m->tasks_active;
+    return stream->task;
+}
+
 static h2_task *next_stream_task(h2_mplx *m)
 {
     h2_stream *stream;
@@ -724,47 +777,64 @@ static h2_task *next_stream_task(h2_mplx *m)
         
         stream = h2_ihash_get(m->streams, sid);
         if (stream) {
-            conn_rec *slave, **pslave;
+            return stream_task(m, stream);
+        }
+    }
+    return NULL;
+}
 
-            pslave = (conn_rec **)apr_array_pop(m->spare_slaves);
-            if (pslave) {
-                slave = *pslave;
-                slave->aborted = 0;
-            }
-            else {
-                slave = h2_slave_create(m->c, stream->id, m->pool);
-            }
-            
-            if (!stream->task) {
+apr_status_t h2_mplx_process_inline(h2_mplx *m, struct h2_stream *stream)
+{
+    apr_status_t status;
+    h2_task *task = NULL;
+    
+    H2_MPLX_ENTER(m);
 
-                if (sid > m->max_stream_started) {
-                    m->max_stream_started = sid;
-                }
-                if (stream->input) {
-                    h2_beam_on_consumed(stream->input, stream_input_ev, 
-                                        stream_input_consumed, stream);
-                }
-                
-                stream->task = h2_task_create(slave, stream->id, 
-                                              stream->request, m, stream->input, 
-                                              stream->session->s->timeout,
-                                              m->stream_max_mem);
-                if (!stream->task) {
-                    ap_log_cerror(APLOG_MARK, APLOG_ERR, APR_ENOMEM, slave,
-                                  H2_STRM_LOG(APLOGNO(02941), stream, 
-                                  "create task"));
-                    return NULL;
-                }
-                
-            }
-            
-            ++m->tasks_active;
-            return stream->task;
+    if (m->aborted) {
+        status = APR_ECONNABORTED;
+    }
+    else if (h2_stream_is_ready(stream)) {
+        /* already have a response */
+        h2_ihash_add(m->streams, stream);
+        check_data_for(m, stream, 0);
+        status = APR_SUCCESS;
+    }
+    else {
+        h2_ihash_add(m->streams, stream);
+        task = stream_task(m, stream);
+        status = task? APR_SUCCESS : APR_ENOMEM;
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE1, status, m->c,
+                      H2_STRM_MSG(stream, "process inline")); 
+    }
+
+    H2_MPLX_LEAVE(m);
+    
+    if (task) {
+        /* We run the task without holding the lock, as it will call
+         * back into us for output. When h2_task_inline_handler() finds
+         * the request is not for a small static file, the task is handed
+         * over to the h2 workers by task_done() to finish it or, should 
+         * it have to be redone, to process it again. */
+        task->run_inline = 1;
+        h2_task_do(task, m->c->current_thread, m->workers->max_workers);
+        task->run_inline = 0;
+        if (task->inline_redo) {
+            /* never opened towards the stream, start over with a new one */
+            h2_beam_destroy(task->output.beam);
+            task->output.beam = NULL;
+        }
+        if (task->inline_redo || task->r_handover) {
+            H2_MPLX_ENTER_ALWAYS(m);
+            h2_ihash_add(m->sredo, stream);
+            H2_MPLX_LEAVE(m);
         }
+        h2_mplx_task_done(m, task, NULL);
     }
-    return NULL;
+    return status;
 }
 
+/* Called by a worker with workers->lock held, takes m->lock. See
+ * register_if_needed() for why the opposite order there is safe. */
 apr_status_t h2_mplx_pop_task(h2_mplx *m, h2_task **ptask)
 {
     apr_status_t rv = APR_EOF;
@@ -773,6 +843,8 @@ apr_status_t h2_mplx_pop_task(h2_mplx *m, h2_task **ptask)
     if (APR_SUCCESS != (rv = apr_thread_mutex_lock(m->lock))) {
         return rv;
     }
+    /* we were queued at the workers, which only happens registered */
+    ap_assert(m->is_registered);
     
     if (m->aborted) {
         rv = APR_EOF;
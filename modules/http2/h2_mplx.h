@@ -50,6 +50,7 @@ struct h2_ngn_shed;
 struct h2_req_engine;
 
 #include <apr_queue.h>
+#include <apr_ring.h>
 
 typedef struct h2_mplx h2_mplx;
 
@@ -94,6 +95,11 @@ struct h2_mplx {
     apr_array_header_t *spare_slaves; /* spare slave connections */
     
     struct h2_workers *workers;
+    /* scheduling at h2_workers, protected by the h2_workers lock */
+    APR_RING_ENTRY(h2_mplx) sched_link;
+    int sched_queued;               /* is in a h2_workers queue */
+    int sched_running;              /* # of its tasks run by workers */
+    apr_time_t sched_since;         /* when it was queued */
     
     struct h2_ngn_shed *ngn_shed;
 };
@@ -177,6 +183,18 @@ apr_status_t h2_mplx_keep_active(h2_mplx *m, struct h2_stream *stream);
 apr_status_t h2_mplx_process(h2_mplx *m, struct h2_stream *stream, 
                              h2_stream_pri_cmp *cmp, void *ctx);
 
+/**
+ * Process the request of the stream right away in the calling thread,
+ * instead of scheduling it for the h2 workers. The response output is
+ * buffered in the stream's output beam, so only small static files (or
+ * cached responses) are served this way, other requests are handed over
+ * to the workers before their handler runs. Returns when the request has
+ * been processed or handed over.
+ * @param m the multiplexer
+ * @param stream the stream to process
+ */
+apr_status_t h2_mplx_process_inline(h2_mplx *m, struct h2_stream *stream);
+
 /**
  * Stream priorities have changed, reschedule pending requests.
  * 
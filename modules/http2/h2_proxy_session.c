@@ -201,7 +201,7 @@ static int on_frame_recv(nghttp2_session *ngh2, const nghttp2_frame *frame,
                               "h2_proxy_session(%s): got interim HEADERS, "
                               "status=%d, will forward=%d",
                               session->id, r->status, forward);
-                if (forward) {
+                if (forward && !session->out) {
                     ap_send_interim_response(r, 1);
                 }
             }
@@ -297,6 +297,10 @@ static apr_status_t h2_proxy_stream_add_header_out(h2_proxy_stream *stream,
                                                    const char *n, apr_size_t nlen,
                                                    const char *v, apr_size_t vlen)
 {
+    if (stream->data_received && stream->session->out) {
+        /* trailers, the request may be in use by its thread already */
+        return APR_SUCCESS;
+    }
     if (n[0] == ':') {
         if (!stream->data_received && !strncmp(":status", n, nlen)) {
             char *s = apr_pstrndup(stream->r->pool, v, vlen);
@@ -423,19 +427,29 @@ static int stream_response_data(nghttp2_session *ngh2, uint8_t flags,
     }
     stream->data_received += len;
     
-    b = apr_bucket_transient_create((const char*)data, len, 
-                                    stream->r->connection->bucket_alloc);
-    APR_BRIGADE_INSERT_TAIL(stream->output, b);
-    /* always flush after a DATA frame, as we have no other indication
-     * of buffer use */
-    b = apr_bucket_flush_create(stream->r->connection->bucket_alloc);
-    APR_BRIGADE_INSERT_TAIL(stream->output, b);
-    
-    status = ap_pass_brigade(stream->r->output_filters, stream->output);
-    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, status, stream->r, APLOGNO(03359)
-                  "h2_proxy_session(%s): stream=%d, response DATA %ld, %ld"
-                  " total", session->id, stream_id, (long)len,
-                  (long)stream->data_received);
+    if (session->out) {
+        /* the request's own thread writes it, we may be on another one */
+        status = session->out(session, stream->r, (const char*)data, len, 0);
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, session->c, 
+                      APLOGNO(03359) "h2_proxy_session(%s): stream=%d, "
+                      "response DATA %ld, %ld total", session->id, stream_id,
+                      (long)len, (long)stream->data_received);
+    }
+    else {
+        b = apr_bucket_transient_create((const char*)data, len, 
+                                        stream->r->connection->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(stream->output, b);
+        /* always flush after a DATA frame, as we have no other indication
+         * of buffer use */
+        b = apr_bucket_flush_create(stream->r->connection->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(stream->output, b);
+        
+        status = ap_pass_brigade(stream->r->output_filters, stream->output);
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, status, stream->r, APLOGNO(03359)
+                      "h2_proxy_session(%s): stream=%d, response DATA %ld, %ld"
+                      " total", session->id, stream_id, (long)len,
+                      (long)stream->data_received);
+    }
     if (status != APR_SUCCESS) {
         ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, session->c, APLOGNO(03344)
                       "h2_proxy_session(%s): passing output on stream %d", 
@@ -446,10 +460,15 @@ static int stream_response_data(nghttp2_session *ngh2, uint8_t flags,
     }
     if (stream->standalone) {
         nghttp2_session_consume(ngh2, stream_id, len);
-        ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, stream->r,
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c,
                       "h2_proxy_session(%s): stream %d, win_update %d bytes",
                       session->id, stream_id, (int)len);
     }
+    else if (session->out) {
+        /* the data is out of the connection, the stream window waits
+         * for h2_proxy_session_stream_consumed() */
+        nghttp2_session_consume_connection(ngh2, len);
+    }
     return 0;
 }
 
@@ -1235,7 +1254,14 @@ static void ev_stream_done(h2_proxy_session *session, int stream_id,
                       session->id, stream_id, touched, stream->error_code);
         
         if (status != APR_SUCCESS) {
-            stream->r->status = 500;
+            if (!session->out) {
+                stream->r->status = 500;
+            }
+        }
+        else if (!stream->data_received && session->out) {
+            h2_proxy_stream_end_headers_out(stream);
+            stream->data_received = 1;
+            session->out(session, stream->r, NULL, 0, 1);
         }
         else if (!stream->data_received) {
             apr_bucket *b;
@@ -1597,3 +1623,58 @@ void h2_proxy_session_update_window(h2_proxy_session *session,
     }
 }
 
+
+typedef struct {
+    request_rec *r;
+    h2_proxy_stream *stream;
+} stream_find_ctx;
+
+static int stream_find_iter(void *udata, void *val)
+{
+    stream_find_ctx *ctx = udata;
+    h2_proxy_stream *stream = val;
+    
+    if (stream->r == ctx->r) {
+        ctx->stream = stream;
+        return 0;
+    }
+    return 1;
+}
+
+static h2_proxy_stream *stream_of(h2_proxy_session *session, request_rec *r)
+{
+    stream_find_ctx ctx;
+    
+    ctx.r = r;
+    ctx.stream = NULL;
+    h2_proxy_ihash_iter(session->streams, stream_find_iter, &ctx);
+    return ctx.stream;
+}
+
+void h2_proxy_session_stream_consumed(h2_proxy_session *session, 
+                                      request_rec *r, apr_off_t bytes)
+{
+    h2_proxy_stream *stream = stream_of(session, r);
+    
+    /* a closed stream takes no more data, nothing to open then */
+    if (stream) {
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, session->c, 
+                      "h2_proxy_session(%s-%d): win_update %ld bytes",
+                      session->id, (int)stream->id, (long)bytes);
+        nghttp2_session_consume_stream(session->ngh2, stream->id, 
+                                       (size_t)bytes);
+    }
+}
+
+void h2_proxy_session_cancel(h2_proxy_session *session, request_rec *r)
+{
+    h2_proxy_stream *stream = stream_of(session, r);
+    
+    if (stream) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, session->c, 
+                      "h2_proxy_session(%s-%d): cancel stream",
+                      session->id, (int)stream->id);
+        nghttp2_submit_rst_stream(session->ngh2, NGHTTP2_FLAG_NONE, 
+                                  stream->id, NGHTTP2_CANCEL);
+    }
+}
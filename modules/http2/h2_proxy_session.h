@@ -63,6 +63,11 @@ typedef enum {
 typedef struct h2_proxy_session h2_proxy_session;
 typedef void h2_proxy_request_done(h2_proxy_session *s, request_rec *r,
                                    apr_status_t status, int touched);
+/* Takes response data (or with len 0, only the end of a body-less
+ * response) of a request, in place of its output filters. */
+typedef apr_status_t h2_proxy_response_out(h2_proxy_session *s, request_rec *r,
+                                           const char *data, apr_size_t len,
+                                           int eos);
 
 struct h2_proxy_session {
     const char *id;
@@ -77,6 +82,7 @@ struct h2_proxy_session {
     unsigned int h2_front : 1; /* if front-end connection is HTTP/2 */
 
     h2_proxy_request_done *done;
+    h2_proxy_response_out *out; /* if set, nothing is written to requests */
     void *user_data;
     
     unsigned char window_bits_stream;
@@ -122,6 +128,23 @@ void h2_proxy_session_cleanup(h2_proxy_session *s, h2_proxy_request_done *done);
 void h2_proxy_session_update_window(h2_proxy_session *s, 
                                     conn_rec *c, apr_off_t bytes);
 
+/**
+ * With an out callback on the session, a stream's window is only opened
+ * again when its request tells how much of the response it has taken.
+ * @param s the session
+ * @param r the request of the stream
+ * @param bytes the number of response bytes taken since the last call
+ */
+void h2_proxy_session_stream_consumed(h2_proxy_session *s, 
+                                      request_rec *r, apr_off_t bytes);
+
+/**
+ * Reset the stream of a request, which then is done with an error.
+ * @param s the session
+ * @param r the request of the stream
+ */
+void h2_proxy_session_cancel(h2_proxy_session *s, request_rec *r);
+
 #define H2_PROXY_REQ_URL_NOTE   "h2-proxy-req-url"
 
 #endif /* h2_proxy_session_h */
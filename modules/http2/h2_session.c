@@ -802,6 +802,8 @@ static apr_status_t h2_session_create_int(h2_session **psession,
                                                H2_CONF_MAX_STREAMS);
     session->max_stream_mem = h2_config_geti(session->config, 
                                              H2_CONF_STREAM_MAX_MEM);
+    session->inline_streams = h2_config_geti(session->config, 
+                                             H2_CONF_INLINE_STREAMS);
     
     status = apr_thread_cond_create(&session->iowait, session->pool);
     if (status != APR_SUCCESS) {
@@ -1480,6 +1482,18 @@ send_headers:
     return status;
 }
 
+static int can_process_inline(h2_session *session, h2_stream *stream)
+{
+    /* Requests without body that only retrieve a resource are most
+     * likely answered by a static file or from the cache. Those we
+     * rather do ourself than pay for the hand over to a worker thread. */
+    const h2_request *req = stream->request;
+    
+    return (session->inline_streams && !stream->input 
+            && !session->local.shutdown
+            && (!strcmp("GET", req->method) || !strcmp("HEAD", req->method)));
+}
+
 static void h2_session_in_flush(h2_session *session)
 {
     int id;
@@ -1488,11 +1502,14 @@ static void h2_session_in_flush(h2_session *session)
         h2_stream *stream = get_stream(session, id);
         if (stream) {
             ap_assert(!stream->scheduled);
-            if (h2_stream_prep_processing(stream) == APR_SUCCESS) {
-                h2_mplx_process(session->mplx, stream, stream_pri_cmp, session);
+            if (h2_stream_prep_processing(stream) != APR_SUCCESS) {
+                h2_stream_rst(stream, H2_ERR_INTERNAL_ERROR);
+            }
+            else if (can_process_inline(session, stream)) {
+                h2_mplx_process_inline(session->mplx, stream);
             }
             else {
-                h2_stream_rst(stream, H2_ERR_INTERNAL_ERROR);
+                h2_mplx_process(session->mplx, stream, stream_pri_cmp, session);
             }
         }
     }
@@ -2189,7 +2206,15 @@ apr_status_t h2_session_process(h2_session *session, int async)
                     ap_update_child_status(session->c->sbh, SERVER_BUSY_WRITE, NULL);
                     status = h2_session_send(session);
                     if (status == APR_SUCCESS) {
-                        status = h2_conn_io_flush(&session->io);
+                        /* Flush at the end of a burst only. While nghttp2
+                         * has more frames ready, pass on what we have and
+                         * let the next iteration fill the write buffer. */
+                        if (nghttp2_session_want_write(session->ngh2)) {
+                            status = h2_conn_io_send(&session->io);
+                        }
+                        else {
+                            status = h2_conn_io_flush(&session->io);
+                        }
                     }
                     if (status != APR_SUCCESS) {
                         dispatch_event(session, H2_SESSION_EV_CONN_ERROR, 
@@ -148,6 +148,12 @@ static apr_status_t slave_out(h2_task *task, ap_filter_t* f,
     apr_status_t rv = APR_SUCCESS;
     int flush = 0, blocking;
     
+    if (task->inline_redo) {
+        /* the request is processed again by a worker, nothing of this
+         * run goes to the stream */
+        apr_brigade_cleanup(bb);
+        return APR_SUCCESS;
+    }
     if (task->frozen) {
         h2_util_bb_log(task->c, task->stream_id, APLOG_TRACE2,
                        "frozen task output write, ignored", bb);
@@ -163,6 +169,27 @@ static apr_status_t slave_out(h2_task *task, ap_filter_t* f,
         }
         return APR_SUCCESS;
     }
+    if (task->run_inline) {
+        /* No one reads the beam while we run, it is opened towards the
+         * stream when we are done. */
+        if (task->r_handover) {
+            /* the flush ap_process_request() sends after a suspended
+             * handler, the worker that finishes the request does that */
+            apr_brigade_cleanup(bb);
+            return APR_SUCCESS;
+        }
+        rv = send_out(task, bb, 0);
+        if (APR_SUCCESS == rv && !APR_BRIGADE_EMPTY(bb)) {
+            /* a response that does not fit, e.g. from the cache or 
+             * inflated by a filter. Nothing of it went to the client. */
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, task->c,
+                          "h2_task(%s): output too large for inline, redo", 
+                          task->id);
+            task->inline_redo = 1;
+            apr_brigade_cleanup(bb);
+        }
+        return rv;
+    }
 
 send:
     /* we send block once we opened the output, so someone is there
@@ -443,6 +470,8 @@ int h2_task_can_redo(h2_task *task) {
 void h2_task_redo(h2_task *task)
 {
     task->rst_error = 0;
+    task->inline_redo = 0;
+    task->output.sent_response = 0;
 }
 
 void h2_task_rst(h2_task *task, int error)
@@ -465,6 +494,8 @@ void h2_task_rst(h2_task *task, int error)
 static const char *const mod_ssl[]        = { "mod_ssl.c", NULL};
 static int h2_task_pre_conn(conn_rec* c, void *arg);
 static int h2_task_process_conn(conn_rec* c);
+static int h2_task_inline_handler(request_rec *r);
+static int h2_task_inline_log(request_rec *r);
 
 APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_in) *h2_task_logio_add_bytes_in;
 APR_OPTIONAL_FN_TYPE(ap_logio_add_bytes_out) *h2_task_logio_add_bytes_out;
@@ -482,6 +513,12 @@ void h2_task_register_hooks(void)
      */
     ap_hook_process_connection(h2_task_process_conn, 
                                NULL, NULL, APR_HOOK_FIRST);
+    /* Before any handler runs, we check that a request processed on
+     * the session thread is served from a small static file.
+     */
+    ap_hook_handler(h2_task_inline_handler, NULL, NULL, APR_HOOK_REALLY_FIRST);
+    ap_hook_log_transaction(h2_task_inline_log, NULL, NULL, 
+                            APR_HOOK_REALLY_FIRST);
 
     ap_register_input_filter("H2_SLAVE_IN", h2_filter_slave_in,
                              NULL, AP_FTYPE_NETWORK);
@@ -573,6 +610,41 @@ void h2_task_destroy(h2_task *task)
     }
 }
 
+/* Run the handler of a request that h2_task_inline_handler() handed over
+ * and finish it, as ap_process_async_request() would have. */
+static apr_status_t task_resume(h2_task *task, apr_thread_t *thread)
+{
+    request_rec *r = task->r_handover;
+    const char *old_handler = r->handler;
+    int status;
+    
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, task->c,
+                  "h2_task(%s): resume handler %s", task->id, task->handler);
+    task->r_handover = NULL;
+    task->c->current_thread = thread;
+    
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(r->invoke_mtx);
+#endif
+    r->handler = task->handler;
+    status = ap_run_handler(r);
+    r->handler = old_handler;
+    if (status == DECLINED) {
+        status = HTTP_INTERNAL_SERVER_ERROR;
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(r->invoke_mtx);
+#endif
+    
+    ap_die_r(status, r, HTTP_OK);
+    ap_process_request_after_handler(r); /* don't touch r after here */
+    
+    if (task->frozen) {
+        return APR_EAGAIN;
+    }
+    return output_finish(task);
+}
+
 apr_status_t h2_task_do(h2_task *task, apr_thread_t *thread, int worker_id)
 {
     conn_rec *c;
@@ -582,6 +654,11 @@ apr_status_t h2_task_do(h2_task *task, apr_thread_t *thread, int worker_id)
     task->worker_started = 1;
     task->started_at = apr_time_now();
     
+    if (task->r_handover) {
+        /* set up already, the request only needs its handler run */
+        return task_resume(task, thread);
+    }
+    
     if (c->master) {
         /* Each conn_rec->id is supposed to be unique at a point in time. Since
          * some modules (and maybe external code) uses this id as an identifier
@@ -609,7 +686,7 @@ apr_status_t h2_task_do(h2_task *task, apr_thread_t *thread, int worker_id)
         else {
             /* Assume we have a more limited number of threads/processes
              * and h2 workers on a 32-bit system. Use the worker instead
-             * of the stream id. */
+             * of the stream id (inline tasks get one past the workers). */
             free_bits = 8;
             slave_id = worker_id; 
         }
@@ -649,7 +726,17 @@ apr_status_t h2_task_do(h2_task *task, apr_thread_t *thread, int worker_id)
     task->c->current_thread = thread; 
     ap_run_process_connection(c);
     
-    if (task->frozen) {
+    if (task->inline_redo) {
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, c,
+                      "h2_task(%s): not for inline, redo", task->id);
+        return APR_SUCCESS;
+    }
+    else if (task->r_handover) {
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, c,
+                      "h2_task(%s): not for inline, hand over", task->id);
+        return APR_SUCCESS;
+    }
+    else if (task->frozen) {
         ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, c,
                       "h2_task(%s): process_conn returned frozen task", 
                       task->id);
@@ -750,6 +837,65 @@ static int h2_task_process_conn(conn_rec* c)
     return DECLINED;
 }
 
+static int h2_task_inline_handler(request_rec *r)
+{
+    h2_ctx *ctx;
+    h2_task *task;
+    
+    if (!r->connection->master) {
+        return DECLINED;
+    }
+    ctx = h2_ctx_get(r->connection, 0);
+    if (!h2_ctx_is_task(ctx) || !ctx->task->run_inline) {
+        return DECLINED;
+    }
+    task = ctx->task;
+    
+    /* Only the default handler serving a regular file, whose content
+     * fits into the output beam (it is not drained while we run), is
+     * quick enough not to hold up the other streams. Subrequests and
+     * internal redirects are no exception. */
+    if (r->handler && !strcmp(r->handler, "default-handler")
+        && r->finfo.filetype == APR_REG 
+        && r->finfo.size <= (apr_off_t)task->output.max_buffer) {
+        return DECLINED;
+    }
+    
+    if (!r->main && !r->prev) {
+        /* The request is processed up to here and nothing was produced: 
+         * suspend it and have a worker run the handler and finish it. */
+        ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                      "h2_task(%s): handler %s not for inline, hand over", 
+                      task->id, r->handler);
+        task->r_handover = r;
+        task->handler = r->handler;
+        return SUSPENDED;
+    }
+    
+    /* In the middle of a response, which did not reach the client yet:
+     * drop this run and have a worker process the request from the 
+     * start. */
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "h2_task(%s): handler %s not for inline, redo", 
+                  task->id, r->handler);
+    task->inline_redo = 1;
+    return DONE;
+}
+
+static int h2_task_inline_log(request_rec *r)
+{
+    h2_ctx *ctx;
+    
+    if (r->connection->master) {
+        ctx = h2_ctx_get(r->connection, 0);
+        if (h2_ctx_is_task(ctx) && ctx->task->inline_redo) {
+            /* this run is discarded, the request is logged again */
+            apr_table_setn(r->subprocess_env, "H2_INLINE_REDO", "1");
+        }
+    }
+    return DECLINED;
+}
+
 apr_status_t h2_task_freeze(h2_task *task)
 {   
     if (!task->frozen) {
@@ -83,6 +83,11 @@ struct h2_task {
     unsigned int thawed         : 1;
     unsigned int worker_started : 1; /* h2_worker started processing */
     unsigned int worker_done    : 1; /* h2_worker finished */
+    unsigned int run_inline     : 1; /* processed on the session thread */
+    unsigned int inline_redo    : 1; /* not for inline, redo on a worker */
+    
+    request_rec *r_handover;         /* inline request, handler on a worker */
+    const char *handler;             /* the handler r_handover is to run */
     
     apr_time_t started_at;           /* when processing started */
     apr_time_t done_at;              /* when processing was done */
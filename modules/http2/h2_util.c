@@ -30,6 +30,7 @@
  */
 
 #include <assert.h>
+#include <apr_lib.h>
 #include <apr_strings.h>
 #include <apr_thread_mutex.h>
 #include <apr_thread_cond.h>
@@ -1617,14 +1618,6 @@ int h2_util_ignore_header(const char *name)
             || H2_HD_MATCH_LIT_CS("transfer-encoding", name));
 }
 
-static int count_header(void *ctx, const char *key, const char *value)
-{
-    if (!h2_util_ignore_header(key)) {
-        (*((size_t*)ctx))++;
-    }
-    return 1;
-}
-
 static const char *inv_field_name_chr(const char *token)
 {
     const char *p = ap_scan_http_token(token);
@@ -1640,9 +1633,77 @@ static const char *inv_field_value_chr(const char *token)
     return (p && *p)? p : NULL;
 }
 
+#ifdef H2_NG2_NO_COPY_NV
+typedef struct {
+    const char *name;
+    apr_size_t len;
+} h2_lc_name;
+
+#define H2_LC_NAME(s)       { (s), sizeof(s)-1 }
+
+/* Lower case names of header fields commonly found in responses. Most 
+ * of them are in the HPACK static table. */
+static const h2_lc_name LcNames[] = {
+    H2_LC_NAME("accept-ranges"),
+    H2_LC_NAME("age"),
+    H2_LC_NAME("allow"),
+    H2_LC_NAME("cache-control"),
+    H2_LC_NAME("content-disposition"),
+    H2_LC_NAME("content-encoding"),
+    H2_LC_NAME("content-language"),
+    H2_LC_NAME("content-length"),
+    H2_LC_NAME("content-location"),
+    H2_LC_NAME("content-range"),
+    H2_LC_NAME("content-security-policy"),
+    H2_LC_NAME("content-type"),
+    H2_LC_NAME("date"),
+    H2_LC_NAME("etag"),
+    H2_LC_NAME("expires"),
+    H2_LC_NAME("last-modified"),
+    H2_LC_NAME("link"),
+    H2_LC_NAME("location"),
+    H2_LC_NAME("refresh"),
+    H2_LC_NAME("retry-after"),
+    H2_LC_NAME("server"),
+    H2_LC_NAME("set-cookie"),
+    H2_LC_NAME("strict-transport-security"),
+    H2_LC_NAME("vary"),
+    H2_LC_NAME("via"),
+    H2_LC_NAME("www-authenticate"),
+    H2_LC_NAME("x-content-type-options"),
+    H2_LC_NAME("x-frame-options"),
+    H2_LC_NAME("x-xss-protection"),
+};
+
+/* Get a lower case version of the name that lives at least as long as
+ * the pool, or NULL if the name is lower case already. */
+static const char *lc_name(apr_pool_t *p, const char *name, apr_size_t len)
+{
+    const char *s;
+    char *lc;
+    apr_size_t i;
+    
+    for (i = 0; i < H2_ALEN(LcNames); ++i) {
+        if (LcNames[i].len == len && !strcasecmp(LcNames[i].name, name)) {
+            return LcNames[i].name;
+        }
+    }
+    for (s = name; *s && !apr_isupper(*s); ++s) {
+        /* nop */
+    }
+    if (!*s) {
+        return NULL;
+    }
+    lc = apr_pstrmemdup(p, name, len);
+    ap_str_tolower(lc);
+    return lc;
+}
+#endif /* H2_NG2_NO_COPY_NV */
+
 typedef struct ngh_ctx {
     apr_pool_t *p;
     int unsafe;
+    int no_copy;
     h2_ngheader *ngh;
     apr_status_t status;
 } ngh_ctx;
@@ -1668,10 +1729,23 @@ static int add_header(ngh_ctx *ctx, const char *key, const char *value)
             return 0;
         }
     }
-    nv->name = (uint8_t*)key;
     nv->namelen = strlen(key);
-    nv->value = (uint8_t*)value;
     nv->valuelen = strlen(value);
+#ifdef H2_NG2_NO_COPY_NV
+    if (ctx->no_copy) {
+        /* nghttp2 will neither copy nor lower case such a name. It needs
+         * to stay valid until the frame is sent, which the pool (or the
+         * static table) guarantees. Values are still copied, they live 
+         * in the pool of the request that produced them. */
+        const char *lc = lc_name(ctx->p, key, nv->namelen);
+        if (lc) {
+            key = lc;
+            nv->flags = NGHTTP2_NV_FLAG_NO_COPY_NAME;
+        }
+    }
+#endif
+    nv->name = (uint8_t*)key;
+    nv->value = (uint8_t*)value;
     
     return 1;
 }
@@ -1685,7 +1759,7 @@ static int add_table_header(void *ctx, const char *key, const char *value)
 }
 
 static apr_status_t ngheader_create(h2_ngheader **ph, apr_pool_t *p, 
-                                    int unsafe, size_t key_count, 
+                                    int unsafe, int no_copy, size_t key_count, 
                                     const char *keys[], const char *values[],
                                     apr_table_t *headers)
 {
@@ -1694,9 +1768,10 @@ static apr_status_t ngheader_create(h2_ngheader **ph, apr_pool_t *p,
     
     ctx.p = p;
     ctx.unsafe = unsafe;
+    ctx.no_copy = no_copy;
     
-    n = key_count;
-    apr_table_do(count_header, &n, headers, NULL);
+    /* Room for all, even the ones we ignore. Saves us a counting pass */
+    n = key_count + apr_table_elts(headers)->nelts;
     
     *ph = ctx.ngh = apr_pcalloc(p, sizeof(h2_ngheader));
     if (!ctx.ngh) {
@@ -1729,7 +1804,7 @@ static int is_unsafe(h2_headers *h)
 apr_status_t h2_res_create_ngtrailer(h2_ngheader **ph, apr_pool_t *p, 
                                     h2_headers *headers)
 {
-    return ngheader_create(ph, p, is_unsafe(headers), 
+    return ngheader_create(ph, p, is_unsafe(headers), 1,
                            0, NULL, NULL, headers->headers);
 }
                                      
@@ -1740,9 +1815,9 @@ apr_status_t h2_res_create_ngheader(h2_ngheader **ph, apr_pool_t *p,
         ":status"
     };
     const char *values[] = {
-        apr_psprintf(p, "%d", headers->status)
+        apr_itoa(p, headers->status)
     };
-    return ngheader_create(ph, p, is_unsafe(headers),  
+    return ngheader_create(ph, p, is_unsafe(headers), 1,
                            H2_ALEN(keys), keys, values, headers->headers);
 }
 
@@ -1768,7 +1843,7 @@ apr_status_t h2_req_create_ngheader(h2_ngheader **ph, apr_pool_t *p,
     ap_assert(req->path);
     ap_assert(req->method);
 
-    return ngheader_create(ph, p, 0, H2_ALEN(keys), keys, values, req->headers);
+    return ngheader_create(ph, p, 0, 0, H2_ALEN(keys), keys, values, req->headers);
 }
 
 /*******************************************************************************
@@ -166,33 +166,122 @@ static void cleanup_zombies(h2_workers *workers)
     }
 }
 
-static apr_status_t slot_pull_task(h2_slot *slot, h2_mplx *m)
+static int hist_index(apr_uint64_t value)
 {
-    apr_status_t rv;
+    int i = 0;
     
-    rv = h2_mplx_pop_task(m, &slot->task);
-    if (slot->task) {
-        /* Ok, we got something to give back to the worker for execution. 
-         * If we still have idle workers, we let the worker be sticky, 
-         * e.g. making it poll the task's h2_mplx instance for more work 
-         * before asking back here. */
-        slot->sticks = slot->workers->max_workers;
-        return rv;            
-    }
-    slot->sticks = 0;
-    return APR_EOF;
+    while (value && i < H2_WORKERS_HIST_LEN - 1) {
+        value >>= 1;
+        ++i;
+    }
+    return i;
+}
+
+static struct h2_mplx_ring *sched_queue(h2_workers *workers, h2_mplx *m)
+{
+    return &workers->queues[H2MIN(m->sched_running, workers->nqueues - 1)];
+}
+
+/* Queue a h2_mplx behind the ones with as many tasks running. 
+ * Needs the workers lock. */
+static void sched_push(h2_workers *workers, h2_mplx *m)
+{
+    if (!m->sched_queued) {
+        APR_RING_INSERT_TAIL(sched_queue(workers, m), m, h2_mplx, sched_link);
+        m->sched_queued = 1;
+        m->sched_since = apr_time_now();
+        apr_atomic_inc32(&workers->queued);
+    }
+}
+
+static void sched_remove(h2_workers *workers, h2_mplx *m)
+{
+    if (m->sched_queued) {
+        APR_RING_REMOVE(m, sched_link);
+        m->sched_queued = 0;
+        apr_atomic_dec32(&workers->queued);
+    }
 }
 
-static h2_fifo_op_t mplx_peek(void *head, void *ctx)
+/* Take the h2_mplx which has the fewest tasks running, the one waiting 
+ * for the longest time among equals. Needs the workers lock. */
+static h2_mplx *sched_pop(h2_workers *workers)
+{
+    struct h2_mplx_ring *q;
+    apr_interval_time_t waited;
+    h2_mplx *m;
+    int i;
+    
+    for (i = 0; i < workers->nqueues; ++i) {
+        q = &workers->queues[i];
+        if (!APR_RING_EMPTY(q, h2_mplx, sched_link)) {
+            m = APR_RING_FIRST(q);
+            waited = apr_time_now() - m->sched_since;
+            ++workers->stats.scheduled;
+            ++workers->stats.queue_depth[hist_index(workers->queued)];
+            ++workers->stats.wait_time[hist_index(waited > 0? 
+                waited / H2_WORKERS_WAIT_UNIT_USECS : 0)];
+            sched_remove(workers, m);
+            return m;
+        }
+    }
+    return NULL;
+}
+
+/* Account for a task of the h2_mplx starting or ending in a worker, 
+ * and move it to its new queue. */
+static void sched_update(h2_workers *workers, h2_mplx *m, int delta)
+{
+    apr_thread_mutex_lock(workers->lock);
+    m->sched_running += delta;
+    if (m->sched_queued) {
+        APR_RING_REMOVE(m, sched_link);
+        APR_RING_INSERT_TAIL(sched_queue(workers, m), m, h2_mplx, sched_link);
+    }
+    apr_thread_mutex_unlock(workers->lock);
+}
+
+/**
+ * Get a task for the slot from the queued h2_mplx, fewest running first. 
+ * An h2_mplx with more tasks to start is queued again. The lock is kept 
+ * while the h2_mplx gives a task, so that it can not unregister meanwhile.
+ * h2_mplx_pop_task() then takes the mplx lock inside workers->lock, while
+ * the mplx registers with its own lock held. This is only safe as long as
+ * a queued mplx is always marked registered, see register_if_needed() in
+ * h2_mplx.c.
+ */
+static apr_status_t slot_pull_task(h2_slot *slot)
 {
-    h2_mplx *m = head;
-    h2_slot *slot = ctx;
+    h2_workers *workers = slot->workers;
+    apr_status_t rv = APR_SUCCESS;
+    int more = 0;
+    h2_mplx *m;
     
-    if (slot_pull_task(slot, m) == APR_EAGAIN) {
-        wake_idle_worker(slot->workers);
-        return H2_FIFO_OP_REPUSH;
-    } 
-    return H2_FIFO_OP_PULL;
+    apr_thread_mutex_lock(workers->lock);
+    while (!slot->task && !workers->aborted 
+           && (m = sched_pop(workers)) != NULL) {
+        apr_status_t status = h2_mplx_pop_task(m, &slot->task);
+        
+        if (slot->task) {
+            ++m->sched_running;
+        }
+        if (status == APR_EAGAIN) {
+            sched_push(workers, m);
+            more = 1;
+        }
+    }
+    if (workers->aborted) {
+        rv = APR_EOF;
+    }
+    apr_thread_mutex_unlock(workers->lock);
+    
+    if (more) {
+        wake_idle_worker(workers);
+    }
+    /* If there is nothing else waiting, the worker is sticky, e.g. it asks 
+     * the task's h2_mplx for more work before asking back here. */
+    slot->sticks = slot->task? workers->max_workers : 0;
+    return rv;
 }
 
 /**
@@ -207,7 +296,7 @@ static apr_status_t get_next(h2_slot *slot)
     slot->task = NULL;
     while (!slot->aborted) {
         if (!slot->task) {
-            status = h2_fifo_try_peek(workers->mplxs, mplx_peek, slot);
+            status = slot_pull_task(slot);
             if (status == APR_EOF) {
                 return status;
             }
@@ -242,17 +331,24 @@ static void* APR_THREAD_FUNC slot_run(apr_thread_t *thread, void *wctx)
         /* Get a h2_task from the mplxs queue. */
         get_next(slot);
         while (slot->task) {
+            h2_mplx *m = slot->task->mplx;
         
             h2_task_do(slot->task, thread, slot->id);
             
-            /* Report the task as done. If stickyness is left, offer the
+            /* Report the task as done (the h2_mplx may be gone after).
+             * If stickyness is left and no other h2_mplx waits, offer the
              * mplx the opportunity to give us back a new task right away.
              */
-            if (!slot->aborted && (--slot->sticks > 0)) {
-                h2_mplx_task_done(slot->task->mplx, slot->task, &slot->task);
+            sched_update(slot->workers, m, -1);
+            if (!slot->aborted && (--slot->sticks > 0)
+                && !apr_atomic_read32(&slot->workers->queued)) {
+                h2_mplx_task_done(m, slot->task, &slot->task);
+                if (slot->task) {
+                    sched_update(slot->workers, m, 1);
+                }
             }
             else {
-                h2_mplx_task_done(slot->task->mplx, slot->task, NULL);
+                h2_mplx_task_done(m, slot->task, NULL);
                 slot->task = NULL;
             }
         }
@@ -268,7 +364,9 @@ static apr_status_t workers_pool_cleanup(void *data)
     h2_slot *slot;
     
     if (!workers->aborted) {
+        apr_thread_mutex_lock(workers->lock);
         workers->aborted = 1;
+        apr_thread_mutex_unlock(workers->lock);
         /* abort all idle slots */
         for (;;) {
             slot = pop_slot(&workers->idle);
@@ -283,9 +381,6 @@ static apr_status_t workers_pool_cleanup(void *data)
             }
         }
 
-        h2_fifo_term(workers->mplxs);
-        h2_fifo_interrupt(workers->mplxs);
-
         cleanup_zombies(workers);
     }
     return APR_SUCCESS;
@@ -321,20 +416,12 @@ h2_workers *h2_workers_create(server_rec *s, apr_pool_t *server_pool,
     workers->max_workers = max_workers;
     workers->max_idle_secs = (idle_secs > 0)? idle_secs : 10;
 
-    /* FIXME: the fifo set we use here has limited capacity. Once the
-     * set is full, connections with new requests do a wait. Unfortunately,
-     * we have optimizations in place there that makes such waiting "unfair"
-     * in the sense that it may take connections a looong time to get scheduled.
-     *
-     * Need to rewrite this to use one of our double-linked lists and a mutex
-     * to have unlimited capacity and fair scheduling.
-     *
-     * For now, we just make enough room to have many connections inside one
-     * process.
-     */
-    status = h2_fifo_set_create(&workers->mplxs, pool, 8 * 1024);
-    if (status != APR_SUCCESS) {
-        return NULL;
+    /* one queue per number of running tasks, up to max_workers */
+    workers->nqueues = max_workers + 1;
+    workers->queues = apr_palloc(pool, workers->nqueues 
+                                 * sizeof(struct h2_mplx_ring));
+    for (i = 0; i < workers->nqueues; ++i) {
+        APR_RING_INIT(&workers->queues[i], h2_mplx, sched_link);
     }
     
     status = apr_threadattr_create(&workers->thread_attr, workers->pool);
@@ -387,12 +474,45 @@ h2_workers *h2_workers_create(server_rec *s, apr_pool_t *server_pool,
 
 apr_status_t h2_workers_register(h2_workers *workers, struct h2_mplx *m)
 {
-    apr_status_t status = h2_fifo_push(workers->mplxs, m);
-    wake_idle_worker(workers);
+    apr_status_t status = APR_SUCCESS;
+    
+    apr_thread_mutex_lock(workers->lock);
+    if (workers->aborted) {
+        status = APR_EOF;
+    }
+    else if (m->sched_queued) {
+        status = APR_EEXIST;
+    }
+    else {
+        sched_push(workers, m);
+    }
+    apr_thread_mutex_unlock(workers->lock);
+    
+    if (status == APR_SUCCESS) {
+        wake_idle_worker(workers);
+    }
     return status;
 }
 
 apr_status_t h2_workers_unregister(h2_workers *workers, struct h2_mplx *m)
 {
-    return h2_fifo_remove(workers->mplxs, m);
+    apr_status_t status = APR_EAGAIN;
+    
+    apr_thread_mutex_lock(workers->lock);
+    if (m->sched_queued) {
+        sched_remove(workers, m);
+        status = APR_SUCCESS;
+    }
+    apr_thread_mutex_unlock(workers->lock);
+    return status;
+}
+
+void h2_workers_get_stats(h2_workers *workers, h2_workers_stats *stats,
+                          int *pworker_count, int *pqueued)
+{
+    apr_thread_mutex_lock(workers->lock);
+    *stats = workers->stats;
+    *pworker_count = (int)apr_atomic_read32(&workers->worker_count);
+    *pqueued = (int)workers->queued;
+    apr_thread_mutex_unlock(workers->lock);
 }
@@ -21,18 +21,40 @@
  * number of workers it creates. Starts with minimum workers and adds
  * some on load, reduces the number again when idle.
  *
+ * Connections (h2_mplx) with tasks to run are queued by the number of
+ * their tasks being run by workers, so that the next worker to become
+ * available serves the connection which has the fewest. Within a
+ * connection, the h2_mplx starts its streams by priority.
  */
+#include <apr_ring.h>
+
 struct apr_thread_mutex_t;
 struct apr_thread_cond_t;
 struct h2_mplx;
 struct h2_request;
 struct h2_task;
-struct h2_fifo;
 
 struct h2_slot;
 
 typedef struct h2_workers h2_workers;
 
+/* h2_mplx queued with the same number of running tasks, oldest first */
+APR_RING_HEAD(h2_mplx_ring, h2_mplx);
+
+/* Histograms have buckets for the values below 1, 2, 4, 8, ... (times
+ * the unit) and a last one for the rest */
+#define H2_WORKERS_HIST_LEN         20
+#define H2_WORKERS_WAIT_UNIT_USECS  64
+
+typedef struct h2_workers_stats h2_workers_stats;
+
+struct h2_workers_stats {
+    apr_uint64_t scheduled;     /* # of times a h2_mplx was served */
+    apr_uint32_t queue_depth[H2_WORKERS_HIST_LEN]; /* # queued when served */
+    apr_uint32_t wait_time[H2_WORKERS_HIST_LEN];   /* time queued, in units
+                                                      of 64 microseconds */
+};
+
 struct h2_workers {
     server_rec *s;
     apr_pool_t *pool;
@@ -55,7 +77,12 @@ struct h2_workers {
     struct h2_slot *idle;
     struct h2_slot *zombies;
     
-    struct h2_fifo *mplxs;
+    /* the h2_mplx with tasks to run, by number of tasks running (the last
+     * queue taking the h2_mplx with more), all protected by the lock */
+    int nqueues;
+    struct h2_mplx_ring *queues;
+    volatile apr_uint32_t queued;
+    h2_workers_stats stats;
     
     struct apr_thread_mutex_t *lock;
 };
@@ -79,4 +106,11 @@ apr_status_t h2_workers_register(h2_workers *workers, struct h2_mplx *m);
  */
 apr_status_t h2_workers_unregister(h2_workers *workers, struct h2_mplx *m);
 
+/**
+ * Get a copy of the scheduling statistics and the current number of
+ * workers and queued h2_mplx.
+ */
+void h2_workers_get_stats(h2_workers *workers, h2_workers_stats *stats,
+                          int *pworker_count, int *pqueued);
+
 #endif /* defined(__mod_h2__h2_workers__) */
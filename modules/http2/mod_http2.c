@@ -78,6 +78,7 @@ typedef struct {
     unsigned int sha256 : 1;
     unsigned int inv_headers : 1;
     unsigned int dyn_windows : 1;
+    unsigned int nocopy_nv : 1;
 } features;
 
 static features myfeats;
@@ -117,6 +118,9 @@ static int h2_post_config(apr_pool_t *p, apr_pool_t *plog,
 #ifdef H2_NG2_LOCAL_WIN_SIZE
     myfeats.dyn_windows = 1;
 #endif
+#ifdef H2_NG2_NO_COPY_NV
+    myfeats.nocopy_nv = 1;
+#endif
     
     apr_pool_userdata_get(&data, mod_h2_init_key, s->process->pool);
     if ( data == NULL ) {
@@ -129,12 +133,13 @@ static int h2_post_config(apr_pool_t *p, apr_pool_t *plog,
     
     ngh2 = nghttp2_version(0);
     ap_log_error( APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(03090)
-                 "mod_http2 (v%s, feats=%s%s%s%s, nghttp2 %s), initializing...",
+                 "mod_http2 (v%s, feats=%s%s%s%s%s, nghttp2 %s), initializing...",
                  MOD_HTTP2_VERSION, 
                  myfeats.change_prio? "CHPRIO"  : "", 
                  myfeats.sha256?      "+SHA256" : "",
                  myfeats.inv_headers? "+INVHD"  : "",
                  myfeats.dyn_windows? "+DWINS"  : "",
+                 myfeats.nocopy_nv?   "+NCPNV"  : "",
                  ngh2?                ngh2->version_str : "unknown");
     
     switch (h2_conn_mpm_type()) {
@@ -29,9 +29,16 @@
  * limitations under the License.
  */
 
+#include <stdlib.h>
+
 #include <nghttp2/nghttp2.h>
 
+#include <apr_hash.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
+
 #include <httpd.h>
+#include <http_config.h>
 #include <mod_proxy.h>
 #include "mod_http2.h"
 
@@ -44,16 +51,96 @@
 
 #define H2MIN(x,y) ((x) < (y) ? (x) : (y))
 
+module AP_MODULE_DECLARE_DATA proxy_http2_module;
+
+typedef struct {
+    int sessions;              /* max backend sessions shared per worker */
+    apr_int32_t win_stream;    /* initial stream window size */
+    apr_int32_t win_conn;      /* connection window size */
+} h2_proxy_srv_conf;
+
+#define H2_PROXY_UNSET          -1
+#define H2_PROXY_WIN_CONN_BITS  30
+#define H2_PROXY_SHARED_BUFSIZE (64*1024)
+
+static void *h2_proxy_create_srv_conf(apr_pool_t *pool, server_rec *s)
+{
+    h2_proxy_srv_conf *conf = apr_pcalloc(pool, sizeof(*conf));
+    
+    conf->sessions   = H2_PROXY_UNSET;
+    conf->win_stream = H2_PROXY_UNSET;
+    conf->win_conn   = H2_PROXY_UNSET;
+    return conf;
+}
+
+static void *h2_proxy_merge_srv_conf(apr_pool_t *pool, void *basev, void *addv)
+{
+    h2_proxy_srv_conf *base = basev, *add = addv;
+    h2_proxy_srv_conf *conf = apr_pcalloc(pool, sizeof(*conf));
+    
+    conf->sessions   = (add->sessions != H2_PROXY_UNSET)? 
+                        add->sessions : base->sessions;
+    conf->win_stream = (add->win_stream != H2_PROXY_UNSET)? 
+                        add->win_stream : base->win_stream;
+    conf->win_conn   = (add->win_conn != H2_PROXY_UNSET)? 
+                        add->win_conn : base->win_conn;
+    return conf;
+}
+
+static const char *h2_proxy_set_sessions(cmd_parms *cmd, void *dirconf,
+                                         const char *value)
+{
+    h2_proxy_srv_conf *conf = ap_get_module_config(cmd->server->module_config,
+                                                   &proxy_http2_module);
+    conf->sessions = (int)apr_atoi64(value);
+    if (conf->sessions < 0 || conf->sessions > 1000) {
+        return "value must be between 0 and 1000";
+    }
+    return NULL;
+}
+
+static const char *h2_proxy_set_window(cmd_parms *cmd, void *dirconf,
+                                       const char *value)
+{
+    h2_proxy_srv_conf *conf = ap_get_module_config(cmd->server->module_config,
+                                                   &proxy_http2_module);
+    apr_int64_t size = apr_atoi64(value);
+    
+    if (size < 65535 || size > (1 << H2_PROXY_WIN_CONN_BITS)) {
+        return apr_psprintf(cmd->pool, "value must be between 65535 and %d",
+                            (1 << H2_PROXY_WIN_CONN_BITS));
+    }
+    if (cmd->info) {
+        conf->win_conn = (apr_int32_t)size;
+    }
+    else {
+        conf->win_stream = (apr_int32_t)size;
+    }
+    return NULL;
+}
+
+static const command_rec h2_proxy_cmds[] = {
+    AP_INIT_TAKE1("H2ProxySessions", h2_proxy_set_sessions, NULL,
+                  RSRC_CONF, "number of backend sessions per proxy worker "
+                  "that requests of all frontend connections share, "
+                  "0 to disable"),
+    AP_INIT_TAKE1("H2ProxyWindowSize", h2_proxy_set_window, NULL,
+                  RSRC_CONF, "initial stream window size for backend sessions"),
+    AP_INIT_TAKE1("H2ProxyConnWindowSize", h2_proxy_set_window, (void *)1,
+                  RSRC_CONF, "connection window size for backend sessions"),
+    { NULL }
+};
+
 static void register_hook(apr_pool_t *p);
 
 AP_DECLARE_MODULE(proxy_http2) = {
     STANDARD20_MODULE_STUFF,
-    NULL,              /* create per-directory config structure */
-    NULL,              /* merge per-directory config structures */
-    NULL,              /* create per-server config structure */
-    NULL,              /* merge per-server config structures */
-    NULL,              /* command apr_table_t */
-    register_hook      /* register hooks */
+    NULL,                     /* create per-directory config structure */
+    NULL,                     /* merge per-directory config structures */
+    h2_proxy_create_srv_conf, /* create per-server config structure */
+    h2_proxy_merge_srv_conf,  /* merge per-server config structures */
+    h2_proxy_cmds,            /* command apr_table_t */
+    register_hook             /* register hooks */
 };
 
 /* Optional functions from mod_http2 */
@@ -90,6 +177,10 @@ typedef struct h2_proxy_ctx {
     unsigned is_ssl : 1;
     unsigned flushall : 1;
     
+    const char *url;
+    const char *proxyname;
+    apr_port_t proxyport;
+    
     apr_status_t r_status;     /* status of our first request work */
     h2_proxy_session *session; /* current http2 session against backend */
 } h2_proxy_ctx;
@@ -216,6 +307,15 @@ static int proxy_http2_canon(request_rec *r, char *url)
     return OK;
 }
 
+static unsigned char window_bits(apr_int32_t size, unsigned char def_bits)
+{
+    /* nghttp2 windows are set as (1 << bits) - 1 */
+    if (size == H2_PROXY_UNSET) {
+        return def_bits;
+    }
+    return H2MIN(h2_proxy_log2((int)size + 1), H2_PROXY_WIN_CONN_BITS);
+}
+
 static void out_consumed(void *baton, conn_rec *c, apr_off_t bytes)
 {
     h2_proxy_ctx *ctx = baton;
@@ -352,6 +452,8 @@ static apr_status_t proxy_engine_run(h2_proxy_ctx *ctx) {
     apr_status_t status = OK;
     int h2_front;
     request_rec *r;
+    h2_proxy_srv_conf *sconf = ap_get_module_config(ctx->server->module_config,
+                                                    &proxy_http2_module);
     
     /* Step Four: Send the Request in a new HTTP/2 stream and
      * loop until we got the response or encounter errors.
@@ -360,8 +462,11 @@ static apr_status_t proxy_engine_run(h2_proxy_ctx *ctx) {
                   "eng(%s): setup session", ctx->engine_id);
     h2_front = is_h2? is_h2(ctx->owner) : 0;
     ctx->session = h2_proxy_session_setup(ctx->engine_id, ctx->p_conn, ctx->conf,
-                                          h2_front, 30, 
-                                          h2_proxy_log2((int)ctx->req_buffer_size), 
+                                          h2_front, 
+                                          window_bits(sconf->win_conn, 
+                                                      H2_PROXY_WIN_CONN_BITS),
+                                          window_bits(sconf->win_stream, 
+                                          h2_proxy_log2((int)ctx->req_buffer_size)), 
                                           session_req_done);
     if (!ctx->session) {
         ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->owner, 
@@ -471,6 +576,593 @@ static apr_status_t push_request_somewhere(h2_proxy_ctx *ctx, request_rec *r)
     return h2_proxy_fifo_push(ctx->requests, r);
 }
 
+#if APR_HAS_THREADS
+/*******************************************************************************
+ * Backend sessions shared by all requests of a child process.
+ *
+ * Per proxy worker, up to H2ProxySessions sessions are kept open. Any
+ * request may queue a stream on them, regardless of the frontend
+ * connection it arrived on. Only one thread at a time processes a
+ * session: the first one that finds it idle. When its own request is
+ * done, it leaves and the next waiting thread takes over.
+ *
+ * The thread processing a session never writes to a client. It copies
+ * the response data of a stream into the h2_proxy_sreq of its request
+ * and wakes the request's own thread, which writes it to its client
+ * and reports how much it took, so that the stream's window opens again
+ * on the next processing cycle. A slow client thereby only holds back its
+ * own stream. The driving thread also stops to write its own response
+ * and lets another one drive meanwhile.
+ *
+ * The session still reads the request_rec of a stream until the
+ * response headers are in; its thread waits and only gets to write once
+ * the first data or the end of the response has arrived. Requests with a
+ * body are not shared, their input would be read by another thread.
+ ******************************************************************************/
+
+typedef struct h2_proxy_backend h2_proxy_backend;
+typedef struct h2_proxy_shared h2_proxy_shared;
+
+typedef struct {
+    request_rec *r;
+    const char *url;
+    h2_proxy_shared *sh;         /* session the request is assigned to */
+    apr_status_t status;
+    char *out;                   /* response data for the request's thread */
+    apr_size_t outlen;
+    apr_size_t outsize;
+    apr_off_t taken;             /* taken by it, stream window not opened */
+    apr_bucket_brigade *bb;
+    unsigned int touched : 1;    /* backend has seen the request */
+    unsigned int done : 1;
+    unsigned int eos : 1;        /* response ends without (further) data */
+    unsigned int cancel : 1;     /* request's thread gave up on it */
+    unsigned int cancelled : 1;  /* stream has been reset */
+} h2_proxy_sreq;
+
+struct h2_proxy_shared {
+    h2_proxy_backend *be;
+    int index;
+    proxy_conn_rec *p_conn;
+    h2_proxy_session *session;
+    apr_array_header_t *queued;  /* h2_proxy_sreq* not submitted yet */
+    apr_array_header_t *open;    /* h2_proxy_sreq* submitted, not done */
+    int assigned;                /* # of requests queued or open */
+    int capacity;                /* max concurrent streams of backend */
+    unsigned int driven : 1;     /* a thread processes the session */
+    unsigned int dead : 1;       /* session is being released */
+};
+
+struct h2_proxy_backend {
+    proxy_worker *worker;
+    apr_thread_mutex_t *lock;
+    apr_thread_cond_t *changed;
+    int nsessions;
+    h2_proxy_shared *sessions;
+};
+
+static apr_pool_t *backends_pool;
+static apr_thread_mutex_t *backends_lock;
+static apr_hash_t *backends;
+
+static void h2_proxy_child_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_status_t status;
+    
+    backends_pool = pchild;
+    backends = apr_hash_make(pchild);
+    status = apr_thread_mutex_create(&backends_lock, 
+                                     APR_THREAD_MUTEX_DEFAULT, pchild);
+    if (status != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, status, s, APLOGNO(10162)
+                     "h2_proxy: creating backends lock, no shared sessions");
+        backends_lock = NULL;
+    }
+}
+
+static h2_proxy_backend *backend_get(proxy_worker *worker, int nsessions)
+{
+    h2_proxy_backend *be;
+    int i;
+    
+    apr_thread_mutex_lock(backends_lock);
+    be = apr_hash_get(backends, &worker, sizeof(worker));
+    if (!be) {
+        be = apr_pcalloc(backends_pool, sizeof(*be));
+        be->worker = worker;
+        if (apr_thread_mutex_create(&be->lock, APR_THREAD_MUTEX_DEFAULT,
+                                    backends_pool) != APR_SUCCESS
+            || apr_thread_cond_create(&be->changed, 
+                                      backends_pool) != APR_SUCCESS) {
+            apr_thread_mutex_unlock(backends_lock);
+            return NULL;
+        }
+        be->nsessions = nsessions;
+        be->sessions = apr_pcalloc(backends_pool, 
+                                   nsessions * sizeof(h2_proxy_shared));
+        for (i = 0; i < nsessions; ++i) {
+            be->sessions[i].be = be;
+            be->sessions[i].index = i;
+            be->sessions[i].queued = apr_array_make(backends_pool, 10, 
+                                                    sizeof(h2_proxy_sreq*));
+            be->sessions[i].open = apr_array_make(backends_pool, 10, 
+                                                  sizeof(h2_proxy_sreq*));
+        }
+        apr_hash_set(backends, &be->worker, sizeof(be->worker), be);
+    }
+    apr_thread_mutex_unlock(backends_lock);
+    return be;
+}
+
+/* Assign the request to a session, called with be->lock held. Streams are
+ * packed onto as few sessions as the backend's MAX_CONCURRENT_STREAMS
+ * allows, before another session is opened. */
+static h2_proxy_shared *backend_assign(h2_proxy_backend *be, 
+                                       h2_proxy_sreq *sreq)
+{
+    h2_proxy_shared *sh, *avail = NULL, *fresh = NULL, *least = NULL;
+    int i;
+    
+    for (i = 0; i < be->nsessions; ++i) {
+        sh = &be->sessions[i];
+        if (sh->dead) {
+            continue;
+        }
+        else if (!sh->session && !sh->assigned && !sh->driven) {
+            if (!fresh) {
+                fresh = sh;
+            }
+        }
+        else if (sh->assigned < sh->capacity) {
+            if (!avail) {
+                avail = sh;
+            }
+        }
+        else if (!least || sh->assigned < least->assigned) {
+            least = sh;
+        }
+    }
+    /* When all sessions are at their limit, nghttp2 queues the
+     * stream until the backend allows more. */
+    sh = avail? avail : (fresh? fresh : least);
+    if (sh) {
+        if (sh == fresh) {
+            sh->capacity = 100;
+        }
+        APR_ARRAY_PUSH(sh->queued, h2_proxy_sreq*) = sreq;
+        ++sh->assigned;
+        sreq->sh = sh;
+        sreq->done = 0;
+        sreq->touched = 0;
+        sreq->cancelled = 0;
+        sreq->status = APR_SUCCESS;
+    }
+    return sh;
+}
+
+/* Called with be->lock held. */
+static void sreq_done(h2_proxy_sreq *sreq, apr_status_t status, int touched)
+{
+    apr_array_header_t *open = sreq->sh->open;
+    int i;
+    
+    for (i = 0; i < open->nelts; ++i) {
+        if (APR_ARRAY_IDX(open, i, h2_proxy_sreq*) == sreq) {
+            APR_ARRAY_IDX(open, i, h2_proxy_sreq*) = 
+                APR_ARRAY_IDX(open, open->nelts - 1, h2_proxy_sreq*);
+            --open->nelts;
+            break;
+        }
+    }
+    sreq->status = status;
+    sreq->touched = touched? 1 : 0;
+    sreq->done = 1;
+    --sreq->sh->assigned;
+}
+
+static void shared_req_done(h2_proxy_session *session, request_rec *r,
+                            apr_status_t status, int touched)
+{
+    h2_proxy_sreq *sreq = ap_get_module_config(r->request_config, 
+                                               &proxy_http2_module);
+    h2_proxy_backend *be = sreq->sh->be;
+    
+    /* not on r, its thread may be using it */
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE1, status, session->c, 
+                  "h2_proxy_session(%s): shared request done, touched=%d",
+                  session->id, touched);
+    apr_thread_mutex_lock(be->lock);
+    sreq_done(sreq, status, touched);
+    apr_thread_cond_broadcast(be->changed);
+    apr_thread_mutex_unlock(be->lock);
+}
+
+/* The session's out callback: keep the response data for the request's
+ * own thread. Runs on the driving thread, without be->lock. What is
+ * buffered here is bounded by the stream window. */
+static apr_status_t shared_out(h2_proxy_session *session, request_rec *r,
+                               const char *data, apr_size_t len, int eos)
+{
+    h2_proxy_sreq *sreq = ap_get_module_config(r->request_config, 
+                                               &proxy_http2_module);
+    h2_proxy_backend *be = sreq->sh->be;
+    apr_status_t status = APR_SUCCESS;
+    
+    apr_thread_mutex_lock(be->lock);
+    if (sreq->cancel) {
+        /* nobody is going to take it */
+        sreq->taken += len;
+    }
+    else if (len) {
+        if (sreq->outlen + len > sreq->outsize) {
+            apr_size_t size = sreq->outsize? 2 * sreq->outsize : 8192;
+            char *out;
+            
+            while (size < sreq->outlen + len) {
+                size *= 2;
+            }
+            /* malloc'ed, it goes out as heap bucket of the request's
+             * own allocator */
+            out = realloc(sreq->out, size);
+            if (out) {
+                sreq->out = out;
+                sreq->outsize = size;
+            }
+            else {
+                status = APR_ENOMEM;
+            }
+        }
+        if (status == APR_SUCCESS) {
+            memcpy(sreq->out + sreq->outlen, data, len);
+            sreq->outlen += len;
+        }
+    }
+    if (eos) {
+        sreq->eos = 1;
+    }
+    apr_thread_cond_broadcast(be->changed);
+    apr_thread_mutex_unlock(be->lock);
+    return status;
+}
+
+/* Write what the session left for our request to the client. Called and
+ * returns with be->lock held, which is released while writing. */
+static void sreq_write(h2_proxy_ctx *ctx, h2_proxy_sreq *sreq)
+{
+    h2_proxy_backend *be = sreq->sh->be;
+    apr_bucket_alloc_t *ba = ctx->owner->bucket_alloc;
+    char *data = sreq->out;
+    apr_size_t len = sreq->outlen;
+    int eos = sreq->eos;
+    apr_status_t status;
+    
+    sreq->out = NULL;
+    sreq->outlen = sreq->outsize = 0;
+    sreq->eos = 0;
+    sreq->taken += len;
+    if (sreq->cancel) {
+        free(data);
+        return;
+    }
+    apr_thread_mutex_unlock(be->lock);
+    
+    if (len) {
+        APR_BRIGADE_INSERT_TAIL(sreq->bb, 
+                                apr_bucket_heap_create(data, len, free, ba));
+    }
+    else {
+        free(data);
+    }
+    APR_BRIGADE_INSERT_TAIL(sreq->bb, apr_bucket_flush_create(ba));
+    if (eos) {
+        APR_BRIGADE_INSERT_TAIL(sreq->bb, apr_bucket_eos_create(ba));
+    }
+    status = ap_pass_brigade(sreq->r->output_filters, sreq->bb);
+    apr_brigade_cleanup(sreq->bb);
+    
+    apr_thread_mutex_lock(be->lock);
+    if (status != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, status, sreq->r, APLOGNO(10172)
+                      "H2: passing output of shared request, cancel it");
+        sreq->cancel = 1;
+    }
+}
+
+/* Cancel our request, called with be->lock held. A request still queued
+ * is done right away, an open stream is reset by the driving thread. */
+static void sreq_cancel(h2_proxy_sreq *sreq)
+{
+    apr_array_header_t *queued = sreq->sh->queued;
+    int i;
+    
+    sreq->cancel = 1;
+    for (i = 0; i < queued->nelts; ++i) {
+        if (APR_ARRAY_IDX(queued, i, h2_proxy_sreq*) == sreq) {
+            for (; i + 1 < queued->nelts; ++i) {
+                APR_ARRAY_IDX(queued, i, h2_proxy_sreq*) = 
+                    APR_ARRAY_IDX(queued, i + 1, h2_proxy_sreq*);
+            }
+            --queued->nelts;
+            sreq_done(sreq, APR_ECONNABORTED, 0);
+            apr_thread_cond_broadcast(sreq->sh->be->changed);
+            break;
+        }
+    }
+}
+
+static apr_status_t shared_open(h2_proxy_ctx *ctx, h2_proxy_shared *sh)
+{
+    h2_proxy_srv_conf *sconf = ap_get_module_config(ctx->server->module_config,
+                                                    &proxy_http2_module);
+    char *locurl = (char *)ctx->url;
+    apr_uri_t uri;
+    int rv;
+    
+    rv = ap_proxy_acquire_connection(ctx->proxy_func, &sh->p_conn,
+                                     ctx->worker, ctx->server);
+    if (rv != OK) {
+        sh->p_conn = NULL;
+        return APR_EGENERAL;
+    }
+    sh->p_conn->is_ssl = ctx->is_ssl;
+    
+    rv = ap_proxy_determine_connection(ctx->pool, ctx->rbase, ctx->conf, 
+                                       ctx->worker, sh->p_conn, &uri, &locurl,
+                                       ctx->proxyname, ctx->proxyport,
+                                       ctx->server_portstr,
+                                       sizeof(ctx->server_portstr));
+    if (rv == OK 
+        && ap_proxy_connect_backend(ctx->proxy_func, sh->p_conn, 
+                                    ctx->worker, ctx->server)) {
+        rv = HTTP_SERVICE_UNAVAILABLE;
+    }
+    if (rv == OK && !sh->p_conn->connection) {
+        rv = ap_proxy_connection_create_ex(ctx->proxy_func, sh->p_conn, 
+                                           ctx->rbase);
+        if (rv == OK && !sh->p_conn->data && ctx->is_ssl) {
+            apr_table_setn(sh->p_conn->connection->notes,
+                           "proxy-request-alpn-protos", "h2");
+        }
+    }
+    if (rv != OK) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->owner, APLOGNO(10163)
+                      "H2: failed to open shared session to backend: %s",
+                      sh->p_conn->hostname);
+        sh->p_conn->close = 1;
+        proxy_run_detach_backend(ctx->rbase, sh->p_conn);
+        ap_proxy_release_connection(ctx->proxy_func, sh->p_conn, ctx->server);
+        sh->p_conn = NULL;
+        return APR_EGENERAL;
+    }
+    
+    sh->session = h2_proxy_session_setup(
+        apr_psprintf(ctx->pool, "shared-%s-%d", ctx->worker->s->name, 
+                     sh->index), 
+        sh->p_conn, ctx->conf, 0, 
+        window_bits(sconf->win_conn, H2_PROXY_WIN_CONN_BITS), 
+        window_bits(sconf->win_stream, 
+                    h2_proxy_log2(H2_PROXY_SHARED_BUFSIZE)), 
+        shared_req_done);
+    if (!sh->session) {
+        return APR_EGENERAL;
+    }
+    /* the connection may come with a session from unshared use */
+    sh->session->done = shared_req_done;
+    sh->session->out = shared_out;
+    sh->session->h2_front = 0;
+    sh->session->user_data = sh;
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->owner, APLOGNO(10164)
+                  "h2_proxy_session(%s): opened shared session",
+                  sh->session->id);
+    return APR_SUCCESS;
+}
+
+/* Process the session until our own request is done, has output to
+ * write, or the session ends. Called and returns with be->lock held. The
+ * responses of the other requests on the session are handed to their
+ * threads (see above). */
+static void shared_drive(h2_proxy_ctx *ctx, h2_proxy_sreq *sreq)
+{
+    h2_proxy_shared *sh = sreq->sh;
+    h2_proxy_backend *be = sh->be;
+    apr_array_header_t *todo;
+    proxy_conn_rec *p_conn;
+    apr_status_t status = APR_SUCCESS;
+    int i;
+    
+    todo = apr_array_make(ctx->pool, 10, sizeof(h2_proxy_sreq*));
+    sh->driven = 1;
+    while (!sreq->done && !sreq->outlen && !sreq->eos) {
+        if (sh->session) {
+            for (i = 0; i < sh->open->nelts; ++i) {
+                h2_proxy_sreq *q = APR_ARRAY_IDX(sh->open, i, h2_proxy_sreq*);
+                if (q->taken) {
+                    h2_proxy_session_stream_consumed(sh->session, q->r, 
+                                                     q->taken);
+                    q->taken = 0;
+                }
+                if (q->cancel && !q->cancelled) {
+                    h2_proxy_session_cancel(sh->session, q->r);
+                    q->cancelled = 1;
+                }
+            }
+        }
+        apr_array_cat(sh->open, sh->queued);
+        apr_array_cat(todo, sh->queued);
+        apr_array_clear(sh->queued);
+        apr_thread_mutex_unlock(be->lock);
+        
+        if (!sh->session) {
+            status = shared_open(ctx, sh);
+        }
+        else if (todo->nelts && h2_proxy_ihash_empty(sh->session->streams)) {
+            /* session has been idle, this pings the backend if needed */
+            h2_proxy_session_setup(sh->session->id, sh->p_conn, ctx->conf, 0, 
+                                   sh->session->window_bits_connection,
+                                   sh->session->window_bits_stream, 
+                                   shared_req_done);
+        }
+        
+        for (i = 0; status == APR_SUCCESS && i < todo->nelts; ++i) {
+            h2_proxy_sreq *q = APR_ARRAY_IDX(todo, i, h2_proxy_sreq*);
+            apr_table_setn(q->r->notes, "proxy-source-port", 
+                           apr_psprintf(q->r->pool, "%hu",
+                           sh->p_conn->connection->local_addr->port));
+            if (h2_proxy_session_submit(sh->session, q->url, 
+                                        q->r, 0) != APR_SUCCESS) {
+                shared_req_done(sh->session, q->r, APR_EGENERAL, 1);
+            }
+        }
+        if (status == APR_SUCCESS) {
+            apr_array_clear(todo);
+            status = h2_proxy_session_process(sh->session);
+        }
+        
+        if (status != APR_SUCCESS) {
+            /* session ended or never started. Fail all its requests, 
+             * the untouched ones will be assigned again. */
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, status, ctx->owner, 
+                          APLOGNO(10165) "h2_proxy_session(%s): end of "
+                          "shared session", 
+                          sh->session? sh->session->id : "-");
+            if (sh->session) {
+                h2_proxy_session_cleanup(sh->session, shared_req_done);
+            }
+            apr_thread_mutex_lock(be->lock);
+            sh->dead = 1;
+            apr_array_cat(todo, sh->queued);
+            apr_array_clear(sh->queued);
+            for (i = 0; i < todo->nelts; ++i) {
+                sreq_done(APR_ARRAY_IDX(todo, i, h2_proxy_sreq*), status, 0);
+            }
+            while (sh->open->nelts) {
+                sreq_done(APR_ARRAY_IDX(sh->open, 0, h2_proxy_sreq*), 
+                          status, 1);
+            }
+            p_conn = sh->p_conn;
+            sh->p_conn = NULL;
+            sh->session = NULL;
+            apr_thread_mutex_unlock(be->lock);
+            
+            if (p_conn) {
+                p_conn->close = 1;
+                proxy_run_detach_backend(ctx->rbase, p_conn);
+                ap_proxy_release_connection(ctx->proxy_func, p_conn, 
+                                            ctx->server);
+            }
+            apr_thread_mutex_lock(be->lock);
+            sh->dead = 0;
+            break;
+        }
+        
+        apr_thread_mutex_lock(be->lock);
+        if (sh->session->remote_max_concurrent > 0) {
+            sh->capacity = (int)sh->session->remote_max_concurrent;
+        }
+    }
+    sh->driven = 0;
+    apr_thread_cond_broadcast(be->changed);
+}
+
+static int shared_handler(h2_proxy_ctx *ctx, int nsessions)
+{
+    h2_proxy_backend *be;
+    h2_proxy_sreq *sreq;
+    apr_interval_time_t timeout;
+    apr_time_t deadline;
+    int retries = 0;
+    
+    if (ctx->worker == ctx->conf->forward || ctx->worker == ctx->conf->reverse
+        || !ctx->worker->s->is_address_reusable || !backends_lock) {
+        /* the default workers may connect anywhere, do not share those */
+        return DECLINED;
+    }
+    if (ap_request_has_body(ctx->rbase) || ctx->rbase->expecting_100) {
+        /* the driving thread would read it from our client */
+        return DECLINED;
+    }
+    if (!(be = backend_get(ctx->worker, nsessions))) {
+        return DECLINED;
+    }
+    
+    sreq = apr_pcalloc(ctx->pool, sizeof(*sreq));
+    sreq->r = ctx->rbase;
+    sreq->url = ctx->url;
+    sreq->bb = apr_brigade_create(ctx->pool, ctx->owner->bucket_alloc);
+    ap_set_module_config(ctx->rbase->request_config, &proxy_http2_module, sreq);
+    
+    apr_thread_mutex_lock(be->lock);
+    if (!backend_assign(be, sreq)) {
+        apr_thread_mutex_unlock(be->lock);
+        return DECLINED;
+    }
+    if (ctx->worker->s->timeout_set) {
+        timeout = ctx->worker->s->timeout;
+    }
+    else if (ctx->conf->timeout_set) {
+        timeout = ctx->conf->timeout;
+    }
+    else {
+        timeout = ctx->server->timeout;
+    }
+    deadline = apr_time_now() + timeout;
+    while (1) {
+        if (sreq->outlen || sreq->eos) {
+            sreq_write(ctx, sreq);
+            deadline = apr_time_now() + timeout;
+            continue;
+        }
+        if (sreq->done) {
+            if (sreq->status != APR_SUCCESS && !sreq->touched 
+                && !sreq->cancel && ++retries < 5 && !ctx->owner->aborted
+                && backend_assign(be, sreq)) {
+                continue;
+            }
+            break;
+        }
+        if (!sreq->cancel 
+            && (ctx->owner->aborted || apr_time_now() >= deadline)) {
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, ctx->rbase, 
+                          APLOGNO(10173) "H2: shared request %s, cancel it",
+                          ctx->owner->aborted? "aborted" : "timed out");
+            sreq_cancel(sreq);
+            continue;
+        }
+        if (!sreq->sh->driven) {
+            /* nobody is processing our session, we do it */
+            shared_drive(ctx, sreq);
+            continue;
+        }
+        /* once cancelled, only wait for the driving thread to reset the
+         * stream, the request cannot go while the session has it */
+        apr_thread_cond_timedwait(be->changed, be->lock, 
+                                  sreq->cancel? timeout 
+                                  : deadline - apr_time_now());
+    }
+    apr_thread_mutex_unlock(be->lock);
+    
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, sreq->status, ctx->rbase, 
+                  "H2: shared request done, retries=%d", retries);
+    if (sreq->status == APR_SUCCESS) {
+        return OK;
+    }
+    if (sreq->cancel && ctx->owner->aborted) {
+        return DONE;
+    }
+    if (ctx->rbase->sent_bodyct) {
+        /* The response has (partly) gone out already, too late for an
+         * error page: abort it so that it is not taken as complete. */
+        apr_bucket_brigade *bb;
+        
+        bb = apr_brigade_create(ctx->pool, ctx->owner->bucket_alloc);
+        ap_proxy_backend_broke(ctx->rbase, bb);
+        ap_pass_brigade(ctx->rbase->output_filters, bb);
+        return DONE;
+    }
+    return sreq->cancel? HTTP_GATEWAY_TIME_OUT : HTTP_SERVICE_UNAVAILABLE;
+}
+#endif /* APR_HAS_THREADS */
+
 static int proxy_http2_handler(request_rec *r, 
                                proxy_worker *worker,
                                proxy_server_conf *conf,
@@ -486,6 +1178,9 @@ static int proxy_http2_handler(request_rec *r,
     h2_proxy_ctx *ctx;
     apr_uri_t uri;
     int reconnects = 0;
+#if APR_HAS_THREADS
+    h2_proxy_srv_conf *sconf;
+#endif
     
     /* find the scheme */
     if ((url[0] != 'h' && url[0] != 'H') || url[1] != '2') {
@@ -522,6 +1217,9 @@ static int proxy_http2_handler(request_rec *r,
     ctx->conf       = conf;
     ctx->flushall   = apr_table_get(r->subprocess_env, "proxy-flushall")? 1 : 0;
     ctx->r_status   = HTTP_SERVICE_UNAVAILABLE;
+    ctx->url        = url;
+    ctx->proxyname  = proxyname;
+    ctx->proxyport  = proxyport;
     
     h2_proxy_fifo_set_create(&ctx->requests, ctx->pool, 100);
     
@@ -532,6 +1230,18 @@ static int proxy_http2_handler(request_rec *r,
     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, ctx->rbase, 
                   "H2: serving URL %s", url);
     
+#if APR_HAS_THREADS
+    sconf = ap_get_module_config(r->server->module_config, &proxy_http2_module);
+    if (sconf->sessions > 0) {
+        int rv = shared_handler(ctx, sconf->sessions);
+        if (rv != DECLINED) {
+            ap_set_module_config(ctx->owner->conn_config, 
+                                 &proxy_http2_module, NULL);
+            return rv;
+        }
+    }
+#endif
+
 run_connect:    
     /* Get a proxy_conn_rec from the worker, might be a new one, might
      * be one still open from another request, or it might fail if the
@@ -654,6 +1364,9 @@ cleanup:
 static void register_hook(apr_pool_t *p)
 {
     ap_hook_post_config(h2_proxy_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+#if APR_HAS_THREADS
+    ap_hook_child_init(h2_proxy_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+#endif
 
     proxy_hook_scheme_handler(proxy_http2_handler, NULL, NULL, APR_HOOK_FIRST);
     proxy_hook_canon_handler(proxy_http2_canon, NULL, NULL, APR_HOOK_FIRST);
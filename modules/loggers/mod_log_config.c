@@ -151,8 +151,13 @@
 #include "apr_hash.h"
 #include "apr_optional.h"
 #include "apr_anylock.h"
+#include "apr_atomic.h"
+#include "apr_thread_proc.h"
+#include "apr_thread_cond.h"
+#include "apr_shm.h"
 
 #define APR_WANT_STRFUNC
+#define APR_WANT_IOVEC
 #include "apr_want.h"
 
 #include "ap_config.h"
@@ -165,6 +170,8 @@
 #include "util_time.h"
 #include "ap_mpm.h"
 #include "ap_provider.h"
+#include "mod_status.h"
+#include "scoreboard.h"
 
 #if APR_HAVE_UNISTD_H
 #include <unistd.h>
@@ -203,8 +210,16 @@ static ap_log_writer *ap_log_set_writer(ap_log_writer *handle);
 static ap_log_writer *log_writer = ap_default_log_writer;
 static ap_log_writer_init *log_writer_init = ap_default_log_writer_init;
 static int buffered_logs = 0; /* default unbuffered */
+static int buffered_logs_async = 0;
 static apr_array_header_t *all_buffered_logs = NULL;
 
+#define LOG_RING_DEFAULT_SIZE   (1024 * 1024)
+#define LOG_RING_MIN_SIZE       (64 * 1024)
+#define LOG_RING_MAX_SIZE       (1024 * 1024 * 1024)
+
+static apr_uint32_t log_ring_size = LOG_RING_DEFAULT_SIZE;
+static int log_ring_drop = 0;
+
 /* POSIX.1 defines PIPE_BUF as the maximum number of bytes that is
  * guaranteed to be atomic when writing a pipe.  And PIPE_BUF >= 512
  * is guaranteed.  So we'll just guess 512 in the event the system
@@ -253,13 +268,6 @@ typedef struct {
  * set to a opaque structure (usually a fd) after it is opened.
 
  */
-typedef struct {
-    apr_file_t *handle;
-    apr_size_t outcnt;
-    char outbuf[LOG_BUFSIZE];
-    apr_anylock_t mutex;
-} buffered_log;
-
 typedef struct {
     const char *fname;
     const char *format_string;
@@ -270,6 +278,9 @@ typedef struct {
     ap_expr_info_t *condition_expr;
     /** place of definition or NULL if already checked */
     const ap_directive_t *directive;
+    int encoding;
+    /** second the binary schema was last written by this child */
+    volatile apr_uint32_t schema_time;
 } config_log_state;
 
 /*
@@ -283,7 +294,54 @@ typedef struct {
 /*
  * Format items...
  * Note that many of these could have ap_sprintfs replaced with static buffers.
+ *
+ * When a format is parsed, the items of the common handlers get an op
+ * (see compile_log_format()). These are formatted straight into the
+ * output line by format_item(), with inline escaping and without
+ * allocating from the request pool. All other items have LOG_OP_FUNC
+ * and call their handler.
+ */
+
+#define LOG_OP_FUNC             0
+#define LOG_OP_CONST            1
+#define LOG_OP_REMOTE_HOST      2
+#define LOG_OP_REMOTE_ADDR      3
+#define LOG_OP_REMOTE_LOGNAME   4
+#define LOG_OP_REMOTE_USER      5
+#define LOG_OP_REQUEST_LINE     6
+#define LOG_OP_REQUEST_URI      7
+#define LOG_OP_REQUEST_METHOD   8
+#define LOG_OP_REQUEST_PROTOCOL 9
+#define LOG_OP_REQUEST_QUERY    10
+#define LOG_OP_STATUS           11
+#define LOG_OP_BYTES_CLF        12
+#define LOG_OP_BYTES            13
+#define LOG_OP_HEADER_IN        14
+#define LOG_OP_NOTE             15
+#define LOG_OP_ENV_VAR          16
+#define LOG_OP_TIME_BEGIN       17
+#define LOG_OP_TIME_END         18
+#define LOG_OP_DURATION_USEC    19
+#define LOG_OP_KEEPALIVES       20
+#define LOG_OP_VIRTUAL_HOST     21
+#define LOG_OP_SERVER_NAME      22
+#define LOG_OP_HEADER_OUT       23
+#define LOG_OP_TRAILER_IN       24
+#define LOG_OP_TRAILER_OUT      25
+#define LOG_OP_COOKIE           26
+#define LOG_OP_FILENAME         27
+#define LOG_OP_HANDLER          28
+
+/*
+ * The fields of a format in the structured encodings: the items that
+ * are not constant text. record is the binary schema record.
  */
+typedef struct {
+    apr_uint32_t id;
+    int nfields;
+    char *record;
+    apr_size_t len;
+} log_schema;
 
 typedef struct {
     ap_log_handler_fn_t *func;
@@ -291,8 +349,17 @@ typedef struct {
     int condition_sense;
     int want_orig;
     apr_array_header_t *conditions;
+    int op;
+    apr_size_t arglen;
+    /** the format directive without "%", the field name */
+    const char *name;
+    log_schema *schema;
 } log_format_item;
 
+#define LOG_ENCODING_TEXT       0
+#define LOG_ENCODING_JSON       1
+#define LOG_ENCODING_BINARY     2
+
 /*
  * errorlog_provider_data holds pointer to provider and its handle
  * generated by provider initialization. It is used when logging using
@@ -322,6 +389,64 @@ typedef struct {
     void *log_writer;
 } default_log_writer;
 
+#if APR_HAS_THREADS
+/*
+ * With "BufferedLogs Async" every buffered log that goes to a file or
+ * pipe gets a ring buffer in each child. Request threads append their
+ * lines to it without taking a lock, a single writer thread per child
+ * drains all rings with writev(). The writer publishes the counters of
+ * its child to a shared memory slot per ring and child, the status page
+ * sums them up over all running children.
+ */
+typedef struct {
+    char *data;
+    int index;                      /* of the ring's counters in a slot */
+    apr_uint32_t size;              /* a power of 2 */
+    volatile apr_uint32_t head;     /* end of the reserved space */
+    volatile apr_uint32_t tail;     /* start of the unwritten records */
+    volatile apr_uint32_t waiters;  /* producers waiting for space */
+    volatile apr_uint32_t lines;
+    volatile apr_uint32_t dropped;
+    volatile apr_uint32_t stalls;
+    /* only updated by the writer thread */
+    apr_uint32_t high;
+    apr_uint64_t writes;
+    apr_uint64_t bytes;
+    apr_uint64_t errors;            /* failed writes, their lines are lost */
+    apr_uint64_t errors_logged;     /* errors when last logged */
+    apr_time_t error_time;          /* when last logged */
+} log_ring;
+
+/* The counters of a ring in a child, written by its writer thread only */
+typedef struct {
+    pid_t pid;                      /* the child they belong to */
+    apr_uint32_t high;
+    apr_uint32_t lines;
+    apr_uint32_t dropped;
+    apr_uint32_t stalls;
+    apr_uint64_t writes;
+    apr_uint64_t bytes;
+    apr_uint64_t errors;
+} log_ring_stats;
+#endif
+
+/*
+ * buffered_log is the log_writer of ap_buffered_log_writer_init. Logs
+ * handled by an errorlog provider have no handle and are not buffered.
+ */
+typedef struct {
+    const char *name;
+    default_log_writer *writer;
+    apr_file_t *handle;
+    int is_pipe;
+    apr_size_t outcnt;
+    char outbuf[LOG_BUFSIZE];
+    apr_anylock_t mutex;
+#if APR_HAS_THREADS
+    log_ring *ring;
+#endif
+} buffered_log;
+
 static char *pfmt(apr_pool_t *p, int i)
 {
     if (i <= 0) {
@@ -387,21 +512,24 @@ static const char *log_remote_user(request_rec *r, char *a)
     return rvalue;
 }
 
-static const char *log_request_line(request_rec *r, char *a)
+static const char *request_line_value(request_rec *r)
 {
     /* NOTE: If the original request contained a password, we
      * re-write the request line here to contain XXXXXX instead:
      * (note the truncation before the protocol string for HTTP/0.9 requests)
      * (note also that r->the_request contains the unmodified request)
      */
-    return ap_escape_logitem(r->pool,
-                             (r->parsed_uri.password)
-                               ? apr_pstrcat(r->pool, r->method, " ",
-                                             apr_uri_unparse(r->pool,
-                                                             &r->parsed_uri, 0),
-                                             r->assbackwards ? NULL : " ",
-                                             r->protocol, NULL)
-                               : r->the_request);
+    return (r->parsed_uri.password)
+             ? apr_pstrcat(r->pool, r->method, " ",
+                           apr_uri_unparse(r->pool, &r->parsed_uri, 0),
+                           r->assbackwards ? NULL : " ",
+                           r->protocol, NULL)
+             : r->the_request;
+}
+
+static const char *log_request_line(request_rec *r, char *a)
+{
+    return ap_escape_logitem(r->pool, request_line_value(r));
 }
 
 static const char *log_request_file(request_rec *r, char *a)
@@ -543,7 +671,7 @@ static APR_INLINE char *find_multiple_headers(apr_pool_t *pool,
     return NULL;
 }
 
-static const char *log_header_out(request_rec *r, char *a)
+static const char *header_out_value(request_rec *r, const char *a)
 {
     const char *cp = NULL;
 
@@ -557,7 +685,12 @@ static const char *log_header_out(request_rec *r, char *a)
         cp = apr_table_get(r->headers_out, a);
     }
 
-    return ap_escape_logitem(r->pool, cp);
+    return cp;
+}
+
+static const char *log_header_out(request_rec *r, char *a)
+{
+    return ap_escape_logitem(r->pool, header_out_value(r, a));
 }
 
 static const char *log_trailer_out(request_rec *r, char *a)
@@ -574,7 +707,7 @@ static const char *log_env_var(request_rec *r, char *a)
     return ap_escape_logitem(r->pool, apr_table_get(r->subprocess_env, a));
 }
 
-static const char *log_cookie(request_rec *r, char *a)
+static const char *cookie_value(request_rec *r, const char *a)
 {
     const char *cookies_entry;
 
@@ -617,7 +750,7 @@ static const char *log_cookie(request_rec *r, char *a)
                        --last;
                     }
 
-                    return ap_escape_logitem(r->pool, value);
+                    return value;
                 }
             }
             /* Iterate the remaining tokens using apr_strtok(NULL, ...) */
@@ -627,6 +760,11 @@ static const char *log_cookie(request_rec *r, char *a)
     return NULL;
 }
 
+static const char *log_cookie(request_rec *r, char *a)
+{
+    return ap_escape_logitem(r->pool, cookie_value(r, a));
+}
+
 static const char *log_request_time_custom(request_rec *r, char *a,
                                            apr_time_exp_t *xt)
 {
@@ -670,6 +808,49 @@ static apr_time_t get_request_end_time(request_rec *r)
 }
 
 
+/*
+ * Get the CLF time string of request_time into *cached_time.
+ */
+static void get_request_time_clf(apr_time_t request_time,
+                                 cached_request_time *cached_time)
+{
+    /* This code uses the same technique as ap_explode_recent_localtime():
+     * optimistic caching with logic to detect and correct race conditions.
+     * See the comments in server/util_time.c for more information.
+     */
+    unsigned t_seconds = (unsigned)apr_time_sec(request_time);
+    unsigned i = t_seconds & TIME_CACHE_MASK;
+    *cached_time = request_time_cache[i];
+    if ((t_seconds != cached_time->t) ||
+        (t_seconds != cached_time->t_validate)) {
+
+        /* Invalid or old snapshot, so compute the proper time string
+         * and store it in the cache
+         */
+        apr_time_exp_t xt;
+        char sign;
+        int timz;
+
+        ap_explode_recent_localtime(&xt, request_time);
+        timz = xt.tm_gmtoff;
+        if (timz < 0) {
+            timz = -timz;
+            sign = '-';
+        }
+        else {
+            sign = '+';
+        }
+        cached_time->t = t_seconds;
+        apr_snprintf(cached_time->timestr, DEFAULT_REQUEST_TIME_SIZE,
+                     "[%02d/%s/%d:%02d:%02d:%02d %c%.2d%.2d]",
+                     xt.tm_mday, apr_month_snames[xt.tm_mon],
+                     xt.tm_year+1900, xt.tm_hour, xt.tm_min, xt.tm_sec,
+                     sign, timz / (60*60), (timz % (60*60)) / 60);
+        cached_time->t_validate = t_seconds;
+        request_time_cache[i] = *cached_time;
+    }
+}
+
 static const char *log_request_time(request_rec *r, char *a)
 {
     apr_time_exp_t xt;
@@ -765,42 +946,9 @@ static const char *log_request_time(request_rec *r, char *a)
         return log_request_time_custom(r, a, &xt);
     }
     else {                                   /* CLF format */
-        /* This code uses the same technique as ap_explode_recent_localtime():
-         * optimistic caching with logic to detect and correct race conditions.
-         * See the comments in server/util_time.c for more information.
-         */
         cached_request_time* cached_time = apr_palloc(r->pool,
                                                       sizeof(*cached_time));
-        unsigned t_seconds = (unsigned)apr_time_sec(request_time);
-        unsigned i = t_seconds & TIME_CACHE_MASK;
-        *cached_time = request_time_cache[i];
-        if ((t_seconds != cached_time->t) ||
-            (t_seconds != cached_time->t_validate)) {
-
-            /* Invalid or old snapshot, so compute the proper time string
-             * and store it in the cache
-             */
-            char sign;
-            int timz;
-
-            ap_explode_recent_localtime(&xt, request_time);
-            timz = xt.tm_gmtoff;
-            if (timz < 0) {
-                timz = -timz;
-                sign = '-';
-            }
-            else {
-                sign = '+';
-            }
-            cached_time->t = t_seconds;
-            apr_snprintf(cached_time->timestr, DEFAULT_REQUEST_TIME_SIZE,
-                         "[%02d/%s/%d:%02d:%02d:%02d %c%.2d%.2d]",
-                         xt.tm_mday, apr_month_snames[xt.tm_mon],
-                         xt.tm_year+1900, xt.tm_hour, xt.tm_min, xt.tm_sec,
-                         sign, timz / (60*60), (timz % (60*60)) / 60);
-            cached_time->t_validate = t_seconds;
-            request_time_cache[i] = *cached_time;
-        }
+        get_request_time_clf(request_time, cached_time);
         return cached_time->timestr;
     }
 }
@@ -978,6 +1126,7 @@ static char *parse_log_misc_string(apr_pool_t *p, log_format_item *it,
 
 static char *parse_log_item(apr_pool_t *p, log_format_item *it, const char **sa)
 {
+    const char *start = *sa;
     const char *s = *sa;
     ap_log_handler *handler = NULL;
 
@@ -1071,6 +1220,7 @@ static char *parse_log_item(apr_pool_t *p, log_format_item *it, const char **sa)
             if (it->want_orig == -1) {
                 it->want_orig = handler->want_orig_default;
             }
+            it->name = apr_pstrmemdup(p, start + 1, s - start - 1);
             *sa = s;
             return NULL;
         }
@@ -1079,6 +1229,121 @@ static char *parse_log_item(apr_pool_t *p, log_format_item *it, const char **sa)
     return "Ran off end of LogFormat parsing args to some directive";
 }
 
+/*
+ * Give the items of handlers that format_item() knows an op. Handlers
+ * are compared by function, so that a tag registered by another module
+ * keeps using its own handler.
+ */
+static log_schema *make_log_schema(apr_pool_t *p, apr_array_header_t *a);
+
+static void compile_log_format(apr_pool_t *p, apr_array_header_t *a)
+{
+    log_format_item *items = (log_format_item *)a->elts;
+    log_schema *schema;
+    int i;
+
+    for (i = 0; i < a->nelts; ++i) {
+        log_format_item *it = &items[i];
+        ap_log_handler_fn_t *func = it->func;
+        const char *arg = it->arg;
+
+        it->arglen = strlen(arg);
+        if (func == constant_item) {
+            it->op = LOG_OP_CONST;
+        }
+        else if (func == log_remote_host && strcmp(arg, "c")) {
+            it->op = LOG_OP_REMOTE_HOST;
+        }
+        else if (func == log_remote_address && strcmp(arg, "c")) {
+            it->op = LOG_OP_REMOTE_ADDR;
+        }
+        else if (func == log_remote_logname) {
+            it->op = LOG_OP_REMOTE_LOGNAME;
+        }
+        else if (func == log_remote_user) {
+            it->op = LOG_OP_REMOTE_USER;
+        }
+        else if (func == log_request_line) {
+            it->op = LOG_OP_REQUEST_LINE;
+        }
+        else if (func == log_request_uri) {
+            it->op = LOG_OP_REQUEST_URI;
+        }
+        else if (func == log_request_method) {
+            it->op = LOG_OP_REQUEST_METHOD;
+        }
+        else if (func == log_request_protocol) {
+            it->op = LOG_OP_REQUEST_PROTOCOL;
+        }
+        else if (func == log_request_query) {
+            it->op = LOG_OP_REQUEST_QUERY;
+        }
+        else if (func == log_status) {
+            it->op = LOG_OP_STATUS;
+        }
+        else if (func == clf_log_bytes_sent) {
+            it->op = LOG_OP_BYTES_CLF;
+        }
+        else if (func == log_bytes_sent) {
+            it->op = LOG_OP_BYTES;
+        }
+        else if (func == log_header_in) {
+            it->op = LOG_OP_HEADER_IN;
+        }
+        else if (func == log_note) {
+            it->op = LOG_OP_NOTE;
+        }
+        else if (func == log_env_var) {
+            it->op = LOG_OP_ENV_VAR;
+        }
+        else if (func == log_request_time
+                 && (!*arg || !strcmp(arg, "begin"))) {
+            it->op = LOG_OP_TIME_BEGIN;
+        }
+        else if (func == log_request_time && !strcmp(arg, "end")) {
+            it->op = LOG_OP_TIME_END;
+        }
+        else if (func == log_request_duration_microseconds) {
+            it->op = LOG_OP_DURATION_USEC;
+        }
+        else if (func == log_requests_on_connection) {
+            it->op = LOG_OP_KEEPALIVES;
+        }
+        else if (func == log_virtual_host) {
+            it->op = LOG_OP_VIRTUAL_HOST;
+        }
+        else if (func == log_server_name) {
+            it->op = LOG_OP_SERVER_NAME;
+        }
+        else if (func == log_header_out) {
+            it->op = LOG_OP_HEADER_OUT;
+        }
+        else if (func == log_trailer_in) {
+            it->op = LOG_OP_TRAILER_IN;
+        }
+        else if (func == log_trailer_out) {
+            it->op = LOG_OP_TRAILER_OUT;
+        }
+        else if (func == log_cookie) {
+            it->op = LOG_OP_COOKIE;
+        }
+        else if (func == log_request_file) {
+            it->op = LOG_OP_FILENAME;
+        }
+        else if (func == log_handler) {
+            it->op = LOG_OP_HANDLER;
+        }
+        else {
+            it->op = LOG_OP_FUNC;
+        }
+    }
+
+    schema = make_log_schema(p, a);
+    for (i = 0; i < a->nelts; ++i) {
+        items[i].schema = schema;
+    }
+}
+
 static apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const char **err)
 {
     apr_array_header_t *a = apr_array_make(p, 30, sizeof(log_format_item));
@@ -1093,6 +1358,7 @@ static apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const
 
     s = APR_EOL_STR;
     parse_log_item(p, (log_format_item *) apr_array_push(a), &s);
+    compile_log_format(p, a);
     return a;
 }
 
@@ -1101,13 +1367,11 @@ static apr_array_header_t *parse_log_string(apr_pool_t *p, const char *s, const
  * Actually logging.
  */
 
-static const char *process_item(request_rec *r, request_rec *orig,
-                          log_format_item *item)
+/*
+ * See if the status conditions of an item, if any, let it be logged.
+ */
+static int item_applies(request_rec *r, log_format_item *item)
 {
-    const char *cp;
-
-    /* First, see if we need to process this thing at all... */
-
     if (item->conditions && item->conditions->nelts != 0) {
         int i;
         int *conds = (int *) item->conditions->elts;
@@ -1122,9 +1386,22 @@ static const char *process_item(request_rec *r, request_rec *orig,
 
         if ((item->condition_sense && in_list)
             || (!item->condition_sense && !in_list)) {
-            return "-";
+            return 0;
         }
     }
+    return 1;
+}
+
+static const char *process_item(request_rec *r, request_rec *orig,
+                          log_format_item *item)
+{
+    const char *cp;
+
+    /* First, see if we need to process this thing at all... */
+
+    if (!item_applies(r, item)) {
+        return "-";
+    }
 
     /* We do.  Do it... */
 
@@ -1132,97 +1409,1241 @@ static const char *process_item(request_rec *r, request_rec *orig,
     return cp ? cp : "-";
 }
 
-static void flush_log(buffered_log *buf)
+/*
+ * A log line being formatted by format_item(). It starts out in a
+ * buffer on the stack and only moves to the request pool for lines that
+ * do not fit there.
+ */
+#define LOG_LINE_SIZE   2048
+
+typedef struct {
+    char *buf;
+    apr_size_t len;
+    apr_size_t size;
+    apr_pool_t *pool;
+} log_line;
+
+static char *log_line_reserve(log_line *line, apr_size_t n)
 {
-    if (buf->outcnt && buf->handle != NULL) {
-        /* XXX: error handling */
-        apr_file_write_full(buf->handle, buf->outbuf, buf->outcnt, NULL);
-        buf->outcnt = 0;
+    if (line->len + n > line->size) {
+        apr_size_t size = line->size * 2;
+        char *buf;
+
+        while (size < line->len + n) {
+            size *= 2;
+        }
+        buf = apr_palloc(line->pool, size);
+        memcpy(buf, line->buf, line->len);
+        line->buf = buf;
+        line->size = size;
     }
+    return line->buf + line->len;
 }
 
+static void log_line_add(log_line *line, const char *s, apr_size_t len)
+{
+    memcpy(log_line_reserve(line, len), s, len);
+    line->len += len;
+}
 
-static int config_log_transaction(request_rec *r, config_log_state *cls,
-                                  apr_array_header_t *default_format)
+static void log_line_num(log_line *line, apr_int64_t n)
 {
-    log_format_item *items;
-    const char **strs;
-    int *strl;
-    request_rec *orig;
-    int i;
-    apr_size_t len = 0;
-    apr_array_header_t *format;
-    char *envar;
-    apr_status_t rv;
+    char digits[24], *d = digits + sizeof(digits);
+    apr_uint64_t u = n < 0 ? -(apr_uint64_t)n : (apr_uint64_t)n;
 
-    if (cls->fname == NULL) {
-        return DECLINED;
+    do {
+        *--d = '0' + (char)(u % 10);
+        u /= 10;
+    } while (u);
+    if (n < 0) {
+        *--d = '-';
     }
+    log_line_add(line, d, digits + sizeof(digits) - d);
+}
 
-    /*
-     * See if we've got any conditional envariable-controlled logging decisions
-     * to make.
-     */
-    if (cls->condition_var != NULL) {
-        envar = cls->condition_var;
-        if (*envar != '!') {
-            if (apr_table_get(r->subprocess_env, envar) == NULL) {
-                return DECLINED;
-            }
+/* The characters ap_escape_logitem() escapes */
+#define LOG_ESCAPE_CHAR(c) \
+    ((c) < 0x20 || (c) >= 0x7f || (c) == '"' || (c) == '\\')
+
+/*
+ * Add s to the line, escaped like ap_escape_logitem() does. A NULL s
+ * is logged as "-".
+ */
+static void log_line_escape(log_line *line, const char *s)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *p = (const unsigned char *)s;
+    const unsigned char *start;
+    char *d;
+
+    if (!s) {
+        log_line_add(line, "-", 1);
+        return;
+    }
+    for (;;) {
+        start = p;
+        while (*p && !LOG_ESCAPE_CHAR(*p)) {
+            ++p;
         }
-        else {
-            if (apr_table_get(r->subprocess_env, &envar[1]) != NULL) {
-                return DECLINED;
-            }
+        log_line_add(line, (const char *)start, p - start);
+        if (!*p) {
+            break;
         }
+
+        d = log_line_reserve(line, 4);
+        d[0] = '\\';
+        switch (*p) {
+        case '\b':
+            d[1] = 'b';
+            break;
+        case '\n':
+            d[1] = 'n';
+            break;
+        case '\r':
+            d[1] = 'r';
+            break;
+        case '\t':
+            d[1] = 't';
+            break;
+        case '\v':
+            d[1] = 'v';
+            break;
+        case '\\':
+        case '"':
+            d[1] = *p;
+            break;
+        default:
+            d[1] = 'x';
+            d[2] = hex[*p >> 4];
+            d[3] = hex[*p & 0xf];
+            line->len += 2;
+            break;
+        }
+        line->len += 2;
+        ++p;
     }
-    else if (cls->condition_expr != NULL) {
-        const char *err;
-        int rc = ap_expr_exec(r, cls->condition_expr, &err);
-        if (rc < 0)
-            ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(00644)
-                           "Error evaluating log condition: %s", err);
-        if (rc <= 0)
-            return DECLINED;
-    }
+}
 
-    format = cls->format ? cls->format : default_format;
+/* Kinds of item values, see item_value() */
+#define LOG_VALUE_NULL  0       /* no value, logged as "-" */
+#define LOG_VALUE_RAW   1       /* a string that needs escaping */
+#define LOG_VALUE_TEXT  2       /* a string already fit for the log */
+#define LOG_VALUE_NUM   3       /* a number */
 
-    strs = apr_palloc(r->pool, sizeof(char *) * (format->nelts));
-    strl = apr_palloc(r->pool, sizeof(int) * (format->nelts));
-    items = (log_format_item *) format->elts;
+/*
+ * Get the value of an item that is not a constant, for the ops that
+ * compile_log_format() knows straight from the request. Times are
+ * returned as numbers, in microseconds.
+ */
+static int item_value(request_rec *r, request_rec *orig,
+                      log_format_item *item, const char **str,
+                      apr_int64_t *num)
+{
+    request_rec *rr;
+    int kind = LOG_VALUE_RAW;
+
+    if (!item_applies(r, item)) {
+        return LOG_VALUE_NULL;
+    }
+
+    rr = item->want_orig ? orig : r;
+    switch (item->op) {
+    case LOG_OP_REMOTE_HOST:
+        *str = ap_get_useragent_host(rr, REMOTE_NAME, NULL);
+        break;
+    case LOG_OP_REMOTE_ADDR:
+        *str = rr->useragent_ip;
+        kind = LOG_VALUE_TEXT;
+        break;
+    case LOG_OP_REMOTE_LOGNAME:
+        *str = ap_get_remote_logname(rr);
+        break;
+    case LOG_OP_REMOTE_USER:
+        *str = rr->user;
+        break;
+    case LOG_OP_REQUEST_LINE:
+        *str = request_line_value(rr);
+        break;
+    case LOG_OP_REQUEST_URI:
+        *str = rr->uri;
+        break;
+    case LOG_OP_REQUEST_METHOD:
+        *str = rr->method;
+        break;
+    case LOG_OP_REQUEST_PROTOCOL:
+        *str = rr->protocol;
+        break;
+    case LOG_OP_REQUEST_QUERY:
+        *str = rr->args;
+        break;
+    case LOG_OP_HEADER_IN:
+        *str = apr_table_get(rr->headers_in, item->arg);
+        break;
+    case LOG_OP_NOTE:
+        *str = apr_table_get(rr->notes, item->arg);
+        break;
+    case LOG_OP_ENV_VAR:
+        *str = apr_table_get(rr->subprocess_env, item->arg);
+        break;
+    case LOG_OP_VIRTUAL_HOST:
+        *str = rr->server->server_hostname;
+        break;
+    case LOG_OP_SERVER_NAME:
+        *str = ap_get_server_name(rr);
+        break;
+    case LOG_OP_HEADER_OUT:
+        *str = header_out_value(rr, item->arg);
+        break;
+    case LOG_OP_TRAILER_IN:
+        *str = apr_table_get(rr->trailers_in, item->arg);
+        break;
+    case LOG_OP_TRAILER_OUT:
+        *str = apr_table_get(rr->trailers_out, item->arg);
+        break;
+    case LOG_OP_COOKIE:
+        *str = cookie_value(rr, item->arg);
+        break;
+    case LOG_OP_FILENAME:
+        *str = rr->filename;
+        break;
+    case LOG_OP_HANDLER:
+        *str = rr->handler;
+        break;
+    case LOG_OP_STATUS:
+        if (rr->status <= 0) {
+            return LOG_VALUE_NULL;
+        }
+        *num = rr->status;
+        return LOG_VALUE_NUM;
+    case LOG_OP_BYTES_CLF:
+    case LOG_OP_BYTES:
+        *num = (!rr->sent_bodyct) ? 0 : rr->bytes_sent;
+        return LOG_VALUE_NUM;
+    case LOG_OP_TIME_BEGIN:
+        *num = rr->request_time;
+        return LOG_VALUE_NUM;
+    case LOG_OP_TIME_END:
+        *num = get_request_end_time(rr);
+        return LOG_VALUE_NUM;
+    case LOG_OP_DURATION_USEC:
+        *num = get_request_end_time(rr) - rr->request_time;
+        return LOG_VALUE_NUM;
+    case LOG_OP_KEEPALIVES:
+        *num = rr->connection->keepalives ?
+               rr->connection->keepalives - 1 : 0;
+        return LOG_VALUE_NUM;
+    default:
+        *str = (*item->func) (rr, item->arg);
+        kind = LOG_VALUE_TEXT;
+        break;
+    }
+    return *str ? kind : LOG_VALUE_NULL;
+}
 
-    orig = r;
-    while (orig->prev) {
-        orig = orig->prev;
+/*
+ * Format one item into the line. Does the same as process_item() and
+ * the item's handler, for the handlers that compile_log_format() knows.
+ */
+static void format_item(log_line *line, request_rec *r, request_rec *orig,
+                        log_format_item *item)
+{
+    cached_request_time cached_time;
+    const char *str = NULL;
+    apr_int64_t num = 0;
+
+    if (item->op == LOG_OP_CONST) {
+        log_line_add(line, item->arg, item->arglen);
+        return;
     }
-    while (r->next) {
-        r = r->next;
+    if (!item_applies(r, item)) {
+        log_line_add(line, "-", 1);
+        return;
     }
 
-    for (i = 0; i < format->nelts; ++i) {
-        strs[i] = process_item(r, orig, &items[i]);
+    switch (item_value(r, orig, item, &str, &num)) {
+    case LOG_VALUE_NULL:
+        if (item->op != LOG_OP_REQUEST_QUERY) {
+            log_line_add(line, "-", 1);
+        }
+        break;
+    case LOG_VALUE_RAW:
+        if (item->op == LOG_OP_REQUEST_QUERY) {
+            log_line_add(line, "?", 1);
+        }
+        else if (item->op == LOG_OP_REMOTE_USER && !*str) {
+            log_line_add(line, "\"\"", 2);
+            break;
+        }
+        log_line_escape(line, str);
+        break;
+    case LOG_VALUE_TEXT:
+        log_line_add(line, str, strlen(str));
+        break;
+    case LOG_VALUE_NUM:
+        if (item->op == LOG_OP_TIME_BEGIN || item->op == LOG_OP_TIME_END) {
+            get_request_time_clf(num, &cached_time);
+            log_line_add(line, cached_time.timestr,
+                         strlen(cached_time.timestr));
+        }
+        else if (item->op == LOG_OP_BYTES_CLF && !num) {
+            log_line_add(line, "-", 1);
+        }
+        else {
+            log_line_num(line, num);
+        }
+        break;
     }
+}
 
-    for (i = 0; i < format->nelts; ++i) {
-        len += strl[i] = strlen(strs[i]);
+/*
+ * The length of the UTF-8 sequence s starts with, 0 if it is not valid
+ * (overlong, a surrogate, beyond U+10FFFF or cut short).
+ */
+static apr_size_t utf8_len(const unsigned char *s)
+{
+    unsigned char lo = 0x80, hi = 0xbf;
+    apr_size_t i, n;
+
+    if (s[0] < 0x80) {
+        return 1;
     }
-    if (!log_writer) {
-        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00645)
-                "log writer isn't correctly setup");
-        return HTTP_INTERNAL_SERVER_ERROR;
+    else if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        n = 2;
     }
-    rv = log_writer(r, cls->log_writer, strs, strl, format->nelts, len);
-    if (rv != APR_SUCCESS) {
-        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00646)
-                      "Error writing to %s", cls->fname);
+    else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        n = 3;
+        if (s[0] == 0xe0) {
+            lo = 0xa0;
+        }
+        else if (s[0] == 0xed) {
+            hi = 0x9f;
+        }
     }
-    return OK;
+    else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        n = 4;
+        if (s[0] == 0xf0) {
+            lo = 0x90;
+        }
+        else if (s[0] == 0xf4) {
+            hi = 0x8f;
+        }
+    }
+    else {
+        return 0;
+    }
+    if (s[1] < lo || s[1] > hi) {
+        return 0;
+    }
+    for (i = 2; i < n; ++i) {
+        if (s[i] < 0x80 || s[i] > 0xbf) {
+            return 0;
+        }
+    }
+    return n;
 }
 
-static int multi_log_transaction(request_rec *r)
+/* The characters log_line_json() escapes, besides invalid UTF-8 */
+#define LOG_JSON_ESCAPE_CHAR(c) \
+    ((c) < 0x20 || (c) == 0x7f || (c) == '"' || (c) == '\\')
+
+/*
+ * Add s to the line as a JSON string. Valid UTF-8 is kept, control
+ * characters and bytes that are not part of valid UTF-8 are escaped
+ * as \u00XX, so the output is always valid UTF-8.
+ */
+static void log_line_json(log_line *line, const char *s)
 {
-    multi_log_state *mls = ap_get_module_config(r->server->module_config,
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *p = (const unsigned char *)s;
+    const unsigned char *start;
+    apr_size_t n;
+    char *d;
+
+    log_line_add(line, "\"", 1);
+    for (;;) {
+        start = p;
+        while (*p && !LOG_JSON_ESCAPE_CHAR(*p)) {
+            if (*p < 0x80) {
+                ++p;
+            }
+            else if ((n = utf8_len(p)) != 0) {
+                p += n;
+            }
+            else {
+                break;
+            }
+        }
+        log_line_add(line, (const char *)start, p - start);
+        if (!*p) {
+            break;
+        }
+
+        d = log_line_reserve(line, 6);
+        d[0] = '\\';
+        switch (*p) {
+        case '\b':
+            d[1] = 'b';
+            break;
+        case '\f':
+            d[1] = 'f';
+            break;
+        case '\n':
+            d[1] = 'n';
+            break;
+        case '\r':
+            d[1] = 'r';
+            break;
+        case '\t':
+            d[1] = 't';
+            break;
+        case '\\':
+        case '"':
+            d[1] = *p;
+            break;
+        default:
+            d[1] = 'u';
+            d[2] = '0';
+            d[3] = '0';
+            d[4] = hex[*p >> 4];
+            d[5] = hex[*p & 0xf];
+            line->len += 4;
+            break;
+        }
+        line->len += 2;
+        ++p;
+    }
+    log_line_add(line, "\"", 1);
+}
+
+/*
+ * Format a request as one JSON object, with the names of the format's
+ * items as keys. Constant text of the format is left out.
+ */
+static void format_json(log_line *line, request_rec *r, request_rec *orig,
+                        apr_array_header_t *format)
+{
+    log_format_item *items = (log_format_item *)format->elts;
+    const char *str;
+    apr_int64_t num;
+    int i, n = 0;
+
+    log_line_add(line, "{", 1);
+    for (i = 0; i < format->nelts; ++i) {
+        if (items[i].op == LOG_OP_CONST) {
+            continue;
+        }
+        if (n++) {
+            log_line_add(line, ",", 1);
+        }
+        log_line_json(line, items[i].name);
+        log_line_add(line, ":", 1);
+
+        str = NULL;
+        num = 0;
+        switch (item_value(r, orig, &items[i], &str, &num)) {
+        case LOG_VALUE_TEXT:
+            /* from a handler that made it fit for the text log, which
+             * has "-" for no value */
+            if (!strcmp(str, "-")) {
+                log_line_add(line, "null", 4);
+                break;
+            }
+            /* fall through */
+        case LOG_VALUE_RAW:
+            log_line_json(line, str);
+            break;
+        case LOG_VALUE_NUM:
+            log_line_num(line, num);
+            break;
+        default:
+            log_line_add(line, "null", 4);
+            break;
+        }
+    }
+    log_line_add(line, "}\n", 2);
+}
+
+/*
+ * The binary encoding is a sequence of records, each a 32 bit length
+ * (little endian) followed by that many bytes:
+ *
+ *   schema: 'S', 32 bit schema id, varint field count, and per field
+ *           a varint name length, the name and a type byte
+ *   entry:  'E', 32 bit schema id, and per field of the schema a type
+ *           byte followed by the value: nothing for null, a varint
+ *           length and the bytes for a string, a zigzag varint for a
+ *           number
+ *
+ * The type bytes are the LOG_FIELD_* values. Each child writes the
+ * schema of a log with its first entry of every second, in the same
+ * write, see config_log_transaction().
+ * support/logdecode turns binary logs back into text or JSON.
+ */
+#define LOG_RECORD_SCHEMA   'S'
+#define LOG_RECORD_ENTRY    'E'
+#define LOG_FIELD_NULL      0
+#define LOG_FIELD_STRING    1
+#define LOG_FIELD_NUMBER    2
+
+static void log_line_u32(log_line *line, apr_uint32_t v)
+{
+    unsigned char *d = (unsigned char *)log_line_reserve(line, 4);
+
+    d[0] = (unsigned char)v;
+    d[1] = (unsigned char)(v >> 8);
+    d[2] = (unsigned char)(v >> 16);
+    d[3] = (unsigned char)(v >> 24);
+    line->len += 4;
+}
+
+static void log_line_varint(log_line *line, apr_uint64_t v)
+{
+    unsigned char *d = (unsigned char *)log_line_reserve(line, 10);
+    apr_size_t n = 0;
+
+    while (v >= 0x80) {
+        d[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    d[n++] = (unsigned char)v;
+    line->len += n;
+}
+
+/* Numbers are zigzag encoded, so that small negative ones stay short */
+static void log_line_zigzag(log_line *line, apr_int64_t n)
+{
+    log_line_varint(line, ((apr_uint64_t)n << 1) ^ (apr_uint64_t)(n >> 63));
+}
+
+/* Start a record, returns the offset of its length */
+static apr_size_t log_record_start(log_line *line, char type,
+                                   apr_uint32_t id)
+{
+    apr_size_t start = line->len;
+
+    log_line_u32(line, 0);
+    log_line_add(line, &type, 1);
+    log_line_u32(line, id);
+    return start;
+}
+
+static void log_record_end(log_line *line, apr_size_t start)
+{
+    apr_size_t len = line->len;
+
+    line->len = start;
+    log_line_u32(line, (apr_uint32_t)(len - start - 4));
+    line->len = len;
+}
+
+static log_schema *make_log_schema(apr_pool_t *p, apr_array_header_t *a)
+{
+    log_format_item *items = (log_format_item *)a->elts;
+    log_schema *schema = apr_pcalloc(p, sizeof(*schema));
+    log_line line;
+    apr_size_t start, len;
+    apr_ssize_t klen;
+    unsigned char type;
+    int i;
+
+    for (i = 0; i < a->nelts; ++i) {
+        if (items[i].op != LOG_OP_CONST) {
+            ++schema->nfields;
+        }
+    }
+
+    line.size = 256;
+    line.buf = apr_palloc(p, line.size);
+    line.len = 0;
+    line.pool = p;
+    start = log_record_start(&line, LOG_RECORD_SCHEMA, 0);
+    log_line_varint(&line, schema->nfields);
+    for (i = 0; i < a->nelts; ++i) {
+        switch (items[i].op) {
+        case LOG_OP_CONST:
+            continue;
+        case LOG_OP_STATUS:
+        case LOG_OP_BYTES_CLF:
+        case LOG_OP_BYTES:
+        case LOG_OP_TIME_BEGIN:
+        case LOG_OP_TIME_END:
+        case LOG_OP_DURATION_USEC:
+        case LOG_OP_KEEPALIVES:
+            type = LOG_FIELD_NUMBER;
+            break;
+        default:
+            type = LOG_FIELD_STRING;
+            break;
+        }
+        len = strlen(items[i].name);
+        log_line_varint(&line, len);
+        log_line_add(&line, items[i].name, len);
+        log_line_add(&line, (const char *)&type, 1);
+    }
+    log_record_end(&line, start);
+
+    /* the id is a hash of the fields, never 0 */
+    klen = line.len - start - 9;
+    schema->id = apr_hashfunc_default(line.buf + start + 9, &klen);
+    if (!schema->id) {
+        schema->id = 1;
+    }
+    len = line.len;
+    line.len = start + 5;
+    log_line_u32(&line, schema->id);
+    line.len = len;
+
+    schema->record = line.buf;
+    schema->len = line.len;
+    return schema;
+}
+
+static void format_binary(log_line *line, request_rec *r, request_rec *orig,
+                          apr_array_header_t *format)
+{
+    log_format_item *items = (log_format_item *)format->elts;
+    const char *str;
+    apr_int64_t num;
+    apr_size_t start, len;
+    unsigned char type;
+    int i;
+
+    start = log_record_start(line, LOG_RECORD_ENTRY, items[0].schema->id);
+    for (i = 0; i < format->nelts; ++i) {
+        if (items[i].op == LOG_OP_CONST) {
+            continue;
+        }
+
+        str = NULL;
+        num = 0;
+        switch (item_value(r, orig, &items[i], &str, &num)) {
+        case LOG_VALUE_TEXT:
+            /* as in format_json() */
+            if (!strcmp(str, "-")) {
+                str = NULL;
+            }
+            /* fall through */
+        case LOG_VALUE_RAW:
+            type = str ? LOG_FIELD_STRING : LOG_FIELD_NULL;
+            log_line_add(line, (const char *)&type, 1);
+            if (str) {
+                len = strlen(str);
+                log_line_varint(line, len);
+                log_line_add(line, str, len);
+            }
+            break;
+        case LOG_VALUE_NUM:
+            type = LOG_FIELD_NUMBER;
+            log_line_add(line, (const char *)&type, 1);
+            log_line_zigzag(line, num);
+            break;
+        default:
+            type = LOG_FIELD_NULL;
+            log_line_add(line, (const char *)&type, 1);
+            break;
+        }
+    }
+    log_record_end(line, start);
+}
+
+static void flush_log(buffered_log *buf)
+{
+    if (buf->outcnt && buf->handle != NULL) {
+        /* XXX: error handling */
+        apr_file_write_full(buf->handle, buf->outbuf, buf->outcnt, NULL);
+        buf->outcnt = 0;
+    }
+}
+
+#if APR_HAS_THREADS
+/*
+ * A ring holds records: a 32 bit header with the length of the line,
+ * followed by the line itself, padded to 8 bytes. A header with
+ * LOG_RING_SKIP set covers the unused space at the end of the ring when
+ * a record does not fit there. Producers reserve space by moving head
+ * with a CAS and set the header only after the line has been copied, a
+ * zero header means "reserved, but not filled in yet". The writer
+ * clears what it has written before it moves tail, so free space is
+ * always zeroed.
+ */
+#define LOG_RING_HDR            4
+#define LOG_RING_ALIGN(n)       (((n) + 7) & ~7)
+#define LOG_RING_SKIP           0x80000000
+#define LOG_RING_MAX_IOV        64
+#define LOG_RING_WAKEUP         apr_time_from_msec(100)
+#define LOG_RING_STALL          apr_time_from_msec(10)
+#define LOG_RING_ERROR_INTERVAL apr_time_from_sec(60)
+
+static apr_thread_t *log_ring_thread;
+static apr_shm_t *log_ring_shm;
+static log_ring_stats *log_ring_shared;    /* nrings per child slot */
+static int log_ring_nrings;
+static int log_ring_slots;
+static apr_thread_mutex_t *log_ring_mutex;
+static apr_thread_cond_t *log_ring_work;
+static apr_thread_cond_t *log_ring_space;
+static volatile apr_uint32_t log_ring_stopping;
+
+#define LOG_RING_AT(ring, pos) \
+    ((volatile apr_uint32_t *)((ring)->data + ((pos) & ((ring)->size - 1))))
+
+/* Read a header with a full barrier, so that the line written before
+ * it is visible as well. The CAS only ever replaces 0 with 0. */
+static APR_INLINE apr_uint32_t log_ring_hdr(log_ring *ring, apr_uint32_t pos)
+{
+    return apr_atomic_cas32(LOG_RING_AT(ring, pos), 0, 0);
+}
+
+static void log_ring_wait(log_ring *ring)
+{
+    apr_thread_mutex_lock(log_ring_mutex);
+    apr_atomic_inc32(&ring->waiters);
+    apr_thread_cond_signal(log_ring_work);
+    /* the writer may have made room before we got here, don't rely
+     * on being woken up */
+    apr_thread_cond_timedwait(log_ring_space, log_ring_mutex,
+                              LOG_RING_STALL);
+    apr_atomic_dec32(&ring->waiters);
+    apr_thread_mutex_unlock(log_ring_mutex);
+}
+
+/*
+ * Append a line to the ring of buf. Returns APR_ENOSPC when the line
+ * has to be written directly: it is too large for the ring, or the
+ * writer thread is gone.
+ */
+static apr_status_t log_ring_put(buffered_log *buf, const char **strs,
+                                 int *strl, int nelts, apr_size_t len)
+{
+    log_ring *ring = buf->ring;
+    apr_uint32_t need, head, tail, skip, used;
+    char *s;
+    int i;
+
+    if (len == 0) {
+        return APR_SUCCESS;
+    }
+    if (len > ring->size / 4) {
+        return APR_ENOSPC;
+    }
+    need = LOG_RING_ALIGN(LOG_RING_HDR + (apr_uint32_t)len);
+
+    for (;;) {
+        head = apr_atomic_read32(&ring->head);
+        tail = apr_atomic_read32(&ring->tail);
+        used = head - tail;
+        skip = (head & (ring->size - 1)) + need > ring->size ?
+               ring->size - (head & (ring->size - 1)) : 0;
+        if (used + skip + need > ring->size) {
+            if (apr_atomic_read32(&log_ring_stopping)) {
+                return APR_ENOSPC;
+            }
+            if (log_ring_drop) {
+                apr_atomic_inc32(&ring->dropped);
+                return APR_SUCCESS;
+            }
+            apr_atomic_inc32(&ring->stalls);
+            log_ring_wait(ring);
+            continue;
+        }
+        if (apr_atomic_cas32(&ring->head, head + skip + need, head) == head) {
+            break;
+        }
+    }
+
+    if (skip) {
+        apr_atomic_cas32(LOG_RING_AT(ring, head), LOG_RING_SKIP | skip, 0);
+        head += skip;
+    }
+    s = (char *)LOG_RING_AT(ring, head) + LOG_RING_HDR;
+    for (i = 0; i < nelts; ++i) {
+        memcpy(s, strs[i], strl[i]);
+        s += strl[i];
+    }
+    apr_atomic_cas32(LOG_RING_AT(ring, head), (apr_uint32_t)len, 0);
+    apr_atomic_inc32(&ring->lines);
+
+    /* wake the writer early when the ring gets half full */
+    if (used < ring->size / 2 && used + skip + need >= ring->size / 2) {
+        apr_thread_cond_signal(log_ring_work);
+    }
+    return APR_SUCCESS;
+}
+
+/*
+ * Wait until the writer has written all lines that are in the ring now,
+ * so that a line written directly does not overtake them.
+ */
+static void log_ring_flush(log_ring *ring)
+{
+    apr_uint32_t head = apr_atomic_read32(&ring->head);
+
+    while ((apr_int32_t)(head - apr_atomic_read32(&ring->tail)) > 0
+           && !apr_atomic_read32(&log_ring_stopping)) {
+        log_ring_wait(ring);
+    }
+}
+
+/*
+ * Write out the filled in records at the tail of the ring with a single
+ * writev(). Writes to a pipe are kept at LOG_BUFSIZE, as they are only
+ * atomic up to PIPE_BUF. Returns non-zero if the tail moved.
+ */
+static int log_ring_drain(buffered_log *buf, server_rec *s)
+{
+    log_ring *ring = buf->ring;
+    struct iovec vec[LOG_RING_MAX_IOV];
+    apr_uint32_t head, tail, pos, hdr, off, used;
+    apr_size_t total = 0;
+    apr_status_t rv;
+    int n = 0;
+
+    tail = pos = ring->tail;
+    head = apr_atomic_read32(&ring->head);
+    if (head - tail > ring->high) {
+        ring->high = head - tail;
+    }
+    while (pos != head && n < LOG_RING_MAX_IOV) {
+        hdr = log_ring_hdr(ring, pos);
+        if (!hdr) {
+            break;
+        }
+        if (hdr & LOG_RING_SKIP) {
+            pos += hdr & ~LOG_RING_SKIP;
+            continue;
+        }
+        if (n && buf->is_pipe && total + hdr > LOG_BUFSIZE) {
+            break;
+        }
+        vec[n].iov_base = (char *)LOG_RING_AT(ring, pos) + LOG_RING_HDR;
+        vec[n].iov_len = hdr;
+        total += hdr;
+        ++n;
+        pos += LOG_RING_ALIGN(LOG_RING_HDR + hdr);
+    }
+    if (pos == tail) {
+        return 0;
+    }
+
+    if (n) {
+        rv = apr_file_writev_full(buf->handle, vec, n, NULL);
+        if (rv == APR_SUCCESS) {
+            ring->writes++;
+            ring->bytes += total;
+        }
+        else {
+            /* Don't flood the error log when the disk is full or the
+             * piped logger has gone away, once a minute is enough.
+             */
+            apr_time_t now = apr_time_now();
+
+            ring->errors++;
+            if (now - ring->error_time >= LOG_RING_ERROR_INTERVAL) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10171)
+                             "Error writing to %s, %" APR_UINT64_T_FMT
+                             " failed writes since last reported",
+                             buf->name, ring->errors - ring->errors_logged);
+                ring->errors_logged = ring->errors;
+                ring->error_time = now;
+            }
+        }
+    }
+
+    off = tail & (ring->size - 1);
+    used = pos - tail;
+    if (off + used > ring->size) {
+        memset(ring->data + off, 0, ring->size - off);
+        memset(ring->data, 0, used - (ring->size - off));
+    }
+    else {
+        memset(ring->data + off, 0, used);
+    }
+    /* the CAS is a barrier, producers see the cleared space first */
+    apr_atomic_cas32(&ring->tail, pos, tail);
+
+    if (apr_atomic_read32(&ring->waiters)) {
+        apr_thread_mutex_lock(log_ring_mutex);
+        apr_thread_cond_broadcast(log_ring_space);
+        apr_thread_mutex_unlock(log_ring_mutex);
+    }
+    return 1;
+}
+
+/*
+ * Copy the counters of our rings to the shared memory slot of this child.
+ * The parent notes the pid of a child in the scoreboard after fork(), the
+ * slot is looked up until it is there.
+ */
+static void log_ring_publish(int *slot)
+{
+    buffered_log **array = (buffered_log **)all_buffered_logs->elts;
+    log_ring_stats *stats;
+    int i;
+
+    if (!log_ring_shared) {
+        return;
+    }
+    for (i = 0; *slot < 0 && i < log_ring_slots; ++i) {
+        if (ap_get_scoreboard_process(i)->pid == getpid()) {
+            *slot = i;
+        }
+    }
+    if (*slot < 0) {
+        return;
+    }
+    for (i = 0; i < all_buffered_logs->nelts; ++i) {
+        log_ring *ring = array[i]->ring;
+
+        if (!ring || ring->index >= log_ring_nrings) {
+            continue;
+        }
+        stats = &log_ring_shared[*slot * log_ring_nrings + ring->index];
+        stats->pid = getpid();
+        stats->high = ring->high;
+        stats->lines = apr_atomic_read32(&ring->lines);
+        stats->dropped = apr_atomic_read32(&ring->dropped);
+        stats->stalls = apr_atomic_read32(&ring->stalls);
+        stats->writes = ring->writes;
+        stats->bytes = ring->bytes;
+        stats->errors = ring->errors;
+    }
+}
+
+static void * APR_THREAD_FUNC log_ring_writer(apr_thread_t *thd, void *data)
+{
+    server_rec *s = data;
+    buffered_log **array = (buffered_log **)all_buffered_logs->elts;
+    int i, busy, slot = -1;
+
+    for (;;) {
+        busy = 0;
+        for (i = 0; i < all_buffered_logs->nelts; ++i) {
+            if (array[i]->ring) {
+                busy |= log_ring_drain(array[i], s);
+            }
+        }
+        log_ring_publish(&slot);
+        if (!busy) {
+            if (apr_atomic_read32(&log_ring_stopping)) {
+                break;
+            }
+            apr_thread_mutex_lock(log_ring_mutex);
+            apr_thread_cond_timedwait(log_ring_work, log_ring_mutex,
+                                      LOG_RING_WAKEUP);
+            apr_thread_mutex_unlock(log_ring_mutex);
+        }
+    }
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static apr_status_t log_ring_stop(void *data)
+{
+    apr_status_t rv;
+
+    apr_atomic_set32(&log_ring_stopping, 1);
+    apr_thread_mutex_lock(log_ring_mutex);
+    apr_thread_cond_signal(log_ring_work);
+    apr_thread_mutex_unlock(log_ring_mutex);
+    apr_thread_join(&rv, log_ring_thread);
+    log_ring_thread = NULL;
+    return APR_SUCCESS;
+}
+
+static void log_ring_start(apr_pool_t *p, server_rec *s)
+{
+    buffered_log **array = (buffered_log **)all_buffered_logs->elts;
+    apr_status_t rv;
+    int i, rings = 0;
+
+    if ((rv = apr_thread_mutex_create(&log_ring_mutex,
+                                      APR_THREAD_MUTEX_DEFAULT,
+                                      p)) != APR_SUCCESS
+        || (rv = apr_thread_cond_create(&log_ring_work, p)) != APR_SUCCESS
+        || (rv = apr_thread_cond_create(&log_ring_space, p)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10166)
+                     "could not initialize asynchronous buffered logs, "
+                     "using BufferedLogs On instead");
+        return;
+    }
+
+    for (i = 0; i < all_buffered_logs->nelts; i++) {
+        if (array[i]->handle) {
+            log_ring *ring = apr_pcalloc(p, sizeof(*ring));
+            ring->index = rings;
+            ring->size = log_ring_size;
+            ring->data = apr_pcalloc(p, ring->size);
+            array[i]->ring = ring;
+            ++rings;
+        }
+    }
+    if (!rings) {
+        return;
+    }
+
+    log_ring_stopping = 0;
+    rv = apr_thread_create(&log_ring_thread, NULL, log_ring_writer, s, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10167)
+                     "could not create log writer thread, "
+                     "using BufferedLogs On instead");
+        for (i = 0; i < all_buffered_logs->nelts; i++) {
+            array[i]->ring = NULL;
+        }
+        log_ring_thread = NULL;
+        return;
+    }
+    /* stop the writer before the child pool goes away, the rings are
+     * drained on the way out */
+    apr_pool_pre_cleanup_register(p, NULL, log_ring_stop);
+}
+
+/* Create the shared memory for the counters of the rings in all children,
+ * in the parent once the logs are open. */
+static void log_ring_init_shared(apr_pool_t *p, server_rec *s)
+{
+    buffered_log **array = (buffered_log **)all_buffered_logs->elts;
+    apr_size_t size;
+    apr_status_t rv;
+    int i;
+
+    log_ring_shm = NULL;
+    log_ring_shared = NULL;
+    log_ring_nrings = 0;
+    for (i = 0; i < all_buffered_logs->nelts; i++) {
+        if (array[i]->handle) {
+            ++log_ring_nrings;
+        }
+    }
+    if (!log_ring_nrings) {
+        return;
+    }
+
+    ap_mpm_query(AP_MPMQ_HARD_LIMIT_DAEMONS, &log_ring_slots);
+    size = (apr_size_t)log_ring_slots * log_ring_nrings
+           * sizeof(log_ring_stats);
+    rv = apr_shm_create(&log_ring_shm, size, NULL, p);
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10174)
+                     "could not create shared memory for the asynchronous "
+                     "buffered log counters, status shows none");
+        log_ring_shm = NULL;
+        return;
+    }
+    log_ring_shared = apr_shm_baseaddr_get(log_ring_shm);
+    memset(log_ring_shared, 0, size);
+}
+
+static int log_ring_status_hook(request_rec *r, int flags)
+{
+    buffered_log **array;
+    int i, j, n;
+
+    if (!log_ring_shared || !ap_exists_scoreboard_image()) {
+        return OK;
+    }
+
+    array = (buffered_log **)all_buffered_logs->elts;
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rputs("<hr />\n<h1>Asynchronous Buffered Logs</h1>\n"
+                 "<p>Sums over the running child processes, "
+                 "max used is of the fullest ring.</p>\n"
+                 "<table border=\"0\"><tr><th>Log</th><th>Ring</th>"
+                 "<th>Max used</th><th>Lines</th><th>Dropped</th>"
+                 "<th>Stalls</th><th>Writes</th><th>Bytes</th>"
+                 "<th>Errors</th></tr>\n", r);
+    }
+    for (i = 0, n = 0; i < all_buffered_logs->nelts; i++) {
+        log_ring_stats sum;
+
+        if (!array[i]->handle || n >= log_ring_nrings) {
+            continue;
+        }
+        memset(&sum, 0, sizeof(sum));
+        for (j = 0; j < log_ring_slots; ++j) {
+            log_ring_stats *stats = &log_ring_shared[j * log_ring_nrings + n];
+            pid_t pid = ap_get_scoreboard_process(j)->pid;
+
+            /* the slot may still have the counters of an exited child */
+            if (!pid || stats->pid != pid) {
+                continue;
+            }
+            if (stats->high > sum.high) {
+                sum.high = stats->high;
+            }
+            sum.lines += stats->lines;
+            sum.dropped += stats->dropped;
+            sum.stalls += stats->stalls;
+            sum.writes += stats->writes;
+            sum.bytes += stats->bytes;
+            sum.errors += stats->errors;
+        }
+        if (!(flags & AP_STATUS_SHORT)) {
+            ap_rvputs(r, "<tr><td>", ap_escape_html(r->pool, array[i]->name),
+                      "</td>", NULL);
+            ap_rprintf(r, "<td>%u</td><td>%u</td><td>%u</td><td>%u</td>"
+                       "<td>%u</td><td>%" APR_UINT64_T_FMT "</td>"
+                       "<td>%" APR_UINT64_T_FMT "</td>"
+                       "<td>%" APR_UINT64_T_FMT "</td></tr>\n",
+                       log_ring_size, sum.high, sum.lines, sum.dropped,
+                       sum.stalls, sum.writes, sum.bytes, sum.errors);
+        }
+        else {
+            ap_rprintf(r, "LogRing%dName: %s\n"
+                       "LogRing%dLines: %u\n"
+                       "LogRing%dDropped: %u\n"
+                       "LogRing%dStalls: %u\n"
+                       "LogRing%dWrites: %" APR_UINT64_T_FMT "\n"
+                       "LogRing%dErrors: %" APR_UINT64_T_FMT "\n",
+                       i, array[i]->name,
+                       i, sum.lines,
+                       i, sum.dropped,
+                       i, sum.stalls,
+                       i, sum.writes,
+                       i, sum.errors);
+        }
+        ++n;
+    }
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rputs("</table>\n", r);
+    }
+    return OK;
+}
+#endif /* APR_HAS_THREADS */
+
+
+static int config_log_transaction(request_rec *r, config_log_state *cls,
+                                  apr_array_header_t *default_format)
+{
+    log_format_item *items;
+    const char **strs;
+    int *strl;
+    request_rec *orig;
+    int i;
+    apr_size_t len = 0;
+    apr_array_header_t *format;
+    char *envar;
+    apr_uint32_t schema_time = 0;
+    apr_status_t rv;
+
+    if (cls->fname == NULL) {
+        return DECLINED;
+    }
+
+    /*
+     * See if we've got any conditional envariable-controlled logging decisions
+     * to make.
+     */
+    if (cls->condition_var != NULL) {
+        envar = cls->condition_var;
+        if (*envar != '!') {
+            if (apr_table_get(r->subprocess_env, envar) == NULL) {
+                return DECLINED;
+            }
+        }
+        else {
+            if (apr_table_get(r->subprocess_env, &envar[1]) != NULL) {
+                return DECLINED;
+            }
+        }
+    }
+    else if (cls->condition_expr != NULL) {
+        const char *err;
+        int rc = ap_expr_exec(r, cls->condition_expr, &err);
+        if (rc < 0)
+            ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(00644)
+                           "Error evaluating log condition: %s", err);
+        if (rc <= 0)
+            return DECLINED;
+    }
+
+    if (!log_writer) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(00645)
+                "log writer isn't correctly setup");
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    format = cls->format ? cls->format : default_format;
+    items = (log_format_item *) format->elts;
+
+    orig = r;
+    while (orig->prev) {
+        orig = orig->prev;
+    }
+    while (r->next) {
+        r = r->next;
+    }
+
+    if (cls->encoding != LOG_ENCODING_TEXT
+        || log_writer == ap_default_log_writer
+        || log_writer == ap_buffered_log_writer) {
+        /* Our own writers take the line in one piece, format it into
+         * a buffer on the stack. */
+        char buf[LOG_LINE_SIZE];
+        log_line line;
+        const char *str;
+        int l;
+
+        line.buf = buf;
+        line.len = 0;
+        line.size = sizeof(buf);
+        line.pool = r->pool;
+        switch (cls->encoding) {
+        case LOG_ENCODING_JSON:
+            format_json(&line, r, orig, format);
+            break;
+        case LOG_ENCODING_BINARY:
+            /* A file can start anywhere (rotation) and the writes of
+             * concurrent requests can be reordered, so rather than once
+             * per child the schema goes with the first entry of every
+             * second, and only counts as written once that entry is.
+             */
+            schema_time = (apr_uint32_t)apr_time_sec(apr_time_now());
+            if (apr_atomic_read32(&cls->schema_time) != schema_time) {
+                log_line_add(&line, items[0].schema->record,
+                             items[0].schema->len);
+            }
+            else {
+                schema_time = 0;
+            }
+            format_binary(&line, r, orig, format);
+            break;
+        default:
+            for (i = 0; i < format->nelts; ++i) {
+                format_item(&line, r, orig, &items[i]);
+            }
+            break;
+        }
+        str = line.buf;
+        l = (int)line.len;
+        rv = log_writer(r, cls->log_writer, &str, &l, 1, line.len);
+        if (schema_time && rv == APR_SUCCESS) {
+            apr_atomic_set32(&cls->schema_time, schema_time);
+        }
+    }
+    else {
+        strs = apr_palloc(r->pool, sizeof(char *) * (format->nelts));
+        strl = apr_palloc(r->pool, sizeof(int) * (format->nelts));
+
+        for (i = 0; i < format->nelts; ++i) {
+            strs[i] = process_item(r, orig, &items[i]);
+        }
+
+        for (i = 0; i < format->nelts; ++i) {
+            len += strl[i] = strlen(strs[i]);
+        }
+        rv = log_writer(r, cls->log_writer, strs, strl, format->nelts, len);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_WARNING, rv, r, APLOGNO(00646)
+                      "Error writing to %s", cls->fname);
+    }
+    return OK;
+}
+
+static int multi_log_transaction(request_rec *r)
+{
+    multi_log_state *mls = ap_get_module_config(r->server->module_config,
                                                 &log_config_module);
     config_log_state *clsarray;
     int i;
@@ -1404,15 +2825,89 @@ static const char *add_global_log(cmd_parms *cmd, void *dummy, const char *fn,
     return ret;
 }
 
+/*
+ * CustomLog and GlobalLog: file format [env=...|expr=...] [encoding=...]
+ */
+static const char *custom_log_args(cmd_parms *cmd, void *dummy, int argc,
+                                   char *const argv[])
+{
+    multi_log_state *mls = ap_get_module_config(cmd->server->module_config,
+                                                &log_config_module);
+    const char *envclause = NULL;
+    const char *err;
+    config_log_state *cls;
+    int encoding = LOG_ENCODING_TEXT;
+    int i;
+
+    if (argc < 2 || argc > 4) {
+        return apr_pstrcat(cmd->pool, cmd->cmd->name,
+                           " takes two to four arguments", NULL);
+    }
+    for (i = 2; i < argc; ++i) {
+        if (!strncasecmp(argv[i], "encoding=", 9)) {
+            if (!strcasecmp(argv[i] + 9, "text")) {
+                encoding = LOG_ENCODING_TEXT;
+            }
+            else if (!strcasecmp(argv[i] + 9, "json")) {
+                encoding = LOG_ENCODING_JSON;
+            }
+            else if (!strcasecmp(argv[i] + 9, "binary")) {
+                encoding = LOG_ENCODING_BINARY;
+            }
+            else {
+                return "encoding must be text, json or binary";
+            }
+        }
+        else if (!envclause) {
+            envclause = argv[i];
+        }
+        else {
+            return "error in condition clause";
+        }
+    }
+
+    if (cmd->info) {
+        err = add_global_log(cmd, dummy, argv[0], argv[1], envclause);
+    }
+    else {
+        err = add_custom_log(cmd, dummy, argv[0], argv[1], envclause);
+    }
+    if (err == NULL) {
+        cls = &((config_log_state *)mls->config_logs->elts)
+                   [mls->config_logs->nelts - 1];
+        cls->encoding = encoding;
+    }
+    return err;
+}
+
 static const char *set_transfer_log(cmd_parms *cmd, void *dummy,
                                     const char *fn)
 {
     return add_custom_log(cmd, dummy, fn, NULL, NULL);
 }
 
-static const char *set_buffered_logs_on(cmd_parms *parms, void *dummy, int flag)
+static const char *set_buffered_logs(cmd_parms *parms, void *dummy,
+                                     const char *arg)
 {
-    buffered_logs = flag;
+    if (!strcasecmp(arg, "On")) {
+        buffered_logs = 1;
+        buffered_logs_async = 0;
+    }
+    else if (!strcasecmp(arg, "Async")) {
+#if APR_HAS_THREADS
+        buffered_logs = 1;
+        buffered_logs_async = 1;
+#else
+        return "BufferedLogs Async requires thread support";
+#endif
+    }
+    else if (!strcasecmp(arg, "Off")) {
+        buffered_logs = 0;
+        buffered_logs_async = 0;
+    }
+    else {
+        return "BufferedLogs must be On, Off or Async";
+    }
     if (buffered_logs) {
         ap_log_set_writer_init(ap_buffered_log_writer_init);
         ap_log_set_writer(ap_buffered_log_writer);
@@ -1423,19 +2918,62 @@ static const char *set_buffered_logs_on(cmd_parms *parms, void *dummy, int flag)
     }
     return NULL;
 }
+
+static const char *set_buffered_logs_size(cmd_parms *parms, void *dummy,
+                                          const char *arg)
+{
+    apr_off_t size;
+    apr_uint32_t bits = LOG_RING_MIN_SIZE;
+
+    if (apr_strtoff(&size, arg, NULL, 10) != APR_SUCCESS
+        || size < LOG_RING_MIN_SIZE || size > LOG_RING_MAX_SIZE) {
+        return apr_psprintf(parms->pool, "BufferedLogsSize must be between "
+                            "%d and %d bytes", LOG_RING_MIN_SIZE,
+                            LOG_RING_MAX_SIZE);
+    }
+    /* round up to a power of 2 */
+    while (bits < size) {
+        bits <<= 1;
+    }
+    log_ring_size = bits;
+    return NULL;
+}
+
+static const char *set_buffered_logs_overflow(cmd_parms *parms, void *dummy,
+                                              const char *arg)
+{
+    if (!strcasecmp(arg, "block")) {
+        log_ring_drop = 0;
+    }
+    else if (!strcasecmp(arg, "drop")) {
+        log_ring_drop = 1;
+    }
+    else {
+        return "BufferedLogsOverflow must be block or drop";
+    }
+    return NULL;
+}
+
 static const command_rec config_log_cmds[] =
 {
-AP_INIT_TAKE23("CustomLog", add_custom_log, NULL, RSRC_CONF,
+AP_INIT_TAKE_ARGV("CustomLog", custom_log_args, NULL, RSRC_CONF,
      "a file name, a custom log format string or format name, "
-     "and an optional \"env=\" or \"expr=\" clause (see docs)"),
-AP_INIT_TAKE23("GlobalLog", add_global_log, NULL, RSRC_CONF,
+     "an optional \"env=\" or \"expr=\" clause and an optional "
+     "\"encoding=\" of text, json or binary (see docs)"),
+AP_INIT_TAKE_ARGV("GlobalLog", custom_log_args, (void *)1, RSRC_CONF,
      "Same as CustomLog, but forces virtualhosts to inherit the log"),
 AP_INIT_TAKE1("TransferLog", set_transfer_log, NULL, RSRC_CONF,
      "the filename of the access log"),
 AP_INIT_TAKE12("LogFormat", log_format, NULL, RSRC_CONF,
      "a log format string (see docs) and an optional format name"),
-AP_INIT_FLAG("BufferedLogs", set_buffered_logs_on, NULL, RSRC_CONF,
-                 "Enable Buffered Logging (experimental)"),
+AP_INIT_TAKE1("BufferedLogs", set_buffered_logs, NULL, RSRC_CONF,
+                 "Enable Buffered Logging: On, Off or Async (experimental)"),
+AP_INIT_TAKE1("BufferedLogsSize", set_buffered_logs_size, NULL, RSRC_CONF,
+                 "Size in bytes of the per child ring buffer of each log "
+                 "with BufferedLogs Async"),
+AP_INIT_TAKE1("BufferedLogsOverflow", set_buffered_logs_overflow, NULL,
+                 RSRC_CONF, "What to do with a line when the ring buffer is "
+                 "full: block or drop"),
     {NULL}
 };
 
@@ -1554,6 +3092,7 @@ static apr_status_t flush_all_logs(void *data)
 
 static int init_config_log(apr_pool_t *pc, apr_pool_t *p, apr_pool_t *pt, server_rec *s)
 {
+    server_rec *main_server = s;
     int res;
 
     /* First init the buffered logs array, which is needed when opening the logs. */
@@ -1572,6 +3111,11 @@ static int init_config_log(apr_pool_t *pc, apr_pool_t *p, apr_pool_t *pt, server
         res = open_multi_logs(s, p);
     }
 
+#if APR_HAS_THREADS
+    if (res == OK && buffered_logs_async) {
+        log_ring_init_shared(p, main_server);
+    }
+#endif
     return res;
 }
 
@@ -1612,6 +3156,12 @@ static void init_child(apr_pool_t *p, server_rec *s)
                 this->mutex.type = apr_anylock_none;
             }
         }
+
+#if APR_HAS_THREADS
+        if (buffered_logs_async) {
+            log_ring_start(p, s);
+        }
+#endif
     }
 }
 
@@ -1649,20 +3199,25 @@ static apr_status_t ap_default_log_writer( request_rec *r,
 
 {
     default_log_writer *log_writer = handle;
-    char *str;
+    const char *str;
     char *s;
     int i;
     apr_status_t rv;
 
-    /*
-     * We do this memcpy dance because write() is atomic for len < PIPE_BUF,
-     * while writev() need not be.
-     */
-    str = apr_palloc(r->pool, len + 1);
+    if (nelts == 1) {
+        str = strs[0];
+    }
+    else {
+        /*
+         * We do this memcpy dance because write() is atomic for
+         * len < PIPE_BUF, while writev() need not be.
+         */
+        str = s = apr_palloc(r->pool, len + 1);
 
-    for (i = 0, s = str; i < nelts; ++i) {
-        memcpy(s, strs[i], strl[i]);
-        s += strl[i];
+        for (i = 0; i < nelts; ++i) {
+            memcpy(s, strs[i], strl[i]);
+            s += strl[i];
+        }
     }
 
     if (log_writer->type == LOG_WRITER_FD) {
@@ -1767,9 +3322,14 @@ static void *ap_buffered_log_writer_init(apr_pool_t *p, server_rec *s,
 {
     buffered_log *b;
     b = apr_pcalloc(p, sizeof(buffered_log));
-    b->handle = ap_default_log_writer_init(p, s, name);
+    b->name = name;
+    b->is_pipe = (*name == '|');
+    b->writer = ap_default_log_writer_init(p, s, name);
 
-    if (b->handle) {
+    if (b->writer) {
+        if (b->writer->type == LOG_WRITER_FD) {
+            b->handle = b->writer->log_writer;
+        }
         *(buffered_log **)apr_array_push(all_buffered_logs) = b;
         return b;
     }
@@ -1790,6 +3350,20 @@ static apr_status_t ap_buffered_log_writer(request_rec *r,
     apr_status_t rv;
     buffered_log *buf = (buffered_log*)handle;
 
+    if (!buf->handle) {
+        return ap_default_log_writer(r, buf->writer, strs, strl, nelts, len);
+    }
+#if APR_HAS_THREADS
+    if (buf->ring) {
+        rv = log_ring_put(buf, strs, strl, nelts, len);
+        if (rv == APR_ENOSPC) {
+            log_ring_flush(buf->ring);
+            rv = ap_default_log_writer(r, buf->writer, strs, strl, nelts, len);
+        }
+        return rv;
+    }
+#endif
+
     if ((rv = APR_ANYLOCK_LOCK(&buf->mutex)) != APR_SUCCESS) {
         return rv;
     }
@@ -1872,6 +3446,9 @@ static int log_pre_config(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp)
     ap_log_set_writer_init(ap_default_log_writer_init);
     ap_log_set_writer(ap_default_log_writer);
     buffered_logs = 0;
+    buffered_logs_async = 0;
+    log_ring_size = LOG_RING_DEFAULT_SIZE;
+    log_ring_drop = 0;
 
     return OK;
 }
@@ -1932,6 +3509,10 @@ static void register_hooks(apr_pool_t *p)
     ap_hook_child_init(init_child,NULL,NULL,APR_HOOK_MIDDLE);
     ap_hook_open_logs(init_config_log,NULL,NULL,APR_HOOK_MIDDLE);
     ap_hook_log_transaction(multi_log_transaction,NULL,NULL,APR_HOOK_MIDDLE);
+#if APR_HAS_THREADS
+    APR_OPTIONAL_HOOK(ap, status_hook, log_ring_status_hook, NULL, NULL,
+                      APR_HOOK_MIDDLE);
+#endif
 
     /* Init log_hash before we register the optional function. It is
      * possible for the optional function, ap_register_log_handler,
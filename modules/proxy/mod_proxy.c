@@ -23,6 +23,7 @@
 
 #if (MODULE_MAGIC_NUMBER_MAJOR > 20020903)
 #include "mod_ssl.h"
+#include "mod_watchdog.h"
 #else
 APR_DECLARE_OPTIONAL_FN(int, ssl_proxy_enable, (conn_rec *));
 APR_DECLARE_OPTIONAL_FN(int, ssl_engine_disable, (conn_rec *));
@@ -134,6 +135,25 @@ static const char *set_worker_param(apr_pool_t *p,
             return "TTL must be at least one second";
         worker->s->ttl = apr_time_from_sec(ival);
     }
+    else if (!strcasecmp(key, "addressttl")) {
+        /* Time to live of the worker's resolved backend address, it is
+         * looked up once only by default.
+         */
+        if (ap_timeout_parameter_parse(val, &timeout, "s") != APR_SUCCESS)
+            return "AddressTTL has wrong format";
+        if (timeout < apr_time_from_sec(1))
+            return "AddressTTL must be at least one second";
+        worker->s->address_ttl = timeout;
+        worker->s->address_ttl_set = 1;
+    }
+    else if (!strcasecmp(key, "warmup")) {
+        /* Number of connections to establish when the child starts
+         */
+        ival = atoi(val);
+        if (ival < 0)
+            return "Warmup must be a positive number";
+        worker->s->warmup = ival;
+    }
     else if (!strcasecmp(key, "min")) {
         /* Initial number of connections to remote
          */
@@ -1008,6 +1028,57 @@ static int proxy_needsdomain(request_rec *r, const char *url, const char *domain
 /* -------------------------------------------------------------- */
 /* Invoke handler */
 
+/* What is needed to finish a request whose scheme handler returned
+ * SUSPENDED, once it is done (see ap_proxy_suspended_done()).
+ */
+typedef struct {
+    proxy_worker *worker;
+    proxy_balancer *balancer;
+    proxy_server_conf *conf;
+    int attempts;
+} proxy_suspended_t;
+
+#define PROXY_SUSPENDED_KEY "proxy_handler_suspended"
+
+static int proxy_handler_done(request_rec *r, proxy_worker *worker,
+                              proxy_balancer *balancer,
+                              proxy_server_conf *conf, int attempts,
+                              int access_status)
+{
+    int saved_status;
+
+    /*
+     * Save current r->status and set it to the value of access_status which
+     * might be different (e.g. r->status could be HTTP_OK if e.g. we override
+     * the error page on the proxy or if the error was not generated by the
+     * backend itself but by the proxy e.g. a bad gateway) in order to give
+     * ap_proxy_post_request a chance to act correctly on the status code.
+     * But only do the above if access_status is not OK and not DONE, because
+     * in this case r->status might contain the true status and overwriting
+     * it with OK or DONE would be wrong.
+     */
+    if ((access_status != OK) && (access_status != DONE)) {
+        saved_status = r->status;
+        r->status = access_status;
+        ap_proxy_post_request(worker, balancer, r, conf);
+        /*
+         * Only restore r->status if it has not been changed by
+         * ap_proxy_post_request as we assume that this change was intentional.
+         */
+        if (r->status == access_status) {
+            r->status = saved_status;
+        }
+    }
+    else {
+        ap_proxy_post_request(worker, balancer, r, conf);
+    }
+
+    proxy_run_request_status(&access_status, r);
+    AP_PROXY_RUN_FINISHED(r, attempts, access_status);
+
+    return access_status;
+}
+
 static int proxy_handler(request_rec *r)
 {
     char *uri, *scheme, *p;
@@ -1025,7 +1096,6 @@ static int proxy_handler(request_rec *r)
     proxy_worker *worker = NULL;
     int attempts = 0, max_attempts = 0;
     struct dirconn_entry *list = (struct dirconn_entry *)conf->dirconn->elts;
-    int saved_status;
 
     /* is this for us? */
     if (!r->filename) {
@@ -1290,6 +1360,20 @@ static int proxy_handler(request_rec *r)
     } while (!PROXY_WORKER_IS_USABLE(worker) &&
              max_attempts > attempts++);
 
+    if (access_status == SUSPENDED) {
+        /* Still in flight, the scheme handler calls
+         * ap_proxy_suspended_done() when the response is complete.
+         */
+        proxy_suspended_t *susp = apr_palloc(r->pool, sizeof(*susp));
+
+        susp->worker = worker;
+        susp->balancer = balancer;
+        susp->conf = conf;
+        susp->attempts = attempts;
+        apr_pool_userdata_setn(susp, PROXY_SUSPENDED_KEY, NULL, r->pool);
+        return SUSPENDED;
+    }
+
     if (DECLINED == access_status) {
         ap_log_rerror(APLOG_MARK, APLOG_WARNING, 0, r, APLOGNO(01144)
                       "No protocol handler was valid for the URL %s " 
@@ -1301,36 +1385,22 @@ static int proxy_handler(request_rec *r)
         goto cleanup;
     }
 cleanup:
-    /*
-     * Save current r->status and set it to the value of access_status which
-     * might be different (e.g. r->status could be HTTP_OK if e.g. we override
-     * the error page on the proxy or if the error was not generated by the
-     * backend itself but by the proxy e.g. a bad gateway) in order to give
-     * ap_proxy_post_request a chance to act correctly on the status code.
-     * But only do the above if access_status is not OK and not DONE, because
-     * in this case r->status might contain the true status and overwriting
-     * it with OK or DONE would be wrong.
-     */
-    if ((access_status != OK) && (access_status != DONE)) {
-        saved_status = r->status;
-        r->status = access_status;
-        ap_proxy_post_request(worker, balancer, r, conf);
-        /*
-         * Only restore r->status if it has not been changed by
-         * ap_proxy_post_request as we assume that this change was intentional.
-         */
-        if (r->status == access_status) {
-            r->status = saved_status;
-        }
-    }
-    else {
-        ap_proxy_post_request(worker, balancer, r, conf);
-    }
+    return proxy_handler_done(r, worker, balancer, conf, attempts,
+                              access_status);
+}
 
-    proxy_run_request_status(&access_status, r);
-    AP_PROXY_RUN_FINISHED(r, attempts, access_status);
+PROXY_DECLARE(int) ap_proxy_suspended_done(request_rec *r, int status)
+{
+    proxy_suspended_t *susp = NULL;
 
-    return access_status;
+    apr_pool_userdata_get((void **)&susp, PROXY_SUSPENDED_KEY, r->pool);
+    if (!susp) {
+        return status;
+    }
+    apr_pool_userdata_setn(NULL, PROXY_SUSPENDED_KEY, NULL, r->pool);
+
+    return proxy_handler_done(r, susp->worker, susp->balancer, susp->conf,
+                              susp->attempts, status);
 }
 
 /* -------------------------------------------------------------- */
@@ -2784,6 +2854,100 @@ PROXY_DECLARE(const char *) ap_proxy_ssl_val(apr_pool_t *p, server_rec *s,
         return NULL;
 }
 
+/*
+ * Per child watchdog which warms up the workers (warmup=) when it starts,
+ * and then refreshes their cached addresses about to expire (addressttl=)
+ * so that requests never wait for DNS.
+ */
+#define PROXY_WATCHDOG_NAME "_proxy_workers_"
+#define PROXY_WATCHDOG_INTERVAL apr_time_from_sec(1)
+
+static void proxy_watchdog_worker(int state, proxy_worker *worker,
+                                  server_rec *s, apr_time_t now)
+{
+    apr_status_t rv;
+
+    if (!PROXY_WORKER_IS_INITIALIZED(worker)) {
+        return;
+    }
+    if (state == AP_WATCHDOG_STATE_STARTING) {
+        if (worker->s->warmup > 0) {
+            ap_proxy_warmup_worker("WARMUP", worker, s);
+        }
+    }
+    else if (worker->s->address_ttl > 0) {
+        rv = ap_proxy_refresh_address(worker, s, now);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10122)
+                         "refreshing the address of worker %s failed",
+                         ap_proxy_worker_name(NULL, worker));
+        }
+    }
+}
+
+static apr_status_t proxy_watchdog_callback(int state, void *data,
+                                            apr_pool_t *pool)
+{
+    server_rec *s;
+    apr_time_t now;
+
+    if (state == AP_WATCHDOG_STATE_STOPPING) {
+        return APR_SUCCESS;
+    }
+
+    now = apr_time_now();
+    for (s = data; s; s = s->next) {
+        proxy_server_conf *conf = ap_get_module_config(s->module_config,
+                                                       &proxy_module);
+        proxy_balancer *balancer;
+        proxy_worker *worker;
+        int i, n;
+
+        worker = (proxy_worker *)conf->workers->elts;
+        for (i = 0; i < conf->workers->nelts; i++, worker++) {
+            proxy_watchdog_worker(state, worker, s, now);
+        }
+        balancer = (proxy_balancer *)conf->balancers->elts;
+        for (i = 0; i < conf->balancers->nelts; i++, balancer++) {
+            proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+            for (n = 0; n < balancer->workers->nelts; n++) {
+                proxy_watchdog_worker(state, workers[n], s, now);
+            }
+        }
+    }
+    return APR_SUCCESS;
+}
+
+/* Whether some worker has an addressttl= or a warmup= */
+static int proxy_watchdog_needed(server_rec *s)
+{
+    for (; s; s = s->next) {
+        proxy_server_conf *conf = ap_get_module_config(s->module_config,
+                                                       &proxy_module);
+        proxy_balancer *balancer;
+        proxy_worker *worker;
+        int i, n;
+
+        worker = (proxy_worker *)conf->workers->elts;
+        for (i = 0; i < conf->workers->nelts; i++, worker++) {
+            if (worker->s->address_ttl > 0 || worker->s->warmup > 0) {
+                return 1;
+            }
+        }
+        balancer = (proxy_balancer *)conf->balancers->elts;
+        for (i = 0; i < conf->balancers->nelts; i++, balancer++) {
+            proxy_worker **workers = (proxy_worker **)balancer->workers->elts;
+            for (n = 0; n < balancer->workers->nelts; n++) {
+                if (workers[n]->s->address_ttl > 0
+                        || workers[n]->s->warmup > 0) {
+                    return 1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
 static int proxy_post_config(apr_pool_t *pconf, apr_pool_t *plog,
                              apr_pool_t *ptemp, server_rec *main_s)
 {
@@ -2804,6 +2968,36 @@ static int proxy_post_config(apr_pool_t *pconf, apr_pool_t *plog,
     ap_proxy_strmatch_path = apr_strmatch_precompile(pconf, "path=", 0);
     ap_proxy_strmatch_domain = apr_strmatch_precompile(pconf, "domain=", 0);
 
+    /* Without mod_watchdog, expired addresses are refreshed by requests
+     * and workers are not warmed up.
+     */
+    if (ap_state_query(AP_SQ_MAIN_STATE) != AP_SQ_MS_CREATE_PRE_CONFIG
+            && proxy_watchdog_needed(main_s)) {
+        APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
+        APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register;
+        wd_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+        wd_register = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+        if (wd_get_instance && wd_register) {
+            ap_watchdog_t *wd;
+            rv = wd_get_instance(&wd, PROXY_WATCHDOG_NAME, 0, 0, pconf);
+            if (rv == APR_SUCCESS) {
+                rv = wd_register(wd, PROXY_WATCHDOG_INTERVAL, main_s,
+                                 proxy_watchdog_callback);
+            }
+            if (rv != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_WARNING, rv, main_s, APLOGNO(10123)
+                             "failed to register the %s watchdog",
+                             PROXY_WATCHDOG_NAME);
+            }
+        }
+        else {
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, main_s, APLOGNO(10128)
+                         "mod_watchdog not loaded, proxy workers won't be "
+                         "warmed up nor their addresses refreshed ahead "
+                         "of time");
+        }
+    }
+
     for (; s; s = s->next) {
         int rc, i;
         proxy_server_conf *sconf =
@@ -3042,6 +3236,8 @@ static void register_hooks(apr_pool_t *p)
      */
     static const char *const aszPred[] = { "mpm_winnt.c", "mod_proxy_balancer.c",
                                            "mod_proxy_hcheck.c", NULL};
+    /* Watchdog instances must be created before mod_watchdog's post_config */
+    static const char *const aszWatchdog[] = { "mod_watchdog.c", NULL};
 
     /* handler */
     ap_hook_handler(proxy_handler, NULL, NULL, APR_HOOK_FIRST);
@@ -3056,7 +3252,7 @@ static void register_hooks(apr_pool_t *p)
     /* pre config handling */
     ap_hook_pre_config(proxy_pre_config, NULL, NULL, APR_HOOK_MIDDLE);
     /* post config handling */
-    ap_hook_post_config(proxy_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+    ap_hook_post_config(proxy_post_config, NULL, aszWatchdog, APR_HOOK_MIDDLE);
     /* child init handling */
     ap_hook_child_init(child_init, aszPred, NULL, APR_HOOK_MIDDLE);
 
@@ -108,6 +108,7 @@ typedef struct {
 typedef struct proxy_balancer  proxy_balancer;
 typedef struct proxy_worker    proxy_worker;
 typedef struct proxy_conn_pool proxy_conn_pool;
+typedef struct proxy_address proxy_address;
 typedef struct proxy_balancer_method proxy_balancer_method;
 
 /* static information about a remote proxy */
@@ -276,6 +277,7 @@ typedef struct {
                                 * and its scpool/bucket_alloc (NULL before),
                                 * must be left cleaned when used (locally).
                                 */
+    proxy_address *address;    /* Worker's cached address in use (if any) */
 } proxy_conn_rec;
 
 typedef struct {
@@ -283,12 +285,28 @@ typedef struct {
         int content_length; /* length of the content */
 } proxy_completion;
 
+/* Resolved backend address, cached by the worker and shared by its
+ * connections (refcounted, see ap_proxy_determine_address()).
+ */
+struct proxy_address {
+    apr_pool_t     *pool;       /* Own pool, destroyed with the last reference */
+    apr_sockaddr_t *addr;       /* Resolved address list */
+    const char     *hostname;   /* Resolved hostname */
+    apr_port_t      port;       /* Resolved port */
+    apr_uint32_t    refcount;   /* The worker and the connections using it */
+    apr_time_t      resolved;   /* When the lookup was done */
+    apr_time_t      expiry;     /* When to lookup again (0 for never) */
+};
+
 /* Connection pool */
 struct proxy_conn_pool {
     apr_pool_t     *pool;   /* The pool used in constructor and destructor calls */
     apr_sockaddr_t *addr;   /* Preparsed remote address info */
     apr_reslist_t  *res;    /* Connection resource list */
     proxy_conn_rec *conn;   /* Single connection for prefork mpm */
+    proxy_address  *address;/* Current cached address (addr above) */
+    apr_pool_t     *dns_pool;/* Parent pool of the cached addresses */
+    unsigned int    resolving:1; /* A lookup is in progress for address */
 };
 
 /* worker status bits */
@@ -452,6 +470,10 @@ typedef struct {
     unsigned int     is_name_matchable:1;
     char      secret[PROXY_WORKER_MAX_SECRET_SIZE]; /* authentication secret (e.g. AJP13) */
     char      upgrade[PROXY_WORKER_MAX_SCHEME_SIZE];/* upgrade protocol used by mod_proxy_wstunnel */
+    apr_interval_time_t address_ttl;    /* time to live of the cached address */
+    apr_time_t      address_changed;    /* last time a child saw it change */
+    unsigned int    address_ttl_set:1;
+    int             warmup;     /* number of connections established at startup */
 } proxy_worker_shared;
 
 #define ALIGNED_PROXY_WORKER_SHARED_SIZE (APR_ALIGN_DEFAULT(sizeof(proxy_worker_shared)))
@@ -912,6 +934,18 @@ PROXY_DECLARE(int) ap_proxy_post_request(proxy_worker *worker,
                                          request_rec *r,
                                          proxy_server_conf *conf);
 
+/**
+ * Finish a request whose scheme handler returned SUSPENDED
+ * @param r      current request
+ * @param status final status of the request (OK, DONE or HTTP_XXX)
+ * @return       status as possibly updated by the request_status hook
+ * @note Runs ap_proxy_post_request() and the request_status hook which
+ * the proxy handler skipped when the request was suspended. This must be
+ * called once the backend connection has been released, before the
+ * request is finalized with the returned status.
+ */
+PROXY_DECLARE(int) ap_proxy_suspended_done(request_rec *r, int status);
+
 /**
  * Determine backend hostname and port
  * @param p       memory pool used for processing
@@ -999,6 +1033,31 @@ PROXY_DECLARE(apr_status_t) ap_proxy_check_connection(const char *scheme,
                                                       unsigned max_blank_lines,
                                                       int flags);
 
+/**
+ * Refresh the worker's cached backend address when its addressttl= is about
+ * to expire; the requests continue to use the current address meanwhile.
+ * @param worker  worker whose address to refresh
+ * @param s       current server record
+ * @param now     current time
+ * @return        APR_SUCCESS or error on (un)locking the worker
+ * @note A failed DNS lookup keeps the current address until the next try.
+ */
+PROXY_DECLARE(apr_status_t) ap_proxy_refresh_address(proxy_worker *worker,
+                                                     server_rec *s,
+                                                     apr_time_t now);
+
+/**
+ * Establish the worker's warmup= connections (http and https workers only,
+ * including the TLS handshake) and release them to its connection pool.
+ * @param proxy_function calling proxy scheme (http, ajp, ...)
+ * @param worker  worker to warm up
+ * @param s       current server record
+ * @return        OK, or DECLINED if the worker can't be warmed up
+ */
+PROXY_DECLARE(int) ap_proxy_warmup_worker(const char *proxy_function,
+                                          proxy_worker *worker,
+                                          server_rec *s);
+
 /**
  * Make a connection to the backend
  * @param proxy_function calling proxy scheme (http, ajp, ...)
@@ -18,6 +18,7 @@
 #include "util_fcgi.h"
 #include "util_script.h"
 #include "ap_expr.h"
+#include "http_core.h"
 
 module AP_MODULE_DECLARE_DATA proxy_fcgi_module;
 
@@ -47,6 +48,8 @@ typedef enum {
 typedef struct {
     fcgi_backend_t backend_type;
     apr_array_header_t *env_fixups;
+    const char *sendfile_root;  /* X-Sendfile allowed below, NULL if off */
+    unsigned int sendfile_set:1;
 } fcgi_dirconf_t;
 
 /*
@@ -280,46 +283,98 @@ static apr_status_t get_data_full(proxy_conn_rec *conn,
     return APR_SUCCESS;
 }
 
-static apr_status_t send_begin_request(proxy_conn_rec *conn,
-                                       apr_uint16_t request_id)
+/* Maximum number of records written at once, each record being
+ * a header and (optionally) its content, so that we stay far below
+ * IOV_MAX.
+ */
+#define FCGI_BATCH_RECORDS 32
+
+/* FastCGI records to be written to the backend with a single
+ * apr_socket_sendv(), rather than one call per record.  The content
+ * of the records is not copied, so it must stay valid until the batch
+ * is sent.
+ */
+typedef struct {
+    struct iovec vec[FCGI_BATCH_RECORDS * 2];
+    unsigned char headers[FCGI_BATCH_RECORDS][AP_FCGI_HEADER_LEN];
+    int nvec;
+    int nrec;
+} fcgi_batch_t;
+
+static apr_status_t batch_send(proxy_conn_rec *conn, fcgi_batch_t *batch)
 {
-    struct iovec vec[2];
-    ap_fcgi_header header;
-    unsigned char farray[AP_FCGI_HEADER_LEN];
-    ap_fcgi_begin_request_body brb;
-    unsigned char abrb[AP_FCGI_HEADER_LEN];
+    apr_status_t rv = APR_SUCCESS;
     apr_size_t len;
 
-    ap_fcgi_fill_in_header(&header, AP_FCGI_BEGIN_REQUEST, request_id,
-                           sizeof(abrb), 0);
+    if (batch->nvec) {
+        rv = send_data(conn, batch->vec, batch->nvec, &len);
+    }
+    batch->nvec = batch->nrec = 0;
+
+    return rv;
+}
+
+/* Queue a record, sending the pending ones first if the batch is full. */
+static apr_status_t batch_add(proxy_conn_rec *conn, fcgi_batch_t *batch,
+                              unsigned char type, apr_uint16_t request_id,
+                              const void *content, apr_uint16_t clen)
+{
+    ap_fcgi_header header;
+    unsigned char *farray;
+
+    if (batch->nrec == FCGI_BATCH_RECORDS) {
+        apr_status_t rv = batch_send(conn, batch);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+    }
+
+    farray = batch->headers[batch->nrec++];
+    ap_fcgi_fill_in_header(&header, type, request_id, clen, 0);
+    ap_fcgi_header_to_array(&header, farray);
+
+    batch->vec[batch->nvec].iov_base = (void *)farray;
+    batch->vec[batch->nvec].iov_len = AP_FCGI_HEADER_LEN;
+    batch->nvec++;
+    if (clen) {
+        batch->vec[batch->nvec].iov_base = (void *)content;
+        batch->vec[batch->nvec].iov_len = clen;
+        batch->nvec++;
+    }
+
+    return APR_SUCCESS;
+}
+
+static apr_status_t add_begin_request(proxy_conn_rec *conn,
+                                      fcgi_batch_t *batch,
+                                      apr_pool_t *temp_pool,
+                                      apr_uint16_t request_id)
+{
+    ap_fcgi_begin_request_body brb;
+    unsigned char *abrb = apr_palloc(temp_pool, AP_FCGI_HEADER_LEN);
 
     ap_fcgi_fill_in_request_body(&brb, AP_FCGI_RESPONDER,
                                  ap_proxy_connection_reusable(conn)
                                      ? AP_FCGI_KEEP_CONN : 0);
-
-    ap_fcgi_header_to_array(&header, farray);
     ap_fcgi_begin_request_body_to_array(&brb, abrb);
 
-    vec[0].iov_base = (void *)farray;
-    vec[0].iov_len = sizeof(farray);
-    vec[1].iov_base = (void *)abrb;
-    vec[1].iov_len = sizeof(abrb);
-
-    return send_data(conn, vec, 2, &len);
+    return batch_add(conn, batch, AP_FCGI_BEGIN_REQUEST, request_id,
+                     abrb, AP_FCGI_HEADER_LEN);
 }
 
-static apr_status_t send_environment(proxy_conn_rec *conn, request_rec *r,
-                                     apr_pool_t *temp_pool,
-                                     apr_uint16_t request_id)
+/* Queue the environment as FCGI_PARAMS records, the caller sends them
+ * along with what precedes (FCGI_BEGIN_REQUEST).
+ */
+static apr_status_t add_environment(proxy_conn_rec *conn, request_rec *r,
+                                    fcgi_batch_t *batch,
+                                    apr_pool_t *temp_pool,
+                                    apr_uint16_t request_id)
 {
     const apr_array_header_t *envarr;
     const apr_table_entry_t *elts;
-    struct iovec vec[2];
-    ap_fcgi_header header;
-    unsigned char farray[AP_FCGI_HEADER_LEN];
     char *body;
     apr_status_t rv;
-    apr_size_t avail_len, len, required_len;
+    apr_size_t avail_len, required_len;
     int next_elem, starting_elem;
     fcgi_req_config_t *rconf = ap_get_module_config(r->request_config, &proxy_fcgi_module);
     fcgi_dirconf_t *dconf = ap_get_module_config(r->per_dir_config, &proxy_fcgi_module);
@@ -423,31 +478,91 @@ static apr_status_t send_environment(proxy_conn_rec *conn, request_rec *r,
         /* compute and encode must be in sync */
         ap_assert(starting_elem == next_elem);
 
-        ap_fcgi_fill_in_header(&header, AP_FCGI_PARAMS, request_id,
-                               (apr_uint16_t)required_len, 0);
-        ap_fcgi_header_to_array(&header, farray);
+        rv = batch_add(conn, batch, AP_FCGI_PARAMS, request_id,
+                       body, (apr_uint16_t)required_len);
+        if (rv) {
+            return rv;
+        }
+    }
+
+    /* Envvars queued, so say we're done */
+    return batch_add(conn, batch, AP_FCGI_PARAMS, request_id, NULL, 0);
+}
 
-        vec[0].iov_base = (void *)farray;
-        vec[0].iov_len = sizeof(farray);
-        vec[1].iov_base = body;
-        vec[1].iov_len = required_len;
+/* The record being read from the backend, possibly across several reads */
+typedef struct {
+    unsigned char header[AP_FCGI_HEADER_LEN];
+    apr_size_t header_len;      /* header bytes read so far */
+    unsigned char type;
+    apr_uint16_t clen;          /* content bytes still to read */
+    unsigned char plen;         /* padding bytes still to read */
+} fcgi_record_t;
 
-        rv = send_data(conn, vec, 2, &len);
-        apr_pool_clear(temp_pool);
+/*
+ * Fill BB with the file named by the X-Sendfile response header, if it
+ * lies below the ProxyFCGISendfile directory, so that the core output
+ * filter can sendfile() it instead of the application sending the body.
+ *
+ * Returns OK or the HTTP status to respond with.
+ */
+static int add_sendfile(request_rec *r, fcgi_dirconf_t *dconf,
+                        apr_bucket_brigade *bb)
+{
+    core_dir_config *coreconf = ap_get_core_module_config(r->per_dir_config);
+    const char *path = apr_table_get(r->headers_out, "X-Sendfile");
+    char *filename;
+    apr_file_t *fd;
+    apr_finfo_t finfo;
+    apr_bucket *e;
+    apr_status_t rv;
 
-        if (rv) {
-            return rv;
+    apr_table_unset(r->headers_out, "X-Sendfile");
+
+    rv = apr_filepath_merge(&filename, dconf->sendfile_root, path,
+                            APR_FILEPATH_SECUREROOT, r->pool);
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10114)
+                      "X-Sendfile '%s' is not below '%s'",
+                      path, dconf->sendfile_root);
+        return HTTP_FORBIDDEN;
+    }
+
+    rv = apr_file_open(&fd, filename, APR_READ | APR_BINARY
+#if APR_HAS_SENDFILE
+                       | AP_SENDFILE_ENABLED(coreconf->enable_sendfile)
+#endif
+                       , 0, r->pool);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_info_get(&finfo, APR_FINFO_NORM, fd);
+        if (rv == APR_SUCCESS && finfo.filetype != APR_REG) {
+            rv = APR_EBADF;
         }
     }
+    if (rv != APR_SUCCESS) {
+        ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(10115)
+                      "X-Sendfile '%s' can't be served", filename);
+        return HTTP_NOT_FOUND;
+    }
 
-    /* Envvars sent, so say we're done */
-    ap_fcgi_fill_in_header(&header, AP_FCGI_PARAMS, request_id, 0, 0);
-    ap_fcgi_header_to_array(&header, farray);
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r,
+                  "serving X-Sendfile '%s'", filename);
 
-    vec[0].iov_base = (void *)farray;
-    vec[0].iov_len = sizeof(farray);
+    ap_set_content_length(r, finfo.size);
+    if (!apr_table_get(r->headers_out, "Last-Modified")) {
+        ap_update_mtime(r, finfo.mtime);
+        ap_set_last_modified(r);
+    }
+
+    e = apr_brigade_insert_file(bb, fd, 0, finfo.size, r->pool);
+#if APR_HAS_MMAP
+    if (coreconf->enable_mmap == ENABLE_MMAP_OFF) {
+        (void)apr_bucket_file_enable_mmap(e, 0);
+    }
+#endif
+    e = apr_bucket_eos_create(r->connection->bucket_alloc);
+    APR_BRIGADE_INSERT_TAIL(bb, e);
 
-    return send_data(conn, vec, 1, &len);
+    return OK;
 }
 
 enum {
@@ -468,9 +583,24 @@ enum {
 static int handle_headers(request_rec *r, int *state,
                           const char *readbuf, apr_size_t readlen)
 {
-    const char *itr = readbuf;
+    const char *itr = readbuf, *end = readbuf + readlen;
+
+    while (itr < end) {
+        if (*state == HDR_STATE_READING_HEADERS) {
+            /* Within a header line, only the end of the line matters */
+            const char *lf = memchr(itr, '\n', end - itr);
+            if (!lf) {
+                if (end[-1] == '\r') {
+                    *state = HDR_STATE_GOT_CR;
+                }
+                return 0;
+            }
+            if (lf > itr && lf[-1] == '\r') {
+                *state = HDR_STATE_GOT_CR;
+            }
+            itr = lf;
+        }
 
-    while (readlen--) {
         if (*itr == '\r') {
             switch (*state) {
                 case HDR_STATE_GOT_CRLF:
@@ -518,9 +648,16 @@ static int handle_headers(request_rec *r, int *state,
     return 0;
 }
 
+/* FCGI_STDOUT contents up to this size are copied rather than passed as
+ * a sub-bucket of the read buffer, which they would keep alive while
+ * they are pending in ob or in the output filters.
+ */
+#define FCGI_STDOUT_COPY_MAX 1024
+
 static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
-                             request_rec *r, apr_pool_t *setaside_pool,
-                             apr_uint16_t request_id, const char **err,
+                             request_rec *r, fcgi_batch_t *batch,
+                             apr_uint16_t request_id,
+                             int stdin_sent, const char **err,
                              int *bad_request, int *has_responded)
 {
     apr_bucket_brigade *ib, *ob;
@@ -528,9 +665,9 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
     apr_status_t rv = APR_SUCCESS;
     int script_error_status = HTTP_OK;
     conn_rec *c = r->connection;
-    struct iovec vec[2];
-    ap_fcgi_header header;
-    unsigned char farray[AP_FCGI_HEADER_LEN];
+    fcgi_dirconf_t *fconf = ap_get_module_config(r->per_dir_config,
+                                                 &proxy_fcgi_module);
+    fcgi_record_t rec;
     apr_pollfd_t pfd;
     apr_pollfd_t *flushpoll = NULL;
     apr_int32_t flushpoll_fd;
@@ -538,8 +675,11 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
     char stack_iobuf[AP_IOBUFSIZE];
     apr_size_t iobuf_size = AP_IOBUFSIZE;
     char *iobuf = stack_iobuf;
+    apr_bucket *rb = NULL; /* heap bucket of the read buffer */
+    char *readbuf = NULL;
 
     *err = NULL;
+    memset(&rec, 0, sizeof(rec));
     if (conn->worker->s->io_buffer_size_set) {
         iobuf_size = conn->worker->s->io_buffer_size;
         iobuf = apr_palloc(r->pool, iobuf_size);
@@ -548,7 +688,7 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
     pfd.desc_type = APR_POLL_SOCKET;
     pfd.desc.s = conn->sock;
     pfd.p = r->pool;
-    pfd.reqevents = APR_POLLIN | APR_POLLOUT;
+    pfd.reqevents = stdin_sent ? APR_POLLIN : APR_POLLIN | APR_POLLOUT;
 
     if (conn->worker->s->flush_packets == flush_auto) {
         flushpoll = apr_pcalloc(r->pool, sizeof(apr_pollfd_t));
@@ -562,7 +702,6 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
 
     while (! done) {
         apr_interval_time_t timeout;
-        apr_size_t len;
         int n;
 
         /* We need SOME kind of timeout here, or virtually anything will
@@ -607,189 +746,272 @@ static apr_status_t dispatch(proxy_conn_rec *conn, proxy_dir_conf *conf,
                 break;
             }
 
+            /* Queue the data as FCGI_STDIN records, followed by the
+             * empty one signaling EOF if it's the last, and write them
+             * all at once.
+             */
             to_send = writebuflen;
             iobuf_cursor = iobuf;
             while (to_send > 0) {
-                int nvec = 0;
                 apr_size_t write_this_time;
 
                 write_this_time =
                     to_send < AP_FCGI_MAX_CONTENT_LEN ? to_send : AP_FCGI_MAX_CONTENT_LEN;
 
-                ap_fcgi_fill_in_header(&header, AP_FCGI_STDIN, request_id,
-                                       (apr_uint16_t)write_this_time, 0);
-                ap_fcgi_header_to_array(&header, farray);
-
-                vec[nvec].iov_base = (void *)farray;
-                vec[nvec].iov_len = sizeof(farray);
-                ++nvec;
-                if (writebuflen) {
-                    vec[nvec].iov_base = iobuf_cursor;
-                    vec[nvec].iov_len = write_this_time;
-                    ++nvec;
-                }
-
-                rv = send_data(conn, vec, nvec, &len);
+                rv = batch_add(conn, batch, AP_FCGI_STDIN, request_id,
+                               iobuf_cursor, (apr_uint16_t)write_this_time);
                 if (rv != APR_SUCCESS) {
-                    *err = "sending stdin";
                     break;
                 }
 
                 to_send -= write_this_time;
                 iobuf_cursor += write_this_time;
             }
-            if (rv != APR_SUCCESS) {
-                break;
-            }
-
-            if (last_stdin) {
+            if (rv == APR_SUCCESS && last_stdin) {
                 pfd.reqevents = APR_POLLIN; /* Done with input data */
 
                 /* signal EOF (empty FCGI_STDIN) */
-                ap_fcgi_fill_in_header(&header, AP_FCGI_STDIN, request_id,
-                                       0, 0);
-                ap_fcgi_header_to_array(&header, farray);
-
-                vec[0].iov_base = (void *)farray;
-                vec[0].iov_len = sizeof(farray);
-
-                rv = send_data(conn, vec, 1, &len);
-                if (rv != APR_SUCCESS) {
-                    *err = "sending empty stdin";
-                    break;
-                }
+                rv = batch_add(conn, batch, AP_FCGI_STDIN, request_id,
+                               NULL, 0);
+            }
+            if (rv == APR_SUCCESS) {
+                rv = batch_send(conn, batch);
+            }
+            if (rv != APR_SUCCESS) {
+                *err = "sending stdin";
+                break;
             }
         }
 
         if (pfd.rtnevents & APR_POLLIN) {
-            apr_size_t readbuflen;
-            apr_uint16_t clen, rid;
             apr_bucket *b;
-            unsigned char plen;
-            unsigned char type, version;
+            apr_size_t readlen, pos = 0;
             int mayflush = 0;
 
-            /* First, we grab the header... */
-            rv = get_data_full(conn, (char *) farray, AP_FCGI_HEADER_LEN);
+            /* Read whatever is available into the heap bucket rb; the
+             * STDOUT contents found there are passed on as sub-buckets
+             * of it, so they are not copied unless short.
+             */
+            if (!rb) {
+                readbuf = apr_bucket_alloc(iobuf_size, c->bucket_alloc);
+                rb = apr_bucket_heap_create(readbuf, iobuf_size,
+                                            apr_bucket_free, c->bucket_alloc);
+            }
+            readlen = iobuf_size;
+            rv = get_data(conn, readbuf, &readlen);
             if (rv != APR_SUCCESS) {
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01067)
-                              "Failed to read FastCGI header");
+                if (rec.header_len < AP_FCGI_HEADER_LEN) {
+                    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01067)
+                                  "Failed to read FastCGI header");
+                }
+                else {
+                    *err = "reading response body";
+                }
                 break;
             }
 
-            ap_log_rdata(APLOG_MARK, APLOG_TRACE8, r, "FastCGI header",
-                         farray, AP_FCGI_HEADER_LEN, 0);
+            while (pos < readlen && !done) {
+                apr_size_t n;
 
-            ap_fcgi_header_fields_from_array(&version, &type, &rid,
-                                             &clen, &plen, farray);
+                /* First, we grab the header... */
+                if (rec.header_len < AP_FCGI_HEADER_LEN) {
+                    unsigned char version;
+                    apr_uint16_t rid;
 
-            if (version != AP_FCGI_VERSION_1) {
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01068)
-                              "Got bogus version %d", (int)version);
-                rv = APR_EINVAL;
-                break;
-            }
+                    n = AP_FCGI_HEADER_LEN - rec.header_len;
+                    if (n > readlen - pos) {
+                        n = readlen - pos;
+                    }
+                    memcpy(rec.header + rec.header_len, readbuf + pos, n);
+                    rec.header_len += n;
+                    pos += n;
+                    if (rec.header_len < AP_FCGI_HEADER_LEN) {
+                        break;
+                    }
 
-            if (rid != request_id) {
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01069)
-                              "Got bogus rid %d, expected %d",
-                              rid, request_id);
-                rv = APR_EINVAL;
-                break;
-            }
+                    ap_log_rdata(APLOG_MARK, APLOG_TRACE8, r, "FastCGI header",
+                                 rec.header, AP_FCGI_HEADER_LEN, 0);
 
-recv_again:
-            if (clen > iobuf_size) {
-                readbuflen = iobuf_size;
-            } else {
-                readbuflen = clen;
-            }
+                    ap_fcgi_header_fields_from_array(&version, &rec.type, &rid,
+                                                     &rec.clen, &rec.plen,
+                                                     rec.header);
 
-            /* Now get the actual data.  Yes it sucks to do this in a second
-             * recv call, this will eventually change when we move to real
-             * nonblocking recv calls. */
-            if (readbuflen != 0) {
-                rv = get_data(conn, iobuf, &readbuflen);
-                if (rv != APR_SUCCESS) {
-                    *err = "reading response body";
-                    break;
-                }
-            }
+                    if (version != AP_FCGI_VERSION_1) {
+                        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01068)
+                                      "Got bogus version %d", (int)version);
+                        rv = APR_EINVAL;
+                        break;
+                    }
 
-            switch (type) {
-            case AP_FCGI_STDOUT:
-                if (clen != 0) {
-                    b = apr_bucket_transient_create(iobuf,
-                                                    readbuflen,
-                                                    c->bucket_alloc);
+                    if (rid != request_id) {
+                        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01069)
+                                      "Got bogus rid %d, expected %d",
+                                      rid, request_id);
+                        rv = APR_EINVAL;
+                        break;
+                    }
 
-                    APR_BRIGADE_INSERT_TAIL(ob, b);
+                    switch (rec.type) {
+                    case AP_FCGI_STDOUT:
+                    case AP_FCGI_STDERR:
+                    case AP_FCGI_END_REQUEST:
+                        break;
 
-                    if (! seen_end_of_headers) {
-                        int st = handle_headers(r, &header_state,
-                                                iobuf, readbuflen);
+                    default:
+                        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01072)
+                                      "Got bogus record %d", rec.type);
+                        break;
+                    }
 
-                        if (st == 1) {
-                            int status;
-                            seen_end_of_headers = 1;
+                    if (rec.type == AP_FCGI_STDOUT && rec.clen == 0) {
+                        /* XXX what if we haven't seen end of the headers yet? */
 
-                            status = ap_scan_script_header_err_brigade_ex(r, ob,
-                                NULL, APLOG_MODULE_INDEX);
-                            /* suck in all the rest */
-                            if (status != OK) {
-                                apr_bucket *tmp_b;
-                                apr_brigade_cleanup(ob);
-                                tmp_b = apr_bucket_eos_create(c->bucket_alloc);
-                                APR_BRIGADE_INSERT_TAIL(ob, tmp_b);
+                        if (script_error_status == HTTP_OK && !ignore_body) {
+                            b = apr_bucket_eos_create(c->bucket_alloc);
+                            APR_BRIGADE_INSERT_TAIL(ob, b);
 
-                                *has_responded = 1;
-                                r->status = status;
-                                rv = ap_pass_brigade(r->output_filters, ob);
-                                if (rv != APR_SUCCESS) {
-                                    *err = "passing headers brigade to output filters";
-                                    break;
+                            *has_responded = 1;
+                            rv = ap_pass_brigade(r->output_filters, ob);
+                            if (rv != APR_SUCCESS) {
+                                *err = "passing brigade to output filters";
+                                break;
+                            }
+                        }
+
+                        /* XXX Why don't we cleanup here?  (logic from AJP) */
+                    }
+                }
+
+                /* ...then the actual data... */
+                else if (rec.clen) {
+                    const char *data = readbuf + pos;
+
+                    n = rec.clen;
+                    if (n > readlen - pos) {
+                        n = readlen - pos;
+                    }
+                    rec.clen -= n;
+                    pos += n;
+
+                    switch (rec.type) {
+                    case AP_FCGI_STDOUT:
+                        if (n <= FCGI_STDOUT_COPY_MAX) {
+                            b = apr_bucket_heap_create(data, n, NULL,
+                                                       c->bucket_alloc);
+                        }
+                        else {
+                            apr_bucket_copy(rb, &b);
+                            b->start += data - readbuf;
+                            b->length = n;
+                        }
+                        APR_BRIGADE_INSERT_TAIL(ob, b);
+
+                        if (! seen_end_of_headers) {
+                            int st = handle_headers(r, &header_state,
+                                                    data, n);
+
+                            if (st == 1) {
+                                int status;
+                                seen_end_of_headers = 1;
+
+                                status = ap_scan_script_header_err_brigade_ex(r, ob,
+                                    NULL, APLOG_MODULE_INDEX);
+                                /* suck in all the rest */
+                                if (status != OK) {
+                                    apr_bucket *tmp_b;
+                                    apr_brigade_cleanup(ob);
+                                    tmp_b = apr_bucket_eos_create(c->bucket_alloc);
+                                    APR_BRIGADE_INSERT_TAIL(ob, tmp_b);
+
+                                    *has_responded = 1;
+                                    r->status = status;
+                                    rv = ap_pass_brigade(r->output_filters, ob);
+                                    if (rv != APR_SUCCESS) {
+                                        *err = "passing headers brigade to output filters";
+                                        break;
+                                    }
+                                    else if (status == HTTP_NOT_MODIFIED
+                                             || status == HTTP_PRECONDITION_FAILED) {
+                                        /* Special 'status' cases handled:
+                                         * 1) HTTP 304 response MUST NOT contain
+                                         *    a message-body, ignore it.
+                                         * 2) HTTP 412 response.
+                                         * The break is not added since there might
+                                         * be more bytes to read from the FCGI
+                                         * connection. Even if the message-body is
+                                         * ignored (and the EOS bucket has already
+                                         * been sent) we want to avoid subsequent
+                                         * bogus reads. */
+                                        ignore_body = 1;
+                                    }
+                                    else {
+                                        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01070)
+                                                        "Error parsing script headers");
+                                        rv = APR_EINVAL;
+                                        break;
+                                    }
                                 }
-                                else if (status == HTTP_NOT_MODIFIED
-                                         || status == HTTP_PRECONDITION_FAILED) {
-                                    /* Special 'status' cases handled:
-                                     * 1) HTTP 304 response MUST NOT contain
-                                     *    a message-body, ignore it.
-                                     * 2) HTTP 412 response.
-                                     * The break is not added since there might
-                                     * be more bytes to read from the FCGI
-                                     * connection. Even if the message-body is
-                                     * ignored (and the EOS bucket has already
-                                     * been sent) we want to avoid subsequent
-                                     * bogus reads. */
-                                    ignore_body = 1;
+
+                                if (conf->error_override
+                                    && ap_is_HTTP_ERROR(r->status) && ap_is_initial_req(r)) {
+                                    /*
+                                     * set script_error_status to discard
+                                     * everything after the headers
+                                     */
+                                    script_error_status = r->status;
+                                    /*
+                                     * prevent ap_die() from treating this as a
+                                     * recursive error, initially:
+                                     */
+                                    r->status = HTTP_OK;
                                 }
-                                else {
-                                    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01070)
-                                                    "Error parsing script headers");
-                                    rv = APR_EINVAL;
-                                    break;
+
+                                if (script_error_status == HTTP_OK && !ignore_body
+                                    && fconf->sendfile_root
+                                    && apr_table_get(r->headers_out, "X-Sendfile")) {
+                                    /* Replace whatever the application sends
+                                     * by the file it designates.
+                                     */
+                                    apr_brigade_cleanup(ob);
+                                    status = add_sendfile(r, fconf, ob);
+                                    if (status != OK) {
+                                        script_error_status = status;
+                                    }
+                                    else {
+                                        *has_responded = 1;
+                                        rv = ap_pass_brigade(r->output_filters, ob);
+                                        if (rv != APR_SUCCESS) {
+                                            *err = "passing file brigade to output filters";
+                                            break;
+                                        }
+                                    }
+                                    ignore_body = 1;
                                 }
-                            }
 
-                            if (conf->error_override
-                                && ap_is_HTTP_ERROR(r->status) && ap_is_initial_req(r)) {
-                                /*
-                                 * set script_error_status to discard
-                                 * everything after the headers
-                                 */
-                                script_error_status = r->status;
-                                /*
-                                 * prevent ap_die() from treating this as a
-                                 * recursive error, initially:
-                                 */
-                                r->status = HTTP_OK;
+                                if (script_error_status == HTTP_OK
+                                    && !APR_BRIGADE_EMPTY(ob) && !ignore_body) {
+                                    /* Send the part of the body that we read while
+                                     * reading the headers.
+                                     */
+                                    *has_responded = 1;
+                                    rv = ap_pass_brigade(r->output_filters, ob);
+                                    if (rv != APR_SUCCESS) {
+                                        *err = "passing brigade to output filters";
+                                        break;
+                                    }
+                                    mayflush = 1;
+                                }
+                                apr_brigade_cleanup(ob);
                             }
-
-                            if (script_error_status == HTTP_OK
-                                && !APR_BRIGADE_EMPTY(ob) && !ignore_body) {
-                                /* Send the part of the body that we read while
-                                 * reading the headers.
-                                 */
+                            /* else we're still looking for the end of the
+                             * headers, what we have so far stays in ob (the
+                             * buckets hold a reference on the read buffer).
+                             */
+                        } else {
+                            /* we've already passed along the headers, so now
+                             * pass through the content (by reference).
+                             */
+                            if (script_error_status == HTTP_OK && !ignore_body) {
                                 *has_responded = 1;
                                 rv = ap_pass_brigade(r->output_filters, ob);
                                 if (rv != APR_SUCCESS) {
@@ -799,96 +1021,58 @@ recv_again:
                                 mayflush = 1;
                             }
                             apr_brigade_cleanup(ob);
-
-                            apr_pool_clear(setaside_pool);
                         }
-                        else {
-                            /* We're still looking for the end of the
-                             * headers, so this part of the data will need
-                             * to persist. */
-                            apr_bucket_setaside(b, setaside_pool);
-                        }
-                    } else {
-                        /* we've already passed along the headers, so now pass
-                         * through the content.  we could simply continue to
-                         * setaside the content and not pass until we see the
-                         * 0 content-length (below, where we append the EOS),
-                         * but that could be a huge amount of data; so we pass
-                         * along smaller chunks
-                         */
-                        if (script_error_status == HTTP_OK && !ignore_body) {
-                            *has_responded = 1;
-                            rv = ap_pass_brigade(r->output_filters, ob);
-                            if (rv != APR_SUCCESS) {
-                                *err = "passing brigade to output filters";
-                                break;
-                            }
-                            mayflush = 1;
-                        }
-                        apr_brigade_cleanup(ob);
-                    }
-
-                    /* If we didn't read all the data, go back and get the
-                     * rest of it. */
-                    if (clen > readbuflen) {
-                        clen -= readbuflen;
-                        goto recv_again;
-                    }
-                } else {
-                    /* XXX what if we haven't seen end of the headers yet? */
+                        break;
 
-                    if (script_error_status == HTTP_OK) {
-                        b = apr_bucket_eos_create(c->bucket_alloc);
-                        APR_BRIGADE_INSERT_TAIL(ob, b);
+                    case AP_FCGI_STDERR:
+                        /* TODO: Should probably clean up this logging a bit... */
+                        ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01071)
+                                      "Got error '%.*s'", (int)n, data);
+                        break;
 
-                        *has_responded = 1;
-                        rv = ap_pass_brigade(r->output_filters, ob);
-                        if (rv != APR_SUCCESS) {
-                            *err = "passing brigade to output filters";
-                            break;
-                        }
+                    default:
+                        /* END_REQUEST body, or unknown record's */
+                        break;
                     }
-
-                    /* XXX Why don't we cleanup here?  (logic from AJP) */
                 }
-                break;
 
-            case AP_FCGI_STDERR:
-                /* TODO: Should probably clean up this logging a bit... */
-                if (clen) {
-                    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01071)
-                                  "Got error '%.*s'", (int)readbuflen, iobuf);
+                /* ...and skip the padding. */
+                else {
+                    n = rec.plen;
+                    if (n > readlen - pos) {
+                        n = readlen - pos;
+                    }
+                    rec.plen -= n;
+                    pos += n;
                 }
 
-                if (clen > readbuflen) {
-                    clen -= readbuflen;
-                    goto recv_again;
+                /* Leave on above inner error. */
+                if (rv != APR_SUCCESS) {
+                    break;
                 }
-                break;
 
-            case AP_FCGI_END_REQUEST:
-                done = 1;
-                break;
+                /* Done with this record? */
+                if (!rec.clen && !rec.plen) {
+                    if (rec.type == AP_FCGI_END_REQUEST) {
+                        done = 1;
+                    }
+                    rec.header_len = 0;
+                }
+            }
 
-            default:
-                ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(01072)
-                              "Got bogus record %d", type);
-                break;
+            /* Read into the same buffer next time if no sub-bucket of it
+             * is left, otherwise those passed on (or still in ob) keep it
+             * alive as long as needed and a new one is allocated.
+             */
+            if (((apr_bucket_heap *)rb->data)->refcount.refcount > 1) {
+                apr_bucket_destroy(rb);
+                rb = NULL;
             }
-            /* Leave on above switch's inner error. */
+
             if (rv != APR_SUCCESS) {
                 break;
             }
 
-            if (plen) {
-                rv = get_data_full(conn, iobuf, plen);
-                if (rv != APR_SUCCESS) {
-                    ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02537)
-                                  "Error occurred reading padding");
-                    break;
-                }
-            }
-
             if (((conn->worker->s->flush_packets == flush_on) ||
                  ((conn->worker->s->flush_packets == flush_auto) && 
                   (apr_poll(flushpoll, 1, &flushpoll_fd,
@@ -905,6 +1089,9 @@ recv_again:
         }
     }
 
+    if (rb) {
+        apr_bucket_destroy(rb);
+    }
     apr_brigade_destroy(ib);
     apr_brigade_destroy(ob);
 
@@ -934,12 +1121,17 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
     apr_uint16_t request_id = 1;
     apr_status_t rv;
     apr_pool_t *temp_pool;
+    fcgi_batch_t *batch;
     const char *err;
     int bad_request = 0,
-        has_responded = 0;
+        has_responded = 0,
+        stdin_sent = 0;
+
+    apr_pool_create(&temp_pool, r->pool);
+    batch = apr_pcalloc(r->pool, sizeof(*batch));
 
-    /* Step 1: Send AP_FCGI_BEGIN_REQUEST */
-    rv = send_begin_request(conn, request_id);
+    /* Step 1: Queue AP_FCGI_BEGIN_REQUEST */
+    rv = add_begin_request(conn, batch, temp_pool, request_id);
     if (rv != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01073)
                       "Failed Writing Request to %s:", server_portstr);
@@ -947,10 +1139,17 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
         return HTTP_SERVICE_UNAVAILABLE;
     }
 
-    apr_pool_create(&temp_pool, r->pool);
-
-    /* Step 2: Send Environment via FCGI_PARAMS */
-    rv = send_environment(conn, r, temp_pool, request_id);
+    /* Step 2: Send it along with the Environment via FCGI_PARAMS, and
+     * the end of FCGI_STDIN already if there is no request body */
+    rv = add_environment(conn, r, batch, temp_pool, request_id);
+    if (rv == APR_SUCCESS && !ap_request_has_body(r)) {
+        rv = batch_add(conn, batch, AP_FCGI_STDIN, request_id, NULL, 0);
+        stdin_sent = 1;
+    }
+    if (rv == APR_SUCCESS) {
+        rv = batch_send(conn, batch);
+    }
+    apr_pool_clear(temp_pool);
     if (rv != APR_SUCCESS) {
         ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01074)
                       "Failed writing Environment to %s:", server_portstr);
@@ -959,7 +1158,7 @@ static int fcgi_do_request(apr_pool_t *p, request_rec *r,
     }
 
     /* Step 3: Read records from the back end server and handle them. */
-    rv = dispatch(conn, conf, r, temp_pool, request_id,
+    rv = dispatch(conn, conf, r, batch, request_id, stdin_sent,
                   &err, &bad_request, &has_responded);
     if (rv != APR_SUCCESS) {
         /* If the client aborted the connection during retrieval or (partially)
@@ -1104,6 +1303,9 @@ static void *fcgi_merge_dconf(apr_pool_t *p, void *basev, void *overridesv)
                       ? over->backend_type
                       : base->backend_type;
     a->env_fixups = apr_array_append(p, base->env_fixups, over->env_fixups);
+    a->sendfile_root = over->sendfile_set ? over->sendfile_root
+                                          : base->sendfile_root;
+    a->sendfile_set = over->sendfile_set || base->sendfile_set;
     return a;
 }
 
@@ -1175,6 +1377,27 @@ static const char *cmd_setenv(cmd_parms *cmd, void *in_dconf,
 
     return NULL;
 }
+
+static const char *cmd_sendfile(cmd_parms *cmd, void *in_dconf,
+                                const char *val)
+{
+    fcgi_dirconf_t *dconf = in_dconf;
+
+    if (!strcasecmp(val, "off")) {
+        dconf->sendfile_root = NULL;
+    }
+    else {
+        dconf->sendfile_root = ap_server_root_relative(cmd->pool, val);
+        if (!dconf->sendfile_root) {
+            return apr_pstrcat(cmd->pool, "ProxyFCGISendfile: invalid path ",
+                               val, NULL);
+        }
+    }
+    dconf->sendfile_set = 1;
+
+    return NULL;
+}
+
 static void register_hooks(apr_pool_t *p)
 {
     proxy_hook_scheme_handler(proxy_fcgi_handler, NULL, NULL, APR_HOOK_FIRST);
@@ -1186,6 +1409,10 @@ static const command_rec command_table[] = {
                   "Specify the type of FastCGI server: 'Generic', 'FPM'"),
     AP_INIT_TAKE23("ProxyFCGISetEnvIf", cmd_setenv, NULL, OR_FILEINFO,
                   "expr-condition env-name expr-value"),
+    AP_INIT_TAKE1("ProxyFCGISendfile", cmd_sendfile, NULL,
+                  RSRC_CONF|ACCESS_CONF,
+                  "Directory below which files named by the application's "
+                  "X-Sendfile header are served, or 'Off' (default)"),
     { NULL }
 };
 
@@ -18,6 +18,7 @@
 
 #include "mod_proxy.h"
 #include "ap_regex.h"
+#include "ap_mpm.h"
 
 module AP_MODULE_DECLARE_DATA proxy_http_module;
 
@@ -28,6 +29,40 @@ static apr_status_t ap_proxy_http_cleanup(const char *scheme,
                                           request_rec *r,
                                           proxy_conn_rec *backend);
 
+typedef struct {
+    int mpm_can_poll;
+    apr_interval_time_t async_delay;    /* < 0 disables going async */
+    apr_interval_time_t idle_timeout;   /* < 0 uses the backend's timeout */
+    unsigned int async_delay_set:1,
+                 idle_timeout_set:1;
+} proxy_http_dir_conf;
+
+typedef enum {
+    PROXY_HTTP_REQ_WAIT_HEADERS = 0,
+    PROXY_HTTP_REQ_STREAM_BODY
+} proxy_http_state_e;
+
+/* State of a request being proxied, which outlives the handler when
+ * the request is suspended while the backend is not readable.
+ */
+typedef struct {
+    request_rec *r;
+    proxy_worker *worker;
+    proxy_server_conf *sconf;
+    proxy_conn_rec *backend;
+    const char *proxy_function;
+    char *server_portstr;
+    apr_bucket_brigade *bb;
+    apr_bucket_brigade *pass_bb;
+    apr_pool_t *async_pool;     /* cleared before each suspend, destroyed
+                                 * once the response is done */
+    apr_interval_time_t async_delay;
+    apr_interval_time_t idle_timeout;
+    proxy_http_state_e state;
+    unsigned int can_go_async:1,
+                 backend_broke:1;
+} proxy_http_req_t;
+
 /*
  * Canonicalise http-like URLs.
  *  scheme is the scheme for the URL
@@ -1240,24 +1275,68 @@ static int add_trailers(void *data, const char *key, const char *val)
     return 1;
 }
 
+/*
+ * Whether the backend has something for us within the given timeout,
+ * either already read by its input filters or pending on the socket.
+ */
+static int proxy_http_backend_readable(proxy_http_req_t *req,
+                                       apr_interval_time_t timeout)
+{
+    proxy_conn_rec *backend = req->backend;
+    apr_bucket_brigade *tmp_bb = backend->tmp_bb;
+    apr_pollfd_t pfd;
+    apr_int32_t nfds;
+    apr_status_t rv;
+
+    if (backend->connection) {
+        int pending;
+
+        apr_brigade_cleanup(tmp_bb);
+        rv = ap_get_brigade(backend->connection->input_filters, tmp_bb,
+                            AP_MODE_SPECULATIVE, APR_NONBLOCK_READ, 1);
+        pending = !APR_BRIGADE_EMPTY(tmp_bb);
+        apr_brigade_cleanup(tmp_bb);
+        if (rv != APR_SUCCESS && !APR_STATUS_IS_EAGAIN(rv)) {
+            /* Let the caller handle the error (EOF, reset...) */
+            return 1;
+        }
+        if (pending) {
+            return 1;
+        }
+    }
+
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.p = req->r->pool;
+    pfd.desc_type = APR_POLL_SOCKET;
+    pfd.reqevents = APR_POLLIN;
+    pfd.desc.s = backend->sock;
+    do {
+        rv = apr_poll(&pfd, 1, &nfds, timeout);
+    } while (APR_STATUS_IS_EINTR(rv));
+
+    return !APR_STATUS_IS_TIMEUP(rv);
+}
+
+static int stream_response_body(proxy_http_req_t *req);
+
 static
 int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
-        proxy_conn_rec **backend_ptr, proxy_worker *worker,
-        proxy_server_conf *conf, char *server_portstr)
+                                   proxy_http_req_t *req)
 {
     conn_rec *c = r->connection;
+    proxy_worker *worker = req->worker;
+    proxy_server_conf *conf = req->sconf;
+    char *server_portstr = req->server_portstr;
     char buffer[HUGE_STRING_LEN];
     const char *buf;
     char keepchar;
     apr_bucket *e;
     apr_bucket_brigade *bb;
-    apr_bucket_brigade *pass_bb;
     int len, backasswards;
     int interim_response = 0; /* non-zero whilst interim 1xx responses
                                * are being read. */
     int pread_len = 0;
     apr_table_t *save_table;
-    int backend_broke = 0;
     static const char *hop_by_hop_hdrs[] =
         {"Keep-Alive", "Proxy-Authenticate", "TE", "Trailer", "Upgrade", NULL};
     int i;
@@ -1266,7 +1345,7 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
     int proxy_status = OK;
     const char *original_status_line = r->status_line;
     const char *proxy_status_line = NULL;
-    proxy_conn_rec *backend = *backend_ptr;
+    proxy_conn_rec *backend = req->backend;
     conn_rec *origin = backend->connection;
     apr_interval_time_t old_timeout = 0;
     proxy_dir_conf *dconf;
@@ -1276,8 +1355,8 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
 
     do_100_continue = PROXY_DO_100_CONTINUE(worker, r);
 
-    bb = apr_brigade_create(p, c->bucket_alloc);
-    pass_bb = apr_brigade_create(p, c->bucket_alloc);
+    bb = req->bb = apr_brigade_create(p, c->bucket_alloc);
+    req->pass_bb = apr_brigade_create(p, c->bucket_alloc);
 
     /* Setup for 100-Continue timeout if appropriate */
     if (do_100_continue) {
@@ -1705,9 +1784,7 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
              * of the page into the brigade
              */
             if (!dconf->error_override || !ap_is_HTTP_ERROR(proxy_status)) {
-                /* read the body, pass it to the output filters */
-                apr_read_type_e mode = APR_NONBLOCK_READ;
-                int finish = FALSE;
+                int status;
 
                 /* Handle the case where the error document is itself reverse
                  * proxied and was successful. We must maintain any previous
@@ -1720,146 +1797,11 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
                     r->status_line = original_status_line;
                 }
 
-                do {
-                    apr_off_t readbytes;
-                    apr_status_t rv;
-
-                    rv = ap_get_brigade(backend->r->input_filters, bb,
-                                        AP_MODE_READBYTES, mode,
-                                        conf->io_buffer_size);
-
-                    /* ap_get_brigade will return success with an empty brigade
-                     * for a non-blocking read which would block: */
-                    if (mode == APR_NONBLOCK_READ
-                        && (APR_STATUS_IS_EAGAIN(rv)
-                            || (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb)))) {
-                        /* flush to the client and switch to blocking mode */
-                        e = apr_bucket_flush_create(c->bucket_alloc);
-                        APR_BRIGADE_INSERT_TAIL(bb, e);
-                        if (ap_pass_brigade(r->output_filters, bb)
-                            || c->aborted) {
-                            backend->close = 1;
-                            break;
-                        }
-                        apr_brigade_cleanup(bb);
-                        mode = APR_BLOCK_READ;
-                        continue;
-                    }
-                    else if (rv == APR_EOF) {
-                        backend->close = 1;
-                        break;
-                    }
-                    else if (rv != APR_SUCCESS) {
-                        if (rv == APR_ENOSPC) {
-                            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02475)
-                                          "Response chunk/line was too large to parse");
-                        }
-                        else if (rv == APR_ENOTIMPL) {
-                            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02476)
-                                          "Response Transfer-Encoding was not recognised");
-                        }
-                        else {
-                            ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01110)
-                                          "Network error reading response");
-                        }
-
-                        /* In this case, we are in real trouble because
-                         * our backend bailed on us. Given we're half way
-                         * through a response, our only option is to
-                         * disconnect the client too.
-                         */
-                        e = ap_bucket_error_create(HTTP_GATEWAY_TIME_OUT, NULL,
-                                r->pool, c->bucket_alloc);
-                        APR_BRIGADE_INSERT_TAIL(bb, e);
-                        e = ap_bucket_eoc_create(c->bucket_alloc);
-                        APR_BRIGADE_INSERT_TAIL(bb, e);
-                        ap_pass_brigade(r->output_filters, bb);
-
-                        backend_broke = 1;
-                        backend->close = 1;
-                        break;
-                    }
-                    /* next time try a non-blocking read */
-                    mode = APR_NONBLOCK_READ;
-
-                    if (!apr_is_empty_table(backend->r->trailers_in)) {
-                        apr_table_do(add_trailers, r->trailers_out,
-                                backend->r->trailers_in, NULL);
-                        apr_table_clear(backend->r->trailers_in);
-                    }
-
-                    apr_brigade_length(bb, 0, &readbytes);
-                    backend->worker->s->read += readbytes;
-#if DEBUGGING
-                    {
-                    ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01111)
-                                  "readbytes: %#x", readbytes);
-                    }
-#endif
-                    /* sanity check */
-                    if (APR_BRIGADE_EMPTY(bb)) {
-                        break;
-                    }
-
-                    /* Switch the allocator lifetime of the buckets */
-                    ap_proxy_buckets_lifetime_transform(r, bb, pass_bb);
-
-                    /* found the last brigade? */
-                    if (APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(pass_bb))) {
-
-                        /* signal that we must leave */
-                        finish = TRUE;
-
-                        /* the brigade may contain transient buckets that contain
-                         * data that lives only as long as the backend connection.
-                         * Force a setaside so these transient buckets become heap
-                         * buckets that live as long as the request.
-                         */
-                        for (e = APR_BRIGADE_FIRST(pass_bb); e
-                                != APR_BRIGADE_SENTINEL(pass_bb); e
-                                = APR_BUCKET_NEXT(e)) {
-                            apr_bucket_setaside(e, r->pool);
-                        }
-
-                        /* finally it is safe to clean up the brigade from the
-                         * connection pool, as we have forced a setaside on all
-                         * buckets.
-                         */
-                        apr_brigade_cleanup(bb);
-
-                        /* make sure we release the backend connection as soon
-                         * as we know we are done, so that the backend isn't
-                         * left waiting for a slow client to eventually
-                         * acknowledge the data.
-                         */
-                        proxy_run_detach_backend(r, backend);
-                        ap_proxy_release_connection(backend->worker->s->scheme,
-                                backend, r->server);
-                        /* Ensure that the backend is not reused */
-                        *backend_ptr = NULL;
-
-                    }
-
-                    /* try send what we read */
-                    if (ap_pass_brigade(r->output_filters, pass_bb) != APR_SUCCESS
-                        || c->aborted) {
-                        /* Ack! Phbtt! Die! User aborted! */
-                        /* Only close backend if we haven't got all from the
-                         * backend. Furthermore if *backend_ptr is NULL it is no
-                         * longer safe to fiddle around with backend as it might
-                         * be already in use by another thread.
-                         */
-                        if (*backend_ptr) {
-                            backend->close = 1;  /* this causes socket close below */
-                        }
-                        finish = TRUE;
-                    }
-
-                    /* make sure we always clean up after ourselves */
-                    apr_brigade_cleanup(pass_bb);
-                    apr_brigade_cleanup(bb);
-
-                } while (!finish);
+                /* read the body, pass it to the output filters */
+                status = stream_response_body(req);
+                if (status == SUSPENDED) {
+                    return SUSPENDED;
+                }
             }
             ap_log_rerror(APLOG_MARK, APLOG_TRACE2, 0, r, "end body send");
         }
@@ -1874,7 +1816,7 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
             proxy_run_detach_backend(r, backend);
             ap_proxy_release_connection(backend->worker->s->scheme,
                     backend, r->server);
-            *backend_ptr = NULL;
+            req->backend = NULL;
 
             /* Pass EOS bucket down the filter chain. */
             e = apr_bucket_eos_create(c->bucket_alloc);
@@ -1885,24 +1827,205 @@ int ap_proxy_http_process_response(apr_pool_t * p, request_rec *r,
         }
     } while (interim_response && (interim_response < AP_MAX_INTERIM_RESPONSES));
 
-    /* We have to cleanup bb brigade, because buckets inserted to it could be
-     * created from scpool and this pool can be freed before this brigade. */
-    apr_brigade_cleanup(bb);
-
-    if (*backend_ptr) {
-        proxy_run_detach_backend(r, backend);
-    }
-
     /* See define of AP_MAX_INTERIM_RESPONSES for why */
     if (interim_response >= AP_MAX_INTERIM_RESPONSES) {
+        proxy_http_end_response(req);
         return ap_proxyerror(r, HTTP_BAD_GATEWAY,
                              apr_psprintf(p,
                              "Too many (%d) interim responses from origin server",
                              interim_response));
     }
 
+    return proxy_http_end_response(req);
+}
+
+/*
+ * Read the response body from the backend and pass it to the output
+ * filters, until EOS or until the backend is not readable anymore and
+ * the request can be suspended (SUSPENDED is returned then).
+ */
+static int stream_response_body(proxy_http_req_t *req)
+{
+    request_rec *r = req->r;
+    conn_rec *c = r->connection;
+    proxy_server_conf *conf = req->sconf;
+    proxy_conn_rec *backend = req->backend;
+    apr_bucket_brigade *bb = req->bb;
+    apr_bucket_brigade *pass_bb = req->pass_bb;
+    apr_read_type_e mode = APR_NONBLOCK_READ;
+    int finish = FALSE;
+    apr_bucket *e;
+
+    do {
+        apr_off_t readbytes;
+        apr_status_t rv;
+
+        rv = ap_get_brigade(backend->r->input_filters, bb,
+                            AP_MODE_READBYTES, mode,
+                            conf->io_buffer_size);
+
+        /* ap_get_brigade will return success with an empty brigade
+         * for a non-blocking read which would block: */
+        if (mode == APR_NONBLOCK_READ
+            && (APR_STATUS_IS_EAGAIN(rv)
+                || (rv == APR_SUCCESS && APR_BRIGADE_EMPTY(bb)))) {
+            /* flush to the client and switch to blocking mode */
+            e = apr_bucket_flush_create(c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, e);
+            if (ap_pass_brigade(r->output_filters, bb)
+                || c->aborted) {
+                backend->close = 1;
+                break;
+            }
+            apr_brigade_cleanup(bb);
+
+            /* or give the thread back to the MPM until the backend
+             * has more to say */
+            if (req->can_go_async
+                    && !proxy_http_backend_readable(req, req->async_delay)) {
+                req->state = PROXY_HTTP_REQ_STREAM_BODY;
+                return SUSPENDED;
+            }
+            mode = APR_BLOCK_READ;
+            continue;
+        }
+        else if (rv == APR_EOF) {
+            backend->close = 1;
+            break;
+        }
+        else if (rv != APR_SUCCESS) {
+            if (rv == APR_ENOSPC) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02475)
+                              "Response chunk/line was too large to parse");
+            }
+            else if (rv == APR_ENOTIMPL) {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(02476)
+                              "Response Transfer-Encoding was not recognised");
+            }
+            else {
+                ap_log_rerror(APLOG_MARK, APLOG_ERR, rv, r, APLOGNO(01110)
+                              "Network error reading response");
+            }
+
+            /* In this case, we are in real trouble because
+             * our backend bailed on us. Given we're half way
+             * through a response, our only option is to
+             * disconnect the client too.
+             */
+            e = ap_bucket_error_create(HTTP_GATEWAY_TIME_OUT, NULL,
+                    r->pool, c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, e);
+            e = ap_bucket_eoc_create(c->bucket_alloc);
+            APR_BRIGADE_INSERT_TAIL(bb, e);
+            ap_pass_brigade(r->output_filters, bb);
+
+            req->backend_broke = 1;
+            backend->close = 1;
+            break;
+        }
+        /* next time try a non-blocking read */
+        mode = APR_NONBLOCK_READ;
+
+        if (!apr_is_empty_table(backend->r->trailers_in)) {
+            apr_table_do(add_trailers, r->trailers_out,
+                    backend->r->trailers_in, NULL);
+            apr_table_clear(backend->r->trailers_in);
+        }
+
+        apr_brigade_length(bb, 0, &readbytes);
+        backend->worker->s->read += readbytes;
+#if DEBUGGING
+        {
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(01111)
+                      "readbytes: %#x", readbytes);
+        }
+#endif
+        /* sanity check */
+        if (APR_BRIGADE_EMPTY(bb)) {
+            break;
+        }
+
+        /* Switch the allocator lifetime of the buckets */
+        ap_proxy_buckets_lifetime_transform(r, bb, pass_bb);
+
+        /* found the last brigade? */
+        if (APR_BUCKET_IS_EOS(APR_BRIGADE_LAST(pass_bb))) {
+
+            /* signal that we must leave */
+            finish = TRUE;
+
+            /* the brigade may contain transient buckets that contain
+             * data that lives only as long as the backend connection.
+             * Force a setaside so these transient buckets become heap
+             * buckets that live as long as the request.
+             */
+            for (e = APR_BRIGADE_FIRST(pass_bb); e
+                    != APR_BRIGADE_SENTINEL(pass_bb); e
+                    = APR_BUCKET_NEXT(e)) {
+                apr_bucket_setaside(e, r->pool);
+            }
+
+            /* finally it is safe to clean up the brigade from the
+             * connection pool, as we have forced a setaside on all
+             * buckets.
+             */
+            apr_brigade_cleanup(bb);
+
+            /* make sure we release the backend connection as soon
+             * as we know we are done, so that the backend isn't
+             * left waiting for a slow client to eventually
+             * acknowledge the data.
+             */
+            proxy_run_detach_backend(r, backend);
+            ap_proxy_release_connection(backend->worker->s->scheme,
+                    backend, r->server);
+            /* Ensure that the backend is not reused */
+            req->backend = NULL;
+
+        }
+
+        /* try send what we read */
+        if (ap_pass_brigade(r->output_filters, pass_bb) != APR_SUCCESS
+            || c->aborted) {
+            /* Ack! Phbtt! Die! User aborted! */
+            /* Only close backend if we haven't got all from the
+             * backend. Furthermore if req->backend is NULL it is no
+             * longer safe to fiddle around with backend as it might
+             * be already in use by another thread.
+             */
+            if (req->backend) {
+                backend->close = 1;  /* this causes socket close below */
+            }
+            finish = TRUE;
+        }
+
+        /* make sure we always clean up after ourselves */
+        apr_brigade_cleanup(pass_bb);
+        apr_brigade_cleanup(bb);
+
+    } while (!finish);
+
+    return OK;
+}
+
+/*
+ * Release what ap_proxy_http_process_response() (or a resumed
+ * stream_response_body()) left to the request once the response is done.
+ */
+static int proxy_http_end_response(proxy_http_req_t *req)
+{
+    conn_rec *c = req->r->connection;
+
+    /* We have to cleanup bb brigade, because buckets inserted to it could be
+     * created from scpool and this pool can be freed before this brigade. */
+    apr_brigade_cleanup(req->bb);
+
+    if (req->backend) {
+        proxy_run_detach_backend(req->r, req->backend);
+    }
+
     /* If our connection with the client is to be aborted, return DONE. */
-    if (c->aborted || backend_broke) {
+    if (c->aborted || req->backend_broke) {
         return DONE;
     }
 
@@ -1917,6 +2040,160 @@ apr_status_t ap_proxy_http_cleanup(const char *scheme, request_rec *r,
     return OK;
 }
 
+static void proxy_http_async_cb(void *baton);
+static void proxy_http_async_cancel_cb(void *baton);
+
+/*
+ * Register the backend socket in the MPM's pollset so that the request is
+ * resumed by proxy_http_async_cb() once the backend is readable, or
+ * terminated by proxy_http_async_cancel_cb() if nothing comes in time.
+ */
+static apr_status_t proxy_http_async_suspend(proxy_http_req_t *req)
+{
+    apr_array_header_t *pfds;
+    apr_pollfd_t *pfd;
+
+    apr_pool_clear(req->async_pool);
+
+    pfds = apr_array_make(req->async_pool, 1, sizeof(apr_pollfd_t));
+    pfd = apr_array_push(pfds);
+    pfd->desc_type = APR_POLL_SOCKET;
+    pfd->reqevents = APR_POLLIN | APR_POLLERR | APR_POLLHUP;
+    pfd->desc.s = req->backend->sock;
+    pfd->p = req->async_pool;
+
+    ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, req->r,
+                  "HTTP: suspending request while %s from backend %s",
+                  req->state == PROXY_HTTP_REQ_WAIT_HEADERS
+                      ? "waiting for the response" : "streaming the body",
+                  req->backend->hostname);
+
+    return ap_mpm_register_poll_callback_timeout(pfds,
+                                                 proxy_http_async_cb,
+                                                 proxy_http_async_cancel_cb,
+                                                 req, req->idle_timeout);
+}
+
+/*
+ * Complete a resumed request the same way ap_process_async_request() would
+ * have done if the handler had not returned SUSPENDED.
+ */
+static void proxy_http_async_finish(proxy_http_req_t *req, int status)
+{
+    request_rec *r = req->r;
+    conn_rec *c = r->connection;
+
+    if (req->backend) {
+        if (status != OK) {
+            req->backend->close = 1;
+        }
+        ap_proxy_http_cleanup(req->proxy_function, r, req->backend);
+        req->backend = NULL;
+    }
+
+    /* Nothing to poll anymore */
+    apr_pool_destroy(req->async_pool);
+
+    /* What proxy_handler() could not do while the request was suspended */
+    status = ap_proxy_suspended_done(r, status);
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(r->invoke_mtx);
+#endif
+
+    ap_die_r(status, r, HTTP_OK);
+    ap_process_request_after_handler(r); /* don't touch req or r after here */
+
+    ap_mpm_resume_suspended(c);
+}
+
+/* Invoked by the MPM when the backend socket becomes readable. */
+static void proxy_http_async_cb(void *baton)
+{
+    proxy_http_req_t *req = (proxy_http_req_t *)baton;
+    request_rec *r = req->r;
+    int status;
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(r->invoke_mtx);
+#endif
+
+    for (;;) {
+        if (req->state == PROXY_HTTP_REQ_WAIT_HEADERS) {
+            status = ap_proxy_http_process_response(r->pool, r, req);
+        }
+        else {
+            status = stream_response_body(req);
+            if (status != SUSPENDED) {
+                status = proxy_http_end_response(req);
+            }
+        }
+        if (status != SUSPENDED) {
+            break;
+        }
+
+        if (proxy_http_async_suspend(req) == APR_SUCCESS) {
+#if APR_HAS_THREADS
+            apr_thread_mutex_unlock(r->invoke_mtx);
+#endif
+            return;
+        }
+
+        /* Can't poll, finish the job synchronously */
+        ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10111)
+                      "HTTP: failed to suspend request, going on "
+                      "synchronously");
+        req->can_go_async = 0;
+    }
+
+    proxy_http_async_finish(req, status);
+}
+
+/* Invoked by the MPM when the backend stayed silent for idle_timeout. */
+static void proxy_http_async_cancel_cb(void *baton)
+{
+    proxy_http_req_t *req = (proxy_http_req_t *)baton;
+    request_rec *r = req->r;
+    conn_rec *c = r->connection;
+    int status;
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(r->invoke_mtx);
+#endif
+
+    ap_log_rerror(APLOG_MARK, APLOG_ERR, 0, r, APLOGNO(10112)
+                  "HTTP: timeout while %s from backend %s",
+                  req->state == PROXY_HTTP_REQ_WAIT_HEADERS
+                      ? "waiting for the response" : "streaming the body",
+                  req->backend->hostname);
+    apr_table_setn(r->notes, "proxy_timedout", "1");
+    req->backend->close = 1;
+
+    if (req->state == PROXY_HTTP_REQ_WAIT_HEADERS) {
+        proxy_run_detach_backend(r, req->backend);
+        status = ap_proxyerror(r, HTTP_GATEWAY_TIME_OUT,
+                               "Timeout reading from remote server");
+    }
+    else {
+        /* Half way through the response, disconnect the client too */
+        apr_bucket_brigade *bb = req->bb;
+        apr_bucket *e;
+
+        apr_brigade_cleanup(bb);
+        e = ap_bucket_error_create(HTTP_GATEWAY_TIME_OUT, NULL,
+                                   r->pool, c->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(bb, e);
+        e = ap_bucket_eoc_create(c->bucket_alloc);
+        APR_BRIGADE_INSERT_TAIL(bb, e);
+        ap_pass_brigade(r->output_filters, bb);
+
+        req->backend_broke = 1;
+        status = proxy_http_end_response(req);
+    }
+
+    proxy_http_async_finish(req, status);
+}
+
 /*
  * This handles http:// URLs, and other URLs using a remote proxy over http
  * If proxyhost is NULL, then contact the server directly, otherwise
@@ -1953,6 +2230,8 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
      */
     apr_pool_t *p = r->pool;
     apr_uri_t *uri;
+    proxy_http_dir_conf *dconf;
+    proxy_http_req_t *req;
 
     /* find the scheme */
     u = strchr(url, ':');
@@ -1987,6 +2266,20 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
     }
     ap_log_rerror(APLOG_MARK, APLOG_TRACE1, 0, r, "HTTP: serving URL %s", url);
 
+    dconf = ap_get_module_config(r->per_dir_config, &proxy_http_module);
+    req = apr_pcalloc(p, sizeof(*req));
+    req->r = r;
+    req->worker = worker;
+    req->sconf = conf;
+    req->proxy_function = proxy_function;
+    req->server_portstr = server_portstr;
+    req->async_delay = dconf->async_delay;
+
+    /* Only the main request of an async MPM connection can be suspended,
+     * ap_process_async_request() is not on the way otherwise.
+     */
+    req->can_go_async = (dconf->mpm_can_poll && dconf->async_delay >= 0
+                         && c->cs && !c->master && !r->main && !r->prev);
 
     /* create space for state information */
     if ((status = ap_proxy_acquire_connection(proxy_function, &backend,
@@ -2116,9 +2409,51 @@ static int proxy_http_handler(request_rec *r, proxy_worker *worker,
             }
         }
 
+        req->backend = backend;
+        if (req->can_go_async) {
+            apr_interval_time_t timeout;
+
+            /* Suspending while waiting on 100-continue is not worth it */
+            if (PROXY_DO_100_CONTINUE(worker, r)) {
+                req->can_go_async = 0;
+            }
+            else {
+                apr_socket_timeout_get(backend->sock, &timeout);
+                req->idle_timeout = (dconf->idle_timeout >= 0)
+                                    ? dconf->idle_timeout : timeout;
+                req->server_portstr = apr_pstrdup(p, server_portstr);
+                apr_pool_create(&req->async_pool, p);
+                apr_pool_tag(req->async_pool, "proxy_http_async");
+            }
+        }
+
         /* Step Five: Receive the Response... Fall thru to cleanup */
-        status = ap_proxy_http_process_response(p, r, &backend, worker,
-                                                conf, server_portstr);
+        if (req->can_go_async
+                && !proxy_http_backend_readable(req, req->async_delay)) {
+            req->state = PROXY_HTTP_REQ_WAIT_HEADERS;
+            status = SUSPENDED;
+        }
+        else {
+            status = ap_proxy_http_process_response(p, r, req);
+        }
+        if (status == SUSPENDED) {
+            if (proxy_http_async_suspend(req) == APR_SUCCESS) {
+                /* The backend is now owned by the callbacks */
+                return SUSPENDED;
+            }
+            ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, APLOGNO(10113)
+                          "HTTP: failed to suspend request, going on "
+                          "synchronously");
+            req->can_go_async = 0;
+            if (req->state == PROXY_HTTP_REQ_WAIT_HEADERS) {
+                status = ap_proxy_http_process_response(p, r, req);
+            }
+            else {
+                stream_response_body(req);
+                status = proxy_http_end_response(req);
+            }
+        }
+        backend = req->backend;
 
         break;
     }
@@ -2133,6 +2468,80 @@ cleanup:
     return status;
 }
 
+static void *create_proxy_http_dir_config(apr_pool_t *p, char *dummy)
+{
+    proxy_http_dir_conf *new =
+        (proxy_http_dir_conf *) apr_pcalloc(p, sizeof(proxy_http_dir_conf));
+
+    new->async_delay = -1; /* never go async */
+    new->idle_timeout = -1; /* backend's timeout */
+
+    ap_mpm_query(AP_MPMQ_CAN_POLL, &new->mpm_can_poll);
+
+    return (void *) new;
+}
+
+static void *merge_proxy_http_dir_config(apr_pool_t *p, void *basev,
+                                         void *addv)
+{
+    proxy_http_dir_conf *new =
+        (proxy_http_dir_conf *) apr_pcalloc(p, sizeof(proxy_http_dir_conf));
+    proxy_http_dir_conf *add = (proxy_http_dir_conf *) addv;
+    proxy_http_dir_conf *base = (proxy_http_dir_conf *) basev;
+
+    new->mpm_can_poll = add->mpm_can_poll;
+    new->async_delay = (add->async_delay_set == 0) ? base->async_delay
+                                                   : add->async_delay;
+    new->async_delay_set = add->async_delay_set || base->async_delay_set;
+    new->idle_timeout = (add->idle_timeout_set == 0) ? base->idle_timeout
+                                                     : add->idle_timeout;
+    new->idle_timeout_set = add->idle_timeout_set || base->idle_timeout_set;
+
+    return new;
+}
+
+static const char *set_async_delay(cmd_parms *cmd, void *conf,
+                                   const char *val)
+{
+    proxy_http_dir_conf *dconf = conf;
+
+    if (!strcasecmp(val, "off")) {
+        dconf->async_delay = -1;
+    }
+    else if (ap_timeout_parameter_parse(val, &dconf->async_delay,
+                                        "ms") != APR_SUCCESS) {
+        return "ProxyHTTPAsyncDelay timeout has wrong format";
+    }
+    dconf->async_delay_set = 1;
+    return NULL;
+}
+
+static const char *set_async_idle_timeout(cmd_parms *cmd, void *conf,
+                                          const char *val)
+{
+    proxy_http_dir_conf *dconf = conf;
+
+    if (ap_timeout_parameter_parse(val, &dconf->idle_timeout,
+                                   "s") != APR_SUCCESS) {
+        return "ProxyHTTPAsyncIdleTimeout timeout has wrong format";
+    }
+    dconf->idle_timeout_set = 1;
+    return NULL;
+}
+
+static const command_rec proxy_http_cmds[] =
+{
+    AP_INIT_TAKE1("ProxyHTTPAsyncDelay", set_async_delay, NULL,
+                  RSRC_CONF|ACCESS_CONF,
+                  "time to wait for the backend before suspending the "
+                  "request (async MPMs only), 'off' by default"),
+    AP_INIT_TAKE1("ProxyHTTPAsyncIdleTimeout", set_async_idle_timeout, NULL,
+                  RSRC_CONF|ACCESS_CONF,
+                  "maximum time a suspended request waits for the backend, "
+                  "defaults to the backend connection's timeout"),
+    {NULL}
+};
+
 /* post_config hook: */
 static int proxy_http_post_config(apr_pool_t *pconf, apr_pool_t *plog,
         apr_pool_t *ptemp, server_rec *s)
@@ -2167,11 +2576,11 @@ static void ap_proxy_http_register_hook(apr_pool_t *p)
 
 AP_DECLARE_MODULE(proxy_http) = {
     STANDARD20_MODULE_STUFF,
-    NULL,              /* create per-directory config structure */
-    NULL,              /* merge per-directory config structures */
+    create_proxy_http_dir_config,   /* create per-directory config structure */
+    merge_proxy_http_dir_config,    /* merge per-directory config structures */
     NULL,              /* create per-server config structure */
     NULL,              /* merge per-server config structures */
-    NULL,              /* command apr_table_t */
+    proxy_http_cmds,   /* command apr_table_t */
     ap_proxy_http_register_hook/* register hooks */
 };
 
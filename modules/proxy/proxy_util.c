@@ -1332,6 +1332,8 @@ static void init_conn_pool(apr_pool_t *p, proxy_worker *worker)
      */
     cp = (proxy_conn_pool *)apr_pcalloc(p, sizeof(proxy_conn_pool));
     cp->pool = pool;
+    apr_pool_create(&cp->dns_pool, pool);
+    apr_pool_tag(cp->dns_pool, "proxy_worker_dns");
     worker->cp = cp;
 }
 
@@ -1469,6 +1471,19 @@ static apr_status_t connection_constructor(void **resource, void *params,
     return APR_SUCCESS;
 }
 
+/* Worker's cached address references (see worker_address_get()) */
+static APR_INLINE void address_inc(proxy_address *address)
+{
+    address->refcount++;
+}
+
+static APR_INLINE void address_dec(proxy_address *address)
+{
+    if (!--address->refcount) {
+        apr_pool_destroy(address->pool);
+    }
+}
+
 /* reslist destructor */
 static apr_status_t connection_destructor(void *resource, void *params,
                                           apr_pool_t *pool)
@@ -1478,6 +1493,15 @@ static apr_status_t connection_destructor(void *resource, void *params,
     /* Destroy the pool only if not called from reslist_destroy */
     if (worker->cp->pool) {
         proxy_conn_rec *conn = resource;
+        if (conn->address) {
+            /* Release the (cached) address, the reslist is locked already
+             * but not necessarily the worker.
+             */
+            if (PROXY_THREAD_LOCK(worker) == APR_SUCCESS) {
+                address_dec(conn->address);
+                PROXY_THREAD_UNLOCK(worker);
+            }
+        }
         apr_pool_destroy(conn->pool);
     }
 
@@ -2235,6 +2259,256 @@ PROXY_DECLARE(int) ap_proxy_release_connection(const char *proxy_function,
     return OK;
 }
 
+/*
+ * Worker's address cache.
+ *
+ * The worker looks up its backend once and keeps the result in cp->address,
+ * used by all its connections. With an addressttl= the lookup is done again
+ * when the address expires, or as soon as another child noticed a change
+ * (s->address_changed), ahead of time by the watchdog when mod_watchdog is
+ * loaded (see ap_proxy_refresh_address()), otherwise by the first request to
+ * notice. Meanwhile the other requests continue to use the current address,
+ * so only the very first lookup is blocking. Each connection holds a
+ * reference on the address it uses, such that a replaced address remains
+ * valid until the last one is done with it. Everything here is protected by
+ * the worker's tmutex.
+ */
+static int address_expired(proxy_worker *worker, proxy_address *address,
+                           apr_time_t now, apr_interval_time_t ahead)
+{
+    if (worker->s->address_changed > address->resolved) {
+        return 1;
+    }
+    return address->expiry && now + ahead >= address->expiry;
+}
+
+/* Whether the two lists contain the same addresses, in whatever order since
+ * round-robin DNS is not a change.
+ */
+static int address_list_equal(apr_sockaddr_t *addr1, apr_sockaddr_t *addr2)
+{
+    apr_sockaddr_t *a, *b;
+    int n1 = 0, n2 = 0;
+
+    for (a = addr1; a; a = a->next) {
+        n1++;
+    }
+    for (b = addr2; b; b = b->next) {
+        n2++;
+    }
+    if (n1 != n2) {
+        return 0;
+    }
+    for (a = addr1; a; a = a->next) {
+        for (b = addr2; b; b = b->next) {
+            if (apr_sockaddr_equal(a, b) && a->port == b->port) {
+                break;
+            }
+        }
+        if (!b) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Called with the worker locked */
+static proxy_address *address_create(proxy_worker *worker,
+                                     const char *hostname, apr_port_t port)
+{
+    proxy_address *address;
+    apr_pool_t *pool;
+
+    apr_pool_create(&pool, worker->cp->dns_pool);
+    apr_pool_tag(pool, "proxy_address");
+    address = apr_pcalloc(pool, sizeof(*address));
+    address->pool = pool;
+    address->hostname = apr_pstrdup(pool, hostname);
+    address->port = port;
+    return address;
+}
+
+/* Can be called with the worker unlocked, the address is not shared yet */
+static apr_status_t address_lookup(proxy_worker *worker,
+                                   proxy_address *address)
+{
+    apr_status_t rv;
+
+    address->resolved = apr_time_now();
+    rv = apr_sockaddr_info_get(&address->addr, address->hostname,
+                               APR_UNSPEC, address->port, 0, address->pool);
+    if (rv == APR_SUCCESS && worker->s->address_ttl > 0) {
+        address->expiry = address->resolved + worker->s->address_ttl;
+    }
+    return rv;
+}
+
+/* Called with the worker locked */
+static void address_install(proxy_worker *worker, proxy_address *address,
+                            server_rec *s)
+{
+    proxy_conn_pool *cp = worker->cp;
+    proxy_address *old = cp->address;
+
+    if (old) {
+        if (!address_list_equal(old->addr, address->addr)) {
+            ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(10116)
+                         "worker %s: address of %s:%d changed to %pI",
+                         ap_proxy_worker_name(address->pool, worker),
+                         address->hostname, (int)address->port,
+                         address->addr);
+            /* Let the other children know */
+            if (worker->s->address_changed < address->resolved) {
+                worker->s->address_changed = address->resolved;
+            }
+        }
+        else {
+            ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, s,
+                         "worker %s: address of %s:%d refreshed",
+                         ap_proxy_worker_name(address->pool, worker),
+                         address->hostname, (int)address->port);
+        }
+    }
+    address->refcount = 1; /* the worker's */
+    cp->address = address;
+    cp->addr = address->addr;
+    if (old) {
+        address_dec(old);
+    }
+}
+
+/*
+ * Lookup the worker's address again if it expired (or is about to, given
+ * ahead), unless some other thread is already doing it. Called with the
+ * worker locked, which is released during the lookup itself; returns with
+ * the worker locked, unless locking again failed.
+ */
+static apr_status_t address_refresh(proxy_worker *worker,
+                                    apr_interval_time_t ahead,
+                                    apr_time_t now, server_rec *s)
+{
+    proxy_conn_pool *cp = worker->cp;
+    proxy_address *current = cp->address, *address;
+    apr_status_t rv, lookup_rv;
+
+    if (!current || cp->resolving
+            || !address_expired(worker, current, now, ahead)) {
+        return APR_SUCCESS;
+    }
+    cp->resolving = 1;
+    address = address_create(worker, current->hostname, current->port);
+
+    if ((rv = PROXY_THREAD_UNLOCK(worker)) != APR_SUCCESS) {
+        cp->resolving = 0;
+        apr_pool_destroy(address->pool);
+        return rv;
+    }
+    lookup_rv = address_lookup(worker, address);
+    if ((rv = PROXY_THREAD_LOCK(worker)) != APR_SUCCESS) {
+        return rv;
+    }
+    cp->resolving = 0;
+
+    /* Only this thread could replace cp->address in the meantime */
+    if (lookup_rv != APR_SUCCESS) {
+        /* Keep using the current address until the next try */
+        ap_log_error(APLOG_MARK, APLOG_WARNING, lookup_rv, s, APLOGNO(10117)
+                     "worker %s: DNS lookup failure for %s:%d, keeping "
+                     "the current address",
+                     ap_proxy_worker_name(address->pool, worker),
+                     current->hostname, (int)current->port);
+        apr_pool_destroy(address->pool);
+        current->resolved = apr_time_now();
+        if (worker->s->address_ttl > 0) {
+            current->expiry = current->resolved + worker->s->address_ttl;
+        }
+        return APR_SUCCESS;
+    }
+    address_install(worker, address, s);
+    return APR_SUCCESS;
+}
+
+/*
+ * Make conn use the worker's cached address, looking it up the first time.
+ * Returns OK or an HTTP error code, *err is set to the lookup error if any.
+ */
+static int worker_address_get(proxy_conn_rec *conn, server_rec *s,
+                              apr_status_t *err)
+{
+    proxy_worker *worker = conn->worker;
+    proxy_conn_pool *cp = worker->cp;
+    apr_time_t now = apr_time_now();
+    apr_status_t rv, uerr;
+
+    /* Fast path, the connection already uses the current address */
+    if (conn->address && conn->address == cp->address
+            && !address_expired(worker, conn->address, now, 0)) {
+        conn->addr = conn->address->addr;
+        return OK;
+    }
+
+    if ((rv = PROXY_THREAD_LOCK(worker)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00945) "lock");
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    if (!cp->address) {
+        /*
+         * Worker can have the single constant backend address.
+         * The single DNS lookup is used once per worker (or per TTL).
+         */
+        proxy_address *address = address_create(worker, conn->hostname,
+                                                 conn->port);
+        *err = address_lookup(worker, address);
+        if (*err == APR_SUCCESS) {
+            address_install(worker, address, s);
+        }
+        else {
+            apr_pool_destroy(address->pool);
+        }
+    }
+    else if ((rv = address_refresh(worker, 0, now, s)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10118)
+                     "lock/unlock");
+        return HTTP_INTERNAL_SERVER_ERROR;
+    }
+    if (cp->address) {
+        if (conn->address != cp->address) {
+            if (conn->address) {
+                address_dec(conn->address);
+            }
+            conn->address = cp->address;
+            address_inc(conn->address);
+        }
+        conn->addr = conn->address->addr;
+    }
+    if ((uerr = PROXY_THREAD_UNLOCK(worker)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, uerr, s, APLOGNO(00946) "unlock");
+    }
+    return OK;
+}
+
+PROXY_DECLARE(apr_status_t) ap_proxy_refresh_address(proxy_worker *worker,
+                                                     server_rec *s,
+                                                     apr_time_t now)
+{
+    apr_status_t rv;
+    proxy_conn_pool *cp = worker->cp;
+
+    /* Nothing to refresh until the first lookup */
+    if (!cp || !cp->address || worker->s->address_ttl <= 0) {
+        return APR_SUCCESS;
+    }
+    if ((rv = PROXY_THREAD_LOCK(worker)) != APR_SUCCESS) {
+        return rv;
+    }
+    /* Refresh within the last quarter of the TTL */
+    rv = address_refresh(worker, worker->s->address_ttl / 4, now, s);
+    if (rv == APR_SUCCESS) {
+        rv = PROXY_THREAD_UNLOCK(worker);
+    }
+    return rv;
+}
+
 PROXY_DECLARE(int)
 ap_proxy_determine_connection(apr_pool_t *p, request_rec *r,
                               proxy_server_conf *conf,
@@ -2327,6 +2601,11 @@ ap_proxy_determine_connection(apr_pool_t *p, request_rec *r,
     }
     else {
         int will_reuse = worker->s->is_address_reusable && !worker->s->disablereuse;
+        /* The worker's address cache can be used even if connections are
+         * not reused, provided it expires.
+         */
+        int cache_address = worker->s->is_address_reusable
+                            && (will_reuse || worker->s->address_ttl > 0);
         if (!conn->hostname || !will_reuse) {
             if (proxyname) {
                 conn->hostname = apr_pstrdup(conn->pool, proxyname);
@@ -2364,7 +2643,7 @@ ap_proxy_determine_connection(apr_pool_t *p, request_rec *r,
                 conn->hostname = apr_pstrdup(conn->pool, uri->hostname);
                 conn->port = uri->port;
             }
-            if (!will_reuse) {
+            if (!cache_address) {
                 /*
                  * Only do a lookup if we should not reuse the backend address.
                  * Otherwise we will look it up once for the worker.
@@ -2377,34 +2656,14 @@ ap_proxy_determine_connection(apr_pool_t *p, request_rec *r,
             socket_cleanup(conn);
             conn->close = 0;
         }
-        if (will_reuse) {
+        if (cache_address) {
             /*
              * Looking up the backend address for the worker only makes sense if
              * we can reuse the address.
              */
-            if (!worker->cp->addr) {
-                if ((err = PROXY_THREAD_LOCK(worker)) != APR_SUCCESS) {
-                    ap_log_rerror(APLOG_MARK, APLOG_ERR, err, r, APLOGNO(00945) "lock");
-                    return HTTP_INTERNAL_SERVER_ERROR;
-                }
-
-                /*
-                 * Worker can have the single constant backend address.
-                 * The single DNS lookup is used once per worker.
-                 * If dynamic change is needed then set the addr to NULL
-                 * inside dynamic config to force the lookup.
-                 */
-                err = apr_sockaddr_info_get(&(worker->cp->addr),
-                                            conn->hostname, APR_UNSPEC,
-                                            conn->port, 0,
-                                            worker->cp->pool);
-                conn->addr = worker->cp->addr;
-                if ((uerr = PROXY_THREAD_UNLOCK(worker)) != APR_SUCCESS) {
-                    ap_log_rerror(APLOG_MARK, APLOG_ERR, uerr, r, APLOGNO(00946) "unlock");
-                }
-            }
-            else {
-                conn->addr = worker->cp->addr;
+            int rc = worker_address_get(conn, r->server, &err);
+            if (rc != OK) {
+                return rc;
             }
         }
     }
@@ -2793,6 +3052,302 @@ PROXY_DECLARE(apr_status_t) ap_proxy_check_connection(const char *scheme,
     return rv;
 }
 
+/*
+ * Create a TCP socket for connecting to addr, with the worker's settings
+ * and the given (connect) timeout.
+ */
+static apr_status_t proxy_socket_create(const char *proxy_function,
+                                        proxy_conn_rec *conn,
+                                        proxy_worker *worker,
+                                        proxy_server_conf *conf,
+                                        server_rec *s,
+                                        apr_sockaddr_t *addr,
+                                        apr_interval_time_t timeout,
+                                        apr_socket_t **newsock)
+{
+    apr_status_t rv;
+    apr_sockaddr_t *local_addr;
+
+    if ((rv = apr_socket_create(newsock, addr->family,
+                                SOCK_STREAM, APR_PROTO_TCP,
+                                conn->scpool)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, addr->next ? APLOG_DEBUG : APLOG_ERR, rv, s,
+                     APLOGNO(00952) "%s: error creating fam %d socket for "
+                     "target %s",
+                     proxy_function,
+                     addr->family,
+                     worker->s->hostname);
+        return rv;
+    }
+
+    if (worker->s->recv_buffer_size > 0 &&
+        (rv = apr_socket_opt_set(*newsock, APR_SO_RCVBUF,
+                                 worker->s->recv_buffer_size))) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00953)
+                     "apr_socket_opt_set(SO_RCVBUF): Failed to set "
+                     "ProxyReceiveBufferSize, using default");
+    }
+
+    rv = apr_socket_opt_set(*newsock, APR_TCP_NODELAY, 1);
+    if (rv != APR_SUCCESS && rv != APR_ENOTIMPL) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00954)
+                     "apr_socket_opt_set(APR_TCP_NODELAY): "
+                     "Failed to set");
+    }
+
+    apr_socket_timeout_set(*newsock, timeout);
+
+    /* Set a keepalive option */
+    if (worker->s->keepalive) {
+        if ((rv = apr_socket_opt_set(*newsock,
+                                     APR_SO_KEEPALIVE, 1)) != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00955)
+                         "apr_socket_opt_set(SO_KEEPALIVE): Failed to set"
+                         " Keepalive");
+        }
+    }
+    ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, s,
+                 "%s: fam %d socket created to connect to %s",
+                 proxy_function, addr->family, worker->s->hostname);
+
+    if (conf->source_address_set) {
+        local_addr = apr_pmemdup(conn->scpool, conf->source_address,
+                                 sizeof(apr_sockaddr_t));
+        local_addr->pool = conn->scpool;
+        rv = apr_socket_bind(*newsock, local_addr);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00956)
+                         "%s: failed to bind socket to local address",
+                         proxy_function);
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Happy Eyeballs (RFC 8305) like connection: when the backend resolves to
+ * multiple addresses, the next one (alternating address families) is tried
+ * concurrently whenever the previous attempts did not complete within
+ * PROXY_CONNECT_ATTEMPT_DELAY, and the first established connection wins.
+ * So an unreachable address costs that delay rather than the whole connect
+ * timeout, which still bounds the overall attempt.
+ */
+#ifndef PROXY_CONNECT_ATTEMPT_DELAY
+#define PROXY_CONNECT_ATTEMPT_DELAY apr_time_from_msec(250)
+#endif
+#define PROXY_CONNECT_ATTEMPTS_MAX  8
+
+/*
+ * Order a list of addresses by alternating their families, starting with
+ * the family of the first one, as RFC 8305 wants them. The relative order
+ * of the addresses of a family is kept.
+ */
+static apr_array_header_t *proxy_sockaddr_interleave(apr_pool_t *p,
+                                                     apr_sockaddr_t *addrs)
+{
+    apr_array_header_t *arr;
+    apr_sockaddr_t *addr, **firsts, **others;
+    int n = 0, nfirst = 0, nother = 0, i, j;
+
+    for (addr = addrs; addr; addr = addr->next) {
+        ++n;
+    }
+    arr = apr_array_make(p, n ? n : 1, sizeof(apr_sockaddr_t *));
+    if (!n) {
+        return arr;
+    }
+
+    /* The family of the head and the others, each in their order */
+    firsts = apr_palloc(p, n * sizeof(apr_sockaddr_t *));
+    others = apr_palloc(p, n * sizeof(apr_sockaddr_t *));
+    for (addr = addrs; addr; addr = addr->next) {
+        if (addr->family == addrs->family) {
+            firsts[nfirst++] = addr;
+        }
+        else {
+            others[nother++] = addr;
+        }
+    }
+    for (i = j = 0; i < nfirst || j < nother;) {
+        if (i < nfirst) {
+            APR_ARRAY_PUSH(arr, apr_sockaddr_t *) = firsts[i++];
+        }
+        if (j < nother) {
+            APR_ARRAY_PUSH(arr, apr_sockaddr_t *) = others[j++];
+        }
+    }
+    return arr;
+}
+
+/*
+ * Connect to the first of the addresses in todo that answers, in their
+ * order. The one connected to is returned in *backend_addr.
+ */
+static apr_status_t proxy_connect_addrs(const char *proxy_function,
+                                        proxy_conn_rec *conn,
+                                        proxy_worker *worker,
+                                        proxy_server_conf *conf,
+                                        server_rec *s,
+                                        apr_array_header_t *todo,
+                                        apr_sockaddr_t **backend_addr,
+                                        apr_socket_t **newsock)
+{
+    apr_status_t rv = APR_EGENERAL;
+    apr_interval_time_t timeout;
+    apr_time_t deadline = 0;
+    apr_pollfd_t pfds[PROXY_CONNECT_ATTEMPTS_MAX];
+    apr_sockaddr_t *addrs[PROXY_CONNECT_ATTEMPTS_MAX];
+    apr_sockaddr_t *addr;
+    apr_socket_t *sock;
+    int npending = 0, ntodo = 0, i, n;
+
+    /* Timeout for connecting to the backend */
+    if (worker->s->conn_timeout_set) {
+        timeout = worker->s->conn_timeout;
+    }
+    else if (worker->s->timeout_set) {
+        timeout = worker->s->timeout;
+    }
+    else if (conf->timeout_set) {
+        timeout = conf->timeout;
+    }
+    else {
+        timeout = s->timeout;
+    }
+
+    /* Single address, plain blocking connect */
+    ntodo = todo->nelts;
+    addr = APR_ARRAY_IDX(todo, 0, apr_sockaddr_t *);
+    if (ntodo == 1) {
+        rv = proxy_socket_create(proxy_function, conn, worker, conf, s,
+                                 addr, timeout, newsock);
+        if (rv == APR_SUCCESS) {
+            rv = apr_socket_connect(*newsock, addr);
+            if (rv != APR_SUCCESS) {
+                apr_socket_close(*newsock);
+                ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00957)
+                             "%s: attempt to connect to %pI (%s) failed",
+                             proxy_function, addr, worker->s->hostname);
+            }
+        }
+        if (rv != APR_SUCCESS) {
+            *backend_addr = NULL;
+        }
+        return rv;
+    }
+
+    if (timeout > 0) {
+        deadline = apr_time_now() + timeout;
+    }
+    *newsock = NULL;
+    for (i = 0;;) {
+        apr_interval_time_t wait;
+        apr_int32_t nsignaled;
+        apr_time_t now;
+
+        /* Start the next attempt */
+        if (i < ntodo && npending < PROXY_CONNECT_ATTEMPTS_MAX) {
+            addr = APR_ARRAY_IDX(todo, i++, apr_sockaddr_t *);
+            rv = proxy_socket_create(proxy_function, conn, worker, conf, s,
+                                     addr, 0, &sock);
+            if (rv == APR_SUCCESS) {
+                rv = apr_socket_connect(sock, addr);
+                if (rv == APR_SUCCESS) {
+                    *newsock = sock;
+                    *backend_addr = addr;
+                    break;
+                }
+                if (APR_STATUS_IS_EINPROGRESS(rv)) {
+                    pfds[npending].p = conn->scpool;
+                    pfds[npending].desc_type = APR_POLL_SOCKET;
+                    pfds[npending].reqevents = APR_POLLOUT;
+                    pfds[npending].rtnevents = 0;
+                    pfds[npending].desc.s = sock;
+                    pfds[npending].client_data = NULL;
+                    addrs[npending++] = addr;
+                }
+                else {
+                    apr_socket_close(sock);
+                    ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(10119)
+                                 "%s: attempt to connect to %pI (%s) failed",
+                                 proxy_function, addr, worker->s->hostname);
+                    continue;
+                }
+            }
+            else {
+                continue;
+            }
+        }
+        if (!npending) {
+            if (i < ntodo) {
+                continue;
+            }
+            break;
+        }
+
+        /* Wait for a pending attempt to complete, until it is time to
+         * start the next one (if any).
+         */
+        now = apr_time_now();
+        if (deadline && now >= deadline) {
+            rv = APR_TIMEUP;
+            break;
+        }
+        wait = deadline ? deadline - now : -1;
+        if (i < ntodo && npending < PROXY_CONNECT_ATTEMPTS_MAX
+                && (wait < 0 || wait > PROXY_CONNECT_ATTEMPT_DELAY)) {
+            wait = PROXY_CONNECT_ATTEMPT_DELAY;
+        }
+        rv = apr_poll(pfds, npending, &nsignaled, wait);
+        if (rv != APR_SUCCESS) {
+            if (APR_STATUS_IS_TIMEUP(rv) || APR_STATUS_IS_EINTR(rv)) {
+                continue;
+            }
+            break;
+        }
+        for (n = 0; n < npending; ) {
+            if (!pfds[n].rtnevents) {
+                ++n;
+                continue;
+            }
+            /* Completed, connect() again to get the outcome */
+            sock = pfds[n].desc.s;
+            addr = addrs[n];
+            rv = apr_socket_connect(sock, addr);
+            if (rv == APR_SUCCESS) {
+                *newsock = sock;
+                *backend_addr = addr;
+                break;
+            }
+            apr_socket_close(sock);
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO(10120)
+                         "%s: attempt to connect to %pI (%s) failed",
+                         proxy_function, addr, worker->s->hostname);
+            pfds[n] = pfds[--npending];
+            addrs[n] = addrs[npending];
+        }
+        if (*newsock) {
+            /* Forget the winner, close the others below */
+            pfds[n] = pfds[--npending];
+            break;
+        }
+    }
+
+    for (n = 0; n < npending; ++n) {
+        apr_socket_close(pfds[n].desc.s);
+    }
+    if (!*newsock) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10121)
+                     "%s: attempts to connect to %s (%d addresses) failed",
+                     proxy_function, worker->s->hostname, ntodo);
+        *backend_addr = NULL;
+        return rv != APR_SUCCESS ? rv : APR_EGENERAL;
+    }
+
+    return APR_SUCCESS;
+}
+
 PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
                                             proxy_conn_rec *conn,
                                             proxy_worker *worker,
@@ -2801,8 +3356,7 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
     apr_status_t rv;
     int loglevel;
     apr_sockaddr_t *backend_addr = conn->addr;
-    /* the local address to use for the outgoing connection */
-    apr_sockaddr_t *local_addr;
+    apr_array_header_t *todo = NULL;
     apr_socket_t *newsock;
     void *sconf = s->module_config;
     proxy_server_conf *conf =
@@ -2852,94 +3406,20 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
         else
 #endif
         {
-            if ((rv = apr_socket_create(&newsock, backend_addr->family,
-                                        SOCK_STREAM, APR_PROTO_TCP,
-                                        conn->scpool)) != APR_SUCCESS) {
-                loglevel = backend_addr->next ? APLOG_DEBUG : APLOG_ERR;
-                ap_log_error(APLOG_MARK, loglevel, rv, s, APLOGNO(00952)
-                             "%s: error creating fam %d socket for "
-                             "target %s",
-                             proxy_function,
-                             backend_addr->family,
-                             worker->s->hostname);
-                /*
-                 * this could be an IPv6 address from the DNS but the
-                 * local machine won't give us an IPv6 socket; hopefully the
-                 * DNS returned an additional address to try
-                 */
-                backend_addr = backend_addr->next;
-                continue;
-            }
-            conn->connection = NULL;
-
-            if (worker->s->recv_buffer_size > 0 &&
-                (rv = apr_socket_opt_set(newsock, APR_SO_RCVBUF,
-                                         worker->s->recv_buffer_size))) {
-                ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00953)
-                             "apr_socket_opt_set(SO_RCVBUF): Failed to set "
-                             "ProxyReceiveBufferSize, using default");
-            }
-
-            rv = apr_socket_opt_set(newsock, APR_TCP_NODELAY, 1);
-            if (rv != APR_SUCCESS && rv != APR_ENOTIMPL) {
-                ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00954)
-                             "apr_socket_opt_set(APR_TCP_NODELAY): "
-                             "Failed to set");
-            }
-
-            /* Set a timeout for connecting to the backend on the socket */
-            if (worker->s->conn_timeout_set) {
-                apr_socket_timeout_set(newsock, worker->s->conn_timeout);
-            }
-            else if (worker->s->timeout_set) {
-                apr_socket_timeout_set(newsock, worker->s->timeout);
-            }
-            else if (conf->timeout_set) {
-                apr_socket_timeout_set(newsock, conf->timeout);
-            }
-            else {
-                apr_socket_timeout_set(newsock, s->timeout);
-            }
-            /* Set a keepalive option */
-            if (worker->s->keepalive) {
-                if ((rv = apr_socket_opt_set(newsock,
-                                             APR_SO_KEEPALIVE, 1)) != APR_SUCCESS) {
-                    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00955)
-                                 "apr_socket_opt_set(SO_KEEPALIVE): Failed to set"
-                                 " Keepalive");
-                }
-            }
-            ap_log_error(APLOG_MARK, APLOG_TRACE2, 0, s,
-                         "%s: fam %d socket created to connect to %s",
-                         proxy_function, backend_addr->family, worker->s->hostname);
-
-            if (conf->source_address_set) {
-                local_addr = apr_pmemdup(conn->scpool, conf->source_address,
-                                         sizeof(apr_sockaddr_t));
-                local_addr->pool = conn->scpool;
-                rv = apr_socket_bind(newsock, local_addr);
-                if (rv != APR_SUCCESS) {
-                    ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(00956)
-                                 "%s: failed to bind socket to local address",
-                                 proxy_function);
-                }
+            /* Order the addresses by alternating their families, starting
+             * with the one preferred by the resolver. The retries after a
+             * failed CONNECT below go on in the same order.
+             */
+            if (!todo) {
+                todo = proxy_sockaddr_interleave(conn->scpool, backend_addr);
             }
-
-            /* make the connection out of the socket */
-            rv = apr_socket_connect(newsock, backend_addr);
-
-            /* if an error occurred, loop round and try again */
+            rv = proxy_connect_addrs(proxy_function, conn, worker, conf, s,
+                                     todo, &backend_addr, &newsock);
             if (rv != APR_SUCCESS) {
-                apr_socket_close(newsock);
-                loglevel = backend_addr->next ? APLOG_DEBUG : APLOG_ERR;
-                ap_log_error(APLOG_MARK, loglevel, rv, s, APLOGNO(00957)
-                             "%s: attempt to connect to %pI (%s) failed",
-                             proxy_function,
-                             backend_addr,
-                             worker->s->hostname);
-                backend_addr = backend_addr->next;
-                continue;
+                /* All the addresses were tried */
+                break;
             }
+            conn->connection = NULL;
 
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(02824)
                          "%s: connection established with %pI (%s)",
@@ -2971,16 +3451,32 @@ PROXY_DECLARE(int) ap_proxy_connect_backend(const char *proxy_function,
                 rv = send_http_connect(conn, s);
                 /* If an error occurred, loop round and try again */
                 if (rv != APR_SUCCESS) {
+                    int i;
+
                     conn->sock = NULL;
                     apr_socket_close(newsock);
-                    loglevel = backend_addr->next ? APLOG_DEBUG : APLOG_ERR;
+                    loglevel = todo->nelts > 1 ? APLOG_DEBUG : APLOG_ERR;
                     ap_log_error(APLOG_MARK, loglevel, rv, s, APLOGNO(00958)
                                  "%s: attempt to connect to %s:%d "
                                  "via http CONNECT through %pI (%s) failed",
                                  proxy_function,
                                  forward->target_host, forward->target_port,
                                  backend_addr, worker->s->hostname);
-                    backend_addr = backend_addr->next;
+                    /* Go on with the others */
+                    for (i = 0; i < todo->nelts; ++i) {
+                        if (APR_ARRAY_IDX(todo, i, apr_sockaddr_t *)
+                                == backend_addr) {
+                            for (; i + 1 < todo->nelts; ++i) {
+                                APR_ARRAY_IDX(todo, i, apr_sockaddr_t *) =
+                                    APR_ARRAY_IDX(todo, i + 1,
+                                                  apr_sockaddr_t *);
+                            }
+                            --todo->nelts;
+                            break;
+                        }
+                    }
+                    backend_addr = todo->nelts ?
+                        APR_ARRAY_IDX(todo, 0, apr_sockaddr_t *) : NULL;
                     continue;
                 }
             }
@@ -3162,6 +3658,124 @@ PROXY_DECLARE(int) ap_proxy_connection_create(const char *proxy_function,
     return proxy_connection_create(proxy_function, conn, NULL, s);
 }
 
+/*
+ * Establish worker->s->warmup connections to the backend (including the TLS
+ * handshake for https), and put them in the worker's pool for the first
+ * requests to reuse.
+ */
+PROXY_DECLARE(int) ap_proxy_warmup_worker(const char *proxy_function,
+                                          proxy_worker *worker,
+                                          server_rec *s)
+{
+    proxy_conn_rec **conns;
+    apr_pool_t *p;
+    int n = worker->s->warmup, i, established = 0, is_ssl;
+
+    if (n <= 0 || PROXY_WORKER_IS_GENERIC(worker)
+            || !worker->s->is_address_reusable || worker->s->disablereuse) {
+        return OK;
+    }
+    if (!strcasecmp(worker->s->scheme, "https")) {
+        is_ssl = 1;
+    }
+    else if (!strcasecmp(worker->s->scheme, "http")) {
+        is_ssl = 0;
+    }
+    else {
+        return DECLINED;
+    }
+    if (is_ssl && !ap_proxy_ssl_enable(NULL)) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10124)
+                     "%s: can't warm up %s, mod_ssl not configured?",
+                     proxy_function, worker->s->name);
+        return DECLINED;
+    }
+    /* Don't wait for connections we can't have */
+    if (!worker->cp->res) {
+        n = 1;
+    }
+    else if (n > worker->s->hmax) {
+        n = worker->s->hmax;
+    }
+
+    apr_pool_create(&p, worker->cp->pool);
+    apr_pool_tag(p, "proxy_warmup");
+    conns = apr_pcalloc(p, n * sizeof(proxy_conn_rec *));
+    for (i = 0; i < n; ++i) {
+        proxy_conn_rec *conn;
+        apr_status_t err = APR_SUCCESS;
+
+        if (ap_proxy_acquire_connection(proxy_function, &conns[i],
+                                        worker, s) != OK) {
+            break;
+        }
+        conn = conns[i];
+        conn->is_ssl = is_ssl;
+        if (!conn->hostname) {
+            conn->hostname = apr_pstrdup(conn->pool, worker->s->hostname);
+            conn->port = worker->s->port;
+        }
+        if (*worker->s->uds_path) {
+            if (!conn->uds_path) {
+                conn->uds_path = apr_pstrdup(conn->pool,
+                                             worker->s->uds_path);
+            }
+        }
+        else if (worker_address_get(conn, s, &err) != OK
+                 || err != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_WARNING, err, s, APLOGNO(10125)
+                         "%s: DNS lookup failure for %s, not warming up",
+                         proxy_function, conn->hostname);
+            conn->close = 1;
+            break;
+        }
+        if (is_ssl && !conn->ssl_hostname) {
+            apr_ipsubnet_t *ip;
+            /* As computed by ap_proxy_determine_connection() for a reverse
+             * proxy request, no SNI for an IP address.
+             */
+            if (apr_ipsubnet_create(&ip, conn->hostname, NULL,
+                                    p) != APR_SUCCESS) {
+                conn->ssl_hostname = apr_pstrdup(conn->scpool,
+                                                 conn->hostname);
+            }
+        }
+        if (ap_proxy_connect_backend(proxy_function, conn, worker, s) != OK
+                || ap_proxy_connection_create(proxy_function, conn,
+                                              NULL, s) != OK) {
+            conn->close = 1;
+            break;
+        }
+        if (is_ssl) {
+            /* Have the handshake done */
+            apr_bucket_brigade *bb = conn->tmp_bb;
+            APR_BRIGADE_INSERT_TAIL(bb, apr_bucket_flush_create(
+                                        bb->bucket_alloc));
+            err = ap_pass_brigade(conn->connection->output_filters, bb);
+            apr_brigade_cleanup(bb);
+            if (err != APR_SUCCESS) {
+                ap_log_error(APLOG_MARK, APLOG_WARNING, err, s, APLOGNO(10126)
+                             "%s: TLS handshake with %pI (%s) failed, "
+                             "not warming up", proxy_function,
+                             conn->addr, conn->hostname);
+                conn->close = 1;
+                break;
+            }
+        }
+        established++;
+    }
+    for (i = 0; i < n && conns[i]; ++i) {
+        ap_proxy_release_connection(proxy_function, conns[i], s);
+    }
+    apr_pool_destroy(p);
+
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10127)
+                 "%s: warmed up %d/%d connections for %s",
+                 proxy_function, established, worker->s->warmup,
+                 worker->s->name);
+    return OK;
+}
+
 int ap_proxy_lb_workers(void)
 {
     /*
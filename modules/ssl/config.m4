@@ -30,6 +30,8 @@ ssl_engine_rand.lo dnl
 ssl_engine_vars.lo dnl
 ssl_scache.lo dnl
 ssl_util_stapling.lo dnl
+ssl_util_ticket.lo dnl
+ssl_util_certs.lo dnl
 ssl_util.lo dnl
 ssl_util_ssl.lo dnl
 ssl_engine_ocsp.lo dnl
@@ -30,6 +30,7 @@
 #include "util_md5.h"
 #include "util_mutex.h"
 #include "ap_provider.h"
+#include "ap_mpm.h"
 #include "http_config.h"
 
 #include "mod_proxy.h" /* for proxy_hook_section_post_config() */
@@ -87,6 +88,14 @@ static const command_rec ssl_config_cmds[] = {
     SSL_CMD_SRV(RandomSeed, TAKE23,
                 "SSL Pseudo Random Number Generator (PRNG) seeding source "
                 "('startup|connect builtin|file:/path|exec:/path [bytes]')")
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    SSL_CMD_SRV(SessionTicketKeyRotation, TAKE12,
+                "Rotation interval of the shared TLS session ticket keys "
+                "('off' or seconds [number of previous keys accepted])")
+    SSL_CMD_SRV(SessionTicketKeyStore, TAKE12,
+                "Encrypted file where the TLS session ticket keys are kept "
+                "across restarts ('/path/to/file [/path/to/secret]')")
+#endif
 
     /*
      * Per-server context configuration directives
@@ -161,6 +170,18 @@ static const command_rec ssl_config_cmds[] = {
     SSL_CMD_SRV(Compression, FLAG,
                 "Enable SSL level compression "
                 "(`on', `off')")
+    SSL_CMD_SRV(KernelTLS, FLAG,
+                "Let the kernel encrypt outgoing TLS records "
+                "(`on', `off')")
+    SSL_CMD_SRV(DynamicRecordSize, FLAG,
+                "Start responses with small TLS records, then grow them "
+                "(`on', `off')")
+    SSL_CMD_SRV(LazyCertificateLoading, FLAG,
+                "Load the server certificates and keys on first use "
+                "(`on', `off')")
+    SSL_CMD_SRV(CertificateLoadThreads, TAKE1,
+                "Number of threads parsing the certificate and key files "
+                "at startup (`0' or `1' to parse them sequentially)")
     SSL_CMD_SRV(SessionTickets, FLAG,
                 "Enable or disable TLS session tickets"
                 "(`on', `off')")
@@ -456,6 +477,10 @@ static int ssl_hook_pre_config(apr_pool_t *pconf,
     ap_mutex_register(pconf, SSL_STAPLING_REFRESH_MUTEX_TYPE, NULL,
                       APR_LOCK_DEFAULT, 0);
 #endif
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    ap_mutex_register(pconf, SSL_TICKET_KEYS_MUTEX_TYPE, NULL,
+                      APR_LOCK_DEFAULT, 0);
+#endif
 
     return OK;
 }
@@ -651,6 +676,13 @@ int ssl_init_ssl_connection(conn_rec *c, request_rec *r)
 
     mctx = myCtxConfig(sslconn, sc);
 
+    if (!sslconn->is_proxy
+        && ssl_init_server_certs_lazy(server, c) != APR_SUCCESS) {
+        c->aborted = 1;
+
+        return DECLINED; /* XXX */
+    }
+
     /*
      * Create a new SSL connection with the configured server SSL context and
      * attach this to the socket. Additionally we register this attachment
@@ -763,11 +795,31 @@ static int ssl_hook_process_connection(conn_rec* c)
          * all kinds of useful things such as SNI and ALPN.
          */
         apr_bucket_brigade* temp;
+        apr_status_t rv;
+        int async = 0;
+
+        /* If the MPM can wait for the client's handshake data on our
+         * behalf, handshake in nonblocking mode and give the thread back
+         * when more data is needed; we'll be called again once readable.
+         */
+        if (c->cs && !c->master) {
+            if (ap_mpm_query(AP_MPMQ_CAN_WAITIO, &async) != APR_SUCCESS) {
+                async = 0;
+            }
+        }
 
         temp = apr_brigade_create(c->pool, c->bucket_alloc);
-        ap_get_brigade(c->input_filters, temp,
-                       AP_MODE_INIT, APR_BLOCK_READ, 0);
+        rv = ap_get_brigade(c->input_filters, temp, AP_MODE_INIT,
+                            async ? APR_NONBLOCK_READ : APR_BLOCK_READ, 0);
         apr_brigade_destroy(temp);
+
+        if (async && APR_STATUS_IS_EAGAIN(rv) && !c->aborted) {
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE3, 0, c,
+                          "SSL handshake in progress, waiting for the client");
+            c->cs->state = CONN_STATE_ASYNC_WAITIO;
+            c->cs->sense = CONN_SENSE_WANT_READ;
+            return OK;
+        }
     }
     
     return DECLINED;
@@ -784,9 +836,10 @@ static void ssl_register_hooks(apr_pool_t *p)
     static const char *pre_prr[] = { "mod_setenvif.c", NULL };
     /* The ssl_init_Module post_config hook should run before mod_proxy's
      * for the ssl proxy main configs to be merged with vhosts' before being
-     * themselves merged with mod_proxy's in proxy_hook_section_post_config.
+     * themselves merged with mod_proxy's in proxy_hook_section_post_config,
+     * and before mod_watchdog's for the OCSP stapling watchdog to start.
      */
-    static const char *b_pc[] = { "mod_proxy.c", NULL};
+    static const char *b_pc[] = { "mod_proxy.c", "mod_watchdog.c", NULL};
 
 
     ssl_io_filter_register(p);
@@ -160,6 +160,14 @@ SOURCE=.\ssl_util_stapling.c
 # End Source File
 # Begin Source File
 
+SOURCE=.\ssl_util_ticket.c
+# End Source File
+# Begin Source File
+
+SOURCE=.\ssl_util_certs.c
+# End Source File
+# Begin Source File
+
 SOURCE=.\ssl_util.c
 # End Source File
 # Begin Source File
@@ -78,6 +78,14 @@ SSLModConfigRec *ssl_config_global_create(server_rec *s)
     mc->stapling_cache_mutex   = NULL;
     mc->stapling_refresh_mutex = NULL;
 #endif
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    mc->ticket_ring_shm        = NULL;
+    mc->ticket_ring            = NULL;
+    mc->ticket_ring_mutex      = NULL;
+#endif
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+    mc->cert_files             = NULL;
+#endif
 
     apr_pool_userdata_set(mc, SSL_MOD_CONFIG_KEY,
                           apr_pool_cleanup_null,
@@ -230,6 +238,18 @@ static SSLSrvConfigRec *ssl_config_server_new(apr_pool_t *p)
     sc->compression            = UNSET;
 #endif
     sc->session_tickets        = UNSET;
+#ifdef HAVE_KTLS
+    sc->ktls                   = UNSET;
+#endif
+    sc->dyn_record_size        = UNSET;
+    sc->lazy_certs             = UNSET;
+    sc->cert_load_threads      = UNSET;
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    sc->ticket_key_rotation    = UNSET;
+    sc->ticket_key_previous    = UNSET;
+    sc->ticket_key_store       = NULL;
+    sc->ticket_key_secret      = NULL;
+#endif
     sc->policies               = NULL;
     sc->error_policy           = NULL;
     sc->enabled_on             = NULL;
@@ -374,6 +394,11 @@ void *ssl_config_server_merge(apr_pool_t *p, void *basev, void *addv)
     cfgMergeBool(compression);
 #endif
     cfgMergeBool(session_tickets);
+#ifdef HAVE_KTLS
+    cfgMergeBool(ktls);
+#endif
+    cfgMergeBool(dyn_record_size);
+    cfgMergeBool(lazy_certs);
 
     mrg->policies = NULL;
     cfgMergeString(error_policy);
@@ -1115,6 +1140,59 @@ const char *ssl_cmd_SSLCompression(cmd_parms *cmd, void *dcfg, int flag)
 #endif
 }
 
+const char *ssl_cmd_SSLKernelTLS(cmd_parms *cmd, void *dcfg, int flag)
+{
+#ifdef HAVE_KTLS
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    sc->ktls = flag ? TRUE : FALSE;
+    return NULL;
+#else
+    if (!flag) {
+        return NULL;
+    }
+    return "Kernel TLS offload unsupported; not implemented by the SSL "
+           "library or the platform";
+#endif
+}
+
+const char *ssl_cmd_SSLDynamicRecordSize(cmd_parms *cmd, void *dcfg, int flag)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    sc->dyn_record_size = flag ? TRUE : FALSE;
+    return NULL;
+}
+
+const char *ssl_cmd_SSLLazyCertificateLoading(cmd_parms *cmd, void *dcfg,
+                                              int flag)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    sc->lazy_certs = flag ? TRUE : FALSE;
+    return NULL;
+}
+
+const char *ssl_cmd_SSLCertificateLoadThreads(cmd_parms *cmd, void *dcfg,
+                                              const char *arg)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    const char *err;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+    if (!myModConfig(cmd->server)) {
+        return "SSLCertificateLoadThreads: cannot be used inside "
+               "SSLPolicyDefine";
+    }
+
+    sc->cert_load_threads = atoi(arg);
+    if (sc->cert_load_threads < 0 || sc->cert_load_threads > 256) {
+        return "SSLCertificateLoadThreads: the number of threads "
+               "must be between 0 and 256";
+    }
+
+    return NULL;
+}
+
 const char *ssl_cmd_SSLHonorCipherOrder(cmd_parms *cmd, void *dcfg, int flag)
 {
 #ifdef SSL_OP_CIPHER_SERVER_PREFERENCE
@@ -1237,6 +1315,87 @@ const char *ssl_cmd_SSLSessionTicketKeyFile(cmd_parms *cmd,
 }
 #endif
 
+#ifdef HAVE_TLS_TICKET_KEY_RING
+const char *ssl_cmd_SSLSessionTicketKeyRotation(cmd_parms *cmd,
+                                                void *dcfg,
+                                                const char *arg1,
+                                                const char *arg2)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    const char *err;
+    apr_interval_time_t rotation;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+    if (!myModConfig(cmd->server)) {
+        return "SSLSessionTicketKeyRotation: cannot be used inside "
+               "SSLPolicyDefine";
+    }
+
+    if (strcEQ(arg1, "off")) {
+        if (arg2) {
+            return "SSLSessionTicketKeyRotation: no number of previous "
+                   "keys allowed with 'off'";
+        }
+        sc->ticket_key_rotation = 0;
+        return NULL;
+    }
+    if (ap_timeout_parameter_parse(arg1, &rotation, "s") != APR_SUCCESS
+        || rotation < apr_time_from_sec(60)) {
+        return "SSLSessionTicketKeyRotation: 'off' or an interval of "
+               "at least 60 seconds is required";
+    }
+    sc->ticket_key_rotation = rotation;
+
+    if (arg2) {
+        sc->ticket_key_previous = atoi(arg2);
+        if (sc->ticket_key_previous < 0 || sc->ticket_key_previous > 14) {
+            return "SSLSessionTicketKeyRotation: the number of previous "
+                   "keys must be between 0 and 14";
+        }
+    }
+
+    return NULL;
+}
+
+const char *ssl_cmd_SSLSessionTicketKeyStore(cmd_parms *cmd,
+                                             void *dcfg,
+                                             const char *arg1,
+                                             const char *arg2)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(cmd->server);
+    const char *err;
+
+    if ((err = ap_check_cmd_context(cmd, GLOBAL_ONLY))) {
+        return err;
+    }
+    if (!myModConfig(cmd->server)) {
+        return "SSLSessionTicketKeyStore: cannot be used inside "
+               "SSLPolicyDefine";
+    }
+
+    sc->ticket_key_store = ap_server_root_relative(cmd->pool, arg1);
+    if (!sc->ticket_key_store) {
+        return apr_pstrcat(cmd->pool, "SSLSessionTicketKeyStore: "
+                           "invalid path '", arg1, "'", NULL);
+    }
+    if (arg2) {
+        sc->ticket_key_secret = ap_server_root_relative(cmd->pool, arg2);
+        if (!sc->ticket_key_secret) {
+            return apr_pstrcat(cmd->pool, "SSLSessionTicketKeyStore: "
+                               "invalid path '", arg2, "'", NULL);
+        }
+    }
+    else {
+        sc->ticket_key_secret = apr_pstrcat(cmd->pool, sc->ticket_key_store,
+                                            ".secret", NULL);
+    }
+
+    return NULL;
+}
+#endif
+
 #define NO_PER_DIR_SSL_CA \
     "Your SSL library does not have support for per-directory CA"
 
@@ -2753,6 +2912,12 @@ static void ssl_srv_dump(SSLSrvConfigRec *sc, apr_pool_t *p,
 #ifndef OPENSSL_NO_COMP
     DMP_ON_OFF("SSLCompression", sc->compression);
 #endif
+#ifdef HAVE_KTLS
+    DMP_ON_OFF("SSLKernelTLS", sc->ktls);
+#endif
+    DMP_ON_OFF("SSLDynamicRecordSize", sc->dyn_record_size);
+    DMP_ON_OFF("SSLLazyCertificateLoading", sc->lazy_certs);
+    DMP_LONG(  "SSLCertificateLoadThreads", sc->cert_load_threads);
 
     modssl_ctx_dump(sc->server, p, 0, out, indent, psep);
 
@@ -2763,6 +2928,10 @@ static void ssl_srv_dump(SSLSrvConfigRec *sc, apr_pool_t *p,
     DMP_ON_OFF("SSLFIPS", sc->fips);
 #endif
     DMP_ON_OFF("SSLSessionTickets", sc->session_tickets);
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    DMP_ITIME( "SSLSessionTicketKeyRotation", sc->ticket_key_rotation);
+    DMP_STRING("SSLSessionTicketKeyStore", sc->ticket_key_store);
+#endif
     DMP_STRARR("SSLPolicy", sc->policies);
 }
 
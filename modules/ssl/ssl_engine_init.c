@@ -30,7 +30,9 @@
 #include "mod_ssl.h"
 #include "mod_ssl_openssl.h"
 #include "mpm_common.h"
+#include "util_md5.h"
 #include "mod_md.h"
+#include "apr_atomic.h"
 
 static apr_status_t ssl_init_ca_cert_path(server_rec *, apr_pool_t *, const char *,
                                           STACK_OF(X509_NAME) *, STACK_OF(X509_INFO) *);
@@ -366,6 +368,23 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
         return rv;
     }
 
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    /*
+     * initialize the shared session ticket keys
+     */
+    if ((rv = ssl_ticket_ring_init(base_server, p, ptemp)) != APR_SUCCESS) {
+        return rv;
+    }
+#endif
+
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+    /*
+     * Parse the certificate and key files of all servers at once,
+     * unless unchanged since the last restart
+     */
+    ssl_cert_files_preload(base_server, ptemp);
+#endif
+
     pphrases = apr_array_make(ptemp, 2, sizeof(char *));
 
     /*
@@ -391,6 +410,10 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
         }
     }
 
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+    ssl_cert_files_fix(base_server, p);
+#endif
+
     if (pphrases->nelts > 0) {
         memset(pphrases->elts, 0, pphrases->elt_size * pphrases->nelts);
         pphrases->nelts = 0;
@@ -405,6 +428,13 @@ apr_status_t ssl_init_Module(apr_pool_t *p, apr_pool_t *plog,
         return rv;
     }
 
+#ifdef HAVE_OCSP_STAPLING
+    /*
+     * Renew the stapled OCSP responses in the background, if possible
+     */
+    ssl_stapling_watchdog_init(base_server, p);
+#endif
+
     for (s = base_server; s; s = s->next) {
         SSLDirConfigRec *sdc = ap_get_module_config(s->lookup_defaults,
                                                     &ssl_module);
@@ -738,6 +768,13 @@ static apr_status_t ssl_init_ctx_protocol(server_rec *s,
     }
 #endif
 
+#ifdef HAVE_KTLS
+    /* Frontend connections only, the proxy does not send files */
+    if (!mctx->pkp && sc->ktls == TRUE) {
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    }
+#endif
+
 #ifdef SSL_OP_NO_TICKET
     /*
      * Configure using RFC 5077 TLS session tickets
@@ -1059,6 +1096,33 @@ static int use_certificate_chain(
     return n;
 }
 
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+/*
+ * Same as use_certificate_chain(), with the certificates of a parsed file
+ */
+static int use_cached_certificate_chain(SSL_CTX *ctx, modssl_cert_file_t *cf,
+                                        int skipfirst)
+{
+    X509 *x509;
+    int i, n = 0;
+
+    SSL_CTX_clear_extra_chain_certs(ctx);
+    if (!cf->cert) {
+        return skipfirst ? -1 : 0;
+    }
+    for (i = skipfirst ? 0 : -1; i < sk_X509_num(cf->chain); i++) {
+        x509 = (i < 0) ? cf->cert : sk_X509_value(cf->chain, i);
+        X509_up_ref(x509);
+        if (!SSL_CTX_add_extra_chain_cert(ctx, x509)) {
+            X509_free(x509);
+            return -1;
+        }
+        n++;
+    }
+    return n;
+}
+#endif
+
 static apr_status_t ssl_init_ctx_cert_chain(server_rec *s,
                                             apr_pool_t *p,
                                             apr_pool_t *ptemp,
@@ -1067,6 +1131,9 @@ static apr_status_t ssl_init_ctx_cert_chain(server_rec *s,
     BOOL skip_first = FALSE;
     int i, n;
     const char *chain = mctx->cert_chain;
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+    modssl_cert_file_t *cf;
+#endif
 
     /*
      * Optionally configure extra server certificate chain certificates.
@@ -1094,6 +1161,12 @@ static apr_status_t ssl_init_ctx_cert_chain(server_rec *s,
         }
     }
 
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+    if ((cf = ssl_cert_files_get(s, ptemp, chain))) {
+        n = use_cached_certificate_chain(mctx->ssl_ctx, cf, skip_first);
+    }
+    else
+#endif
     n = use_certificate_chain(mctx->ssl_ctx, (char *)chain, skip_first, NULL);
     if (n < 0) {
         ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(01903)
@@ -1196,6 +1269,43 @@ static int ssl_no_passwd_prompt_cb(char *buf, int size, int rwflag,
    return 0;
 }
 
+/*
+ * Configure a certificate, with its chain or not, and its private key,
+ * from the parsed files if they are cached
+ */
+static int ssl_init_use_certificate(server_rec *s, apr_pool_t *ptemp,
+                                    SSL_CTX *ctx, const char *file,
+                                    int with_chain)
+{
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+    modssl_cert_file_t *cf = ssl_cert_files_get(s, ptemp, file);
+
+    if (cf && cf->cert) {
+        if (SSL_CTX_use_certificate(ctx, cf->cert) < 1) {
+            return 0;
+        }
+        return with_chain ? (int)SSL_CTX_set1_chain(ctx, cf->chain) : 1;
+    }
+#endif
+    if (with_chain) {
+        return SSL_CTX_use_certificate_chain_file(ctx, file);
+    }
+    return SSL_CTX_use_certificate_file(ctx, file, SSL_FILETYPE_PEM);
+}
+
+static int ssl_init_use_private_key(server_rec *s, apr_pool_t *ptemp,
+                                    SSL_CTX *ctx, const char *file)
+{
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+    modssl_cert_file_t *cf = ssl_cert_files_get(s, ptemp, file);
+
+    if (cf && cf->pkey) {
+        return SSL_CTX_use_PrivateKey(ctx, cf->pkey);
+    }
+#endif
+    return SSL_CTX_use_PrivateKey_file(ctx, file, SSL_FILETYPE_PEM);
+}
+
 static apr_status_t ssl_init_server_certs(server_rec *s,
                                           apr_pool_t *p,
                                           apr_pool_t *ptemp,
@@ -1230,8 +1340,8 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
 
         /* first the certificate (public key) */
         if (mctx->cert_chain) {
-            if ((SSL_CTX_use_certificate_file(mctx->ssl_ctx, certfile,
-                                              SSL_FILETYPE_PEM) < 1)) {
+            if ((ssl_init_use_certificate(s, ptemp, mctx->ssl_ctx,
+                                          certfile, 0) < 1)) {
                 ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(02561)
                              "Failed to configure certificate %s, check %s",
                              key_id, certfile);
@@ -1239,8 +1349,8 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
                 return APR_EGENERAL;
             }
         } else {
-            if ((SSL_CTX_use_certificate_chain_file(mctx->ssl_ctx,
-                                                    certfile) < 1)) {
+            if ((ssl_init_use_certificate(s, ptemp, mctx->ssl_ctx,
+                                          certfile, 1) < 1)) {
                 ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(02562)
                              "Failed to configure certificate %s (with chain),"
                              " check %s", key_id, certfile);
@@ -1258,8 +1368,8 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
 
         ERR_clear_error();
 
-        if ((SSL_CTX_use_PrivateKey_file(mctx->ssl_ctx, keyfile,
-                                         SSL_FILETYPE_PEM) < 1) &&
+        if ((ssl_init_use_private_key(s, ptemp, mctx->ssl_ctx,
+                                      keyfile) < 1) &&
             (ERR_GET_FUNC(ERR_peek_last_error())
                 != X509_F_X509_CHECK_PRIVATE_KEY)) {
             ssl_asn1_t *asn1;
@@ -1268,8 +1378,11 @@ static apr_status_t ssl_init_server_certs(server_rec *s,
 
             ERR_clear_error();
 
-            /* perhaps it's an encrypted private key, so try again */
-            ssl_load_encrypted_pkey(s, ptemp, i, keyfile, &pphrases);
+            /* perhaps it's an encrypted private key, so try again
+             * (unless loaded lazily, without a pass phrase dialog) */
+            if (pphrases) {
+                ssl_load_encrypted_pkey(s, ptemp, i, keyfile, &pphrases);
+            }
 
             if (!(asn1 = ssl_asn1_table_get(mc->tPrivateKey, key_id)) ||
                 !(ptr = asn1->cpData) ||
@@ -1409,6 +1522,20 @@ static apr_status_t ssl_init_ticket_key(server_rec *s,
     modssl_ticket_key_t *ticket_key = mctx->ticket_key;
 
     if (!ticket_key->file_path) {
+#ifdef HAVE_TLS_TICKET_KEY_RING
+        /* Use the shared keys, unless tickets are disabled */
+        if (mySrvConfig(s)->session_tickets != FALSE
+            && ssl_ticket_ring_enabled(s)) {
+            if (!SSL_CTX_set_tlsext_ticket_key_cb(mctx->ssl_ctx,
+                                                  ssl_callback_SessionTicket)) {
+                ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(10155)
+                             "Unable to initialize TLS session ticket key "
+                             "callback (incompatible OpenSSL version?)");
+                ssl_log_ssl_error(SSLLOG_MARK, APLOG_EMERG, s);
+                return ssl_die(s);
+            }
+        }
+#endif
         return APR_SUCCESS;
     }
 
@@ -1665,6 +1792,47 @@ static apr_status_t ssl_cleanup_proxy_ctx(void *data)
     return APR_SUCCESS;
 }
 
+/*
+ * Client side session cache for the proxy, using the (shared) SSLSessionCache
+ * so that handshakes with the backends can be abbreviated by any child and
+ * across restarts. The sessions are cached under a digest of the settings
+ * here, such that resumption never bypasses a different verification or
+ * client certificate, completed with the backend address and SNI for each
+ * connection (see ssl_io_filter_handshake()).
+ */
+static void ssl_init_proxy_session_cache(server_rec *s,
+                                         apr_pool_t *p,
+                                         apr_pool_t *ptemp,
+                                         modssl_ctx_t *proxy)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    SSL_CTX *ctx = proxy->ssl_ctx;
+    const char *settings;
+
+    if (!mc->sesscache) {
+        return;
+    }
+
+    settings = apr_psprintf(ptemp, "%s|%d|%s|%s|%s|%s|%s|%s|%d|%d|%s|%s|%d",
+                            ssl_util_vhostid(ptemp, s), proxy->protocol,
+                            proxy->pkp->cert_file, proxy->pkp->cert_path,
+                            proxy->pkp->ca_cert_file,
+                            proxy->auth.ca_cert_file,
+                            proxy->auth.ca_cert_path,
+                            proxy->auth.cipher_suite,
+                            proxy->auth.verify_mode,
+                            proxy->auth.verify_depth,
+                            proxy->crl_file, proxy->crl_path,
+                            proxy->crl_check_mask);
+    proxy->proxy_sess_ctx = ap_md5(p, (const unsigned char *)settings);
+
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT
+                                        | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx,    ssl_callback_ProxyNewSessionCacheEntry);
+    SSL_CTX_sess_set_get_cb(ctx,    NULL);
+    SSL_CTX_sess_set_remove_cb(ctx, NULL);
+}
+
 static apr_status_t ssl_init_proxy_ctx(server_rec *s,
                                        apr_pool_t *p,
                                        apr_pool_t *ptemp,
@@ -1689,9 +1857,47 @@ static apr_status_t ssl_init_proxy_ctx(server_rec *s,
         return rv;
     }
 
+    ssl_init_proxy_session_cache(s, p, ptemp, proxy);
+
     return APR_SUCCESS;
 }
 
+/*
+ * Whether the certificates of a server can be loaded on first use: not
+ * when they are needed at startup (OCSP stapling), nor when they may
+ * come from elsewhere (SSLOpenSSLConfCmd, Managed Domains).
+ */
+static int ssl_init_lazy_allowed(server_rec *s, apr_pool_t *p,
+                                 SSLSrvConfigRec *sc)
+{
+    const char *reason = NULL;
+
+    if (sc->server->pks->cert_files->nelts == 0) {
+        reason = "no SSLCertificateFile";
+    }
+#ifdef HAVE_OCSP_STAPLING
+    else if (sc->server->stapling_enabled == TRUE) {
+        reason = "SSLUseStapling is on";
+    }
+#endif
+#ifdef HAVE_SSL_CONF_CMD
+    else if (sc->server->ssl_ctx_param->nelts > 0) {
+        reason = "SSLOpenSSLConfCmd is used";
+    }
+#endif
+    else if (md_is_managed && md_is_managed(s)) {
+        reason = "it is a Managed Domain";
+    }
+
+    if (reason) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10156)
+                     "Init: (%s) SSLLazyCertificateLoading ignored, %s",
+                     ssl_util_vhostid(p, s), reason);
+        return 0;
+    }
+    return 1;
+}
+
 static apr_status_t ssl_init_server_ctx(server_rec *s,
                                         apr_pool_t *p,
                                         apr_pool_t *ptemp,
@@ -1768,8 +1974,14 @@ static apr_status_t ssl_init_server_ctx(server_rec *s,
         return rv;
     }
 
-    if ((rv = ssl_init_server_certs(s, p, ptemp, sc->server, pphrases))
-        != APR_SUCCESS) {
+    if (sc->lazy_certs == TRUE && ssl_init_lazy_allowed(s, p, sc)) {
+        sc->server->pks->certs_lazy = 1;
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10157)
+                     "Init: (%s) certificates and keys will be loaded "
+                     "on first use", sc->vhost_id);
+    }
+    else if ((rv = ssl_init_server_certs(s, p, ptemp, sc->server, pphrases))
+             != APR_SUCCESS) {
         return rv;
     }
 
@@ -1798,7 +2010,8 @@ static apr_status_t ssl_init_server_ctx(server_rec *s,
     }
 #endif
 
-    if (SSL_CTX_check_private_key(sc->server->ssl_ctx) != 1) {
+    if (!sc->server->pks->certs_lazy
+        && SSL_CTX_check_private_key(sc->server->ssl_ctx) != 1) {
         ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(02572)
                      "Failed to configure at least one certificate and key "
                      "for %s", sc->vhost_id);
@@ -1891,6 +2104,66 @@ apr_status_t ssl_init_ConfigureServer(server_rec *s,
     return APR_SUCCESS;
 }
 
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *lazy_certs_mutex;
+#endif
+
+/*
+ * Load the certificates and keys of a server with SSLLazyCertificateLoading
+ * on first use, once per child.  Encrypted private keys can't be loaded
+ * this way, unless already decrypted at startup (e.g. by another server).
+ */
+apr_status_t ssl_init_server_certs_lazy(server_rec *s, conn_rec *c)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(s);
+    modssl_pk_server_t *pks = sc->server ? sc->server->pks : NULL;
+    apr_uint32_t loaded;
+    apr_pool_t *ptemp;
+    apr_status_t rv;
+
+    if (!pks || !pks->certs_lazy) {
+        return APR_SUCCESS;
+    }
+    loaded = apr_atomic_read32(&pks->certs_loaded);
+    if (loaded) {
+        return (loaded == 1) ? APR_SUCCESS : APR_EGENERAL;
+    }
+
+#if APR_HAS_THREADS
+    if (lazy_certs_mutex) {
+        apr_thread_mutex_lock(lazy_certs_mutex);
+    }
+#endif
+    loaded = apr_atomic_read32(&pks->certs_loaded);
+    if (!loaded) {
+        apr_pool_create(&ptemp, c->pool);
+        apr_pool_tag(ptemp, "ssl_lazy_certs");
+        rv = ssl_init_server_certs(s, ptemp, ptemp, sc->server, NULL);
+        apr_pool_destroy(ptemp);
+
+        loaded = (rv == APR_SUCCESS) ? 1 : 2;
+        apr_atomic_set32(&pks->certs_loaded, loaded);
+        if (loaded == 1) {
+            ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(10158)
+                          "Certificates and keys of %s loaded on first use",
+                          sc->vhost_id);
+        }
+        else {
+            ap_log_cerror(APLOG_MARK, APLOG_ERR, rv, c, APLOGNO(10159)
+                          "Failed to load the certificates and keys of %s "
+                          "on first use, TLS disabled for it",
+                          sc->vhost_id);
+        }
+    }
+#if APR_HAS_THREADS
+    if (lazy_certs_mutex) {
+        apr_thread_mutex_unlock(lazy_certs_mutex);
+    }
+#endif
+
+    return (loaded == 1) ? APR_SUCCESS : APR_EGENERAL;
+}
+
 apr_status_t ssl_init_CheckServers(server_rec *base_server, apr_pool_t *p)
 {
     server_rec *s;
@@ -2152,6 +2425,14 @@ void ssl_init_Child(apr_pool_t *p, server_rec *s)
 #ifdef HAVE_OCSP_STAPLING
     ssl_stapling_mutex_reinit(s, p);
 #endif
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    ssl_ticket_ring_child_init(s, p);
+#endif
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&lazy_certs_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+#endif
+    ssl_vhost_index_child_init(p);
 }
 
 apr_status_t ssl_init_ModuleKill(void *data)
@@ -31,6 +31,13 @@
 #include "mod_ssl.h"
 #include "mod_ssl_openssl.h"
 #include "apr_date.h"
+#include "apr_md5.h"
+
+#ifdef HAVE_KTLS
+#include "apr_support.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
 
 APR_IMPLEMENT_OPTIONAL_HOOK_RUN_ALL(ssl, SSL, int, proxy_post_handshake,
                                     (conn_rec *c,SSL *ssl),
@@ -109,6 +116,13 @@ typedef struct {
     ap_filter_t        *pInputFilter;
     ap_filter_t        *pOutputFilter;
     SSLConnRec         *config;
+#ifdef HAVE_KTLS
+    int                 ktls_tx;  /* the kernel encrypts outgoing records */
+#endif
+    apr_size_t          record_size;    /* max payload of the next record */
+    unsigned int        record_ramp;    /* small records of this response */
+    apr_uint64_t        records_out;    /* records written */
+    apr_uint64_t        bytes_out;      /* payload bytes written */
 } ssl_filter_ctx_t;
 
 typedef struct {
@@ -116,6 +130,9 @@ typedef struct {
     conn_rec *c;
     apr_bucket_brigade *bb;    /* Brigade used as a buffer. */
     apr_status_t rc;
+#ifdef HAVE_KTLS
+    unsigned char ktls_record_type; /* non-application record to send */
+#endif
 } bio_filter_out_ctx_t;
 
 static bio_filter_out_ctx_t *bio_filter_out_ctx_new(ssl_filter_ctx_t *filter_ctx,
@@ -126,6 +143,9 @@ static bio_filter_out_ctx_t *bio_filter_out_ctx_new(ssl_filter_ctx_t *filter_ctx
     outctx->filter_ctx = filter_ctx;
     outctx->c = c;
     outctx->bb = apr_brigade_create(c->pool, c->bucket_alloc);
+#ifdef HAVE_KTLS
+    outctx->ktls_record_type = 0;
+#endif
 
     return outctx;
 }
@@ -161,6 +181,123 @@ static int bio_filter_out_flush(BIO *bio)
     return bio_filter_out_pass(outctx);
 }
 
+#ifdef HAVE_KTLS
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+
+/* Hand the transmit keys computed by OpenSSL to the kernel (the crypto_info
+ * is a struct tls12_crypto_info_* for the negotiated cipher); returns 1 if
+ * the kernel took over encryption, or 0 for OpenSSL to keep doing it. */
+static long bio_filter_out_ktls_start(bio_filter_out_ctx_t *outctx,
+                                      long is_tx, void *crypto_info)
+{
+    const struct tls_crypto_info *info = crypto_info;
+    apr_socket_t *sock = ap_get_conn_socket(outctx->c);
+    apr_os_sock_t fd;
+    socklen_t len;
+
+    /* Receiving is still done by OpenSSL */
+    if (!is_tx || !sock || apr_os_sock_get(&fd, sock) != APR_SUCCESS) {
+        return 0;
+    }
+
+    switch (info->cipher_type) {
+    case TLS_CIPHER_AES_GCM_128:
+        len = sizeof(struct tls12_crypto_info_aes_gcm_128);
+        break;
+#ifdef TLS_CIPHER_AES_GCM_256
+    case TLS_CIPHER_AES_GCM_256:
+        len = sizeof(struct tls12_crypto_info_aes_gcm_256);
+        break;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+    case TLS_CIPHER_CHACHA20_POLY1305:
+        len = sizeof(struct tls12_crypto_info_chacha20_poly1305);
+        break;
+#endif
+    default:
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, outctx->c,
+                      "kTLS: cipher type %d not supported by the kernel",
+                      (int)info->cipher_type);
+        return 0;
+    }
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0
+        || setsockopt(fd, SOL_TLS, TLS_TX, info, len) < 0) {
+        ap_log_cerror(APLOG_MARK, APLOG_DEBUG, errno, outctx->c, APLOGNO(10129)
+                      "kTLS: unable to enable kernel TLS transmit, "
+                      "falling back to userspace encryption");
+        return 0;
+    }
+
+    ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, outctx->c,
+                  "kTLS: kernel TLS transmit enabled");
+    outctx->filter_ctx->ktls_tx = 1;
+    return 1;
+}
+
+/* Send a non-application record (handshake message, alert) once the kernel
+ * encrypts: its content type goes in a control message, which the output
+ * filters can't carry, so it's written to the socket directly after what
+ * is pending in the core. Returns the number of bytes sent or -1. */
+static int bio_filter_out_ktls_send(BIO *bio, const char *in, int inl)
+{
+    bio_filter_out_ctx_t *outctx = (bio_filter_out_ctx_t *)BIO_get_data(bio);
+    apr_socket_t *sock = ap_get_conn_socket(outctx->c);
+    char cbuf[CMSG_SPACE(sizeof(unsigned char))];
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    apr_os_sock_t fd;
+    ssize_t n;
+
+    if (bio_filter_out_flush(bio) < 0) {
+        return -1;
+    }
+    if ((outctx->rc = apr_os_sock_get(&fd, sock)) != APR_SUCCESS) {
+        return -1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    iov.iov_base = (void *)in;
+    iov.iov_len = inl;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_TLS;
+    cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+    *CMSG_DATA(cmsg) = outctx->ktls_record_type;
+    msg.msg_controllen = cmsg->cmsg_len;
+
+    for (;;) {
+        n = sendmsg(fd, &msg, 0);
+        if (n >= 0) {
+            return (int)n;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            outctx->rc = apr_wait_for_io_or_timeout(NULL, sock, 0);
+            if (outctx->rc != APR_SUCCESS) {
+                return -1;
+            }
+        }
+        else if (errno != EINTR) {
+            outctx->rc = errno;
+            return -1;
+        }
+    }
+}
+
+#endif /* HAVE_KTLS */
+
 static int bio_filter_create(BIO *bio)
 {
     BIO_set_shutdown(bio, 1);
@@ -217,6 +354,12 @@ static int bio_filter_out_write(BIO *bio, const char *in, int inl)
      */
     BIO_clear_retry_flags(bio);
 
+#ifdef HAVE_KTLS
+    if (outctx->ktls_record_type) {
+        return bio_filter_out_ktls_send(bio, in, inl);
+    }
+#endif
+
     /* Use a transient bucket for the output data - any downstream
      * filter must setaside if necessary. */
     e = apr_bucket_transient_create(in, inl, outctx->bb->bucket_alloc);
@@ -279,6 +422,20 @@ static long bio_filter_out_ctrl(BIO *bio, int cmd, long num, void *ptr)
       case BIO_CTRL_DUP:
         ret = 1;
         break;
+#ifdef HAVE_KTLS
+      case BIO_CTRL_SET_KTLS:
+        ret = bio_filter_out_ktls_start(outctx, num, ptr);
+        break;
+      case BIO_CTRL_GET_KTLS_SEND:
+        ret = outctx->filter_ctx->ktls_tx;
+        break;
+      case BIO_CTRL_SET_KTLS_TX_SEND_CTRL_MSG:
+        outctx->ktls_record_type = (unsigned char)num;
+        break;
+      case BIO_CTRL_CLEAR_KTLS_TX_CTRL_MSG:
+        outctx->ktls_record_type = 0;
+        break;
+#endif
         /* N/A */
       case BIO_C_SET_BUF_MEM:
       case BIO_C_GET_BUF_MEM_PTR:
@@ -859,19 +1016,35 @@ static apr_status_t ssl_io_input_getline(bio_filter_in_ctx_t *inctx,
 }
 
 
-static apr_status_t ssl_filter_write(ap_filter_t *f,
-                                     const char *data,
-                                     apr_size_t len)
+/* Dynamic record sizing: a record can only be decrypted once it has
+ * been received entirely, so at the start of each response records
+ * fitting in a single TCP segment let the client start processing
+ * early.  After MODSSL_RECORD_RAMP of them, full sized
+ * records minimize the framing and per-record crypto overhead.
+ * MODSSL_RECORD_SMALL is the TLS payload of a 1500 bytes MTU segment
+ * (IP/TCP headers with options, TLS record header, IV and MAC). */
+#define MODSSL_RECORD_SMALL (1369)
+#define MODSSL_RECORD_LARGE (16384)
+#define MODSSL_RECORD_RAMP  (32)
+
+static apr_size_t ssl_filter_record_size(ssl_filter_ctx_t *filter_ctx)
+{
+    SSLSrvConfigRec *sc = mySrvConfig(filter_ctx->config->server);
+
+    if (sc->dyn_record_size != TRUE) {
+        return MODSSL_RECORD_LARGE;
+    }
+    return filter_ctx->record_size;
+}
+
+static apr_status_t ssl_filter_write_record(ap_filter_t *f,
+                                            const char *data,
+                                            apr_size_t len)
 {
     ssl_filter_ctx_t *filter_ctx = f->ctx;
     bio_filter_out_ctx_t *outctx;
     int res;
 
-    /* write SSL */
-    if (filter_ctx->pssl == NULL) {
-        return APR_EGENERAL;
-    }
-
     /* We rely on SSL_get_error() after the write, which requires an empty error
      * queue before the write in order to work properly.
      */
@@ -944,6 +1117,45 @@ static apr_status_t ssl_filter_write(ap_filter_t *f,
     return outctx->rc;
 }
 
+static apr_status_t ssl_filter_write(ap_filter_t *f,
+                                     const char *data,
+                                     apr_size_t len)
+{
+    ssl_filter_ctx_t *filter_ctx = f->ctx;
+    apr_size_t record_size, n;
+    apr_status_t rv;
+
+    /* write SSL */
+    if (filter_ctx->pssl == NULL) {
+        return APR_EGENERAL;
+    }
+
+    record_size = ssl_filter_record_size(filter_ctx);
+    while (len > 0) {
+        n = (len > record_size) ? record_size : len;
+        rv = ssl_filter_write_record(f, data, n);
+        if (rv != APR_SUCCESS) {
+            return rv;
+        }
+        filter_ctx->records_out += (n + MODSSL_RECORD_LARGE - 1)
+                                   / MODSSL_RECORD_LARGE;
+        filter_ctx->bytes_out += n;
+        data += n;
+        len -= n;
+
+        if (record_size < MODSSL_RECORD_LARGE
+                && ++filter_ctx->record_ramp >= MODSSL_RECORD_RAMP) {
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE4, 0, f->c,
+                          "growing TLS records to %d bytes after %"
+                          APR_UINT64_T_FMT " bytes",
+                          MODSSL_RECORD_LARGE, filter_ctx->bytes_out);
+            filter_ctx->record_size = record_size = MODSSL_RECORD_LARGE;
+        }
+    }
+
+    return APR_SUCCESS;
+}
+
 /* Just use a simple request.  Any request will work for this, because
  * we use a flag in the conn_rec->conn_vector now.  The fake request just
  * gets the request back to the Apache core so that a response can be sent.
@@ -1125,6 +1337,11 @@ static void ssl_filter_io_shutdown(ssl_filter_ctx_t *filter_ctx,
     SSL_set_shutdown(ssl, shutdown_type);
     modssl_smart_shutdown(ssl);
 
+    ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(10175)
+                  "TLS output: %" APR_UINT64_T_FMT " records, %"
+                  APR_UINT64_T_FMT " bytes", filter_ctx->records_out,
+                  filter_ctx->bytes_out);
+
     /* and finally log the fact that we've closed the connection */
     if (APLOG_CS_IS_LEVEL(c, mySrvFromConn(c), loglevel)) {
         /* Intentional no APLOGNO */
@@ -1174,6 +1391,37 @@ static apr_status_t ssl_io_filter_cleanup(void *data)
  * ap_hook_process_connection hook.
  */
 
+/* Offer the session cached for this backend (if any) for resumption, and
+ * set the key under which the new session will be cached otherwise. */
+static void ssl_io_proxy_session_init(conn_rec *c, SSLConnRec *sslconn,
+                                      SSL *ssl, const char *hostname)
+{
+    SSLModConfigRec *mc = myModConfig(sslconn->server);
+    modssl_ctx_t *proxy = sslconn->dc->proxy;
+    SSL_SESSION *session;
+    const char *key;
+
+    if (!mc->sesscache || !proxy->proxy_sess_ctx) {
+        return;
+    }
+
+    key = apr_psprintf(c->pool, "%s|%s|%pI", proxy->proxy_sess_ctx,
+                       hostname ? hostname : "", c->client_addr);
+    sslconn->proxy_sess_key = apr_palloc(c->pool, APR_MD5_DIGESTSIZE);
+    apr_md5(sslconn->proxy_sess_key, key, strlen(key));
+
+    session = ssl_scache_retrieve(sslconn->server, sslconn->proxy_sess_key,
+                                  APR_MD5_DIGESTSIZE, c->pool);
+    if (session) {
+        if (SSL_set_session(ssl, session)) {
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE3, 0, c,
+                          "SSL Proxy: offering cached session to %pI (%s)",
+                          c->client_addr, key);
+        }
+        SSL_SESSION_free(session);
+    }
+}
+
 /* Perform the SSL handshake (whether in client or server mode), if
  * necessary, for the given connection. */
 static apr_status_t ssl_io_filter_handshake(ssl_filter_ctx_t *filter_ctx)
@@ -1270,6 +1518,9 @@ static apr_status_t ssl_io_filter_handshake(ssl_filter_ctx_t *filter_ctx)
         }
 #endif /* defined HAVE_TLSEXT */
 
+        ssl_io_proxy_session_init(c, sslconn, filter_ctx->pssl,
+                                  hostname_note);
+
         if ((n = SSL_connect(filter_ctx->pssl)) <= 0) {
             ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, c, APLOGNO(02003)
                           "SSL Proxy connect failed");
@@ -1280,6 +1531,12 @@ static apr_status_t ssl_io_filter_handshake(ssl_filter_ctx_t *filter_ctx)
             return MODSSL_ERROR_BAD_GATEWAY;
         }
 
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, c,
+                      "SSL Proxy: %s handshake with %pI",
+                      SSL_session_reused(filter_ctx->pssl) ? "abbreviated"
+                                                           : "full",
+                      c->client_addr);
+
         cert = SSL_get_peer_certificate(filter_ctx->pssl);
 
         if (dc->proxy->ssl_check_peer_expire != FALSE) {
@@ -1631,7 +1888,8 @@ static apr_status_t ssl_io_filter_input(ap_filter_t *f,
  *
  * The coalescing filter merges many small buckets into larger buckets
  * where possible, allowing the SSL I/O output filter to handle them
- * more efficiently. */
+ * more efficiently.  With SSLDynamicRecordSize, no more is coalesced
+ * than fits in a small record, see ssl_filter_record_size(). */
 
 #define COALESCE_BYTES (2048)
 
@@ -1647,6 +1905,8 @@ static apr_status_t ssl_io_filter_coalesce(ap_filter_t *f,
     apr_size_t bytes = 0;
     struct coalesce_ctx *ctx = f->ctx;
     unsigned count = 0;
+    int dynamic = mySrvConfigFromConn(f->c)->dyn_record_size == TRUE;
+    apr_size_t limit = dynamic ? MODSSL_RECORD_SMALL : COALESCE_BYTES;
 
     /* The brigade consists of zero-or-more small data buckets which
      * can be coalesced (the prefix), followed by the remainder of the
@@ -1665,10 +1925,10 @@ static apr_status_t ssl_io_filter_coalesce(ap_filter_t *f,
          e != APR_BRIGADE_SENTINEL(bb)
              && !APR_BUCKET_IS_METADATA(e)
              && e->length != (apr_size_t)-1
-             && e->length < COALESCE_BYTES
-             && (bytes + e->length) < COALESCE_BYTES
+             && e->length < limit
+             && (bytes + e->length) < limit
              && (ctx == NULL
-                 || bytes + ctx->bytes + e->length < COALESCE_BYTES);
+                 || bytes + ctx->bytes + e->length < limit);
          e = APR_BUCKET_NEXT(e)) {
         if (e->length) count++; /* don't count zero-length buckets */
         bytes += e->length;
@@ -1750,8 +2010,30 @@ static apr_status_t ssl_io_filter_coalesce(ap_filter_t *f,
 
     /* If anything remains in the brigade, it must now be passed down
      * the filter stack, first prepending anything that has been
-     * coalesced. */
+     * coalesced.  With small records, top up the buffer with the head
+     * of the next data bucket beforehand, so that e.g. the response
+     * headers and the start of the body go out in the same record. */
     if (ctx && ctx->bytes) {
+        apr_size_t room = limit - ctx->bytes;
+
+        e = APR_BRIGADE_FIRST(bb);
+        if (dynamic && room > 0
+            && !APR_BUCKET_IS_METADATA(e)
+            && e->length != (apr_size_t)-1
+            && e->length > 0
+            && (e->length <= room
+                || apr_bucket_split(e, room) == APR_SUCCESS)) {
+            const char *data;
+            apr_size_t len;
+
+            if (apr_bucket_read(e, &data, &len, APR_BLOCK_READ) == APR_SUCCESS
+                && len <= room) {
+                memcpy(ctx->buffer + ctx->bytes, data, len);
+                ctx->bytes += len;
+                apr_bucket_delete(e);
+            }
+        }
+
         ap_log_cerror(APLOG_MARK, APLOG_TRACE4, 0, f->c,
                       "coalesce: passing on %" APR_SIZE_T_FMT " bytes", ctx->bytes);
 
@@ -1763,6 +2045,42 @@ static apr_status_t ssl_io_filter_coalesce(ap_filter_t *f,
     return ap_pass_brigade(f->next, bb);
 }
 
+#ifdef HAVE_KTLS
+/* Once the kernel encrypts, data buckets are passed down as is, so that
+ * file buckets can still be sent with sendfile(). */
+static apr_status_t ssl_io_filter_output_ktls(ap_filter_t *f,
+                                              apr_bucket_brigade *bb)
+{
+    ssl_filter_ctx_t *filter_ctx = f->ctx;
+    apr_bucket *bucket;
+
+    for (bucket = APR_BRIGADE_FIRST(bb);
+         bucket != APR_BRIGADE_SENTINEL(bb);
+         bucket = APR_BUCKET_NEXT(bucket)) {
+        if (AP_BUCKET_IS_EOC(bucket)) {
+            /* The close_notify alert must follow what precedes */
+            apr_bucket_brigade *tail;
+            apr_status_t status;
+
+            tail = apr_brigade_split_ex(bb, bucket, NULL);
+            status = APR_BRIGADE_EMPTY(bb) ? APR_SUCCESS
+                                           : ap_pass_brigade(f->next, bb);
+            if (status == APR_SUCCESS) {
+                ssl_filter_io_shutdown(filter_ctx, f->c, 0);
+            }
+            else {
+                ssl_filter_io_shutdown(filter_ctx, f->c, 1);
+            }
+            APR_BRIGADE_CONCAT(bb, tail);
+            apr_brigade_destroy(tail);
+            break;
+        }
+    }
+
+    return ap_pass_brigade(f->next, bb);
+}
+#endif
+
 static apr_status_t ssl_io_filter_output(ap_filter_t *f,
                                          apr_bucket_brigade *bb)
 {
@@ -1800,6 +2118,12 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
         return ssl_io_filter_error(inctx, bb, status, 0);
     }
 
+#ifdef HAVE_KTLS
+    if (filter_ctx->ktls_tx) {
+        return ssl_io_filter_output_ktls(f, bb);
+    }
+#endif
+
     while (!APR_BRIGADE_EMPTY(bb) && status == APR_SUCCESS) {
         apr_bucket *bucket = APR_BRIGADE_FIRST(bb);
 
@@ -1819,6 +2143,11 @@ static apr_status_t ssl_io_filter_output(ap_filter_t *f,
             if (AP_BUCKET_IS_EOC(bucket)) {
                 ssl_filter_io_shutdown(filter_ctx, f->c, 0);
             }
+            else if (AP_BUCKET_IS_EOR(bucket)) {
+                /* the next response starts with small records again */
+                filter_ctx->record_size = MODSSL_RECORD_SMALL;
+                filter_ctx->record_ramp = 0;
+            }
 
             /* Metadata buckets are passed one per brigade; it might
              * be more efficient (but also more complex) to use
@@ -2109,6 +2438,13 @@ void ssl_io_filter_init(conn_rec *c, request_rec *r, SSL *ssl)
     filter_ctx = apr_palloc(c->pool, sizeof(ssl_filter_ctx_t));
 
     filter_ctx->config          = myConnConfig(c);
+#ifdef HAVE_KTLS
+    filter_ctx->ktls_tx         = 0;
+#endif
+    filter_ctx->record_size     = MODSSL_RECORD_SMALL;
+    filter_ctx->record_ramp     = 0;
+    filter_ctx->records_out     = 0;
+    filter_ctx->bytes_out       = 0;
 
     ap_add_output_filter(ssl_io_coalesce, NULL, r, c);
 
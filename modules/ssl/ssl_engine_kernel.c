@@ -32,10 +32,12 @@
 #include "mod_ssl.h"
 #include "util_md5.h"
 #include "scoreboard.h"
+#include "apr_atomic.h"
 
 static void ssl_configure_env(request_rec *r, SSLConnRec *sslconn);
 #ifdef HAVE_TLSEXT
 static int ssl_find_vhost(void *servername, conn_rec *c, server_rec *s);
+static int ssl_set_vhost(conn_rec *c, server_rec *s);
 #endif
 
 #define SWITCH_STATUS_LINE "HTTP/1.1 101 Switching Protocols"
@@ -1944,6 +1946,41 @@ int ssl_callback_NewSessionCacheEntry(SSL *ssl, SSL_SESSION *session)
     return 0;
 }
 
+/*
+ *  This callback function is executed by OpenSSL whenever a new SSL_SESSION
+ *  is established with a backend (SSLProxy*). We store it in the
+ *  inter-process cache under the backend's key so that the next connections
+ *  of any process can resume it (see ssl_io_filter_handshake()).
+ */
+int ssl_callback_ProxyNewSessionCacheEntry(SSL *ssl, SSL_SESSION *session)
+{
+    conn_rec *conn      = (conn_rec *)SSL_get_app_data(ssl);
+    SSLConnRec *sslconn = myConnConfig(conn);
+    server_rec *s       = mySrvFromConn(conn);
+    SSLSrvConfigRec *sc = mySrvConfig(s);
+    long timeout        = sc->session_cache_timeout;
+    BOOL rc;
+
+    if (!sslconn || !sslconn->proxy_sess_key) {
+        return 0;
+    }
+
+    rc = ssl_scache_store(s, sslconn->proxy_sess_key, APR_MD5_DIGESTSIZE,
+                          apr_time_from_sec(SSL_SESSION_get_time(session)
+                                          + timeout),
+                          session, conn->pool);
+
+    ssl_session_log(s, "SET", sslconn->proxy_sess_key, APR_MD5_DIGESTSIZE,
+                    rc == TRUE ? "OK" : "BAD",
+                    "caching proxy", timeout);
+
+    /*
+     * return 0 which means to OpenSSL that the session is still
+     * valid and was not freed by us with SSL_SESSION_free().
+     */
+    return 0;
+}
+
 /*
  *  This callback function is executed by OpenSSL whenever a
  *  SSL_SESSION is looked up in the internal OpenSSL cache and it
@@ -2131,6 +2168,191 @@ void ssl_callback_Info(const SSL *ssl, int where, int rc)
     }
 }
 
+#ifdef HAVE_TLSEXT
+/*
+ * Index of the names of the virtual hosts on an address (those which
+ * ap_vhost_iterate_given_conn() walks for a connection), so that a server
+ * name is resolved without comparing it with every ServerName/ServerAlias:
+ * exact names are hashed, wildcard aliases of the form "*.domain" are
+ * hashed by their ".domain" suffix, and only the vhosts with other
+ * wildcards are still matched one by one.  As with the iteration, the
+ * first vhost (in configuration order) having a matching name wins.
+ *
+ * The name chains are only reachable through a connection, so a child
+ * builds the index of an address the first time it needs it, and adds it
+ * to a list which is then read without locking.
+ */
+typedef struct {
+    server_rec *s;
+    int order;
+} ssl_vhost_entry_t;
+
+typedef struct ssl_vhost_index_t ssl_vhost_index_t;
+struct ssl_vhost_index_t {
+    ssl_vhost_index_t *next;
+    void *lookup_data;              /* conn_rec->vhost_lookup_data */
+    apr_port_t port;
+    int count;
+    apr_hash_t *names;              /* name -> ssl_vhost_entry_t */
+    apr_hash_t *suffixes;           /* ".domain" -> ssl_vhost_entry_t */
+    apr_array_header_t *others;     /* of ssl_vhost_entry_t * */
+};
+
+static apr_pool_t *vhost_index_pool;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *vhost_index_mutex;
+#endif
+static void *volatile vhost_indexes;
+
+static void vhost_index_add_name(apr_hash_t *h, const char *name,
+                                 ssl_vhost_entry_t *e)
+{
+    char *key = apr_pstrdup(vhost_index_pool, name);
+
+    ap_str_tolower(key);
+    if (!apr_hash_get(h, key, APR_HASH_KEY_STRING)) {
+        apr_hash_set(h, key, APR_HASH_KEY_STRING, e);
+    }
+}
+
+static int vhost_index_add(void *baton, conn_rec *c, server_rec *s)
+{
+    ssl_vhost_index_t *idx = baton;
+    ssl_vhost_entry_t *e;
+    char **name;
+    int i, other = 0;
+
+    e = apr_palloc(vhost_index_pool, sizeof(*e));
+    e->s = s;
+    e->order = idx->count++;
+
+    vhost_index_add_name(idx->names, s->server_hostname, e);
+    if (s->names) {
+        name = (char **)s->names->elts;
+        for (i = 0; i < s->names->nelts; ++i) {
+            if (name[i]) {
+                vhost_index_add_name(idx->names, name[i], e);
+            }
+        }
+    }
+    if (s->wild_names) {
+        name = (char **)s->wild_names->elts;
+        for (i = 0; i < s->wild_names->nelts; ++i) {
+            if (!name[i]) {
+                continue;
+            }
+            if (name[i][0] == '*' && name[i][1] == '.'
+                && !strpbrk(name[i] + 1, "*?")) {
+                vhost_index_add_name(idx->suffixes, name[i] + 1, e);
+            }
+            else {
+                other = 1;
+            }
+        }
+    }
+    if (other) {
+        APR_ARRAY_PUSH(idx->others, ssl_vhost_entry_t *) = e;
+    }
+
+    return 0;
+}
+
+static ssl_vhost_index_t *vhost_index_find(void *lookup_data,
+                                           apr_port_t port)
+{
+    ssl_vhost_index_t *idx;
+
+    for (idx = vhost_indexes; idx; idx = idx->next) {
+        if (idx->lookup_data == lookup_data && idx->port == port) {
+            break;
+        }
+    }
+    return idx;
+}
+
+static ssl_vhost_index_t *vhost_index_get(conn_rec *c)
+{
+    apr_port_t port = c->local_addr->port;
+    ssl_vhost_index_t *idx;
+
+    if (!vhost_index_pool || !c->vhost_lookup_data) {
+        return NULL;
+    }
+    if ((idx = vhost_index_find(c->vhost_lookup_data, port))) {
+        return idx;
+    }
+
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(vhost_index_mutex);
+#endif
+    if (!(idx = vhost_index_find(c->vhost_lookup_data, port))) {
+        idx = apr_pcalloc(vhost_index_pool, sizeof(*idx));
+        idx->lookup_data = c->vhost_lookup_data;
+        idx->port = port;
+        idx->names = apr_hash_make(vhost_index_pool);
+        idx->suffixes = apr_hash_make(vhost_index_pool);
+        idx->others = apr_array_make(vhost_index_pool, 1,
+                                     sizeof(ssl_vhost_entry_t *));
+        ap_vhost_iterate_given_conn(c, vhost_index_add, idx);
+
+        idx->next = vhost_indexes;
+        apr_atomic_xchgptr((void *)&vhost_indexes, idx);
+
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE1, 0, c,
+                      "SNI index of %d virtual hosts built for %pI",
+                      idx->count, c->local_addr);
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(vhost_index_mutex);
+#endif
+
+    return idx;
+}
+
+static server_rec *vhost_index_lookup(ssl_vhost_index_t *idx, conn_rec *c,
+                                      const char *servername)
+{
+    ssl_vhost_entry_t *best, *e;
+    char *name, *dot;
+    int i;
+
+    name = apr_pstrdup(c->pool, servername);
+    ap_str_tolower(name);
+
+    best = apr_hash_get(idx->names, name, APR_HASH_KEY_STRING);
+    for (dot = strchr(name, '.'); dot; dot = strchr(dot + 1, '.')) {
+        e = apr_hash_get(idx->suffixes, dot, APR_HASH_KEY_STRING);
+        if (e && (!best || e->order < best->order)) {
+            best = e;
+        }
+    }
+    for (i = 0; i < idx->others->nelts; ++i) {
+        e = APR_ARRAY_IDX(idx->others, i, ssl_vhost_entry_t *);
+        if (best && e->order >= best->order) {
+            break;
+        }
+        if (ssl_util_vhost_matches(servername, e->s)) {
+            best = e;
+            break;
+        }
+    }
+
+    return best ? best->s : NULL;
+}
+#endif /* HAVE_TLSEXT */
+
+void ssl_vhost_index_child_init(apr_pool_t *p)
+{
+#ifdef HAVE_TLSEXT
+    apr_pool_create(&vhost_index_pool, p);
+    apr_pool_tag(vhost_index_pool, "ssl_vhost_index");
+#if APR_HAS_THREADS
+    apr_thread_mutex_create(&vhost_index_mutex, APR_THREAD_MUTEX_DEFAULT, p);
+#endif
+    vhost_indexes = NULL;
+#endif
+}
+
 #ifdef HAVE_TLSEXT
 /*
  * This function sets the virtual host from an extended
@@ -2152,14 +2374,28 @@ static apr_status_t init_vhost(conn_rec *c, SSL *ssl)
         
         servername = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
         if (servername) {
-            if (ap_vhost_iterate_given_conn(c, ssl_find_vhost,
-                                            (void *)servername)) {
+            ssl_vhost_index_t *idx = vhost_index_get(c);
+            int found;
+
+            if (idx) {
+                server_rec *s = vhost_index_lookup(idx, c, servername);
+                found = s ? ssl_set_vhost(c, s) : 0;
+            }
+            else {
+                found = ap_vhost_iterate_given_conn(c, ssl_find_vhost,
+                                                    (void *)servername);
+            }
+            if (found > 0) {
                 ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO(02043)
                               "SSL virtual host for servername %s found",
                               servername);
                 
                 return APR_SUCCESS;
             }
+            else if (found < 0) {
+                /* its certificates could not be loaded */
+                return APR_EINIT;
+            }
             else if (ssl_is_challenge(c, servername, &cert, &key)) {
             
                 sslcon->service_unavailable = 1;
@@ -2227,6 +2463,10 @@ int ssl_callback_ServerNameIndication(SSL *ssl, int *al, modssl_ctx_t *mctx)
     conn_rec *c = (conn_rec *)SSL_get_app_data(ssl);
     apr_status_t status = init_vhost(c, ssl);
     
+    if (status == APR_EINIT) {
+        *al = SSL_AD_INTERNAL_ERROR;
+        return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
     return (status == APR_SUCCESS)? SSL_TLSEXT_ERR_OK : SSL_TLSEXT_ERR_NOACK;
 }
 
@@ -2236,19 +2476,34 @@ int ssl_callback_ServerNameIndication(SSL *ssl, int *al, modssl_ctx_t *mctx)
  * with ap_vhost_iterate_given_conn())
  */
 static int ssl_find_vhost(void *servername, conn_rec *c, server_rec *s)
+{
+    if (!ssl_util_vhost_matches(servername, s)) {
+        return 0;
+    }
+    return ssl_set_vhost(c, s);
+}
+
+/*
+ * Switch the connection to the (matched) virtual host, returns 1 if done,
+ * or -1 if the certificates of a SSLLazyCertificateLoading host could
+ * not be loaded.
+ */
+static int ssl_set_vhost(conn_rec *c, server_rec *s)
 {
     SSLSrvConfigRec *sc;
     SSL *ssl;
-    BOOL found;
     SSLConnRec *sslcon;
 
-    found = ssl_util_vhost_matches(servername, s);
-
-    /* set SSL_CTX (if matched) */
+    /* set SSL_CTX */
     sslcon = myConnConfig(c);
-    if (found && (ssl = sslcon->ssl) &&
+    if ((ssl = sslcon->ssl) &&
         (sc = mySrvConfig(s))) {
-        SSL_CTX *ctx = SSL_set_SSL_CTX(ssl, sc->server->ssl_ctx);
+        SSL_CTX *ctx;
+
+        if (ssl_init_server_certs_lazy(s, c) != APR_SUCCESS) {
+            return -1;
+        }
+        ctx = SSL_set_SSL_CTX(ssl, sc->server->ssl_ctx);
         /*
          * SSL_set_SSL_CTX() only deals with the server cert,
          * so we need to duplicate a few additional settings
@@ -2324,7 +2579,8 @@ static int ssl_find_vhost(void *servername, conn_rec *c, server_rec *s)
 /*
  * This callback function is executed when OpenSSL needs a key for encrypting/
  * decrypting a TLS session ticket (RFC 5077) and a ticket key file has been
- * configured through SSLSessionTicketKeyFile.
+ * configured through SSLSessionTicketKeyFile, or the shared ticket keys are
+ * used.
  */
 int ssl_callback_SessionTicket(SSL *ssl,
                                unsigned char *keyname,
@@ -2340,6 +2596,13 @@ int ssl_callback_SessionTicket(SSL *ssl,
     modssl_ctx_t *mctx = myCtxConfig(sslconn, sc);
     modssl_ticket_key_t *ticket_key = mctx->ticket_key;
 
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    if (ticket_key && !ticket_key->file_path) {
+        return ssl_ticket_ring_callback(c, keyname, iv, cipher_ctx, hctx,
+                                        mode);
+    }
+#endif
+
     if (mode == 1) {
         /* 
          * OpenSSL is asking for a key for encrypting a ticket,
@@ -50,6 +50,7 @@
 #include "apr_fnmatch.h"
 #include "apr_strings.h"
 #include "apr_global_mutex.h"
+#include "apr_shm.h"
 #include "apr_optional.h"
 #include "ap_socache.h"
 #include "mod_auth.h"
@@ -203,6 +204,17 @@
 #define tlsext_tick_md EVP_sha256
 #endif
 #endif
+/* Shared ticket key ring, rotated in the background (its store is
+ * encrypted with AES-GCM) */
+#if defined(EVP_CTRL_GCM_SET_IVLEN)
+#define HAVE_TLS_TICKET_KEY_RING
+#endif
+#endif
+
+/* Cache of parsed certificate and key files, kept across restarts (the
+ * library must survive restarts, and provide SSL_CTX_set1_chain()) */
+#if !MODSSL_USE_OPENSSL_PRE_1_1_API && defined(SSL_CTRL_CHAIN)
+#define HAVE_SSL_CERT_FILE_CACHE
 #endif
 
 /* Secure Remote Password */
@@ -218,6 +230,16 @@
 
 #endif /* !defined(OPENSSL_NO_TLSEXT) && defined(SSL_set_tlsext_host_name) */
 
+/* Kernel TLS: OpenSSL hands the transmit keys to the output BIO once the
+ * handshake completes, the kernel encrypts from then on (Linux only). */
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_CTRL_SET_KTLS) \
+    && defined(__linux__)
+#include <linux/tls.h>
+#if defined(TLS_TX) && defined(TLS_SET_RECORD_TYPE)
+#define HAVE_KTLS
+#endif
+#endif
+
 #if MODSSL_USE_OPENSSL_PRE_1_1_API
 #define BN_get_rfc2409_prime_768   get_rfc2409_prime_768
 #define BN_get_rfc2409_prime_1024  get_rfc2409_prime_1024
@@ -517,6 +539,7 @@ typedef struct {
     
     const char *cipher_suite; /* cipher suite used in last reneg */
     int service_unavailable;  /* thouugh we negotiate SSL, no requests will be served */
+    unsigned char *proxy_sess_key; /* backend's session cache key (if any) */
 } SSLConnRec;
 
 /* BIG FAT WARNING: SSLModConfigRec has unusual memory lifetime: it is
@@ -581,6 +604,18 @@ typedef struct {
     apr_global_mutex_t   *stapling_refresh_mutex;
 #endif
 
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    /* The shared session ticket key ring, which survives restarts */
+    apr_shm_t            *ticket_ring_shm;
+    void                 *ticket_ring;
+    apr_global_mutex_t   *ticket_ring_mutex;
+#endif
+
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+    /* The parsed certificate and key files, which survive restarts */
+    void                 *cert_files;
+#endif
+
 } SSLModConfigRec;
 
 /** Structure representing configured filenames for certs and keys for
@@ -597,6 +632,11 @@ typedef struct {
     
     /* TLS service for this server is suspended */
     int service_unavailable;
+
+    /* Certificates and keys loaded on first use (SSLLazyCertificateLoading),
+     * certs_loaded is 1 once done, or 2 if it failed */
+    int certs_lazy;
+    apr_uint32_t certs_loaded;
 } modssl_pk_server_t;
 
 typedef struct {
@@ -610,6 +650,15 @@ typedef struct {
                                 * (ptr to array of ptrs) */
 } modssl_pk_proxy_t;
 
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+/** A parsed certificate and/or key file, see ssl_util_certs.c */
+typedef struct {
+    X509 *cert;                 /* the first certificate, if any */
+    STACK_OF(X509) *chain;      /* and the ones following it */
+    EVP_PKEY *pkey;             /* the private key, unless encrypted */
+} modssl_cert_file_t;
+#endif
+
 /** stuff related to authentication that can also be per-dir */
 typedef struct {
     /** known/trusted CAs */
@@ -710,6 +759,10 @@ typedef struct {
     BOOL ssl_check_peer_cn;
     BOOL ssl_check_peer_name;
     BOOL ssl_check_peer_expire;
+
+    /** digest of the client settings, sessions resumed with backends
+     * are cached under it (NULL if there is no session cache) */
+    const char *proxy_sess_ctx;
 } modssl_ctx_t;
 
 struct SSLSrvConfigRec {
@@ -731,6 +784,19 @@ struct SSLSrvConfigRec {
     BOOL             compression;
 #endif
     BOOL             session_tickets;
+#ifdef HAVE_KTLS
+    BOOL             ktls;
+#endif
+    BOOL             dyn_record_size;
+    BOOL             lazy_certs;
+    int              cert_load_threads; /* global, base server only */
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    /* global, read from the base server only */
+    apr_interval_time_t ticket_key_rotation;
+    int              ticket_key_previous;
+    const char      *ticket_key_store;
+    const char      *ticket_key_secret;
+#endif
     
     apr_array_header_t *policies;      /* policy that shall be applied to this config */
     const char      *error_policy;     /* error in policy merge, bubble up */
@@ -807,6 +873,10 @@ const char  *ssl_cmd_SSLCARevocationFile(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLCARevocationCheck(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLHonorCipherOrder(cmd_parms *cmd, void *dcfg, int flag);
 const char  *ssl_cmd_SSLCompression(cmd_parms *, void *, int flag);
+const char  *ssl_cmd_SSLKernelTLS(cmd_parms *, void *, int flag);
+const char  *ssl_cmd_SSLDynamicRecordSize(cmd_parms *, void *, int flag);
+const char  *ssl_cmd_SSLLazyCertificateLoading(cmd_parms *, void *, int flag);
+const char  *ssl_cmd_SSLCertificateLoadThreads(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLSessionTickets(cmd_parms *, void *, int flag);
 const char  *ssl_cmd_SSLVerifyClient(cmd_parms *, void *, const char *);
 const char  *ssl_cmd_SSLVerifyDepth(cmd_parms *, void *, const char *);
@@ -838,6 +908,10 @@ const char  *ssl_cmd_SSLProxyMachineCertificateChainFile(cmd_parms *, void *, co
 #ifdef HAVE_TLS_SESSION_TICKETS
 const char *ssl_cmd_SSLSessionTicketKeyFile(cmd_parms *cmd, void *dcfg, const char *arg);
 #endif
+#ifdef HAVE_TLS_TICKET_KEY_RING
+const char *ssl_cmd_SSLSessionTicketKeyRotation(cmd_parms *cmd, void *dcfg, const char *arg1, const char *arg2);
+const char *ssl_cmd_SSLSessionTicketKeyStore(cmd_parms *cmd, void *dcfg, const char *arg1, const char *arg2);
+#endif
 const char  *ssl_cmd_SSLProxyCheckPeerExpire(cmd_parms *cmd, void *dcfg, int flag);
 const char  *ssl_cmd_SSLProxyCheckPeerCN(cmd_parms *cmd, void *dcfg, int flag);
 const char  *ssl_cmd_SSLProxyCheckPeerName(cmd_parms *cmd, void *dcfg, int flag);
@@ -879,6 +953,8 @@ int          ssl_proxy_section_post_config(apr_pool_t *p, apr_pool_t *plog,
 STACK_OF(X509_NAME)
             *ssl_init_FindCAList(server_rec *, apr_pool_t *, const char *, const char *);
 void         ssl_init_Child(apr_pool_t *, server_rec *);
+apr_status_t ssl_init_server_certs_lazy(server_rec *, conn_rec *);
+void         ssl_vhost_index_child_init(apr_pool_t *);
 apr_status_t ssl_init_ModuleKill(void *data);
 
 /**  Apache API hooks  */
@@ -900,6 +976,7 @@ int          ssl_callback_SSLVerify(int, X509_STORE_CTX *);
 int          ssl_callback_SSLVerify_CRL(int, X509_STORE_CTX *, conn_rec *);
 int          ssl_callback_proxy_cert(SSL *ssl, X509 **x509, EVP_PKEY **pkey);
 int          ssl_callback_NewSessionCacheEntry(SSL *, SSL_SESSION *);
+int          ssl_callback_ProxyNewSessionCacheEntry(SSL *, SSL_SESSION *);
 SSL_SESSION *ssl_callback_GetSessionCacheEntry(SSL *, IDCONST unsigned char *, int, int *);
 void         ssl_callback_DelSessionCacheEntry(SSL_CTX *, SSL_SESSION *);
 void         ssl_callback_Info(const SSL *, int, int);
@@ -927,6 +1004,25 @@ SSL_SESSION *ssl_scache_retrieve(server_rec *, IDCONST UCHAR *, int, apr_pool_t
 void         ssl_scache_remove(server_rec *, IDCONST UCHAR *, int,
                                apr_pool_t *);
 
+/**  Shared Session Ticket Keys  */
+#ifdef HAVE_TLS_TICKET_KEY_RING
+apr_status_t ssl_ticket_ring_init(server_rec *, apr_pool_t *, apr_pool_t *);
+void         ssl_ticket_ring_child_init(server_rec *, apr_pool_t *);
+BOOL         ssl_ticket_ring_enabled(server_rec *);
+int          ssl_ticket_ring_callback(conn_rec *, unsigned char *,
+                                      unsigned char *, EVP_CIPHER_CTX *,
+                                      HMAC_CTX *, int);
+void         ssl_ticket_ring_status(request_rec *, int);
+#endif
+
+/**  Certificate and Key Files Cache  */
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+void         ssl_cert_files_preload(server_rec *, apr_pool_t *);
+modssl_cert_file_t *ssl_cert_files_get(server_rec *, apr_pool_t *,
+                                       const char *);
+void         ssl_cert_files_fix(server_rec *, apr_pool_t *);
+#endif
+
 /** OCSP Stapling Support */
 #ifdef HAVE_OCSP_STAPLING
 const char *ssl_cmd_SSLStaplingCache(cmd_parms *, void *, const char *);
@@ -941,6 +1037,7 @@ const char *ssl_cmd_SSLStaplingResponderTimeout(cmd_parms *, void *, const char
 const char *ssl_cmd_SSLStaplingForceURL(cmd_parms *, void *, const char *);
 apr_status_t modssl_init_stapling(server_rec *, apr_pool_t *, apr_pool_t *, modssl_ctx_t *);
 void         ssl_stapling_certinfo_hash_init(apr_pool_t *);
+void         ssl_stapling_watchdog_init(server_rec *, apr_pool_t *);
 int          ssl_stapling_init_cert(server_rec *, apr_pool_t *, apr_pool_t *,
                                     modssl_ctx_t *, X509 *);
 #endif
@@ -1008,6 +1105,7 @@ int          ssl_stapling_mutex_reinit(server_rec *, apr_pool_t *);
 #define SSL_CACHE_MUTEX_TYPE    "ssl-cache"
 #define SSL_STAPLING_CACHE_MUTEX_TYPE "ssl-stapling"
 #define SSL_STAPLING_REFRESH_MUTEX_TYPE "ssl-stapling-refresh"
+#define SSL_TICKET_KEYS_MUTEX_TYPE "ssl-ticket-keys"
 
 apr_status_t ssl_die(server_rec *);
 
@@ -1067,7 +1165,7 @@ int modssl_verify_ocsp(X509_STORE_CTX *ctx, SSLSrvConfigRec *sc,
 OCSP_RESPONSE *modssl_dispatch_ocsp_request(const apr_uri_t *uri,
                                             apr_interval_time_t timeout,
                                             OCSP_REQUEST *request,
-                                            conn_rec *c, apr_pool_t *p);
+                                            server_rec *s, apr_pool_t *p);
 
 /* Initialize OCSP trusted certificate list */
 void ssl_init_ocsp_certificates(server_rec *s, modssl_ctx_t *mctx);
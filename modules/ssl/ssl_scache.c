@@ -197,8 +197,12 @@ void ssl_scache_remove(server_rec *s, IDCONST UCHAR *id, int idlen,
 static int ssl_ext_status_hook(request_rec *r, int flags)
 {
     SSLModConfigRec *mc = myModConfig(r->server);
+    int tickets = 0;
 
-    if (mc == NULL || mc->sesscache == NULL)
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    tickets = ssl_ticket_ring_enabled(r->server);
+#endif
+    if (mc == NULL || (mc->sesscache == NULL && !tickets))
         return OK;
 
     if (!(flags & AP_STATUS_SHORT)) {
@@ -213,16 +217,24 @@ static int ssl_ext_status_hook(request_rec *r, int flags)
         ap_rputs("TLSSessionCacheStatus\n", r);
     }
 
-    if (mc->sesscache->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
-        ssl_mutex_on(r->server);
-    }
+    if (mc->sesscache) {
+        if (mc->sesscache->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+            ssl_mutex_on(r->server);
+        }
 
-    mc->sesscache->status(mc->sesscache_context, r, flags);
+        mc->sesscache->status(mc->sesscache_context, r, flags);
 
-    if (mc->sesscache->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
-        ssl_mutex_off(r->server);
+        if (mc->sesscache->flags & AP_SOCACHE_FLAG_NOTMPSAFE) {
+            ssl_mutex_off(r->server);
+        }
     }
 
+#ifdef HAVE_TLS_TICKET_KEY_RING
+    if (tickets) {
+        ssl_ticket_ring_status(r, flags);
+    }
+#endif
+
     if (!(flags & AP_STATUS_SHORT)) {
         ap_rputs("</td></tr>\n", r);
         ap_rputs("</table>\n", r);
@@ -0,0 +1,501 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*                      _             _
+ *  _ __ ___   ___   __| |    ___ ___| |  mod_ssl
+ * | '_ ` _ \ / _ \ / _` |   / __/ __| |  Apache Interface to OpenSSL
+ * | | | | | | (_) | (_| |   \__ \__ \ |
+ * |_| |_| |_|\___/ \__,_|___|___/___/_|
+ *                      |_____|
+ *  ssl_util_certs.c
+ *  Cache of parsed certificate and key files
+ */
+
+#include "ssl_private.h"
+#if APR_HAS_THREADS
+#include "apr_thread_pool.h"
+#endif
+
+#ifdef HAVE_SSL_CERT_FILE_CACHE
+
+/*
+ * The certificate, chain and key files of all the servers are parsed
+ * once per configuration (in parallel, by SSLCertificateLoadThreads
+ * threads), whatever the number of servers sharing them, and the parsed
+ * X509 and EVP_PKEY objects are kept in the parent across restarts.
+ *
+ * Files are still read at each restart, but parsed again only if their
+ * content (SHA-256) changed.  Those which are no longer configured are
+ * dropped once the servers are initialized.  Files that can't be read
+ * or parsed are not cached, so that the usual loading code reports the
+ * errors; likewise for encrypted private keys.
+ *
+ * Keeping the objects across restarts relies on OpenSSL 1.1.0 and later
+ * neither cleaning up its state nor being unloaded with mod_ssl; it is
+ * not done with a SSLCryptoDevice, whose keys may be bound to the engine.
+ */
+
+#define CERT_LOAD_THREADS_DEFAULT   4
+#define CERT_FILE_MAX_SIZE          (1024 * 1024)
+
+typedef struct {
+    modssl_cert_file_t cf;
+    char *path;
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    apr_uint32_t generation;
+} cert_file_entry_t;
+
+typedef struct {
+    apr_hash_t *files;
+    apr_uint32_t generation;
+    int open;                   /* entries can be added (during init) */
+} cert_cache_t;
+
+typedef struct cert_parse_batch_t cert_parse_batch_t;
+
+typedef struct {
+    cert_file_entry_t *entry;
+    const char *data;
+    apr_size_t len;
+    int parsed;
+    cert_parse_batch_t *batch;
+} cert_file_task_t;
+
+#if APR_HAS_THREADS
+struct cert_parse_batch_t {
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *done;
+    int pending;
+};
+#endif
+
+static cert_cache_t *cert_cache_get(SSLModConfigRec *mc)
+{
+    cert_cache_t *cache = mc->cert_files;
+
+    if (!cache) {
+        cache = apr_pcalloc(mc->pPool, sizeof(*cache));
+        cache->files = apr_hash_make(mc->pPool);
+        mc->cert_files = cache;
+    }
+    return cache;
+}
+
+static void cert_file_entry_free(cert_file_entry_t *e)
+{
+    X509_free(e->cf.cert);
+    sk_X509_pop_free(e->cf.chain, X509_free);
+    EVP_PKEY_free(e->cf.pkey);
+    free(e->path);
+    free(e);
+}
+
+/* prevent OpenSSL from showing its "Enter PEM pass phrase:" prompt */
+static int cert_file_no_passwd_cb(char *buf, int size, int rwflag,
+                                  void *userdata)
+{
+    return 0;
+}
+
+/* Whether the only error left by a PEM read loop is the end of input */
+static int cert_file_pem_eof(void)
+{
+    unsigned long err = ERR_peek_error();
+
+    return !err || (ERR_GET_LIB(err) == ERR_LIB_PEM
+                    && ERR_GET_REASON(err) == PEM_R_NO_START_LINE);
+}
+
+/*
+ * Parse the certificates and the (unencrypted) private key of a file, as
+ * SSL_CTX_use_certificate_chain_file() and SSL_CTX_use_PrivateKey_file()
+ * would.  Only OpenSSL is used here, so that it can run in any thread.
+ */
+static void cert_file_parse(cert_file_task_t *task)
+{
+    modssl_cert_file_t *cf = &task->entry->cf;
+    BIO *bio;
+    X509 *x509;
+
+    task->parsed = 0;
+
+    ERR_clear_error();
+    if (!(bio = BIO_new_mem_buf((void *)task->data, (int)task->len))) {
+        goto done;
+    }
+    if ((cf->cert = PEM_read_bio_X509_AUX(bio, NULL, cert_file_no_passwd_cb,
+                                          NULL))) {
+        if (!(cf->chain = sk_X509_new_null())) {
+            BIO_free(bio);
+            goto done;
+        }
+        while ((x509 = PEM_read_bio_X509(bio, NULL, cert_file_no_passwd_cb,
+                                         NULL))) {
+            if (!sk_X509_push(cf->chain, x509)) {
+                X509_free(x509);
+                BIO_free(bio);
+                goto done;
+            }
+        }
+        if (!cert_file_pem_eof()) {
+            BIO_free(bio);
+            goto done;
+        }
+    }
+    BIO_free(bio);
+
+    ERR_clear_error();
+    if (!(bio = BIO_new_mem_buf((void *)task->data, (int)task->len))) {
+        goto done;
+    }
+    cf->pkey = PEM_read_bio_PrivateKey(bio, NULL, cert_file_no_passwd_cb,
+                                       NULL);
+    BIO_free(bio);
+
+    task->parsed = (cf->cert || cf->pkey);
+
+done:
+    ERR_clear_error();
+}
+
+/*
+ * Read a file: return its cache entry if the content did not change,
+ * or NULL with a parsing task otherwise (or none if it can't be read).
+ */
+static cert_file_entry_t *cert_file_read(server_rec *s, cert_cache_t *cache,
+                                         const char *path, apr_pool_t *ptemp,
+                                         cert_file_task_t **ptask)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    cert_file_entry_t *e;
+    cert_file_task_t *task;
+    apr_file_t *fp;
+    apr_finfo_t finfo;
+    apr_size_t len = 0, plen;
+    apr_status_t rv;
+    char *data = NULL;
+
+    *ptask = NULL;
+
+    rv = apr_file_open(&fp, path, APR_FOPEN_READ | APR_FOPEN_BINARY,
+                       APR_OS_DEFAULT, ptemp);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, fp);
+        if (rv == APR_SUCCESS && finfo.size > CERT_FILE_MAX_SIZE) {
+            rv = APR_EINVAL;
+        }
+        if (rv == APR_SUCCESS) {
+            len = (apr_size_t)finfo.size;
+            data = apr_palloc(ptemp, len + 1);
+            rv = apr_file_read_full(fp, data, len, &len);
+        }
+        apr_file_close(fp);
+    }
+    if (rv != APR_SUCCESS
+        || !EVP_Digest(data, len, digest, NULL, EVP_sha256(), NULL)) {
+        ap_log_error(APLOG_MARK, APLOG_TRACE1, rv, s,
+                     "Init: not caching %s", path);
+        if ((e = apr_hash_get(cache->files, path, APR_HASH_KEY_STRING))) {
+            apr_hash_set(cache->files, path, APR_HASH_KEY_STRING, NULL);
+            cert_file_entry_free(e);
+        }
+        return NULL;
+    }
+
+    e = apr_hash_get(cache->files, path, APR_HASH_KEY_STRING);
+    if (e && !memcmp(e->digest, digest, sizeof(digest))) {
+        e->generation = cache->generation;
+        return e;
+    }
+
+    plen = strlen(path);
+    e = ap_calloc(1, sizeof(*e));
+    e->path = ap_malloc(plen + 1);
+    memcpy(e->path, path, plen + 1);
+    memcpy(e->digest, digest, sizeof(digest));
+    e->generation = cache->generation;
+
+    task = apr_pcalloc(ptemp, sizeof(*task));
+    task->entry = e;
+    task->data = data;
+    task->len = len;
+    *ptask = task;
+    return NULL;
+}
+
+/* Replace the cached entry of a file by the one parsed by a task */
+static cert_file_entry_t *cert_file_install(cert_cache_t *cache,
+                                            cert_file_task_t *task)
+{
+    cert_file_entry_t *e = task->entry, *old;
+
+    old = apr_hash_get(cache->files, e->path, APR_HASH_KEY_STRING);
+    if (old) {
+        apr_hash_set(cache->files, old->path, APR_HASH_KEY_STRING, NULL);
+        cert_file_entry_free(old);
+    }
+    if (!task->parsed) {
+        cert_file_entry_free(e);
+        return NULL;
+    }
+    apr_hash_set(cache->files, e->path, APR_HASH_KEY_STRING, e);
+    return e;
+}
+
+#if APR_HAS_THREADS
+static void *APR_THREAD_FUNC cert_file_parse_thread(apr_thread_t *thd,
+                                                    void *data)
+{
+    cert_file_task_t *task = data;
+    cert_parse_batch_t *batch = task->batch;
+
+    cert_file_parse(task);
+
+    apr_thread_mutex_lock(batch->mutex);
+    if (--batch->pending == 0) {
+        apr_thread_cond_signal(batch->done);
+    }
+    apr_thread_mutex_unlock(batch->mutex);
+
+    return NULL;
+}
+
+/*
+ * Run the parsing tasks in a pool of threads, and wait for them all.
+ * The tasks which can't be queued (e.g. no thread could be created) are
+ * parsed here, sequentially.
+ */
+static apr_status_t cert_files_parse_parallel(server_rec *s,
+                                              apr_pool_t *ptemp,
+                                              apr_array_header_t *tasks,
+                                              int nthreads)
+{
+    cert_parse_batch_t batch;
+    apr_thread_pool_t *tp;
+    apr_status_t rv;
+    int i;
+
+    if ((rv = apr_thread_mutex_create(&batch.mutex, APR_THREAD_MUTEX_DEFAULT,
+                                      ptemp)) != APR_SUCCESS
+        || (rv = apr_thread_cond_create(&batch.done, ptemp)) != APR_SUCCESS
+        || (rv = apr_thread_pool_create(&tp, 0, nthreads,
+                                        ptemp)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10160)
+                     "Init: can't create %d threads to load the "
+                     "certificates, loading them sequentially", nthreads);
+        return rv;
+    }
+    batch.pending = 0;
+
+    apr_thread_mutex_lock(batch.mutex);
+    for (i = 0; i < tasks->nelts; i++) {
+        cert_file_task_t *task = APR_ARRAY_IDX(tasks, i, cert_file_task_t *);
+
+        task->batch = &batch;
+        if (apr_thread_pool_push(tp, cert_file_parse_thread, task,
+                                 APR_THREAD_TASK_PRIORITY_NORMAL,
+                                 NULL) != APR_SUCCESS) {
+            break;
+        }
+        batch.pending++;
+    }
+    while (batch.pending > 0) {
+        apr_thread_cond_wait(batch.done, batch.mutex);
+    }
+    apr_thread_mutex_unlock(batch.mutex);
+
+    apr_thread_pool_destroy(tp);
+
+    /* whatever could not be pushed */
+    for (; i < tasks->nelts; i++) {
+        cert_file_parse(APR_ARRAY_IDX(tasks, i, cert_file_task_t *));
+    }
+
+    return APR_SUCCESS;
+}
+#endif
+
+static void cert_files_collect(apr_hash_t *paths, apr_array_header_t *files)
+{
+    const char *path;
+    int i;
+
+    for (i = 0; (i < files->nelts) &&
+                (path = APR_ARRAY_IDX(files, i, const char *)); i++) {
+        apr_hash_set(paths, path, APR_HASH_KEY_STRING, path);
+    }
+}
+
+/*
+ * Parse (or reuse) the certificate and key files of all the servers
+ * enabled for SSL, before they are initialized
+ */
+void ssl_cert_files_preload(server_rec *base_server, apr_pool_t *ptemp)
+{
+    SSLModConfigRec *mc = myModConfig(base_server);
+    SSLSrvConfigRec *sc = mySrvConfig(base_server);
+    cert_cache_t *cache = cert_cache_get(mc);
+    apr_array_header_t *tasks;
+    apr_hash_t *paths;
+    apr_hash_index_t *hi;
+    int nthreads, parallel = 0, reused = 0, i;
+    server_rec *s;
+
+    cache->generation++;
+    cache->open = 1;
+
+    nthreads = sc->cert_load_threads;
+    if (nthreads == UNSET) {
+        nthreads = CERT_LOAD_THREADS_DEFAULT;
+    }
+
+    paths = apr_hash_make(ptemp);
+    for (s = base_server; s; s = s->next) {
+        sc = mySrvConfig(s);
+        if ((sc->enabled != SSL_ENABLED_TRUE
+             && sc->enabled != SSL_ENABLED_OPTIONAL)
+            || !sc->server || !sc->server->pks
+            || sc->lazy_certs == TRUE) {
+            continue;
+        }
+        cert_files_collect(paths, sc->server->pks->cert_files);
+        cert_files_collect(paths, sc->server->pks->key_files);
+        if (sc->server->cert_chain) {
+            apr_hash_set(paths, sc->server->cert_chain, APR_HASH_KEY_STRING,
+                         sc->server->cert_chain);
+        }
+    }
+
+    tasks = apr_array_make(ptemp, 16, sizeof(cert_file_task_t *));
+    for (hi = apr_hash_first(ptemp, paths); hi; hi = apr_hash_next(hi)) {
+        cert_file_task_t *task;
+        const void *path;
+
+        apr_hash_this(hi, &path, NULL, NULL);
+        if (cert_file_read(base_server, cache, path, ptemp, &task)) {
+            reused++;
+        }
+        else if (task) {
+            APR_ARRAY_PUSH(tasks, cert_file_task_t *) = task;
+        }
+    }
+
+    if (nthreads > tasks->nelts) {
+        nthreads = tasks->nelts;
+    }
+#if APR_HAS_THREADS
+    if (nthreads > 1) {
+        parallel = (cert_files_parse_parallel(base_server, ptemp, tasks,
+                                              nthreads) == APR_SUCCESS);
+    }
+#endif
+    if (!parallel) {
+        nthreads = tasks->nelts ? 1 : 0;
+        for (i = 0; i < tasks->nelts; i++) {
+            cert_file_parse(APR_ARRAY_IDX(tasks, i, cert_file_task_t *));
+        }
+    }
+
+    for (i = 0; i < tasks->nelts; i++) {
+        cert_file_install(cache, APR_ARRAY_IDX(tasks, i, cert_file_task_t *));
+    }
+
+    ap_log_error(APLOG_MARK, APLOG_INFO, 0, base_server, APLOGNO(10161)
+                 "Init: %d certificate/key files, %d unchanged, "
+                 "%d parsed by %d thread%s", apr_hash_count(paths), reused,
+                 tasks->nelts, nthreads, nthreads == 1 ? "" : "s");
+}
+
+/*
+ * The parsed objects of a file, loaded now if needed (and possible),
+ * or NULL if the file has to be loaded the usual way.  Once the servers
+ * are initialized (i.e. in the children), only the cache is looked up.
+ */
+modssl_cert_file_t *ssl_cert_files_get(server_rec *s, apr_pool_t *ptemp,
+                                       const char *path)
+{
+    cert_cache_t *cache = myModConfig(s)->cert_files;
+    cert_file_entry_t *e;
+    cert_file_task_t *task;
+
+    if (!cache) {
+        return NULL;
+    }
+    e = apr_hash_get(cache->files, path, APR_HASH_KEY_STRING);
+    if (e && e->generation == cache->generation) {
+        return &e->cf;
+    }
+    if (!cache->open) {
+        return NULL;
+    }
+
+    if (!(e = cert_file_read(s, cache, path, ptemp, &task)) && task) {
+        cert_file_parse(task);
+        e = cert_file_install(cache, task);
+    }
+    return e ? &e->cf : NULL;
+}
+
+static void cert_cache_flush(cert_cache_t *cache, int all)
+{
+    apr_hash_index_t *hi;
+
+    for (hi = apr_hash_first(NULL, cache->files); hi; hi = apr_hash_next(hi)) {
+        cert_file_entry_t *e;
+        void *val;
+
+        apr_hash_this(hi, NULL, NULL, &val);
+        e = val;
+
+        if (all || e->generation != cache->generation) {
+            apr_hash_set(cache->files, e->path, APR_HASH_KEY_STRING, NULL);
+            cert_file_entry_free(e);
+        }
+    }
+}
+
+#if defined(HAVE_OPENSSL_ENGINE_H) && defined(HAVE_ENGINE_INIT)
+static apr_status_t cert_cache_cleanup(void *data)
+{
+    cert_cache_flush(data, 1);
+    return APR_SUCCESS;
+}
+#endif
+
+/*
+ * Drop the files which are no longer used once all the servers are
+ * initialized, and everything on restart if nothing can be kept.
+ */
+void ssl_cert_files_fix(server_rec *base_server, apr_pool_t *p)
+{
+    SSLModConfigRec *mc = myModConfig(base_server);
+    cert_cache_t *cache = mc->cert_files;
+
+    if (!cache) {
+        return;
+    }
+    cert_cache_flush(cache, 0);
+    cache->open = 0;
+
+#if defined(HAVE_OPENSSL_ENGINE_H) && defined(HAVE_ENGINE_INIT)
+    if (mc->szCryptoDevice) {
+        apr_pool_cleanup_register(p, cache, cert_cache_cleanup,
+                                  apr_pool_cleanup_null);
+    }
+#endif
+}
+
+#endif /* HAVE_SSL_CERT_FILE_CACHE */
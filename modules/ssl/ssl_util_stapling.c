@@ -31,6 +31,7 @@
 #include "ssl_private.h"
 #include "ap_mpm.h"
 #include "apr_thread_mutex.h"
+#include "mod_watchdog.h"
 
 #ifdef HAVE_OCSP_STAPLING
 
@@ -54,6 +55,12 @@ typedef struct {
     OCSP_CERTID *cid;
     /* URI of the OCSP responder */
     char *uri;
+    /* Server and context the response is renewed for in the background
+     * (the first vhost configured with the certificate) */
+    server_rec *s;
+    modssl_ctx_t *mctx;
+    /* Time of the next background renewal */
+    apr_time_t refresh;
 } certinfo;
 
 static apr_status_t ssl_stapling_certid_free(void *data)
@@ -69,6 +76,9 @@ static apr_status_t ssl_stapling_certid_free(void *data)
 
 static apr_hash_t *stapling_certinfo;
 
+/* Whether responses are renewed by the watchdog rather than handshakes */
+static int stapling_watchdog;
+
 void ssl_stapling_certinfo_hash_init(apr_pool_t *p)
 {
     stapling_certinfo = apr_hash_make(p);
@@ -168,6 +178,8 @@ int ssl_stapling_init_cert(server_rec *s, apr_pool_t *p, apr_pool_t *ptemp,
     cinf = apr_pcalloc(p, sizeof(certinfo));
     memcpy (cinf->idx, idx, sizeof(idx));
     cinf->cid = cid;
+    cinf->s = s;
+    cinf->mctx = mctx;
     /* make sure cid is also freed at pool cleanup */
     apr_pool_cleanup_register(p, cid, ssl_stapling_certid_free,
                               apr_pool_cleanup_null);
@@ -432,11 +444,14 @@ static int stapling_check_response(server_rec *s, modssl_ctx_t *mctx,
     return rv;
 }
 
+/* Query the responder and cache its response; ssl is NULL for background
+ * renewals, which don't forward the client's request extensions. An error
+ * response is not cached if cache_errors is FALSE. */
 static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
                                     certinfo *cinf, OCSP_RESPONSE **prsp,
-                                    BOOL *pok, apr_pool_t *pool)
+                                    BOOL *pok, BOOL cache_errors,
+                                    apr_pool_t *pool)
 {
-    conn_rec *conn      = (conn_rec *)SSL_get_app_data(ssl);
     apr_pool_t *vpool;
     OCSP_REQUEST *req = NULL;
     OCSP_CERTID *id = NULL;
@@ -461,11 +476,13 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
         goto err;
     id = NULL;
     /* Add any extensions to the request */
-    SSL_get_tlsext_status_exts(ssl, &exts);
-    for (i = 0; i < sk_X509_EXTENSION_num(exts); i++) {
-        X509_EXTENSION *ext = sk_X509_EXTENSION_value(exts, i);
-        if (!OCSP_REQUEST_add_ext(req, ext, -1))
-            goto err;
+    if (ssl) {
+        SSL_get_tlsext_status_exts(ssl, &exts);
+        for (i = 0; i < sk_X509_EXTENSION_num(exts); i++) {
+            X509_EXTENSION *ext = sk_X509_EXTENSION_value(exts, i);
+            if (!OCSP_REQUEST_add_ext(req, ext, -1))
+                goto err;
+        }
     }
 
     if (mctx->stapling_force_url)
@@ -481,7 +498,7 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
     }
 
     /* Create a temporary pool to constrain memory use */
-    apr_pool_create(&vpool, conn->pool);
+    apr_pool_create(&vpool, pool);
 
     if (apr_uri_parse(vpool, ocspuri, &uri) != APR_SUCCESS) {
         ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(01939)
@@ -502,7 +519,7 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
     }
 
     *prsp = modssl_dispatch_ocsp_request(&uri, mctx->stapling_responder_timeout,
-                                         req, conn, vpool);
+                                         req, s, vpool);
 
     apr_pool_destroy(vpool);
 
@@ -536,7 +553,8 @@ static BOOL stapling_renew_response(server_rec *s, modssl_ctx_t *mctx, SSL *ssl,
             *pok = FALSE;
         }
     }
-    if (stapling_cache_response(s, mctx, *prsp, cinf, *pok, pool) == FALSE) {
+    if ((*pok == TRUE || cache_errors == TRUE)
+        && stapling_cache_response(s, mctx, *prsp, cinf, *pok, pool) == FALSE) {
         ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(01945)
                      "stapling_renew_response: error caching response!");
     }
@@ -774,7 +792,12 @@ static int stapling_cb(SSL *ssl, void *arg)
         return rv;
     }
 
-    if (rsp == NULL) {
+    if (rsp == NULL && stapling_watchdog) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10130)
+                     "stapling_cb: no cached response, renewal left to "
+                     "the watchdog");
+    }
+    else if (rsp == NULL) {
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(01954)
                      "stapling_cb: renewing cached response");
         stapling_refresh_mutex_on(s);
@@ -801,7 +824,7 @@ static int stapling_cb(SSL *ssl, void *arg)
                          "stapling_cb: still must refresh cached response "
                          "after obtaining refresh mutex");
             rv = stapling_renew_response(s, mctx, ssl, cinf, &rsp, &ok,
-                                         conn->pool);
+                                         TRUE, conn->pool);
             stapling_refresh_mutex_off(s);
 
             if ((rv == TRUE) && (ok == TRUE) && rsp) {
@@ -830,6 +853,130 @@ static int stapling_cb(SSL *ssl, void *arg)
 
 }
 
+/*
+ * Background renewal of the responses by a (singleton) watchdog, so that
+ * handshakes never wait for the responder: a response is renewed when
+ * three quarters of its cache lifetime have elapsed, and a failure does
+ * not replace a still valid response in the cache.
+ */
+#define STAPLING_WATCHDOG_NAME "_ssl_stapling_"
+#define STAPLING_WATCHDOG_INTERVAL apr_time_from_sec(1)
+
+static void stapling_refresh_cert(certinfo *cinf, apr_time_t now,
+                                  apr_pool_t *p)
+{
+    server_rec *s = cinf->s;
+    modssl_ctx_t *mctx = cinf->mctx;
+    apr_interval_time_t lifetime, retry;
+    OCSP_RESPONSE *rsp = NULL;
+    BOOL ok = FALSE, valid = FALSE;
+
+    stapling_get_cached_response(s, &rsp, &ok, cinf, p);
+    if (rsp) {
+        valid = ok && stapling_check_response(s, mctx, cinf, rsp, NULL)
+                      == SSL_TLSEXT_ERR_OK;
+        OCSP_RESPONSE_free(rsp);
+        rsp = NULL;
+    }
+
+    lifetime = apr_time_from_sec(mctx->stapling_cache_timeout);
+    ok = FALSE;
+    if (stapling_renew_response(s, mctx, NULL, cinf, &rsp, &ok, !valid, p)
+            && ok == TRUE) {
+        cinf->refresh = now + lifetime - lifetime / 4;
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10131)
+                     "stapling_refresh_cert: response renewed, next "
+                     "renewal in %" APR_TIME_T_FMT "s",
+                     apr_time_sec(cinf->refresh - now));
+    }
+    else {
+        retry = apr_time_from_sec(mctx->stapling_errcache_timeout);
+        if (valid && retry > lifetime / 8) {
+            retry = lifetime / 8;
+        }
+        cinf->refresh = now + retry;
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10132)
+                     "stapling_refresh_cert: renewal failed, %s, "
+                     "retrying in %" APR_TIME_T_FMT "s",
+                     valid ? "keeping the cached response"
+                           : "no valid response cached",
+                     apr_time_sec(retry));
+    }
+    if (rsp) {
+        OCSP_RESPONSE_free(rsp);
+    }
+}
+
+static apr_status_t stapling_watchdog_callback(int state, void *data,
+                                               apr_pool_t *pool)
+{
+    apr_hash_index_t *hi;
+    apr_time_t now;
+    apr_pool_t *p;
+
+    if (state == AP_WATCHDOG_STATE_STOPPING) {
+        return APR_SUCCESS;
+    }
+
+    apr_pool_create(&p, pool);
+    now = apr_time_now();
+    for (hi = apr_hash_first(p, stapling_certinfo); hi;
+         hi = apr_hash_next(hi)) {
+        certinfo *cinf;
+        void *val;
+
+        apr_hash_this(hi, NULL, NULL, &val);
+        cinf = val;
+        if (now >= cinf->refresh) {
+            apr_pool_t *ptemp;
+
+            apr_pool_create(&ptemp, p);
+            stapling_refresh_cert(cinf, now, ptemp);
+            apr_pool_destroy(ptemp);
+        }
+    }
+    apr_pool_destroy(p);
+
+    return APR_SUCCESS;
+}
+
+void ssl_stapling_watchdog_init(server_rec *s, apr_pool_t *p)
+{
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register;
+    ap_watchdog_t *wd;
+    apr_status_t rv;
+
+    stapling_watchdog = 0;
+    if (!stapling_certinfo || !apr_hash_count(stapling_certinfo)) {
+        return;
+    }
+
+    wd_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+    wd_register = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+    if (!wd_get_instance || !wd_register) {
+        ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(10133)
+                     "mod_watchdog not loaded, OCSP stapling responses "
+                     "will be renewed during handshakes");
+        return;
+    }
+
+    rv = wd_get_instance(&wd, STAPLING_WATCHDOG_NAME, 0, 1, p);
+    if (rv == APR_SUCCESS) {
+        rv = wd_register(wd, STAPLING_WATCHDOG_INTERVAL, s,
+                         stapling_watchdog_callback);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10134)
+                     "failed to register the %s watchdog, OCSP stapling "
+                     "responses will be renewed during handshakes",
+                     STAPLING_WATCHDOG_NAME);
+        return;
+    }
+
+    stapling_watchdog = 1;
+}
+
 apr_status_t modssl_init_stapling(server_rec *s, apr_pool_t *p,
                                   apr_pool_t *ptemp, modssl_ctx_t *mctx)
 {
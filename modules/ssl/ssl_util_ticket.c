@@ -0,0 +1,860 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*                      _             _
+ *  _ __ ___   ___   __| |    ___ ___| |  mod_ssl
+ * | '_ ` _ \ / _ \ / _` |   / __/ __| |  Apache Interface to OpenSSL
+ * | | | | | | (_) | (_| |   \__ \__ \ |
+ * |_| |_| |_|\___/ \__,_|___|___/___/_|
+ *                      |_____|
+ *  ssl_util_ticket.c
+ *  Shared Session Ticket Keys
+ */
+
+#include "ssl_private.h"
+#include "mod_status.h"
+#include "mod_watchdog.h"
+#include "apr_atomic.h"
+
+#ifdef HAVE_TLS_TICKET_KEY_RING
+
+/*
+ * The session ticket keys live in a ring in shared memory, created once
+ * in the parent and kept across graceful restarts, so that a ticket
+ * issued by any child can be decrypted by any other child, of this
+ * generation or of the next one:
+ *
+ *  - the current key (the newest one whose time has come) encrypts the
+ *    new tickets;
+ *  - the next key (due one rotation interval later) is already accepted,
+ *    so that it can take over without a gap;
+ *  - the previous keys are still accepted, and tickets decrypted with
+ *    them (or with the next key) are renewed.
+ *
+ * A singleton watchdog generates the next key whenever the current one
+ * is superseded, and the parent saves the ring to the (encrypted) key
+ * store on restart and shutdown, to load it back at startup.
+ *
+ * Readers never lock: each slot has a sequence number which is odd while
+ * the slot is being written, and a read is retried (a few times, then
+ * the slot is skipped) if the number changed meanwhile.  Writers (the
+ * parent and the watchdog) are serialized by the ssl-ticket-keys mutex.
+ */
+
+#define TICKET_RING_SLOTS         16
+#define TICKET_ROTATION_DEFAULT   apr_time_from_sec(3600)
+#define TICKET_PREVIOUS_DEFAULT   2
+
+#define TICKET_WATCHDOG_NAME      "_ssl_ticket_keys_"
+#define TICKET_WATCHDOG_INTERVAL  apr_time_from_sec(1)
+
+#define TICKET_SLOT_READ_TRIES    16
+#define TICKET_SLOT_READ_BACKOFF  50    /* usecs */
+
+#define TICKET_KEY_NAME(k)        (k)
+#define TICKET_KEY_HMAC(k)        ((k) + 16)
+#define TICKET_KEY_AES(k)         ((k) + 32)
+
+typedef struct {
+    apr_uint32_t seq;
+    apr_time_t not_before;              /* 0 if the slot is unused */
+    unsigned char key[TLSEXT_TICKET_KEY_LEN];
+} ticket_slot_t;
+
+typedef struct {
+    apr_uint32_t nkeys;                 /* next + current + previous */
+    apr_interval_time_t rotation;
+
+    apr_uint32_t rotations;
+    apr_uint32_t issued;
+    apr_uint32_t hits;
+    apr_uint32_t renewals;
+    apr_uint32_t misses;
+
+    ticket_slot_t slots[TICKET_RING_SLOTS];
+} ticket_ring_t;
+
+/* The ring of this generation, NULL if disabled */
+static ticket_ring_t *ticket_ring;
+
+/*
+ * The key store: the keys with their not_before time (56 bytes each,
+ * big endian time first), encrypted with AES-256-GCM under a 32 bytes
+ * secret kept in a separate file, and preceded by a magic and the IV.
+ */
+#define TICKET_STORE_MAGIC        "mssltk01"
+#define TICKET_STORE_MAGIC_LEN    8
+#define TICKET_STORE_IV_LEN       12
+#define TICKET_STORE_TAG_LEN      16
+#define TICKET_STORE_SECRET_LEN   32
+#define TICKET_STORE_RECORD_LEN   (8 + TLSEXT_TICKET_KEY_LEN)
+#define TICKET_STORE_MAX_LEN      (TICKET_STORE_MAGIC_LEN + \
+                                   TICKET_STORE_IV_LEN + \
+                                   TICKET_RING_SLOTS * \
+                                   TICKET_STORE_RECORD_LEN + \
+                                   TICKET_STORE_TAG_LEN)
+
+typedef struct {
+    server_rec *s;
+    ticket_ring_t *ring;
+    const char *path;
+    const char *secret_path;
+    unsigned char secret[TICKET_STORE_SECRET_LEN];
+    pid_t pid;
+} ticket_store_t;
+
+/*  _________________________________________________________________
+**
+**  Ring Access
+**  _________________________________________________________________
+*/
+
+/* apr_atomic_add32() is used for its full barrier */
+#define ticket_slot_seq(slot) apr_atomic_add32(&(slot)->seq, 0)
+
+/*
+ * Returns 1 if the slot has a key, 0 if it is unused, and -1 if it could
+ * not be read consistently (the writer is slow or died while writing).
+ */
+static int ticket_slot_read(ticket_slot_t *slot, apr_time_t *not_before,
+                            unsigned char *key)
+{
+    apr_uint32_t seq;
+    int tries;
+
+    for (tries = 0; tries < TICKET_SLOT_READ_TRIES; tries++) {
+        if (tries) {
+            apr_sleep(TICKET_SLOT_READ_BACKOFF);
+        }
+        seq = ticket_slot_seq(slot);
+        if (!(seq & 1)) {
+            *not_before = slot->not_before;
+            memcpy(key, slot->key, TLSEXT_TICKET_KEY_LEN);
+            if (ticket_slot_seq(slot) == seq) {
+                return *not_before != 0;
+            }
+        }
+    }
+    return -1;
+}
+
+/*
+ * Called with the ring locked, so an odd sequence number can only have
+ * been left by a writer which died, and is evened first.
+ */
+static void ticket_slot_write(ticket_slot_t *slot, apr_time_t not_before,
+                              const unsigned char *key)
+{
+    if (ticket_slot_seq(slot) & 1) {
+        apr_atomic_inc32(&slot->seq);
+    }
+    apr_atomic_inc32(&slot->seq);
+    slot->not_before = not_before;
+    if (key) {
+        memcpy(slot->key, key, TLSEXT_TICKET_KEY_LEN);
+    }
+    else {
+        OPENSSL_cleanse(slot->key, TLSEXT_TICKET_KEY_LEN);
+    }
+    apr_atomic_inc32(&slot->seq);
+}
+
+static int ticket_ring_lock(server_rec *s)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    apr_status_t rv;
+
+    if ((rv = apr_global_mutex_lock(mc->ticket_ring_mutex)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10168)
+                     "Failed to acquire %s lock", SSL_TICKET_KEYS_MUTEX_TYPE);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void ticket_ring_unlock(server_rec *s)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    apr_status_t rv;
+
+    if ((rv = apr_global_mutex_unlock(mc->ticket_ring_mutex)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10169)
+                     "Failed to release %s lock", SSL_TICKET_KEYS_MUTEX_TYPE);
+    }
+}
+
+/*
+ * Generate the keys needed for a current and a next key to exist, then
+ * forget the oldest keys beyond the configured number.  Called with the
+ * ring locked, returns the number of keys generated or -1 on error.
+ */
+static int ticket_ring_update(ticket_ring_t *ring, apr_time_t now)
+{
+    unsigned char key[TLSEXT_TICKET_KEY_LEN];
+    apr_time_t not_before;
+    int generated = 0;
+
+    for (;;) {
+        apr_time_t newest = 0, oldest = 0, when;
+        int i, used = 0, unused = -1, victim = -1;
+
+        for (i = 0; i < TICKET_RING_SLOTS; i++) {
+            if (ticket_slot_read(&ring->slots[i], &not_before, key) <= 0) {
+                if (unused < 0) {
+                    unused = i;
+                }
+                continue;
+            }
+            used++;
+            if (not_before > newest) {
+                newest = not_before;
+            }
+            if (victim < 0 || not_before < oldest) {
+                victim = i;
+                oldest = not_before;
+            }
+        }
+
+        if (newest > now) {
+            /* Forget the keys which are not needed anymore */
+            if (used <= (int)ring->nkeys) {
+                break;
+            }
+            ticket_slot_write(&ring->slots[victim], 0, NULL);
+            continue;
+        }
+        if (unused >= 0) {
+            victim = unused;
+        }
+
+        if (newest && newest + ring->rotation > now) {
+            when = newest + ring->rotation;
+        }
+        else {
+            when = now;
+        }
+        if (RAND_bytes(key, TLSEXT_TICKET_KEY_LEN) != 1) {
+            generated = -1;
+            break;
+        }
+        ticket_slot_write(&ring->slots[victim], when, key);
+        generated++;
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+
+    if (generated > 0) {
+        apr_atomic_add32(&ring->rotations, generated);
+    }
+    return generated;
+}
+
+/*
+ * This callback function is executed when OpenSSL needs a key for
+ * encrypting/decrypting a TLS session ticket and no ticket key file
+ * is configured (see ssl_callback_SessionTicket()).
+ */
+int ssl_ticket_ring_callback(conn_rec *c,
+                             unsigned char *keyname,
+                             unsigned char *iv,
+                             EVP_CIPHER_CTX *cipher_ctx,
+                             HMAC_CTX *hctx,
+                             int mode)
+{
+    ticket_ring_t *ring = ticket_ring;
+    unsigned char tmp[TLSEXT_TICKET_KEY_LEN];
+    unsigned char key[TLSEXT_TICKET_KEY_LEN];
+    apr_time_t now = apr_time_now(), current = 0, found = 0, not_before;
+    int i, rv;
+
+    if (mode != 1 && mode != 0) {
+        /* OpenSSL is not expected to call us with other modes */
+        return -1;
+    }
+    if (ring == NULL) {
+        return mode == 1 ? -1 : 0;
+    }
+
+    for (i = 0; i < TICKET_RING_SLOTS; i++) {
+        if (ticket_slot_read(&ring->slots[i], &not_before, tmp) <= 0) {
+            continue;
+        }
+        if (mode == 1) {
+            if (not_before <= now && not_before > current) {
+                current = found = not_before;
+                memcpy(key, tmp, sizeof(key));
+            }
+        }
+        else {
+            if (not_before <= now && not_before > current) {
+                current = not_before;
+            }
+            if (!found && !memcmp(TICKET_KEY_NAME(tmp), keyname, 16)) {
+                found = not_before;
+                memcpy(key, tmp, sizeof(key));
+            }
+        }
+    }
+    OPENSSL_cleanse(tmp, sizeof(tmp));
+
+    if (!found) {
+        if (mode == 0) {
+            apr_atomic_inc32(&ring->misses);
+            ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, c,
+                          "session ticket key not found, full handshake");
+            return 0;
+        }
+        return -1;
+    }
+
+    if (mode == 1) {
+        memcpy(keyname, TICKET_KEY_NAME(key), 16);
+        if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1) {
+            rv = -1;
+        }
+        else {
+            EVP_EncryptInit_ex(cipher_ctx, EVP_aes_128_cbc(), NULL,
+                               TICKET_KEY_AES(key), iv);
+            HMAC_Init_ex(hctx, TICKET_KEY_HMAC(key), 16, tlsext_tick_md(),
+                         NULL);
+            apr_atomic_inc32(&ring->issued);
+            rv = 1;
+        }
+    }
+    else {
+        EVP_DecryptInit_ex(cipher_ctx, EVP_aes_128_cbc(), NULL,
+                           TICKET_KEY_AES(key), iv);
+        HMAC_Init_ex(hctx, TICKET_KEY_HMAC(key), 16, tlsext_tick_md(), NULL);
+        apr_atomic_inc32(&ring->hits);
+        if (found != current) {
+            /* Not the current key, have the ticket renewed */
+            apr_atomic_inc32(&ring->renewals);
+            rv = 2;
+        }
+        else {
+            rv = 1;
+        }
+        ap_log_cerror(APLOG_MARK, APLOG_TRACE2, 0, c,
+                      "session ticket key found%s",
+                      rv == 2 ? ", renewing the ticket" : "");
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+
+    return rv;
+}
+
+BOOL ssl_ticket_ring_enabled(server_rec *s)
+{
+    return ticket_ring != NULL;
+}
+
+/*  _________________________________________________________________
+**
+**  Key Store
+**  _________________________________________________________________
+*/
+
+static int ticket_store_crypt(int enc, const unsigned char *secret,
+                              const unsigned char *iv,
+                              const unsigned char *in, int len,
+                              unsigned char *out, unsigned char *tag)
+{
+    EVP_CIPHER_CTX *ctx;
+    int n, ok;
+
+    if (!(ctx = EVP_CIPHER_CTX_new())) {
+        return 0;
+    }
+    ok = EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), NULL, NULL, NULL, enc)
+         && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN,
+                                TICKET_STORE_IV_LEN, NULL)
+         && EVP_CipherInit_ex(ctx, NULL, NULL, secret, iv, enc)
+         && EVP_CipherUpdate(ctx, NULL, &n,
+                             (const unsigned char *)TICKET_STORE_MAGIC,
+                             TICKET_STORE_MAGIC_LEN)
+         && EVP_CipherUpdate(ctx, out, &n, in, len)
+         && (enc || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG,
+                                        TICKET_STORE_TAG_LEN, tag))
+         && EVP_CipherFinal_ex(ctx, out + n, &n)
+         && (!enc || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG,
+                                         TICKET_STORE_TAG_LEN, tag));
+    EVP_CIPHER_CTX_free(ctx);
+
+    return ok;
+}
+
+/*
+ * Read the store's secret, or create it on first use.
+ */
+static apr_status_t ticket_store_secret(ticket_store_t *store,
+                                        apr_pool_t *ptemp)
+{
+    apr_file_t *fp;
+    apr_size_t len;
+    apr_status_t rv;
+
+    rv = apr_file_open(&fp, store->secret_path, APR_READ|APR_BINARY,
+                       APR_OS_DEFAULT, ptemp);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_read_full(fp, store->secret, TICKET_STORE_SECRET_LEN,
+                                &len);
+        apr_file_close(fp);
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_EMERG, rv, store->s, APLOGNO(10136)
+                         "Failed to read %d bytes from %s",
+                         TICKET_STORE_SECRET_LEN, store->secret_path);
+        }
+        return rv;
+    }
+    if (!APR_STATUS_IS_ENOENT(rv)) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, rv, store->s, APLOGNO(10137)
+                     "Failed to open ticket key store secret %s",
+                     store->secret_path);
+        return rv;
+    }
+
+    if (RAND_bytes(store->secret, TICKET_STORE_SECRET_LEN) != 1) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, 0, store->s, APLOGNO(10138)
+                     "Failed to generate the ticket key store secret");
+        ssl_log_ssl_error(SSLLOG_MARK, APLOG_EMERG, store->s);
+        return APR_EGENERAL;
+    }
+    rv = apr_file_open(&fp, store->secret_path,
+                       APR_WRITE|APR_CREATE|APR_EXCL|APR_BINARY,
+                       APR_FPROT_UREAD|APR_FPROT_UWRITE, ptemp);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(fp, store->secret, TICKET_STORE_SECRET_LEN,
+                                 NULL);
+        apr_file_close(fp);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, rv, store->s, APLOGNO(10139)
+                     "Failed to create ticket key store secret %s",
+                     store->secret_path);
+        return rv;
+    }
+    ap_log_error(APLOG_MARK, APLOG_INFO, 0, store->s, APLOGNO(10140)
+                 "Created ticket key store secret %s", store->secret_path);
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Load the keys from the store into an empty ring, skipping those
+ * which would have been forgotten already.
+ */
+static void ticket_store_load(ticket_store_t *store, apr_time_t now,
+                              apr_pool_t *ptemp)
+{
+    ticket_ring_t *ring = store->ring;
+    unsigned char *buf, *plain, *rec;
+    apr_interval_time_t retention;
+    apr_file_t *fp;
+    apr_size_t len;
+    apr_status_t rv;
+    int i, n, loaded = 0;
+
+    rv = apr_file_open(&fp, store->path, APR_READ|APR_BINARY,
+                       APR_OS_DEFAULT, ptemp);
+    if (APR_STATUS_IS_ENOENT(rv)) {
+        return;
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, store->s, APLOGNO(10141)
+                     "Failed to open ticket key store %s, starting with "
+                     "new keys", store->path);
+        return;
+    }
+    buf = apr_palloc(ptemp, TICKET_STORE_MAX_LEN);
+    rv = apr_file_read_full(fp, buf, TICKET_STORE_MAX_LEN, &len);
+    apr_file_close(fp);
+    if (rv != APR_SUCCESS && !APR_STATUS_IS_EOF(rv)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, store->s, APLOGNO(10142)
+                     "Failed to read ticket key store %s, starting with "
+                     "new keys", store->path);
+        return;
+    }
+
+    n = (int)len - (TICKET_STORE_MAGIC_LEN + TICKET_STORE_IV_LEN
+                    + TICKET_STORE_TAG_LEN);
+    plain = apr_palloc(ptemp, TICKET_STORE_MAX_LEN);
+    if (n < 0 || n % TICKET_STORE_RECORD_LEN
+        || memcmp(buf, TICKET_STORE_MAGIC, TICKET_STORE_MAGIC_LEN)
+        || !ticket_store_crypt(0, store->secret,
+                               buf + TICKET_STORE_MAGIC_LEN,
+                               buf + TICKET_STORE_MAGIC_LEN
+                                   + TICKET_STORE_IV_LEN, n,
+                               plain, buf + len - TICKET_STORE_TAG_LEN)) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, store->s, APLOGNO(10143)
+                     "Ticket key store %s is invalid or was not encrypted "
+                     "with %s, starting with new keys",
+                     store->path, store->secret_path);
+        ERR_clear_error();
+        return;
+    }
+
+    retention = (apr_interval_time_t)(ring->nkeys - 1) * ring->rotation;
+    for (i = 0, rec = plain; i < n / TICKET_STORE_RECORD_LEN;
+         i++, rec += TICKET_STORE_RECORD_LEN) {
+        apr_time_t not_before = 0;
+        int j;
+
+        for (j = 0; j < 8; j++) {
+            not_before = (not_before << 8) | rec[j];
+        }
+        if (not_before <= 0 || not_before + retention <= now) {
+            continue;
+        }
+        ticket_slot_write(&ring->slots[loaded++], not_before, rec + 8);
+    }
+    OPENSSL_cleanse(plain, n);
+
+    ap_log_error(APLOG_MARK, APLOG_INFO, 0, store->s, APLOGNO(10144)
+                 "Loaded %d session ticket keys from %s", loaded,
+                 store->path);
+}
+
+/*
+ * Save the ring to the store, atomically.
+ */
+static apr_status_t ticket_store_save(ticket_store_t *store,
+                                      apr_pool_t *ptemp)
+{
+    ticket_ring_t *ring = store->ring;
+    unsigned char plain[TICKET_RING_SLOTS * TICKET_STORE_RECORD_LEN];
+    unsigned char *buf, *rec = plain;
+    const char *tmp_path;
+    apr_time_t not_before;
+    apr_file_t *fp;
+    apr_status_t rv;
+    int i, j, n;
+
+    for (i = 0; i < TICKET_RING_SLOTS; i++) {
+        if (ticket_slot_read(&ring->slots[i], &not_before, rec + 8) <= 0) {
+            continue;
+        }
+        for (j = 7; j >= 0; j--) {
+            rec[j] = (unsigned char)(not_before & 0xff);
+            not_before >>= 8;
+        }
+        rec += TICKET_STORE_RECORD_LEN;
+    }
+    n = rec - plain;
+
+    buf = apr_palloc(ptemp, TICKET_STORE_MAX_LEN);
+    memcpy(buf, TICKET_STORE_MAGIC, TICKET_STORE_MAGIC_LEN);
+    if (RAND_bytes(buf + TICKET_STORE_MAGIC_LEN, TICKET_STORE_IV_LEN) != 1
+        || !ticket_store_crypt(1, store->secret,
+                               buf + TICKET_STORE_MAGIC_LEN, plain, n,
+                               buf + TICKET_STORE_MAGIC_LEN
+                                   + TICKET_STORE_IV_LEN,
+                               buf + TICKET_STORE_MAGIC_LEN
+                                   + TICKET_STORE_IV_LEN + n)) {
+        OPENSSL_cleanse(plain, sizeof(plain));
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, store->s, APLOGNO(10145)
+                     "Failed to encrypt the session ticket keys");
+        ssl_log_ssl_error(SSLLOG_MARK, APLOG_ERR, store->s);
+        return APR_EGENERAL;
+    }
+    OPENSSL_cleanse(plain, sizeof(plain));
+
+    tmp_path = apr_pstrcat(ptemp, store->path, ".tmp", NULL);
+    rv = apr_file_open(&fp, tmp_path,
+                       APR_WRITE|APR_CREATE|APR_TRUNCATE|APR_BINARY,
+                       APR_FPROT_UREAD|APR_FPROT_UWRITE, ptemp);
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_write_full(fp, buf, TICKET_STORE_MAGIC_LEN
+                                          + TICKET_STORE_IV_LEN + n
+                                          + TICKET_STORE_TAG_LEN, NULL);
+        apr_file_close(fp);
+        if (rv == APR_SUCCESS) {
+            rv = apr_file_rename(tmp_path, store->path, ptemp);
+        }
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, store->s, APLOGNO(10146)
+                     "Failed to save the session ticket keys to %s",
+                     store->path);
+        return rv;
+    }
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, store->s, APLOGNO(10147)
+                 "Saved %d session ticket keys to %s",
+                 n / TICKET_STORE_RECORD_LEN, store->path);
+
+    return APR_SUCCESS;
+}
+
+/*
+ * Save the keys rotated by the watchdog when the parent restarts or
+ * stops (pconf cleanup), children don't run it.
+ */
+static apr_status_t ticket_store_cleanup(void *data)
+{
+    ticket_store_t *store = data;
+    apr_pool_t *ptemp;
+
+    if (store->pid == getpid()) {
+        apr_pool_create(&ptemp, NULL);
+        ticket_store_save(store, ptemp);
+        apr_pool_destroy(ptemp);
+    }
+    OPENSSL_cleanse(store->secret, sizeof(store->secret));
+
+    return APR_SUCCESS;
+}
+
+/*  _________________________________________________________________
+**
+**  Rotation
+**  _________________________________________________________________
+*/
+
+static apr_status_t ticket_watchdog_callback(int state, void *data,
+                                             apr_pool_t *pool)
+{
+    server_rec *s = data;
+    ticket_ring_t *ring = ticket_ring;
+    int n;
+
+    if (state == AP_WATCHDOG_STATE_STOPPING || !ring) {
+        return APR_SUCCESS;
+    }
+    if (!ticket_ring_lock(s)) {
+        return APR_SUCCESS;
+    }
+    n = ticket_ring_update(ring, apr_time_now());
+    ticket_ring_unlock(s);
+
+    if (n < 0) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, s, APLOGNO(10148)
+                     "Failed to generate a new session ticket key, "
+                     "will retry");
+        ssl_log_ssl_error(SSLLOG_MARK, APLOG_ERR, s);
+    }
+    else if (n > 0) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10149)
+                     "Session ticket keys rotated");
+    }
+
+    return APR_SUCCESS;
+}
+
+static void ticket_watchdog_init(server_rec *s, apr_pool_t *p)
+{
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
+    APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register;
+    ap_watchdog_t *wd;
+    apr_status_t rv;
+
+    wd_get_instance = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_get_instance);
+    wd_register = APR_RETRIEVE_OPTIONAL_FN(ap_watchdog_register_callback);
+    if (!wd_get_instance || !wd_register) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, 0, s, APLOGNO(10150)
+                     "mod_watchdog not loaded, session ticket keys "
+                     "will only be rotated on restart");
+        return;
+    }
+
+    rv = wd_get_instance(&wd, TICKET_WATCHDOG_NAME, 0, 1, p);
+    if (rv == APR_SUCCESS) {
+        rv = wd_register(wd, TICKET_WATCHDOG_INTERVAL, s,
+                         ticket_watchdog_callback);
+    }
+    if (rv != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO(10151)
+                     "failed to register the %s watchdog, session ticket "
+                     "keys will only be rotated on restart",
+                     TICKET_WATCHDOG_NAME);
+    }
+}
+
+/*  _________________________________________________________________
+**
+**  Initialization
+**  _________________________________________________________________
+*/
+
+apr_status_t ssl_ticket_ring_init(server_rec *s, apr_pool_t *p,
+                                  apr_pool_t *ptemp)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    SSLSrvConfigRec *sc = mySrvConfig(s);
+    ticket_store_t *store = NULL;
+    ticket_ring_t *ring;
+    apr_status_t rv;
+    apr_time_t now;
+    int fresh = 0, n;
+
+    ticket_ring = NULL;
+
+    /* Nothing to do for the first (dry run) post_config invocation */
+    if (ap_state_query(AP_SQ_MAIN_STATE) == AP_SQ_MS_CREATE_PRE_CONFIG) {
+        return APR_SUCCESS;
+    }
+    if (sc->ticket_key_rotation == 0) {
+        return APR_SUCCESS;
+    }
+
+    if (!mc->ticket_ring) {
+        /* Allocated from the process pool to survive restarts */
+        rv = apr_shm_create(&mc->ticket_ring_shm, sizeof(ticket_ring_t),
+                            NULL, mc->pPool);
+        if (rv == APR_ENOTIMPL) {
+            const char *fname = ap_runtime_dir_relative(ptemp,
+                                                        "ssl_ticket_keys");
+            apr_shm_remove(fname, ptemp);
+            rv = apr_shm_create(&mc->ticket_ring_shm, sizeof(ticket_ring_t),
+                                apr_pstrdup(mc->pPool, fname), mc->pPool);
+        }
+        if (rv != APR_SUCCESS) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10152)
+                         "Cannot create shared memory for the session "
+                         "ticket keys, each process will use its own");
+            return APR_SUCCESS;
+        }
+        mc->ticket_ring = apr_shm_baseaddr_get(mc->ticket_ring_shm);
+        memset(mc->ticket_ring, 0, sizeof(ticket_ring_t));
+        fresh = 1;
+    }
+    ring = mc->ticket_ring;
+
+    if (!mc->ticket_ring_mutex
+        && (rv = ap_global_mutex_create(&mc->ticket_ring_mutex, NULL,
+                                        SSL_TICKET_KEYS_MUTEX_TYPE, NULL, s,
+                                        s->process->pool, 0)) != APR_SUCCESS) {
+        return ssl_die(s);
+    }
+
+    if (sc->ticket_key_store) {
+        store = apr_pcalloc(p, sizeof(*store));
+        store->s = s;
+        store->ring = ring;
+        store->path = sc->ticket_key_store;
+        store->secret_path = sc->ticket_key_secret;
+        store->pid = getpid();
+        if (ticket_store_secret(store, ptemp) != APR_SUCCESS) {
+            return ssl_die(s);
+        }
+    }
+
+    now = apr_time_now();
+    if (!ticket_ring_lock(s)) {
+        return ssl_die(s);
+    }
+    ring->rotation = (sc->ticket_key_rotation == UNSET)
+                     ? TICKET_ROTATION_DEFAULT : sc->ticket_key_rotation;
+    ring->nkeys = 2 + ((sc->ticket_key_previous == UNSET)
+                       ? TICKET_PREVIOUS_DEFAULT : sc->ticket_key_previous);
+    if (store && fresh) {
+        ticket_store_load(store, now, ptemp);
+    }
+    n = ticket_ring_update(ring, now);
+    ticket_ring_unlock(s);
+
+    if (n < 0) {
+        ap_log_error(APLOG_MARK, APLOG_EMERG, 0, s, APLOGNO(10153)
+                     "Failed to generate the session ticket keys");
+        ssl_log_ssl_error(SSLLOG_MARK, APLOG_EMERG, s);
+        return ssl_die(s);
+    }
+
+    if (store) {
+        ticket_store_save(store, ptemp);
+        apr_pool_cleanup_register(p, store, ticket_store_cleanup,
+                                  apr_pool_cleanup_null);
+    }
+
+    ticket_ring = ring;
+    ticket_watchdog_init(s, p);
+
+    ap_log_error(APLOG_MARK, APLOG_INFO, 0, s, APLOGNO(10154)
+                 "Session ticket keys shared by all processes, rotated "
+                 "every %" APR_TIME_T_FMT "s, %d previous keys accepted",
+                 apr_time_sec(ring->rotation), (int)ring->nkeys - 2);
+
+    return APR_SUCCESS;
+}
+
+void ssl_ticket_ring_child_init(server_rec *s, apr_pool_t *p)
+{
+    SSLModConfigRec *mc = myModConfig(s);
+    const char *lockfile;
+    apr_status_t rv;
+
+    if (!mc->ticket_ring_mutex) {
+        return;
+    }
+    lockfile = apr_global_mutex_lockfile(mc->ticket_ring_mutex);
+    if ((rv = apr_global_mutex_child_init(&mc->ticket_ring_mutex,
+                                          lockfile, p)) != APR_SUCCESS) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10170)
+                     "Cannot reinit %s mutex%s%s", SSL_TICKET_KEYS_MUTEX_TYPE,
+                     lockfile ? " with file " : "", lockfile ? lockfile : "");
+    }
+}
+
+/*  _________________________________________________________________
+**
+**  SSL Extension to mod_status
+**  _________________________________________________________________
+*/
+
+void ssl_ticket_ring_status(request_rec *r, int flags)
+{
+    ticket_ring_t *ring = ticket_ring;
+    unsigned char key[TLSEXT_TICKET_KEY_LEN];
+    apr_time_t not_before;
+    int i, keys = 0;
+
+    if (ring == NULL) {
+        return;
+    }
+    for (i = 0; i < TICKET_RING_SLOTS; i++) {
+        if (ticket_slot_read(&ring->slots[i], &not_before, key) > 0) {
+            keys++;
+        }
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+
+    if (!(flags & AP_STATUS_SHORT)) {
+        ap_rprintf(r, "session ticket keys: <b>%d</b>, rotated every "
+                   "<b>%" APR_TIME_T_FMT "</b> seconds, rotations: "
+                   "<b>%u</b><br>", keys, apr_time_sec(ring->rotation),
+                   apr_atomic_read32(&ring->rotations));
+        ap_rprintf(r, "session tickets issued: <b>%u</b>, key lookups: "
+                   "<b>%u</b> hit (<b>%u</b> renewed), <b>%u</b> miss<br>",
+                   apr_atomic_read32(&ring->issued),
+                   apr_atomic_read32(&ring->hits),
+                   apr_atomic_read32(&ring->renewals),
+                   apr_atomic_read32(&ring->misses));
+    }
+    else {
+        ap_rprintf(r, "TicketKeys: %d\n", keys);
+        ap_rprintf(r, "TicketKeyRotation: %" APR_TIME_T_FMT "\n",
+                   apr_time_sec(ring->rotation));
+        ap_rprintf(r, "TicketKeyRotations: %u\n",
+                   apr_atomic_read32(&ring->rotations));
+        ap_rprintf(r, "TicketIssueCount: %u\n",
+                   apr_atomic_read32(&ring->issued));
+        ap_rprintf(r, "TicketKeyHitCount: %u\n",
+                   apr_atomic_read32(&ring->hits));
+        ap_rprintf(r, "TicketKeyRenewCount: %u\n",
+                   apr_atomic_read32(&ring->renewals));
+        ap_rprintf(r, "TicketKeyMissCount: %u\n",
+                   apr_atomic_read32(&ring->misses));
+    }
+}
+
+#endif /* HAVE_TLS_TICKET_KEY_RING */
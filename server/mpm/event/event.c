@@ -687,6 +687,9 @@ static int event_query(int query_code, int *result, apr_status_t *rv)
     case AP_MPMQ_CAN_POLL:
         *result = 1;
         break;
+    case AP_MPMQ_CAN_WAITIO:
+        *result = 1;
+        break;
     default:
         *rv = APR_ENOTIMPL;
         break;
@@ -1053,8 +1056,10 @@ static void process_socket(apr_thread_t *thd, apr_pool_t * p, apr_socket_t * soc
             rc = OK;
         }
     }
-    else if (cs->pub.state == CONN_STATE_READ_REQUEST_LINE) {
+    else if (cs->pub.state == CONN_STATE_READ_REQUEST_LINE
+             || cs->pub.state == CONN_STATE_ASYNC_WAITIO) {
 read_request:
+        cs->pub.state = CONN_STATE_READ_REQUEST_LINE;
         rc = ap_run_process_connection(c);
         if (rc == DONE) {
             rc = OK;
@@ -1072,6 +1077,10 @@ read_request:
      *   completion at some point may require reads (e.g. SSL_ERROR_WANT_READ),
      *   an output filter can set the sense to CONN_SENSE_WANT_READ at any time
      *   for event MPM to do the right thing,
+     * - wait for read/write-ability of the underlying socket with respect to
+     *   its own timeout and then run the process_connection hooks again
+     *   (CONN_STATE_ASYNC_WAITIO, per the sense), e.g. for mod_ssl to resume
+     *   a TLS handshake which needs more data from the client,
      * - suspend the connection (SUSPENDED) such that it now interracts with
      *   the MPM through suspend/resume_connection() hooks, and/or registered
      *   poll callbacks (PT_USER), and/or registered timed callbacks triggered
@@ -1088,6 +1097,7 @@ read_request:
     if (rc != OK || (cs->pub.state != CONN_STATE_LINGER
                      && cs->pub.state != CONN_STATE_WRITE_COMPLETION
                      && cs->pub.state != CONN_STATE_CHECK_REQUEST_LINE_READABLE
+                     && cs->pub.state != CONN_STATE_ASYNC_WAITIO
                      && cs->pub.state != CONN_STATE_SUSPENDED)) {
         ap_log_cerror(APLOG_MARK, APLOG_DEBUG, 0, c, APLOGNO()
                       "process_socket: connection processing %s: closing",
@@ -1159,6 +1169,40 @@ read_request:
     if (cs->pub.state == CONN_STATE_LINGER) {
         start_lingering_close_blocking(cs);
     }
+    else if (cs->pub.state == CONN_STATE_ASYNC_WAITIO) {
+        /* Let the event thread poll for read/writeability, with respect to
+         * the server Timeout (the write completion queue's), and hand the
+         * connection back to a worker to run the process_connection hooks
+         * again.
+         */
+        ap_update_child_status(cs->sbh, SERVER_BUSY_READ, NULL);
+        cs->queue_timestamp = apr_time_now();
+        notify_suspend(cs);
+
+        if (cs->pub.sense == CONN_SENSE_WANT_WRITE) {
+            cs->pfd.reqevents = APR_POLLOUT;
+        }
+        else {
+            cs->pfd.reqevents = APR_POLLIN;
+        }
+        cs->pfd.reqevents |= APR_POLLHUP | APR_POLLERR;
+        cs->pub.sense = CONN_SENSE_DEFAULT;
+
+        apr_thread_mutex_lock(timeout_mutex);
+        TO_QUEUE_APPEND(cs->sc->wc_q, cs);
+        rc = apr_pollset_add(event_pollset, &cs->pfd);
+        if (rc != APR_SUCCESS && !APR_STATUS_IS_EEXIST(rc)) {
+            TO_QUEUE_REMOVE(cs->sc->wc_q, cs);
+            apr_thread_mutex_unlock(timeout_mutex);
+            ap_log_error(APLOG_MARK, APLOG_ERR, rc, ap_server_conf, APLOGNO(10135)
+                         "process_socket: apr_pollset_add failure for "
+                         "async IO wait");
+            apr_socket_close(cs->pfd.desc.s);
+            ap_push_pool(worker_queue_info, cs->p);
+            return;
+        }
+        apr_thread_mutex_unlock(timeout_mutex);
+    }
     else if (cs->pub.state == CONN_STATE_CHECK_REQUEST_LINE_READABLE) {
         ap_update_child_status(cs->sbh, SERVER_BUSY_KEEPALIVE, NULL);
 
@@ -1935,6 +1979,7 @@ static void * APR_THREAD_FUNC listener_thread(apr_thread_t * thd, void *dummy)
                     /* don't wait for a worker for a keepalive request */
                     blocking = 0;
                     /* FALL THROUGH */
+                case CONN_STATE_ASYNC_WAITIO:
                 case CONN_STATE_WRITE_COMPLETION:
                     get_worker(&have_idle_worker, blocking,
                                &workers_were_busy);
@@ -125,6 +125,7 @@
 #include "apr.h"
 #include "apr_signal.h"
 #include "apr_strings.h"
+#include "apr_tables.h"
 #include "apr_network_io.h"
 #include "apr_file_io.h"
 #include "apr_time.h"
@@ -134,6 +135,10 @@
 #include "apr_portable.h"
 #include "ap_release.h"
 #include "apr_poll.h"
+#include "apr_atomic.h"
+#if APR_HAS_THREADS
+#include "apr_thread_proc.h"
+#endif
 
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
@@ -197,6 +202,9 @@ typedef STACK_OF(X509) X509_STACK_TYPE;
 #if !defined(OPENSSL_NO_TLSEXT) && defined(SSL_set_tlsext_host_name)
 #define HAVE_TLSEXT
 #endif
+#if !defined(OPENSSL_NO_TLSEXT) && OPENSSL_VERSION_NUMBER >= 0x10002000L
+#define HAVE_TLS_ALPN
+#endif
 #if defined(LIBRESSL_VERSION_NUMBER) && LIBRESSL_VERSION_NUMBER < 0x2060000f
 #define SSL_CTRL_SET_MIN_PROTO_VERSION 123
 #define SSL_CTRL_SET_MAX_PROTO_VERSION 124
@@ -207,6 +215,11 @@ typedef STACK_OF(X509) X509_STACK_TYPE;
 #endif
 #endif
 
+#if defined(HAVE_LIBNGHTTP2)
+#include <nghttp2/nghttp2.h>
+#define USE_H2
+#endif
+
 #include <math.h>
 #if APR_HAVE_CTYPE_H
 #include <ctype.h>
@@ -223,7 +236,8 @@ typedef STACK_OF(X509) X509_STACK_TYPE;
 #define AB_MAX LLONG_MAX
 #endif
 
-/* maximum number of requests on a time limited test */
+/* maximum number of requests on a time limited test, unless the
+ * times are kept in histograms (-W) */
 #define MAX_REQUESTS (INT_MAX > 50000 ? 50000 : INT_MAX)
 
 /* connection state
@@ -241,6 +255,20 @@ typedef enum {
 
 #define CBUFFSIZE (8192)
 
+#ifdef USE_H2
+/* a request on an HTTP/2 connection (-2) */
+struct stream {
+    apr_int32_t id;             /* 0 while the slot is free */
+    apr_time_t intended,        /* as for the connection */
+               start,
+               endwrite,
+               beginread;
+    apr_size_t bread;           /* amount of body read */
+    apr_size_t posted;          /* amount of body sent */
+    int status;                 /* of the response */
+};
+#endif
+
 struct connection {
     apr_pool_t *ctx;
     apr_socket_t *aprsock;
@@ -263,9 +291,21 @@ struct connection {
                done;            /* Connection closed */
 
     int socknum;
+    int pipelined;              /* requests written and not answered yet */
+    struct worker *worker;      /* the event loop of the connection */
+    apr_time_t intended;        /* when the request was due to be sent (-R) */
+    apr_uint32_t nsent;         /* requests sent on this connection (-R) */
+    apr_time_t send_at;         /* when to send the next one, while waiting */
+    struct connection *tprev,   /* on the timer wheel */
+                      *tnext;
+    int waiting;                /* non-zero if on the timer wheel */
 #ifdef USE_SSL
     SSL *ssl;
 #endif
+#ifdef USE_H2
+    nghttp2_session *h2;        /* with -2 */
+    struct stream *streams;     /* -K of them, the "pipelined" ones open */
+#endif
 };
 
 struct data {
@@ -275,11 +315,83 @@ struct data {
     apr_interval_time_t time;     /* time for connection */
 };
 
+/*
+ * Without the per request data of struct data (-W), the times are
+ * counted in histograms, as HdrHistogram does: in microseconds, exact
+ * below 2^HIST_SUB_BITS and within 1/2^(HIST_SUB_BITS-1) above, up to
+ * 2^HIST_MAX_BITS (19 hours).
+ */
+#define HIST_SUB_BITS   10
+#define HIST_MAX_BITS   36
+#define HIST_SUB_COUNT  (1 << HIST_SUB_BITS)
+#define HIST_HALF_COUNT (HIST_SUB_COUNT / 2)
+#define HIST_COUNTS     (HIST_SUB_COUNT + \
+                         (HIST_MAX_BITS - HIST_SUB_BITS) * HIST_HALF_COUNT)
+
+struct histogram {
+    apr_uint64_t *counts;         /* HIST_COUNTS buckets */
+    apr_uint64_t total;
+    apr_interval_time_t min, max;
+    double sum, sumsq;            /* for the mean and standard deviation */
+};
+
+/* the times measured of each request */
+enum {
+    T_CONNECT = 0,                /* struct data ctime */
+    T_PROCESSING,                 /* time - ctime */
+    T_WAITING,                    /* waittime */
+    T_TOTAL,                      /* time */
+    T_NUM
+};
+
+/*
+ * With -R, the connections waiting for the time of their next request
+ * are kept on a timer wheel of WHEEL_SLOTS ticks of WHEEL_TICK usecs,
+ * those due later than one turn stay in their slot for the next turns.
+ */
+#define WHEEL_TICK      1000
+#define WHEEL_SLOTS     1024
+
+/*
+ * An event loop, of which there is one per thread with -W. The
+ * connections of a worker are polled and handled by that worker only,
+ * so the counters are its own, and they are summed into the globals of
+ * the same name by sum_workers() when the results are output.
+ */
+struct worker {
+    int id;
+    apr_pool_t *pool;
+    apr_pollset_t *pollset;
+    struct connection *con;       /* the connections of this worker */
+    int concurrency;              /* and their number */
+    apr_sockaddr_t *destsa;
+    int requests_initialized;
+    apr_time_t lasttime;
+    apr_size_t doclen;
+    apr_int64_t totalread, totalbread, totalposted;
+    int doneka, good, bad, epipe;
+    int err_length, err_conn, err_recv, err_except, err_response;
+    struct histogram hist[T_NUM];
+    struct connection *wheel[WHEEL_SLOTS];
+    apr_int64_t wheel_tick;       /* the tick the wheel has run up to */
+    int nwaiting;                 /* connections on the wheel */
+#ifdef USE_SSL
+    SSL_SESSION *session;         /* to resume (-U) */
+    int handshakes, resumed;
+#endif
+#if APR_HAS_THREADS
+    apr_thread_t *thread;
+#endif
+    /* a throw-away buffer to read stuff into */
+    char buffer[8192];
+};
+
 #define ap_min(a,b) (((a)<(b))?(a):(b))
 #define ap_max(a,b) (((a)>(b))?(a):(b))
 #define ap_round_ms(a) ((apr_time_t)((a) + 500)/1000)
 #define ap_double_ms(a) ((double)(a)/1000.0)
 #define MAX_CONCURRENCY 20000
+#define MAX_PIPELINE 1000
 
 /* --------------------- GLOBALS ---------------------------- */
 
@@ -296,6 +408,14 @@ int nolength = 0;       /* Accept variable document length */
 int confidence = 1;     /* Show confidence estimator and warnings */
 int tlimit = 0;         /* time limit in secs */
 int keepalive = 0;      /* try and do keepalive connections */
+int pipeline = 1;       /* requests written at once on a keepalive connection,
+                         * or streams open at once with HTTP/2 */
+#ifdef USE_H2
+int http2 = 0;          /* speak HTTP/2 */
+#endif
+int threads = 0;        /* number of worker threads, 0 for none */
+double rate = 0;        /* requests per second to send, 0 for as fast as
+                         * the responses come (closed loop) */
 int windowsize = 0;     /* we use the OS default window size */
 char servername[1024];  /* name that server reports */
 char *hostname;         /* host name from URL */
@@ -315,6 +435,7 @@ const char *myhost;
 apr_port_t connectport;
 const char *gnuplot;          /* GNUplot file */
 const char *csvperc;          /* CSV Percentile file */
+const char *jsonfile;         /* JSON results file */
 const char *fullurl;
 const char *colonhost;
 int isproxy = 0;
@@ -333,11 +454,15 @@ const char *tablestring;
 const char *trstring;
 const char *tdstring;
 
+/* request budget shared by the workers */
+volatile apr_uint32_t started = 0;  /* number of requests started, so no excess */
+volatile apr_uint32_t finished = 0; /* number of requests finished */
+
+/* totals of all workers, see sum_workers() */
 apr_size_t doclen = 0;     /* the length the document should be */
 apr_int64_t totalread = 0;    /* total number of bytes read */
 apr_int64_t totalbread = 0;   /* totoal amount of entity body read */
 apr_int64_t totalposted = 0;  /* total number of bytes posted, inc. headers */
-int started = 0;           /* number of requests started, so no excess */
 int done = 0;              /* number of requests we have done */
 int doneka = 0;            /* number of keep alive connections done */
 int good = 0, bad = 0;     /* number of good and bad requests */
@@ -359,6 +484,9 @@ BIO *bio_out,*bio_err;
 int tls_use_sni = 1;         /* used by default, -I disables it */
 const char *tls_sni = NULL; /* 'opt_host' if any, 'hostname' otherwise */
 #endif
+int tls_resume = 0;          /* resume the TLS sessions of the worker */
+int handshakes = 0;          /* number of TLS handshakes */
+int resumed = 0;             /* of which resumed sessions */
 #endif
 
 apr_time_t start, lasttime, stoptime;
@@ -367,20 +495,25 @@ apr_time_t start, lasttime, stoptime;
 char _request[8192];
 char *request = _request;
 apr_size_t reqlen;
-int requests_initialized = 0;
+apr_size_t reqsize;        /* reqlen plus the body, if any */
 
-/* one global throw-away buffer to read stuff into */
-char buffer[8192];
+#ifdef USE_H2
+/* the request with HTTP/2 */
+nghttp2_nv *h2_nv;
+size_t h2_nvlen;
+nghttp2_session_callbacks *h2_callbacks;
+#endif
 
 /* interesting percentiles */
-int percs[] = {50, 66, 75, 80, 90, 95, 98, 99, 100};
+double percs[] = {50, 66, 75, 80, 90, 95, 98, 99, 99.9, 99.99, 99.999, 100};
 
 struct connection *con;     /* connection array */
-struct data *stats;         /* data for each request */
+struct data *stats;         /* data for each request, unless -W */
+struct histogram hists[T_NUM]; /* or the times of all requests */
+struct worker *workers;     /* event loops */
+int nworkers;
 apr_pool_t *cntxt;
 
-apr_pollset_t *readbits;
-
 apr_sockaddr_t *mysa;
 apr_sockaddr_t *destsa;
 
@@ -390,16 +523,26 @@ apr_xlate_t *from_ascii, *to_ascii;
 
 static void write_request(struct connection * c);
 static void close_connection(struct connection * c);
+static void start_connect(struct connection * c);
 
 /* --------------------------------------------------------- */
 
 /* simple little function to write an error string and exit */
 
+static int requests_done(void)
+{
+    apr_uint32_t n = apr_atomic_read32(&finished);
+
+    return n < (apr_uint32_t)requests ? (int)n : requests;
+}
+
 static void err(const char *s)
 {
+    int n = requests_done();
+
     fprintf(stderr, "%s\n", s);
-    if (done)
-        printf("Total of %d requests completed\n" , done);
+    if (n)
+        printf("Total of %d requests completed\n" , n);
     exit(1);
 }
 
@@ -409,11 +552,13 @@ static void apr_err(const char *s, apr_status_t rv)
 {
     char buf[120];
 
+    int n = requests_done();
+
     fprintf(stderr,
         "%s: %s (%d)\n",
         s, apr_strerror(rv, buf, sizeof buf), rv);
-    if (done)
-        printf("Total of %d requests completed\n" , done);
+    if (n)
+        printf("Total of %d requests completed\n" , n);
     exit(rv);
 }
 
@@ -494,13 +639,320 @@ static int abort_on_oom(int retcode)
     return retcode;
 }
 
+/* --------------------------------------------------------- */
+
+/* latency histograms */
+
+static void hist_init(struct histogram *h, apr_pool_t *p)
+{
+    if (h->counts) {
+        memset(h->counts, 0, HIST_COUNTS * sizeof(apr_uint64_t));
+    }
+    else {
+        h->counts = apr_pcalloc(p, HIST_COUNTS * sizeof(apr_uint64_t));
+    }
+    h->total = 0;
+    h->min = AB_MAX;
+    h->max = 0;
+    h->sum = h->sumsq = 0;
+}
+
+static int hist_index(apr_interval_time_t v)
+{
+    int shift = 0;
+
+    if (v < HIST_SUB_COUNT) {
+        return v < 0 ? 0 : (int)v;
+    }
+    if (v >= (APR_INT64_C(1) << HIST_MAX_BITS)) {
+        v = (APR_INT64_C(1) << HIST_MAX_BITS) - 1;
+    }
+    while ((v >> shift) >= HIST_SUB_COUNT) {
+        shift++;
+    }
+    /* v >> shift is in [HIST_HALF_COUNT, HIST_SUB_COUNT) */
+    return shift * HIST_HALF_COUNT + (int)(v >> shift);
+}
+
+/* the highest value counted in bucket i */
+static apr_interval_time_t hist_value(int i)
+{
+    int shift;
+
+    if (i < HIST_SUB_COUNT) {
+        return i;
+    }
+    shift = i / HIST_HALF_COUNT - 1;
+    return ((apr_interval_time_t)(i - shift * HIST_HALF_COUNT + 1) << shift) - 1;
+}
+
+static void hist_record(struct histogram *h, apr_interval_time_t v)
+{
+    h->counts[hist_index(v)]++;
+    h->total++;
+    h->min = ap_min(h->min, v);
+    h->max = ap_max(h->max, v);
+    h->sum += (double)v;
+    h->sumsq += (double)v * v;
+}
+
+static void hist_add(struct histogram *to, const struct histogram *from)
+{
+    int i;
+
+    for (i = 0; i < HIST_COUNTS; i++) {
+        to->counts[i] += from->counts[i];
+    }
+    to->total += from->total;
+    to->min = ap_min(to->min, from->min);
+    to->max = ap_max(to->max, from->max);
+    to->sum += from->sum;
+    to->sumsq += from->sumsq;
+}
+
+/* the time within which pct percent of the values fall */
+static apr_interval_time_t hist_percentile(const struct histogram *h,
+                                           double pct)
+{
+    apr_uint64_t want, seen = 0;
+    int i;
+
+    if (!h->total) {
+        return 0;
+    }
+    want = (apr_uint64_t)(pct / 100 * h->total + 0.5);
+    if (want < 1) {
+        want = 1;
+    }
+    for (i = 0; i < HIST_COUNTS; i++) {
+        seen += h->counts[i];
+        if (seen >= want) {
+            return ap_max(h->min, ap_min(hist_value(i), h->max));
+        }
+    }
+    return h->max;
+}
+
+static void hist_stats(const struct histogram *h, apr_interval_time_t *min,
+                       apr_time_t *mean, double *sd,
+                       apr_interval_time_t *median, apr_interval_time_t *max)
+{
+    double n = (double)h->total;
+
+    *min = h->min;
+    *max = h->max;
+    *mean = (apr_time_t)(h->sum / n);
+    *median = hist_percentile(h, 50);
+    /* the sample variance, as computed from struct data */
+    *sd = (n > 1) ? (h->sumsq - h->sum * h->sum / n) / (n - 1) : 0;
+    *sd = (*sd > 0) ? sqrt(*sd) : 0;
+}
+
+/* --------------------------------------------------------- */
+
+/* take up to n requests from the budget, returns how many */
+
+static int reserve_requests(int n)
+{
+    apr_uint32_t s;
+
+    do {
+        s = apr_atomic_read32(&started);
+        if (s >= (apr_uint32_t)requests) {
+            return 0;
+        }
+        if ((apr_uint32_t)n > (apr_uint32_t)requests - s) {
+            n = (int)((apr_uint32_t)requests - s);
+        }
+    } while (apr_atomic_cas32(&started, s + n, s) != s);
+
+    return n;
+}
+
+/* save out the times of a finished request, if it is within the budget */
+
+static int record_times(struct worker *w, apr_time_t from, apr_time_t start,
+                        apr_time_t connect, apr_time_t endwrite,
+                        apr_time_t beginread, apr_time_t done)
+{
+    apr_uint32_t n = apr_atomic_inc32(&finished);
+
+    if (n >= (apr_uint32_t)requests) {
+        return 0;
+    }
+
+    w->lasttime = done;
+    if (stats) {
+        struct data *s = &stats[n];
+        s->starttime = from;
+        s->ctime     = ap_max(0, connect - start);
+        s->time      = ap_max(0, done - from);
+        s->waittime  = ap_max(0, beginread - endwrite);
+    }
+    else {
+        hist_record(&w->hist[T_CONNECT], ap_max(0, connect - start));
+        hist_record(&w->hist[T_PROCESSING], ap_max(0, done - connect));
+        hist_record(&w->hist[T_WAITING], ap_max(0, beginread - endwrite));
+        hist_record(&w->hist[T_TOTAL], ap_max(0, done - from));
+    }
+    if (heartbeatres && !((n + 1) % heartbeatres)) {
+        fprintf(stderr, "Completed %u requests\n", n + 1);
+        fflush(stderr);
+    }
+    return 1;
+}
+
+static int save_times(struct connection *c)
+{
+    c->done = apr_time_now();
+    /*
+     * At a constant rate the time is from when the request was due, not
+     * from when it could be sent, so that a slow response counts for the
+     * requests it held up too (no coordinated omission).
+     */
+    return record_times(c->worker, rate ? c->intended : c->start, c->start,
+                        c->connect, c->endwrite, c->beginread, c->done);
+}
+
+/* sum up the counters of all workers into the globals */
+
+static void sum_workers(void)
+{
+    int i, j;
+
+    done = requests_done();
+    doneka = good = bad = epipe = 0;
+    err_length = err_conn = err_recv = err_except = err_response = 0;
+    totalread = totalbread = totalposted = 0;
+#ifdef USE_SSL
+    handshakes = resumed = 0;
+#endif
+    if (!stats) {
+        for (j = 0; j < T_NUM; j++) {
+            hist_init(&hists[j], cntxt);
+        }
+    }
+
+    for (i = 0; i < nworkers; i++) {
+        struct worker *w = &workers[i];
+
+        if (w->good && !good) {
+            doclen = w->doclen;
+        }
+        lasttime = ap_max(lasttime, w->lasttime);
+        doneka += w->doneka;
+        good += w->good;
+        bad += w->bad;
+        epipe += w->epipe;
+        err_length += w->err_length;
+        err_conn += w->err_conn;
+        err_recv += w->err_recv;
+        err_except += w->err_except;
+        err_response += w->err_response;
+        totalread += w->totalread;
+        totalbread += w->totalbread;
+        totalposted += w->totalposted;
+#ifdef USE_SSL
+        handshakes += w->handshakes;
+        resumed += w->resumed;
+#endif
+        if (!stats) {
+            for (j = 0; j < T_NUM; j++) {
+                hist_add(&hists[j], &w->hist[j]);
+            }
+        }
+    }
+}
+
+/* --------------------------------------------------------- */
+
+/* constant rate (-R) scheduling */
+
+/*
+ * Each connection sends its share of the rate, the connections spaced
+ * evenly over the interval. The time is computed from the start for
+ * every request so that it doesn't drift.
+ */
+static apr_time_t send_time(struct connection *c)
+{
+    return start + (apr_time_t)(((double)c->nsent * concurrency + (c - con))
+                                * APR_USEC_PER_SEC / rate);
+}
+
+static void timer_add(struct worker *w, struct connection *c)
+{
+    struct connection **slot;
+
+    c->send_at = send_time(c);
+    slot = &w->wheel[(c->send_at / WHEEL_TICK) % WHEEL_SLOTS];
+    c->tprev = NULL;
+    c->tnext = *slot;
+    if (*slot) {
+        (*slot)->tprev = c;
+    }
+    *slot = c;
+    c->waiting = 1;
+    w->nwaiting++;
+}
+
+static void timer_remove(struct worker *w, struct connection *c)
+{
+    if (c->tprev) {
+        c->tprev->tnext = c->tnext;
+    }
+    else {
+        w->wheel[(c->send_at / WHEEL_TICK) % WHEEL_SLOTS] = c->tnext;
+    }
+    if (c->tnext) {
+        c->tnext->tprev = c->tprev;
+    }
+    c->waiting = 0;
+    w->nwaiting--;
+}
+
+/* send the requests that are due */
+static void timer_run(struct worker *w, apr_time_t now)
+{
+    struct connection *due = NULL, *c, *next;
+    apr_int64_t tick = now / WHEEL_TICK;
+
+    /* a whole turn visits every slot */
+    if (tick - w->wheel_tick >= WHEEL_SLOTS) {
+        w->wheel_tick = tick - WHEEL_SLOTS + 1;
+    }
+    for (; w->wheel_tick <= tick; w->wheel_tick++) {
+        for (c = w->wheel[w->wheel_tick % WHEEL_SLOTS]; c; c = next) {
+            next = c->tnext;
+            if (c->send_at <= now) {
+                timer_remove(w, c);
+                c->tnext = due;
+                due = c;
+            }
+        }
+    }
+    /* the current tick is looked at again, for what is due later in it */
+    w->wheel_tick = tick;
+
+    for (c = due; c; c = next) {
+        next = c->tnext;
+        if (c->state == STATE_UNCONNECTED) {
+            start_connect(c);
+        }
+        else {
+            /* an idle keep-alive connection, its time starts now */
+            c->start = apr_time_now();
+            write_request(c);
+        }
+    }
+}
+
 static void set_polled_events(struct connection *c, apr_int16_t new_reqevents)
 {
     apr_status_t rv;
 
     if (c->pollfd.reqevents != new_reqevents) {
         if (c->pollfd.reqevents != 0) {
-            rv = apr_pollset_remove(readbits, &c->pollfd);
+            rv = apr_pollset_remove(c->worker->pollset, &c->pollfd);
             if (rv != APR_SUCCESS) {
                 apr_err("apr_pollset_remove()", rv);
             }
@@ -508,7 +960,7 @@ static void set_polled_events(struct connection *c, apr_int16_t new_reqevents)
 
         if (new_reqevents != 0) {
             c->pollfd.reqevents = new_reqevents;
-            rv = apr_pollset_add(readbits, &c->pollfd);
+            rv = apr_pollset_add(c->worker->pollset, &c->pollfd);
             if (rv != APR_SUCCESS) {
                 apr_err("apr_pollset_add()", rv);
             }
@@ -578,6 +1030,22 @@ static void ssl_state_cb(const SSL *s, int w, int r)
     }
 }
 
+/*
+ * With -U, the last session (or ticket) the server gave the worker is
+ * offered by its next connections, as a browser would.
+ */
+static int ssl_new_session_cb(SSL *ssl, SSL_SESSION *session)
+{
+    struct connection *c = SSL_get_app_data(ssl);
+    struct worker *w = c->worker;
+
+    if (w->session) {
+        SSL_SESSION_free(w->session);
+    }
+    w->session = session;
+    return 1;
+}
+
 #ifndef RAND_MAX
 #define RAND_MAX INT_MAX
 #endif
@@ -714,7 +1182,12 @@ static void ssl_proceed_handshake(struct connection *c)
         case SSL_ERROR_NONE:
             if (verbosity >= 2)
                 ssl_print_info(c);
-            if (ssl_info == NULL) {
+            c->worker->handshakes++;
+            if (SSL_session_reused(c->ssl)) {
+                c->worker->resumed++;
+            }
+            /* the first worker describes the session for all of them */
+            if (ssl_info == NULL && c->worker->id == 0) {
                 AB_SSL_CIPHER_CONST SSL_CIPHER *ci;
                 X509 *cert;
                 int sk_bits, pk_bits, swork;
@@ -733,7 +1206,7 @@ static void ssl_proceed_handshake(struct connection *c)
                              SSL_CIPHER_get_name(ci),
                              pk_bits, sk_bits);
             }
-            if (ssl_tmp_key == NULL) {
+            if (ssl_tmp_key == NULL && c->worker->id == 0) {
                 EVP_PKEY *key;
                 if (SSL_get_server_tmp_key(c->ssl, &key)) {
                     ssl_tmp_key = xmalloc(128);
@@ -758,65 +1231,603 @@ static void ssl_proceed_handshake(struct connection *c)
                         if (!cname)
                             cname = OBJ_nid2sn(nid);
 
-                        apr_snprintf(ssl_tmp_key, 128, "ECDH %s %d bits",
-                                     cname,
-                                     EVP_PKEY_bits(key));
-                        break;
-                        }
+                        apr_snprintf(ssl_tmp_key, 128, "ECDH %s %d bits",
+                                     cname,
+                                     EVP_PKEY_bits(key));
+                        break;
+                        }
+#endif
+                    }
+                    EVP_PKEY_free(key);
+                }
+            }
+            write_request(c);
+            do_next = 0;
+            break;
+        case SSL_ERROR_WANT_READ:
+            set_polled_events(c, APR_POLLIN);
+            do_next = 0;
+            break;
+        case SSL_ERROR_WANT_WRITE:
+            set_polled_events(c, APR_POLLOUT);
+            do_next = 0;
+            break;
+        case SSL_ERROR_WANT_CONNECT:
+        case SSL_ERROR_SSL:
+        case SSL_ERROR_SYSCALL:
+            /* Unexpected result */
+            BIO_printf(bio_err, "SSL handshake failed (%d).\n", ecode);
+            ERR_print_errors(bio_err);
+            close_connection(c);
+            do_next = 0;
+            break;
+        }
+    }
+}
+
+#endif /* USE_SSL */
+
+/* the first response tells the destination address works, start the rest */
+
+static void connect_all(struct worker *w)
+{
+    int i;
+
+    for (i = 1; i < w->concurrency; i++) {
+        w->con[i].socknum = i;
+        start_connect(&w->con[i]);
+    }
+    w->requests_initialized = 1;
+}
+
+#ifdef USE_H2
+/* --------------------------------------------------------- */
+
+/*
+ * HTTP/2 (-2), with nghttp2 as mod_http2. Up to -K requests are open
+ * as streams on a connection, and a stream that is done is replaced by
+ * the next request straight away, so the server always has as many to
+ * work on. The request is set up once, by h2_setup().
+ */
+
+#define H2_WINDOW_SIZE  (1 << 30)
+
+static ssize_t h2_send_cb(nghttp2_session *session, const uint8_t *data,
+                          size_t length, int flags, void *user_data)
+{
+    struct connection *c = user_data;
+    apr_size_t l = length;
+    apr_status_t rv;
+
+#ifdef USE_SSL
+    if (c->ssl) {
+        int e = SSL_write(c->ssl, data, (int)length);
+
+        if (e <= 0) {
+            switch (SSL_get_error(c->ssl, e)) {
+            case SSL_ERROR_WANT_READ:
+            case SSL_ERROR_WANT_WRITE:
+                return NGHTTP2_ERR_WOULDBLOCK;
+            default:
+                c->worker->epipe++;
+                return NGHTTP2_ERR_CALLBACK_FAILURE;
+            }
+        }
+        c->worker->totalposted += e;
+        return e;
+    }
+#endif
+    rv = apr_socket_send(c->aprsock, (const char *)data, &l);
+    if (rv != APR_SUCCESS && !l) {
+        if (APR_STATUS_IS_EAGAIN(rv)) {
+            return NGHTTP2_ERR_WOULDBLOCK;
+        }
+        c->worker->epipe++;
+        return NGHTTP2_ERR_CALLBACK_FAILURE;
+    }
+    c->worker->totalposted += l;
+    return l;
+}
+
+static ssize_t h2_body_cb(nghttp2_session *session, int32_t stream_id,
+                          uint8_t *buf, size_t length, uint32_t *data_flags,
+                          nghttp2_data_source *source, void *user_data)
+{
+    struct stream *s = source->ptr;
+    apr_size_t l = ap_min(length, postlen - s->posted);
+
+    memcpy(buf, postdata + s->posted, l);
+    s->posted += l;
+    if (s->posted == postlen) {
+        *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+    }
+    return l;
+}
+
+static int h2_frame_send_cb(nghttp2_session *session,
+                            const nghttp2_frame *frame, void *user_data)
+{
+    struct stream *s;
+
+    if ((frame->hd.flags & NGHTTP2_FLAG_END_STREAM)
+        && (frame->hd.type == NGHTTP2_HEADERS
+            || frame->hd.type == NGHTTP2_DATA)
+        && (s = nghttp2_session_get_stream_user_data(session,
+                                                     frame->hd.stream_id))) {
+        s->endwrite = apr_time_now();
+    }
+    return 0;
+}
+
+static int h2_begin_headers_cb(nghttp2_session *session,
+                               const nghttp2_frame *frame, void *user_data)
+{
+    struct stream *s;
+
+    if (frame->hd.type == NGHTTP2_HEADERS
+        && (s = nghttp2_session_get_stream_user_data(session,
+                                                     frame->hd.stream_id))
+        && !s->beginread) {
+        s->beginread = apr_time_now();
+    }
+    return 0;
+}
+
+static int h2_header_cb(nghttp2_session *session, const nghttp2_frame *frame,
+                        const uint8_t *name, size_t namelen,
+                        const uint8_t *value, size_t valuelen,
+                        uint8_t flags, void *user_data)
+{
+    struct connection *c = user_data;
+    struct worker *w = c->worker;
+    struct stream *s;
+
+    s = nghttp2_session_get_stream_user_data(session, frame->hd.stream_id);
+    if (!s) {
+        return 0;
+    }
+    if (verbosity >= 2) {
+        printf("LOG: header received: %s: %s\n", name, value);
+    }
+    if (namelen == 7 && !memcmp(name, ":status", 7)) {
+        s->status = atoi((const char *)value);
+    }
+    else if (!w->good && w->id == 0
+             && namelen == 6 && !memcmp(name, "server", 6)) {
+        /* this is first time, as with HTTP/1.x */
+        const char *p = (const char *)value;
+        char *q = servername;
+
+        while (*p > 32 && q < servername + sizeof(servername) - 1)
+            *q++ = *p++;
+        *q = 0;
+    }
+    return 0;
+}
+
+static int h2_data_chunk_cb(nghttp2_session *session, uint8_t flags,
+                            int32_t stream_id, const uint8_t *data,
+                            size_t len, void *user_data)
+{
+    struct connection *c = user_data;
+    struct stream *s = nghttp2_session_get_stream_user_data(session,
+                                                            stream_id);
+
+    if (s) {
+        s->bread += len;
+    }
+    c->worker->totalbread += len;
+    return 0;
+}
+
+/* a stream is done (or never will be), count it as a request */
+
+static void h2_stream_done(struct connection *c, struct stream *s,
+                           apr_uint32_t error_code)
+{
+    struct worker *w = c->worker;
+
+    if (error_code == NGHTTP2_REFUSED_STREAM
+        || (error_code != NGHTTP2_NO_ERROR && !s->endwrite)) {
+        /* the server did not take it, the request is still to be done */
+        apr_atomic_sub32(&started, 1);
+    }
+    else {
+        if (error_code != NGHTTP2_NO_ERROR) {
+            w->bad++;
+            if (error_code == NGHTTP2_CONNECT_ERROR) {
+                /* from h2_close() */
+                w->err_conn++;
+            }
+            else {
+                w->err_recv++;
+            }
+        }
+        else {
+            w->good++;
+            if (s->status < 200 || s->status > 299) {
+                w->err_response++;
+                if (verbosity >= 2)
+                    printf("WARNING: Response code not 2xx (%d)\n",
+                           s->status);
+            }
+            else if (verbosity >= 3) {
+                printf("LOG: Response code = %d\n", s->status);
+            }
+            if (w->good == 1) {
+                /* first time here */
+                w->doclen = s->bread;
+            }
+            else if ((s->bread != w->doclen) && !nolength) {
+                w->bad++;
+                w->err_length++;
+            }
+        }
+        /* the first streams waited for the connection, later ones did not */
+        if (record_times(w, rate ? s->intended : s->start, s->start,
+                         ap_max(s->start, c->connect), s->endwrite,
+                         s->beginread, apr_time_now())) {
+            w->doneka++;
+        }
+    }
+    s->id = 0;
+    c->pipelined--;
+}
+
+static int h2_stream_close_cb(nghttp2_session *session, int32_t stream_id,
+                              uint32_t error_code, void *user_data)
+{
+    struct connection *c = user_data;
+    struct stream *s = nghttp2_session_get_stream_user_data(session,
+                                                            stream_id);
+
+    if (s) {
+        h2_stream_done(c, s, error_code);
+    }
+    return 0;
+}
+
+/* the streams left open on a connection that is closed have failed */
+
+static void h2_close(struct connection *c)
+{
+    int i;
+
+    for (i = 0; i < pipeline && c->pipelined; i++) {
+        if (c->streams[i].id) {
+            h2_stream_done(c, &c->streams[i], NGHTTP2_CONNECT_ERROR);
+        }
+    }
+    nghttp2_session_del(c->h2);
+    c->h2 = NULL;
+}
+
+static void h2_add_header(apr_array_header_t *nv, const char *name,
+                          const char *value)
+{
+    nghttp2_nv *h = apr_array_push(nv);
+
+    h->name = (uint8_t *)name;
+    h->namelen = strlen(name);
+    h->value = (uint8_t *)value;
+    h->valuelen = strlen(value);
+    h->flags = NGHTTP2_NV_FLAG_NONE;
+}
+
+/* the request as header fields, from the request line and headers */
+
+static void h2_setup(void)
+{
+    apr_array_header_t *nv = apr_array_make(cntxt, 16, sizeof(nghttp2_nv));
+    char *lines, *line, *last, *value, *p;
+
+    h2_add_header(nv, ":method", method_str[method]);
+#ifdef USE_SSL
+    h2_add_header(nv, ":scheme", is_ssl ? "https" : "http");
+#else
+    h2_add_header(nv, ":scheme", "http");
+#endif
+    h2_add_header(nv, ":authority", opt_host ? opt_host
+                  : apr_pstrcat(cntxt, host_field, colonhost, NULL));
+    h2_add_header(nv, ":path", path);
+
+    lines = apr_pstrcat(cntxt, cookie, auth, hdrs, NULL);
+    for (line = apr_strtok(lines, "\r\n", &last); line;
+         line = apr_strtok(NULL, "\r\n", &last)) {
+        if (!(value = strchr(line, ':'))) {
+            continue;
+        }
+        *value++ = '\0';
+        while (apr_isspace(*value))
+            value++;
+        for (p = line; *p; p++)
+            *p = apr_tolower(*p);
+        /* Host: is the :authority, and no connection specific fields */
+        if (!strcmp(line, "host") || !strcmp(line, "connection")
+            || !strcmp(line, "keep-alive") || !strcmp(line, "upgrade")
+            || !strcmp(line, "proxy-connection")
+            || !strcmp(line, "transfer-encoding")) {
+            continue;
+        }
+        h2_add_header(nv, line, value);
+    }
+    if (send_body) {
+        h2_add_header(nv, "content-length",
+                      apr_psprintf(cntxt, "%" APR_SIZE_T_FMT, postlen));
+        h2_add_header(nv, "content-type",
+                      content_type ? content_type : "text/plain");
+    }
+    h2_nv = (nghttp2_nv *)nv->elts;
+    h2_nvlen = nv->nelts;
+
+    if (nghttp2_session_callbacks_new(&h2_callbacks)) {
+        err("nghttp2_session_callbacks_new failed\n");
+    }
+    nghttp2_session_callbacks_set_send_callback(h2_callbacks, h2_send_cb);
+    nghttp2_session_callbacks_set_on_frame_send_callback(h2_callbacks,
+                                                         h2_frame_send_cb);
+    nghttp2_session_callbacks_set_on_begin_headers_callback(h2_callbacks,
+                                                      h2_begin_headers_cb);
+    nghttp2_session_callbacks_set_on_header_callback(h2_callbacks,
+                                                     h2_header_cb);
+    nghttp2_session_callbacks_set_on_data_chunk_recv_callback(h2_callbacks,
+                                                         h2_data_chunk_cb);
+    nghttp2_session_callbacks_set_on_stream_close_callback(h2_callbacks,
+                                                       h2_stream_close_cb);
+}
+
+/* the connection is up, speak HTTP/2 on it */
+
+static void h2_start(struct connection *c, apr_time_t now)
+{
+    nghttp2_settings_entry settings[] = {
+        { NGHTTP2_SETTINGS_ENABLE_PUSH, 0 },
+        { NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, H2_WINDOW_SIZE }
+    };
+
+#ifdef HAVE_TLS_ALPN
+    if (c->ssl) {
+        const unsigned char *proto = NULL;
+        unsigned int len = 0;
+
+        SSL_get0_alpn_selected(c->ssl, &proto, &len);
+        if (len != 2 || memcmp(proto, "h2", 2)) {
+            err("The server did not select HTTP/2 (h2) with ALPN\n");
+        }
+    }
+#endif
+    if (nghttp2_session_client_new(&c->h2, h2_callbacks, c)) {
+        err("nghttp2_session_client_new failed\n");
+    }
+    /* the windows are not what is measured, open them wide */
+    nghttp2_submit_settings(c->h2, NGHTTP2_FLAG_NONE, settings,
+                            sizeof(settings) / sizeof(settings[0]));
+    nghttp2_submit_window_update(c->h2, NGHTTP2_FLAG_NONE, 0, H2_WINDOW_SIZE
+                                 - NGHTTP2_INITIAL_CONNECTION_WINDOW_SIZE);
+    if (!c->streams) {
+        c->streams = xcalloc(pipeline, sizeof(struct stream));
+    }
+    /* nghttp2 writes the frames one by one, don't let them wait for ACKs */
+    apr_socket_opt_set(c->aprsock, APR_TCP_NODELAY, 1);
+    apr_socket_timeout_set(c->aprsock, 0);
+    c->connect = now;
+    set_conn_state(c, STATE_READ);
+}
+
+/* open a stream for a request taken from the budget */
+
+static void h2_submit(struct connection *c, apr_time_t now)
+{
+    struct stream *s = c->streams;
+    nghttp2_data_provider body, *provider = NULL;
+
+    /* there is a free one, fewer than -K are open */
+    while (s->id)
+        s++;
+    memset(s, 0, sizeof(*s));
+    /* the first streams wait for the connection, their times start with it */
+    s->start = (now == c->connect) ? c->start : now;
+    if (rate) {
+        s->intended = send_time(c);
+        c->nsent++;
+    }
+    if (send_body) {
+        body.source.ptr = s;
+        body.read_callback = h2_body_cb;
+        provider = &body;
+    }
+    s->id = nghttp2_submit_request(c->h2, NULL, h2_nv, h2_nvlen,
+                                   provider, s);
+    if (s->id < 0) {
+        fprintf(stderr, "nghttp2_submit_request: %s\n",
+                nghttp2_strerror(s->id));
+        exit(1);
+    }
+    c->pipelined++;
+}
+
+/* open as many streams as may be, and write out what nghttp2 has */
+
+static void h2_write(struct connection *c)
+{
+    struct worker *w = c->worker;
+    apr_time_t now = w->lasttime = apr_time_now();
+    int exhausted = 0;
+    int rv;
+
+    if (!c->h2) {
+        h2_start(c, now);
+    }
+
+    while (c->pipelined < pipeline) {
+        if (apr_atomic_read32(&started) >= (apr_uint32_t)requests) {
+            exhausted = 1;
+            break;
+        }
+        /* at a constant rate, wait until the next request is due */
+        if (rate && send_time(c) > now) {
+            if (!c->waiting) {
+                timer_add(w, c);
+            }
+            break;
+        }
+        if (!reserve_requests(1)) {
+            exhausted = 1;
+            break;
+        }
+        h2_submit(c, now);
+    }
+    if (exhausted && !c->pipelined) {
+        /* all requests are made, the connection is of no use */
+        nghttp2_session_terminate_session(c->h2, NGHTTP2_NO_ERROR);
+        nghttp2_session_send(c->h2);
+        close_connection(c);
+        return;
+    }
+
+    if ((rv = nghttp2_session_send(c->h2)) != 0) {
+        if (verbosity >= 1) {
+            fprintf(stderr, "nghttp2_session_send: %s\n",
+                    nghttp2_strerror(rv));
+        }
+        close_connection(c);
+        return;
+    }
+    if (!nghttp2_session_want_read(c->h2)
+        && !nghttp2_session_want_write(c->h2)) {
+        /* the server has ended the session (GOAWAY), connect again */
+        close_connection(c);
+        return;
+    }
+    set_polled_events(c, nghttp2_session_want_write(c->h2)
+                         ? APR_POLLIN | APR_POLLOUT : APR_POLLIN);
+}
+
+static void h2_read(struct connection *c)
+{
+    struct worker *w = c->worker;
+    apr_size_t r;
+    apr_status_t status;
+    ssize_t rv;
+
+    for (;;) {
+        r = sizeof(w->buffer);
+#ifdef USE_SSL
+        if (c->ssl) {
+            int e = SSL_read(c->ssl, w->buffer, (int)r);
+
+            if (e <= 0) {
+                int scode = SSL_get_error(c->ssl, e);
+
+                if (scode == SSL_ERROR_WANT_READ
+                    || scode == SSL_ERROR_WANT_WRITE) {
+                    break;
+                }
+                if (scode != SSL_ERROR_ZERO_RETURN && verbosity >= 1) {
+                    BIO_printf(bio_err, "SSL read failed (%d) - closing "
+                               "connection\n", scode);
+                    ERR_print_errors(bio_err);
+                }
+                close_connection(c);
+                return;
+            }
+            r = e;
+        }
+        else
 #endif
-                    }
-                    EVP_PKEY_free(key);
+        {
+            status = apr_socket_recv(c->aprsock, w->buffer, &r);
+            if (APR_STATUS_IS_EAGAIN(status)) {
+                break;
+            }
+            if (status != APR_SUCCESS) {
+                if (!APR_STATUS_IS_EOF(status) && verbosity >= 1) {
+                    char buf[120];
+                    fprintf(stderr, "%s: %s (%d)\n", "apr_socket_recv",
+                            apr_strerror(status, buf, sizeof buf), status);
                 }
+                close_connection(c);
+                return;
             }
-            write_request(c);
-            do_next = 0;
-            break;
-        case SSL_ERROR_WANT_READ:
-            set_polled_events(c, APR_POLLIN);
-            do_next = 0;
-            break;
-        case SSL_ERROR_WANT_WRITE:
-            set_polled_events(c, APR_POLLOUT);
-            do_next = 0;
-            break;
-        case SSL_ERROR_WANT_CONNECT:
-        case SSL_ERROR_SSL:
-        case SSL_ERROR_SYSCALL:
-            /* Unexpected result */
-            BIO_printf(bio_err, "SSL handshake failed (%d).\n", ecode);
-            ERR_print_errors(bio_err);
+        }
+        w->totalread += r;
+
+        rv = nghttp2_session_mem_recv(c->h2, (const uint8_t *)w->buffer, r);
+        if (rv < 0) {
+            if (verbosity >= 1) {
+                fprintf(stderr, "nghttp2_session_mem_recv: %s\n",
+                        nghttp2_strerror((int)rv));
+            }
+            w->err_response++;
             close_connection(c);
-            do_next = 0;
+            return;
+        }
+        if (r < sizeof(w->buffer)
+#ifdef USE_SSL
+            && !(c->ssl && SSL_pending(c->ssl))
+#endif
+            ) {
             break;
         }
     }
+
+    if (w->good && !w->requests_initialized) {
+        connect_all(w);
+    }
+    h2_write(c);
 }
 
-#endif /* USE_SSL */
+#endif /* USE_H2 */
 
 static void write_request(struct connection * c)
 {
-    if (started >= requests) {
+    struct worker *w = c->worker;
+
+#ifdef USE_H2
+    if (http2) {
+        h2_write(c);
         return;
     }
+#endif
 
     do {
         apr_time_t tnow;
         apr_size_t l = c->rwrite;
         apr_status_t e = APR_SUCCESS; /* prevent gcc warning */
 
-        tnow = lasttime = apr_time_now();
+        tnow = w->lasttime = apr_time_now();
 
         /*
          * First time round ?
          */
         if (c->rwrite == 0) {
+            /* at a constant rate, wait until the request is due */
+            if (rate && send_time(c) > tnow) {
+                timer_add(w, c);
+                return;
+            }
+            /* with -K, as many requests as are left, up to the depth */
+            if (!(c->pipelined = reserve_requests(pipeline))) {
+                /* all requests are made, the connection is of no use */
+                set_conn_state(c, STATE_UNCONNECTED);
+#ifdef USE_SSL
+                if (c->ssl) {
+                    SSL_shutdown(c->ssl);
+                    SSL_free(c->ssl);
+                    c->ssl = NULL;
+                }
+#endif
+                apr_socket_close(c->aprsock);
+                return;
+            }
+            if (rate) {
+                c->intended = send_time(c);
+                c->nsent++;
+            }
             apr_socket_timeout_set(c->aprsock, 0);
             c->connect = tnow;
             c->rwrote = 0;
-            c->rwrite = reqlen;
-            if (send_body)
-                c->rwrite += postlen;
+            c->rwrite = c->pipelined * reqsize;
             l = c->rwrite;
         }
         else if (tnow > c->connect + aprtimeout) {
@@ -852,7 +1863,7 @@ static void write_request(struct connection * c)
             e = apr_socket_send(c->aprsock, request + c->rwrote, &l);
             if (e != APR_SUCCESS && !l) {
                 if (!APR_STATUS_IS_EAGAIN(e)) {
-                    epipe++;
+                    w->epipe++;
                     printf("Send request failed!\n");
                     close_connection(c);
                 }
@@ -862,13 +1873,12 @@ static void write_request(struct connection * c)
                 return;
             }
         }
-        totalposted += l;
+        w->totalposted += l;
         c->rwrote += l;
         c->rwrite -= l;
     } while (c->rwrite);
 
-    c->endwrite = lasttime = apr_time_now();
-    started++;
+    c->endwrite = w->lasttime = apr_time_now();
     set_conn_state(c, STATE_READ);
 }
 
@@ -914,10 +1924,108 @@ static int compwait(struct data * a, struct data * b)
     return 0;
 }
 
+/*
+ * The total time within which p percent of the requests were served,
+ * the stats sorted on it.
+ */
+static apr_interval_time_t total_percentile(double p)
+{
+    if (!stats) {
+        return hist_percentile(&hists[T_TOTAL], p);
+    }
+    if (p >= 100) {
+        return stats[done - 1].time;
+    }
+    return stats[(unsigned long)(done * p / 100)].time;
+}
+
+/* write the results out as JSON, to track them from run to run */
+
+static void output_json(double timetaken)
+{
+    FILE *out = fopen(jsonfile, "w");
+    apr_interval_time_t min = 0, max = 0, median = 0;
+    apr_time_t mean = 0;
+    double sd = 0;
+    int i;
+
+    if (!out) {
+        perror("Cannot open JSON output file");
+        exit(1);
+    }
+    fprintf(out, "{\n");
+    fprintf(out, "  \"concurrency\": %d,\n", concurrency);
+    fprintf(out, "  \"threads\": %d,\n", threads);
+    fprintf(out, "  \"pipeline\": %d,\n", pipeline);
+#ifdef USE_H2
+    fprintf(out, "  \"http2\": %s,\n", http2 ? "true" : "false");
+#endif
+#ifdef USE_SSL
+    if (is_ssl) {
+        fprintf(out, "  \"tls_handshakes\": %d,\n", handshakes);
+        fprintf(out, "  \"tls_resumed\": %d,\n", resumed);
+    }
+#endif
+    fprintf(out, "  \"target_rate\": %.2f,\n", rate);
+    fprintf(out, "  \"time_taken\": %.3f,\n", timetaken);
+    fprintf(out, "  \"complete_requests\": %d,\n", done);
+    fprintf(out, "  \"failed_requests\": %d,\n", bad);
+    fprintf(out, "  \"non_2xx_responses\": %d,\n", err_response);
+    fprintf(out, "  \"write_errors\": %d,\n", epipe);
+    fprintf(out, "  \"keepalive_requests\": %d,\n", doneka);
+    fprintf(out, "  \"total_transferred\": %" APR_INT64_T_FMT ",\n",
+            totalread);
+    fprintf(out, "  \"html_transferred\": %" APR_INT64_T_FMT ",\n",
+            totalbread);
+    fprintf(out, "  \"requests_per_second\": %.2f,\n",
+            timetaken ? (double) done / timetaken : 0);
+
+    if (!done) {
+        fprintf(out, "  \"latency_ms\": null\n}\n");
+        fclose(out);
+        return;
+    }
+    if (stats) {
+        apr_time_t total = 0;
+
+        qsort(stats, done, sizeof(struct data),
+              (int (*) (const void *, const void *)) comprando);
+        for (i = 0; i < done; i++) {
+            total += stats[i].time;
+        }
+        mean = total / done;
+        for (i = 0; i < done; i++) {
+            double a = (double)stats[i].time - mean;
+            sd += a * a;
+        }
+        sd = (done > 1) ? sqrt(sd / (done - 1)) : 0;
+        min = stats[0].time;
+        max = stats[done - 1].time;
+        median = total_percentile(50);
+    }
+    else {
+        hist_stats(&hists[T_TOTAL], &min, &mean, &sd, &median, &max);
+    }
+    fprintf(out, "  \"latency_ms\": {\n");
+    fprintf(out, "    \"min\": %.3f,\n", ap_double_ms(min));
+    fprintf(out, "    \"mean\": %.3f,\n", ap_double_ms(mean));
+    fprintf(out, "    \"sd\": %.3f,\n", ap_double_ms(sd));
+    fprintf(out, "    \"median\": %.3f,\n", ap_double_ms(median));
+    fprintf(out, "    \"max\": %.3f,\n", ap_double_ms(max));
+    fprintf(out, "    \"percentiles\": {");
+    for (i = 0; i < sizeof(percs) / sizeof(percs[0]); i++) {
+        fprintf(out, "%s\n      \"%g\": %.3f", i ? "," : "", percs[i],
+                ap_double_ms(total_percentile(percs[i])));
+    }
+    fprintf(out, "\n    }\n  }\n}\n");
+    fclose(out);
+}
+
 static void output_results(int sig)
 {
     double timetaken;
 
+    sum_workers();
     if (sig) {
         lasttime = apr_time_now();  /* record final time if interrupted */
     }
@@ -939,6 +2047,10 @@ static void output_results(int sig)
         printf("TLS Server Name:        %s\n", tls_sni);
     }
 #endif
+    if (is_ssl && tls_resume) {
+        printf("TLS sessions resumed:   %d of %d handshakes\n",
+               resumed, handshakes);
+    }
 #endif
     printf("\n");
     printf("Document Path:          %s\n", path);
@@ -948,6 +2060,17 @@ static void output_results(int sig)
         printf("Document Length:        %" APR_SIZE_T_FMT " bytes\n", doclen);
     printf("\n");
     printf("Concurrency Level:      %d\n", concurrency);
+    if (threads)
+        printf("Worker threads:         %d\n", threads);
+#ifdef USE_H2
+    if (http2)
+        printf("HTTP/2 streams:         %d per connection\n", pipeline);
+    else
+#endif
+    if (pipeline > 1)
+        printf("Pipeline depth:         %d\n", pipeline);
+    if (rate)
+        printf("Target rate:            %.2f [#/sec]\n", rate);
     printf("Time taken for tests:   %.3f seconds\n", timetaken);
     printf("Complete requests:      %d\n", done);
     printf("Failed requests:        %d\n", bad);
@@ -995,80 +2118,92 @@ static void output_results(int sig)
         apr_interval_time_t mediancon = 0, mediantot = 0, mediand = 0, medianwait = 0;
         double sdtot = 0, sdcon = 0, sdd = 0, sdwait = 0;
 
-        for (i = 0; i < done; i++) {
-            struct data *s = &stats[i];
-            mincon = ap_min(mincon, s->ctime);
-            mintot = ap_min(mintot, s->time);
-            mind = ap_min(mind, s->time - s->ctime);
-            minwait = ap_min(minwait, s->waittime);
-
-            maxcon = ap_max(maxcon, s->ctime);
-            maxtot = ap_max(maxtot, s->time);
-            maxd = ap_max(maxd, s->time - s->ctime);
-            maxwait = ap_max(maxwait, s->waittime);
-
-            totalcon += s->ctime;
-            total += s->time;
-            totald += s->time - s->ctime;
-            totalwait += s->waittime;
-        }
-        meancon = totalcon / done;
-        meantot = total / done;
-        meand = totald / done;
-        meanwait = totalwait / done;
-
-        /* calculating the sample variance: the sum of the squared deviations, divided by n-1 */
-        for (i = 0; i < done; i++) {
-            struct data *s = &stats[i];
-            double a;
-            a = ((double)s->time - meantot);
-            sdtot += a * a;
-            a = ((double)s->ctime - meancon);
-            sdcon += a * a;
-            a = ((double)s->time - (double)s->ctime - meand);
-            sdd += a * a;
-            a = ((double)s->waittime - meanwait);
-            sdwait += a * a;
-        }
-
-        sdtot = (done > 1) ? sqrt(sdtot / (done - 1)) : 0;
-        sdcon = (done > 1) ? sqrt(sdcon / (done - 1)) : 0;
-        sdd = (done > 1) ? sqrt(sdd / (done - 1)) : 0;
-        sdwait = (done > 1) ? sqrt(sdwait / (done - 1)) : 0;
-
-        /*
-         * XXX: what is better; this hideous cast of the compradre function; or
-         * the four warnings during compile ? dirkx just does not know and
-         * hates both/
-         */
-        qsort(stats, done, sizeof(struct data),
-              (int (*) (const void *, const void *)) compradre);
-        if ((done > 1) && (done % 2))
-            mediancon = (stats[done / 2].ctime + stats[done / 2 + 1].ctime) / 2;
-        else
-            mediancon = stats[done / 2].ctime;
+        if (stats) {
+            for (i = 0; i < done; i++) {
+                struct data *s = &stats[i];
+                mincon = ap_min(mincon, s->ctime);
+                mintot = ap_min(mintot, s->time);
+                mind = ap_min(mind, s->time - s->ctime);
+                minwait = ap_min(minwait, s->waittime);
+
+                maxcon = ap_max(maxcon, s->ctime);
+                maxtot = ap_max(maxtot, s->time);
+                maxd = ap_max(maxd, s->time - s->ctime);
+                maxwait = ap_max(maxwait, s->waittime);
+
+                totalcon += s->ctime;
+                total += s->time;
+                totald += s->time - s->ctime;
+                totalwait += s->waittime;
+            }
+            meancon = totalcon / done;
+            meantot = total / done;
+            meand = totald / done;
+            meanwait = totalwait / done;
 
-        qsort(stats, done, sizeof(struct data),
-              (int (*) (const void *, const void *)) compri);
-        if ((done > 1) && (done % 2))
-            mediand = (stats[done / 2].time + stats[done / 2 + 1].time \
-            -stats[done / 2].ctime - stats[done / 2 + 1].ctime) / 2;
-        else
-            mediand = stats[done / 2].time - stats[done / 2].ctime;
+            /* calculating the sample variance: the sum of the squared deviations, divided by n-1 */
+            for (i = 0; i < done; i++) {
+                struct data *s = &stats[i];
+                double a;
+                a = ((double)s->time - meantot);
+                sdtot += a * a;
+                a = ((double)s->ctime - meancon);
+                sdcon += a * a;
+                a = ((double)s->time - (double)s->ctime - meand);
+                sdd += a * a;
+                a = ((double)s->waittime - meanwait);
+                sdwait += a * a;
+            }
 
-        qsort(stats, done, sizeof(struct data),
-              (int (*) (const void *, const void *)) compwait);
-        if ((done > 1) && (done % 2))
-            medianwait = (stats[done / 2].waittime + stats[done / 2 + 1].waittime) / 2;
-        else
-            medianwait = stats[done / 2].waittime;
+            sdtot = (done > 1) ? sqrt(sdtot / (done - 1)) : 0;
+            sdcon = (done > 1) ? sqrt(sdcon / (done - 1)) : 0;
+            sdd = (done > 1) ? sqrt(sdd / (done - 1)) : 0;
+            sdwait = (done > 1) ? sqrt(sdwait / (done - 1)) : 0;
 
-        qsort(stats, done, sizeof(struct data),
-              (int (*) (const void *, const void *)) comprando);
-        if ((done > 1) && (done % 2))
-            mediantot = (stats[done / 2].time + stats[done / 2 + 1].time) / 2;
-        else
-            mediantot = stats[done / 2].time;
+            /*
+             * XXX: what is better; this hideous cast of the compradre function; or
+             * the four warnings during compile ? dirkx just does not know and
+             * hates both/
+             */
+            qsort(stats, done, sizeof(struct data),
+                  (int (*) (const void *, const void *)) compradre);
+            if ((done > 1) && (done % 2))
+                mediancon = (stats[done / 2].ctime + stats[done / 2 + 1].ctime) / 2;
+            else
+                mediancon = stats[done / 2].ctime;
+
+            qsort(stats, done, sizeof(struct data),
+                  (int (*) (const void *, const void *)) compri);
+            if ((done > 1) && (done % 2))
+                mediand = (stats[done / 2].time + stats[done / 2 + 1].time \
+                -stats[done / 2].ctime - stats[done / 2 + 1].ctime) / 2;
+            else
+                mediand = stats[done / 2].time - stats[done / 2].ctime;
+
+            qsort(stats, done, sizeof(struct data),
+                  (int (*) (const void *, const void *)) compwait);
+            if ((done > 1) && (done % 2))
+                medianwait = (stats[done / 2].waittime + stats[done / 2 + 1].waittime) / 2;
+            else
+                medianwait = stats[done / 2].waittime;
+
+            qsort(stats, done, sizeof(struct data),
+                  (int (*) (const void *, const void *)) comprando);
+            if ((done > 1) && (done % 2))
+                mediantot = (stats[done / 2].time + stats[done / 2 + 1].time) / 2;
+            else
+                mediantot = stats[done / 2].time;
+        }
+        else {
+            hist_stats(&hists[T_CONNECT], &mincon, &meancon, &sdcon,
+                       &mediancon, &maxcon);
+            hist_stats(&hists[T_PROCESSING], &mind, &meand, &sdd,
+                       &mediand, &maxd);
+            hist_stats(&hists[T_WAITING], &minwait, &meanwait, &sdwait,
+                       &medianwait, &maxwait);
+            hist_stats(&hists[T_TOTAL], &mintot, &meantot, &sdtot,
+                       &mediantot, &maxtot);
+        }
 
         printf("\nConnection Times (ms)\n");
         /*
@@ -1138,15 +2273,18 @@ static void output_results(int sig)
         /* Sorted on total connect times */
         if (percentile && (done > 1)) {
             printf("\nPercentage of the requests served within a certain time (ms)\n");
-            for (i = 0; i < sizeof(percs) / sizeof(int); i++) {
+            for (i = 0; i < sizeof(percs) / sizeof(percs[0]); i++) {
                 if (percs[i] <= 0)
                     printf(" 0%%  <0> (never)\n");
                 else if (percs[i] >= 100)
                     printf(" 100%%  %5" APR_TIME_T_FMT " (longest request)\n",
-                           ap_round_ms(stats[done - 1].time));
+                           ap_round_ms(total_percentile(100)));
+                else if (done < 100 / (100 - percs[i]) - 0.5)
+                    /* the tail is not measured with so few requests */
+                    continue;
                 else
-                    printf("  %d%%  %5" APR_TIME_T_FMT "\n", percs[i],
-                           ap_round_ms(stats[(unsigned long)done * percs[i] / 100].time));
+                    printf("  %g%%  %5" APR_TIME_T_FMT "\n", percs[i],
+                           ap_round_ms(total_percentile(percs[i])));
             }
         }
         if (csvperc) {
@@ -1158,7 +2296,9 @@ static void output_results(int sig)
             fprintf(out, "" "Percentage served" "," "Time in ms" "\n");
             for (i = 0; i <= 100; i++) {
                 double t;
-                if (i == 0)
+                if (!stats)
+                    t = ap_double_ms(hist_percentile(&hists[T_TOTAL], i));
+                else if (i == 0)
                     t = ap_double_ms(stats[0].time);
                 else if (i == 100)
                     t = ap_double_ms(stats[done - 1].time);
@@ -1190,6 +2330,9 @@ static void output_results(int sig)
             fclose(out);
         }
     }
+    if (jsonfile) {
+        output_json(timetaken);
+    }
 
     if (sig) {
         exit(1);
@@ -1286,7 +2429,7 @@ static void output_html_results(void)
         apr_interval_time_t mincon = AB_MAX, mintot = AB_MAX;
         apr_interval_time_t maxcon = 0, maxtot = 0;
 
-        for (i = 0; i < done; i++) {
+        for (i = 0; stats && i < done; i++) {
             struct data *s = &stats[i];
             mincon = ap_min(mincon, s->ctime);
             mintot = ap_min(mintot, s->time);
@@ -1295,6 +2438,14 @@ static void output_html_results(void)
             totalcon += s->ctime;
             total    += s->time;
         }
+        if (!stats) {
+            mincon   = hists[T_CONNECT].min;
+            mintot   = hists[T_TOTAL].min;
+            maxcon   = hists[T_CONNECT].max;
+            maxtot   = hists[T_TOTAL].max;
+            totalcon = (apr_interval_time_t)hists[T_CONNECT].sum;
+            total    = (apr_interval_time_t)hists[T_TOTAL].sum;
+        }
         /*
          * Reduce stats from apr time to milliseconds
          */
@@ -1329,6 +2480,9 @@ static void output_html_results(void)
         }
         printf("</table>\n");
     }
+    if (jsonfile) {
+        output_json(timetaken);
+    }
 }
 
 /* --------------------------------------------------------- */
@@ -1337,10 +2491,17 @@ static void output_html_results(void)
 
 static void start_connect(struct connection * c)
 {
+    struct worker *w = c->worker;
     apr_status_t rv;
 
-    if (!(started < requests))
+    if (!(apr_atomic_read32(&started) < (apr_uint32_t)requests))
+        return;
+
+    /* at a constant rate, connect when the request is due */
+    if (rate && send_time(c) > apr_time_now()) {
+        timer_add(w, c);
         return;
+    }
 
     c->read = 0;
     c->bread = 0;
@@ -1348,12 +2509,13 @@ static void start_connect(struct connection * c)
     c->cbx = 0;
     c->gotheader = 0;
     c->rwrite = 0;
+    c->pipelined = 0;
     if (c->ctx)
         apr_pool_clear(c->ctx);
     else
-        apr_pool_create(&c->ctx, cntxt);
+        apr_pool_create(&c->ctx, w->pool);
 
-    if ((rv = apr_socket_create(&c->aprsock, destsa->family,
+    if ((rv = apr_socket_create(&c->aprsock, w->destsa->family,
                 SOCK_STREAM, 0, c->ctx)) != APR_SUCCESS) {
     apr_err("socket", rv);
     }
@@ -1387,7 +2549,7 @@ static void start_connect(struct connection * c)
         }
     }
 
-    c->start = lasttime = apr_time_now();
+    c->start = w->lasttime = apr_time_now();
 #ifdef USE_SSL
     if (is_ssl) {
         BIO *bio;
@@ -1404,6 +2566,10 @@ static void start_connect(struct connection * c)
         BIO_set_nbio(bio, 1);
         SSL_set_bio(c->ssl, bio, bio);
         SSL_set_connect_state(c->ssl);
+        SSL_set_app_data(c->ssl, c);
+        if (tls_resume && w->session) {
+            SSL_set_session(c->ssl, w->session);
+        }
         if (verbosity >= 4) {
             BIO_set_callback(bio, ssl_print_cb);
             BIO_set_callback_arg(bio, (void *)bio_err);
@@ -1417,7 +2583,7 @@ static void start_connect(struct connection * c)
         c->ssl = NULL;
     }
 #endif
-    if ((rv = apr_socket_connect(c->aprsock, destsa)) != APR_SUCCESS) {
+    if ((rv = apr_socket_connect(c->aprsock, w->destsa)) != APR_SUCCESS) {
         if (APR_STATUS_IS_EINPROGRESS(rv)) {
             set_conn_state(c, STATE_CONNECTING);
             c->rwrite = 0;
@@ -1426,17 +2592,17 @@ static void start_connect(struct connection * c)
         else {
             set_conn_state(c, STATE_UNCONNECTED);
             apr_socket_close(c->aprsock);
-            if (good == 0 && destsa->next) {
-                destsa = destsa->next;
-                err_conn = 0;
+            if (w->good == 0 && w->destsa->next) {
+                w->destsa = w->destsa->next;
+                w->err_conn = 0;
             }
-            else if (bad++ > 10) {
+            else if (w->bad++ > 10) {
                 fprintf(stderr,
                    "\nTest aborted after 10 failures\n\n");
                 apr_err("apr_socket_connect()", rv);
             }
             else {
-                err_conn++;
+                w->err_conn++;
             }
 
             start_connect(c);
@@ -1462,36 +2628,46 @@ static void start_connect(struct connection * c)
 
 static void close_connection(struct connection * c)
 {
-    if (c->read == 0 && c->keepalive) {
+    struct worker *w = c->worker;
+    int idle = c->waiting;
+
+    if (idle) {
+        timer_remove(w, c);
+    }
+#ifdef USE_H2
+    if (c->h2) {
+        h2_close(c);
+    }
+    else
+#endif
+    if (c->read == 0 && (c->keepalive || idle)) {
         /*
          * server has legitimately shut down an idle keep alive request
          */
-        if (good)
-            good--;     /* connection never happened */
+        if (w->good)
+            w->good--;     /* connection never happened */
+        /* so the requests written are still to be done */
+        if (c->pipelined) {
+            apr_atomic_sub32(&started, c->pipelined);
+        }
     }
     else {
-        if (good == 1) {
+        if (w->good == 1) {
             /* first time here */
-            doclen = c->bread;
+            w->doclen = c->bread;
         }
-        else if ((c->bread != doclen) && !nolength) {
-            bad++;
-            err_length++;
+        else if ((c->bread != w->doclen) && !nolength) {
+            w->bad++;
+            w->err_length++;
         }
         /* save out time */
-        if (done < requests) {
-            struct data *s = &stats[done++];
-            c->done      = lasttime = apr_time_now();
-            s->starttime = c->start;
-            s->ctime     = ap_max(0, c->connect - c->start);
-            s->time      = ap_max(0, c->done - c->start);
-            s->waittime  = ap_max(0, c->beginread - c->endwrite);
-            if (heartbeatres && !(done % heartbeatres)) {
-                fprintf(stderr, "Completed %d requests\n", done);
-                fflush(stderr);
-            }
+        save_times(c);
+        /* and give back the pipelined requests left unanswered */
+        if (c->pipelined > 1) {
+            apr_atomic_sub32(&started, c->pipelined - 1);
         }
     }
+    c->pipelined = 0;
 
     set_conn_state(c, STATE_UNCONNECTED);
 #ifdef USE_SSL
@@ -1514,23 +2690,30 @@ static void close_connection(struct connection * c)
 
 static void read_connection(struct connection * c)
 {
-    apr_size_t r;
+    struct worker *w = c->worker;
+    apr_size_t r, overflow;
     apr_status_t status;
     char *part;
     char respcode[4];       /* 3 digits and null */
-    int i;
 
-    r = sizeof(buffer);
+#ifdef USE_H2
+    if (c->h2) {
+        h2_read(c);
+        return;
+    }
+#endif
+
+    r = sizeof(w->buffer);
 read_more:
 #ifdef USE_SSL
     if (c->ssl) {
-        status = SSL_read(c->ssl, buffer, r);
+        status = SSL_read(c->ssl, w->buffer, r);
         if (status <= 0) {
             int scode = SSL_get_error(c->ssl, status);
 
             if (scode == SSL_ERROR_ZERO_RETURN) {
                 /* connection closed cleanly: */
-                good++;
+                w->good++;
                 close_connection(c);
             }
             else if (scode == SSL_ERROR_SYSCALL
@@ -1540,14 +2723,14 @@ read_more:
                  * some data has already been read; this commonly happens, so
                  * let the length check catch any response errors
                  */
-                good++;
+                w->good++;
                 close_connection(c);
             }
             else if (scode == SSL_ERROR_SYSCALL 
                      && c->read == 0
-                     && destsa->next
+                     && w->destsa->next
                      && c->state == STATE_CONNECTING
-                     && good == 0) {
+                     && w->good == 0) {
                 return;
             }
             else if (scode == SSL_ERROR_WANT_READ) {
@@ -1570,37 +2753,38 @@ read_more:
     else
 #endif
     {
-        status = apr_socket_recv(c->aprsock, buffer, &r);
+        status = apr_socket_recv(c->aprsock, w->buffer, &r);
         if (APR_STATUS_IS_EAGAIN(status))
             return;
         else if (r == 0 && APR_STATUS_IS_EOF(status)) {
-            good++;
+            w->good++;
             close_connection(c);
             return;
         }
         /* catch legitimate fatal apr_socket_recv errors */
         else if (status != APR_SUCCESS) {
             if (recverrok) {
-                err_recv++;
-                bad++;
+                w->err_recv++;
+                w->bad++;
                 close_connection(c);
                 if (verbosity >= 1) {
                     char buf[120];
                     fprintf(stderr,"%s: %s (%d)\n", "apr_socket_recv", apr_strerror(status, buf, sizeof buf), status);
                 }
                 return;
-            } else if (destsa->next && c->state == STATE_CONNECTING
-                       && c->read == 0 && good == 0) {
+            } else if (w->destsa->next && c->state == STATE_CONNECTING
+                       && c->read == 0 && w->good == 0) {
                 return;
             }
             else {
-                err_recv++;
+                w->err_recv++;
                 apr_err("apr_socket_recv", status);
             }
         }
     }
 
-    totalread += r;
+    w->totalread += r;
+process:
     if (c->read == 0) {
         c->beginread = apr_time_now();
     }
@@ -1615,7 +2799,7 @@ read_more:
 #ifdef NOT_ASCII
         apr_size_t inbytes_left = space, outbytes_left = space;
 
-        status = apr_xlate_conv_buffer(from_ascii, buffer, &inbytes_left,
+        status = apr_xlate_conv_buffer(from_ascii, w->buffer, &inbytes_left,
                            c->cbuff + c->cbx, &outbytes_left);
         if (status || inbytes_left || outbytes_left) {
             fprintf(stderr, "only simple translation is supported (%d/%" APR_SIZE_T_FMT
@@ -1623,7 +2807,7 @@ read_more:
             exit(1);
         }
 #else
-        memcpy(c->cbuff + c->cbx, buffer, space);
+        memcpy(c->cbuff + c->cbx, w->buffer, space);
 #endif              /* NOT_ASCII */
         c->cbx += tocopy;
         space -= tocopy;
@@ -1650,8 +2834,11 @@ read_more:
             /* header is in invalid or too big - close connection */
                 set_conn_state(c, STATE_UNCONNECTED);
                 apr_socket_close(c->aprsock);
-                err_response++;
-                if (bad++ > 10) {
+                if (c->pipelined) {
+                    apr_atomic_sub32(&started, c->pipelined);
+                }
+                w->err_response++;
+                if (w->bad++ > 10) {
                     err("\nTest aborted after 10 failures\n\n");
                 }
                 start_connect(c);
@@ -1659,7 +2846,7 @@ read_more:
         }
         else {
             /* have full header */
-            if (!good) {
+            if (!w->good && w->id == 0) {
                 /*
                  * this is first time, extract some interesting info
                  */
@@ -1693,87 +2880,248 @@ read_more:
             }
 
             if (respcode[0] != '2') {
-                err_response++;
+                w->err_response++;
                 if (verbosity >= 2)
                     printf("WARNING: Response code not 2xx (%s)\n", respcode);
             }
             else if (verbosity >= 3) {
                 printf("LOG: Response code = %s\n", respcode);
             }
-            c->gotheader = 1;
-            *s = 0;     /* terminate at end of header */
-            if (keepalive && xstrcasestr(c->cbuff, "Keep-Alive")) {
-                char *cl;
-                c->keepalive = 1;
-                cl = xstrcasestr(c->cbuff, "Content-Length:");
-                if (cl && method != HEAD) {
-                    /* response to HEAD doesn't have entity body */
-                    c->length = atoi(cl + 16);
+            c->gotheader = 1;
+            *s = 0;     /* terminate at end of header */
+            if (keepalive && xstrcasestr(c->cbuff, "Keep-Alive")) {
+                char *cl;
+                c->keepalive = 1;
+                cl = xstrcasestr(c->cbuff, "Content-Length:");
+                if (cl && method != HEAD) {
+                    /* response to HEAD doesn't have entity body */
+                    c->length = atoi(cl + 16);
+                }
+                else {
+                    c->length = 0;
+                }
+            }
+            c->bread += c->cbx - (s + l - c->cbuff) + r - tocopy;
+            w->totalbread += c->bread;
+
+            /* We have received the header, so we know this destination socket
+             * address is working, so initialize all remaining requests. */
+            if (!w->requests_initialized) {
+                connect_all(w);
+            }
+        }
+    }
+    else {
+        /* outside header, everything we have read is entity body */
+        c->bread += r;
+        w->totalbread += r;
+    }
+    if (r == sizeof(w->buffer) && c->bread < c->length) {
+        /* read was full, try more immediately (nonblocking already) */
+        goto read_more;
+    }
+
+    if (c->keepalive && (c->bread >= c->length)) {
+        /* finished a keep-alive connection */
+        w->good++;
+        /* what was read past this response belongs to the next one */
+        overflow = c->bread - c->length;
+        c->bread -= overflow;
+        w->totalbread -= overflow;
+        /* save out time */
+        if (w->good == 1) {
+            /* first time here */
+            w->doclen = c->bread;
+        }
+        else if ((c->bread != w->doclen) && !nolength) {
+            w->bad++;
+            w->err_length++;
+        }
+        if (save_times(c)) {
+            w->doneka++;
+        }
+        c->keepalive = 0;
+        c->length = 0;
+        c->gotheader = 0;
+        c->cbx = 0;
+        c->read = c->bread = 0;
+        if (--c->pipelined > 0) {
+            /* more responses to read, the times run on from the write */
+            if (overflow) {
+                memmove(w->buffer, w->buffer + r - overflow, overflow);
+                r = overflow;
+                goto process;
+            }
+#ifdef USE_SSL
+            if (c->ssl && SSL_pending(c->ssl)) {
+                r = sizeof(w->buffer);
+                goto read_more;
+            }
+#endif
+            return;
+        }
+        /* zero connect time with keep-alive */
+        c->start = c->connect = w->lasttime = apr_time_now();
+        set_conn_state(c, STATE_CONNECTED);
+        write_request(c);
+    }
+}
+
+/* --------------------------------------------------------- */
+
+/* run the event loop of a worker */
+
+static void run_worker(struct worker *w)
+{
+    apr_int16_t rtnev;
+    apr_status_t rv, status;
+    int i;
+
+    /* initialise first connection to determine destination socket address
+     * which should be used for next connections. */
+    w->con[0].socknum = 0;
+    start_connect(&w->con[0]);
+
+    do {
+        apr_int32_t n;
+        const apr_pollfd_t *pollresults, *pollfd;
+
+        /* all requests are started, leave when ours are done */
+        if (apr_atomic_read32(&started) >= (apr_uint32_t)requests) {
+            for (i = 0; i < w->concurrency; i++) {
+                if (w->con[i].state != STATE_UNCONNECTED) {
+                    break;
+                }
+            }
+            if (i == w->concurrency) {
+                break;
+            }
+        }
+
+        if (w->nwaiting) {
+            timer_run(w, apr_time_now());
+        }
+
+        n = w->concurrency;
+        do {
+            status = apr_pollset_poll(w->pollset,
+                                      w->nwaiting ? WHEEL_TICK : aprtimeout,
+                                      &n, &pollresults);
+        } while (APR_STATUS_IS_EINTR(status));
+        if (APR_STATUS_IS_TIMEUP(status) && w->nwaiting)
+            continue;
+        if (status != APR_SUCCESS)
+            apr_err("apr_pollset_poll", status);
+
+        for (i = 0, pollfd = pollresults; i < n; i++, pollfd++) {
+            struct connection *c;
+
+            c = pollfd->client_data;
+
+            /*
+             * If the connection isn't connected how can we check it?
+             */
+            if (c->state == STATE_UNCONNECTED)
+                continue;
+
+            rtnev = pollfd->rtnevents;
+
+#ifdef USE_SSL
+            if (c->state == STATE_CONNECTED && c->ssl && SSL_in_init(c->ssl)) {
+                ssl_proceed_handshake(c);
+                continue;
+            }
+#endif
+
+            /*
+             * Notes: APR_POLLHUP is set after FIN is received on some
+             * systems, so treat that like APR_POLLIN so that we try to read
+             * again.
+             *
+             * Some systems return APR_POLLERR with APR_POLLHUP.  We need to
+             * call read_connection() for APR_POLLHUP, so check for
+             * APR_POLLHUP first so that a closed connection isn't treated
+             * like an I/O error.  If it is, we never figure out that the
+             * connection is done and we loop here endlessly calling
+             * apr_poll().
+             */
+            if ((rtnev & APR_POLLIN) || (rtnev & APR_POLLPRI) || (rtnev & APR_POLLHUP)) {
+                read_connection(c);
+#ifdef USE_H2
+                /* which writes too, and sees to errors (and reconnects) */
+                if (http2)
+                    continue;
+#endif
+            }
+            if ((rtnev & APR_POLLERR) || (rtnev & APR_POLLNVAL)) {
+                if (w->destsa->next && c->state == STATE_CONNECTING && w->good == 0) {
+                    w->destsa = w->destsa->next;
+                    start_connect(c);
                 }
                 else {
-                    c->length = 0;
+                    w->bad++;
+                    w->err_except++;
+                    /* avoid apr_poll/EINPROGRESS loop on HP-UX, let recv discover ECONNREFUSED */
+                    if (c->state == STATE_CONNECTING) {
+                        read_connection(c);
+                    }
+                    else {
+                        start_connect(c);
+                    }
                 }
+                continue;
             }
-            c->bread += c->cbx - (s + l - c->cbuff) + r - tocopy;
-            totalbread += c->bread;
-
-            /* We have received the header, so we know this destination socket
-             * address is working, so initialize all remaining requests. */
-            if (!requests_initialized) {
-                for (i = 1; i < concurrency; i++) {
-                    con[i].socknum = i;
-                    start_connect(&con[i]);
+            if (rtnev & APR_POLLOUT) {
+                if (c->state == STATE_CONNECTING) {
+                    /* call connect() again to detect errors */
+                    rv = apr_socket_connect(c->aprsock, w->destsa);
+                    if (rv != APR_SUCCESS) {
+                        set_conn_state(c, STATE_UNCONNECTED);
+                        apr_socket_close(c->aprsock);
+                        w->err_conn++;
+                        if (w->bad++ > 10) {
+                            fprintf(stderr,
+                                    "\nTest aborted after 10 failures\n\n");
+                            apr_err("apr_socket_connect()", rv);
+                        }
+                        start_connect(c);
+                        continue;
+                    }
+                    else {
+                        set_conn_state(c, STATE_CONNECTED);
+#ifdef USE_SSL
+                        if (c->ssl)
+                            ssl_proceed_handshake(c);
+                        else
+#endif
+                        write_request(c);
+                    }
+                }
+                else {
+                    /* POLLOUT is one shot */
+                    set_polled_events(c, APR_POLLIN);
+                    if (c->state == STATE_READ) {
+                        read_connection(c);
+                    }
+                    else {
+                        write_request(c);
+                    }
                 }
-                requests_initialized = 1;
             }
         }
-    }
-    else {
-        /* outside header, everything we have read is entity body */
-        c->bread += r;
-        totalbread += r;
-    }
-    if (r == sizeof(buffer) && c->bread < c->length) {
-        /* read was full, try more immediately (nonblocking already) */
-        goto read_more;
-    }
+    } while (w->lasttime < stoptime
+             && apr_atomic_read32(&finished) < (apr_uint32_t)requests);
+}
 
-    if (c->keepalive && (c->bread >= c->length)) {
-        /* finished a keep-alive connection */
-        good++;
-        /* save out time */
-        if (good == 1) {
-            /* first time here */
-            doclen = c->bread;
-        }
-        else if ((c->bread != doclen) && !nolength) {
-            bad++;
-            err_length++;
-        }
-        if (done < requests) {
-            struct data *s = &stats[done++];
-            doneka++;
-            c->done      = apr_time_now();
-            s->starttime = c->start;
-            s->ctime     = ap_max(0, c->connect - c->start);
-            s->time      = ap_max(0, c->done - c->start);
-            s->waittime  = ap_max(0, c->beginread - c->endwrite);
-            if (heartbeatres && !(done % heartbeatres)) {
-                fprintf(stderr, "Completed %d requests\n", done);
-                fflush(stderr);
-            }
-        }
-        c->keepalive = 0;
-        c->length = 0;
-        c->gotheader = 0;
-        c->cbx = 0;
-        c->read = c->bread = 0;
-        /* zero connect time with keep-alive */
-        c->start = c->connect = lasttime = apr_time_now();
-        set_conn_state(c, STATE_CONNECTED);
-        write_request(c);
-    }
+
+#if APR_HAS_THREADS
+static void * APR_THREAD_FUNC worker_thread(apr_thread_t *thd, void *data)
+{
+    run_worker(data);
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
 }
+#endif
 
 /* --------------------------------------------------------- */
 
@@ -1781,10 +3129,8 @@ read_more:
 
 static void test(void)
 {
-    apr_time_t stoptime;
-    apr_int16_t rtnev;
     apr_status_t rv;
-    int i;
+    int i, j, c;
     apr_status_t status;
     int snprintf_res = 0;
 #ifdef NOT_ASCII
@@ -1812,14 +3158,11 @@ static void test(void)
     con = xcalloc(concurrency, sizeof(struct connection));
 
     /*
-     * XXX: a way to calculate the stats without requiring O(requests) memory
-     * XXX: would be nice.
+     * The workers of -W count the times in histograms, in O(1) memory,
+     * otherwise each request has its data for the exact statistics.
      */
-    stats = xcalloc(requests, sizeof(struct data));
-
-    if ((status = apr_pollset_create(&readbits, concurrency, cntxt,
-                                     APR_POLLSET_NOCOPY)) != APR_SUCCESS) {
-        apr_err("apr_pollset_create failed", status);
+    if (!threads) {
+        stats = xcalloc(requests, sizeof(struct data));
     }
 
     /* add default headers if necessary */
@@ -1893,6 +3236,12 @@ static void test(void)
         printf("INFO: %s header == \n---\n%s\n---\n",
                method_str[method], request);
 
+#ifdef USE_H2
+    if (http2) {
+        h2_setup();
+    }
+#endif
+
     reqlen = strlen(request);
 
     /*
@@ -1917,6 +3266,16 @@ static void test(void)
     }
 #endif              /* NOT_ASCII */
 
+    /* with -K, the requests written at once follow each other */
+    reqsize = reqlen + (send_body ? postlen : 0);
+    if (pipeline > 1) {
+        char *buff = xmalloc(pipeline * reqsize);
+        for (i = 0; i < pipeline; i++) {
+            memcpy(buff + i * reqsize, request, reqsize);
+        }
+        request = buff;
+    }
+
     if (myhost) {
         /* This only needs to be done once */
         if ((rv = apr_sockaddr_info_get(&mysa, myhost, APR_UNSPEC, 0, 0, cntxt)) != APR_SUCCESS) {
@@ -1938,123 +3297,78 @@ static void test(void)
         apr_err(buf, rv);
     }
 
+    /*
+     * The connections are shared out among the workers, each of which
+     * has a pool (and allocator) of its own so they don't contend.
+     */
+    nworkers = threads ? threads : 1;
+    workers = xcalloc(nworkers, sizeof(struct worker));
+    for (i = 0, c = 0; i < nworkers; i++) {
+        struct worker *w = &workers[i];
+        apr_allocator_t *allocator;
+
+        w->id = i;
+        w->con = &con[c];
+        w->concurrency = concurrency / nworkers
+                         + (i < concurrency % nworkers);
+        w->destsa = destsa;
+        c += w->concurrency;
+        for (j = 0; j < w->concurrency; j++) {
+            w->con[j].worker = w;
+        }
+
+        if ((status = apr_allocator_create(&allocator)) != APR_SUCCESS) {
+            apr_err("apr_allocator_create", status);
+        }
+        if ((status = apr_pool_create_ex(&w->pool, NULL, abort_on_oom,
+                                         allocator)) != APR_SUCCESS) {
+            apr_err("apr_pool_create_ex", status);
+        }
+        apr_allocator_owner_set(allocator, w->pool);
+
+        if ((status = apr_pollset_create(&w->pollset, w->concurrency,
+                                         w->pool, APR_POLLSET_NOCOPY))
+                != APR_SUCCESS) {
+            apr_err("apr_pollset_create failed", status);
+        }
+        if (!stats) {
+            for (j = 0; j < T_NUM; j++) {
+                hist_init(&w->hist[j], w->pool);
+            }
+        }
+    }
+
     /* ok - lets start */
     start = lasttime = apr_time_now();
     stoptime = tlimit ? (start + apr_time_from_sec(tlimit)) : AB_MAX;
+    for (i = 0; i < nworkers; i++) {
+        workers[i].lasttime = start;
+        workers[i].wheel_tick = start / WHEEL_TICK;
+    }
 
 #ifdef SIGINT
     /* Output the results if the user terminates the run early. */
     apr_signal(SIGINT, output_results);
 #endif
 
-    /* initialise first connection to determine destination socket address
-     * which should be used for next connections. */
-    con[0].socknum = 0;
-    start_connect(&con[0]);
-
-    do {
-        apr_int32_t n;
-        const apr_pollfd_t *pollresults, *pollfd;
-
-        n = concurrency;
-        do {
-            status = apr_pollset_poll(readbits, aprtimeout, &n, &pollresults);
-        } while (APR_STATUS_IS_EINTR(status));
-        if (status != APR_SUCCESS)
-            apr_err("apr_pollset_poll", status);
-
-        for (i = 0, pollfd = pollresults; i < n; i++, pollfd++) {
-            struct connection *c;
-
-            c = pollfd->client_data;
-
-            /*
-             * If the connection isn't connected how can we check it?
-             */
-            if (c->state == STATE_UNCONNECTED)
-                continue;
-
-            rtnev = pollfd->rtnevents;
-
-#ifdef USE_SSL
-            if (c->state == STATE_CONNECTED && c->ssl && SSL_in_init(c->ssl)) {
-                ssl_proceed_handshake(c);
-                continue;
-            }
-#endif
-
-            /*
-             * Notes: APR_POLLHUP is set after FIN is received on some
-             * systems, so treat that like APR_POLLIN so that we try to read
-             * again.
-             *
-             * Some systems return APR_POLLERR with APR_POLLHUP.  We need to
-             * call read_connection() for APR_POLLHUP, so check for
-             * APR_POLLHUP first so that a closed connection isn't treated
-             * like an I/O error.  If it is, we never figure out that the
-             * connection is done and we loop here endlessly calling
-             * apr_poll().
-             */
-            if ((rtnev & APR_POLLIN) || (rtnev & APR_POLLPRI) || (rtnev & APR_POLLHUP))
-                read_connection(c);
-            if ((rtnev & APR_POLLERR) || (rtnev & APR_POLLNVAL)) {
-                if (destsa->next && c->state == STATE_CONNECTING && good == 0) {
-                    destsa = destsa->next;
-                    start_connect(c);
-                }
-                else {
-                    bad++;
-                    err_except++;
-                    /* avoid apr_poll/EINPROGRESS loop on HP-UX, let recv discover ECONNREFUSED */
-                    if (c->state == STATE_CONNECTING) {
-                        read_connection(c);
-                    }
-                    else {
-                        start_connect(c);
-                    }
-                }
-                continue;
-            }
-            if (rtnev & APR_POLLOUT) {
-                if (c->state == STATE_CONNECTING) {
-                    /* call connect() again to detect errors */
-                    rv = apr_socket_connect(c->aprsock, destsa);
-                    if (rv != APR_SUCCESS) {
-                        set_conn_state(c, STATE_UNCONNECTED);
-                        apr_socket_close(c->aprsock);
-                        err_conn++;
-                        if (bad++ > 10) {
-                            fprintf(stderr,
-                                    "\nTest aborted after 10 failures\n\n");
-                            apr_err("apr_socket_connect()", rv);
-                        }
-                        start_connect(c);
-                        continue;
-                    }
-                    else {
-                        set_conn_state(c, STATE_CONNECTED);
-#ifdef USE_SSL
-                        if (c->ssl)
-                            ssl_proceed_handshake(c);
-                        else
-#endif
-                        write_request(c);
-                    }
-                }
-                else {
-                    /* POLLOUT is one shot */
-                    set_polled_events(c, APR_POLLIN);
-                    if (c->state == STATE_READ) {
-                        read_connection(c);
-                    }
-                    else {
-                        write_request(c);
-                    }
-                }
+#if APR_HAS_THREADS
+    if (threads) {
+        for (i = 0; i < nworkers; i++) {
+            rv = apr_thread_create(&workers[i].thread, NULL, worker_thread,
+                                   &workers[i], cntxt);
+            if (rv != APR_SUCCESS) {
+                apr_err("apr_thread_create", rv);
             }
         }
-    } while (lasttime < stoptime && done < requests);
+        for (i = 0; i < nworkers; i++) {
+            apr_thread_join(&status, workers[i].thread);
+        }
+    }
+    else
+#endif
+    run_worker(&workers[0]);
 
+    sum_workers();
     if (heartbeatres)
         fprintf(stderr, "Finished %d requests\n", done);
     else
@@ -2126,12 +3440,24 @@ static void usage(const char *progname)
     fprintf(stderr, "    -X proxy:port   Proxyserver and port number to use\n");
     fprintf(stderr, "    -V              Print version number and exit\n");
     fprintf(stderr, "    -k              Use HTTP KeepAlive feature\n");
+    fprintf(stderr, "    -R rate         Send that many requests per second, whether or not\n");
+    fprintf(stderr, "                    the responses keep up; times are from when each was due\n");
+    fprintf(stderr, "    -K depth        Pipeline that many requests on each connection\n");
+    fprintf(stderr, "                    This implies -k\n");
+#ifdef USE_H2
+    fprintf(stderr, "    -2              Use HTTP/2, -K is then the number of streams open\n");
+    fprintf(stderr, "                    at once on each connection\n");
+#endif
+#if APR_HAS_THREADS
+    fprintf(stderr, "    -W threads      Number of threads to share the connections among\n");
+#endif
     fprintf(stderr, "    -d              Do not show percentiles served table.\n");
     fprintf(stderr, "    -S              Do not show confidence estimators and warnings.\n");
     fprintf(stderr, "    -q              Do not show progress when doing more than 150 requests\n");
     fprintf(stderr, "    -l              Accept variable document length (use this for dynamic pages)\n");
     fprintf(stderr, "    -g filename     Output collected data to gnuplot format file.\n");
     fprintf(stderr, "    -e filename     Output CSV file with percentages served\n");
+    fprintf(stderr, "    -j filename     Output the results to a JSON file\n");
     fprintf(stderr, "    -r              Don't exit on socket receive errors.\n");
     fprintf(stderr, "    -m method       Method name\n");
     fprintf(stderr, "    -h              Display usage information (this message)\n");
@@ -2158,6 +3484,7 @@ static void usage(const char *progname)
 #ifdef HAVE_TLSEXT
     fprintf(stderr, "    -I              Disable TLS Server Name Indication (SNI) extension\n");
 #endif
+    fprintf(stderr, "    -U              Resume TLS sessions, with tickets if the server has them\n");
     fprintf(stderr, "    -Z ciphersuite  Specify SSL/TLS cipher suite (See openssl ciphers)\n");
     fprintf(stderr, "    -f protocol     Specify SSL/TLS protocol\n");
     fprintf(stderr, "                    (" SSL2_HELP_MSG SSL3_HELP_MSG "TLS1" TLS1_X_HELP_MSG " or ALL)\n");
@@ -2329,9 +3656,15 @@ int main(int argc, const char * const argv[])
     myhost = NULL; /* 0.0.0.0 or :: */
 
     apr_getopt_init(&opt, cntxt, argc, argv);
-    while ((status = apr_getopt(opt, "n:c:t:s:b:T:p:u:v:lrkVhwiIx:y:z:C:H:P:A:g:X:de:SqB:m:"
+    while ((status = apr_getopt(opt, "n:c:t:s:b:T:p:u:v:lrkK:R:VhwiIx:y:z:C:H:P:A:g:X:de:j:SqB:m:"
+#if APR_HAS_THREADS
+            "W:"
+#endif
+#ifdef USE_H2
+            "2"
+#endif
 #ifdef USE_SSL
-            "Z:f:"
+            "Z:f:U"
 #endif
             ,&c, &opt_arg)) == APR_SUCCESS) {
         switch (c) {
@@ -2344,6 +3677,33 @@ int main(int argc, const char * const argv[])
             case 'k':
                 keepalive = 1;
                 break;
+            case 'K':
+                pipeline = atoi(opt_arg);
+                if (pipeline <= 0 || pipeline > MAX_PIPELINE) {
+                    err("Invalid pipeline depth\n");
+                }
+                keepalive = 1;
+                break;
+            case 'R':
+                rate = atof(opt_arg);
+                if (rate <= 0) {
+                    err("Invalid request rate\n");
+                }
+                break;
+#if APR_HAS_THREADS
+            case 'W':
+                threads = atoi(opt_arg);
+                if (threads <= 0) {
+                    err("Invalid number of worker threads\n");
+                }
+                break;
+#endif
+#ifdef USE_H2
+            case '2':
+                http2 = 1;
+                keepalive = 1;
+                break;
+#endif
             case 'q':
                 heartbeatres = 0;
                 break;
@@ -2367,6 +3727,9 @@ int main(int argc, const char * const argv[])
             case 'e':
                 csvperc = xstrdup(opt_arg);
                 break;
+            case 'j':
+                jsonfile = xstrdup(opt_arg);
+                break;
             case 'S':
                 confidence = 0;
                 break;
@@ -2515,6 +3878,9 @@ int main(int argc, const char * const argv[])
             case 'Z':
                 ssl_cipher = strdup(opt_arg);
                 break;
+            case 'U':
+                tls_resume = 1;
+                break;
             case 'f':
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
                 if (strncasecmp(opt_arg, "ALL", 3) == 0) {
@@ -2603,6 +3969,54 @@ int main(int argc, const char * const argv[])
         usage(argv[0]);
     }
 
+    if (rate && pipeline > 1
+#ifdef USE_H2
+        && !http2
+#endif
+        ) {
+        fprintf(stderr, "%s: Cannot pipeline requests at a constant rate\n",
+                argv[0]);
+        usage(argv[0]);
+    }
+
+#ifdef USE_H2
+    if (http2 && isproxy) {
+        fprintf(stderr, "%s: Cannot use HTTP/2 through a proxy\n", argv[0]);
+        usage(argv[0]);
+    }
+#if defined(USE_SSL) && !defined(HAVE_TLS_ALPN)
+    if (http2 && is_ssl) {
+        fprintf(stderr, "%s: HTTP/2 over TLS needs ALPN, OpenSSL 1.0.2 "
+                "or later\n", argv[0]);
+        exit(1);
+    }
+#endif
+#endif
+
+    if (threads) {
+        if (threads > concurrency) {
+            fprintf(stderr, "%s: Cannot use more worker threads than the "
+                    "concurrency level\n", argv[0]);
+            usage(argv[0]);
+        }
+        if (gnuplot) {
+            fprintf(stderr, "%s: Cannot output the data of each request "
+                    "with worker threads\n", argv[0]);
+            usage(argv[0]);
+        }
+#if defined(USE_SSL) && OPENSSL_VERSION_NUMBER < 0x10100000L
+        if (is_ssl && threads > 1) {
+            fprintf(stderr, "%s: Worker threads with SSL/TLS need "
+                    "OpenSSL 1.1.0 or later\n", argv[0]);
+            exit(1);
+        }
+#endif
+        if (tlimit && requests == MAX_REQUESTS) {
+            /* no data array to size, run out the time */
+            requests = INT_MAX;
+        }
+    }
+
     if ((heartbeatres) && (requests > 150)) {
         heartbeatres = requests / 10;   /* Print line every 10% of requests */
         if (heartbeatres < 100)
@@ -2649,6 +4063,21 @@ int main(int argc, const char * const argv[])
     if (verbosity >= 3) {
         SSL_CTX_set_info_callback(ssl_ctx, ssl_state_cb);
     }
+    if (tls_resume) {
+        SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT
+                                       | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ssl_ctx, ssl_new_session_cb);
+    }
+#ifdef USE_H2
+    if (http2) {
+#ifdef HAVE_TLS_ALPN
+        SSL_CTX_set_alpn_protos(ssl_ctx, (const unsigned char *)"\x02h2", 3);
+#endif
+        /* nghttp2 may write less, or from elsewhere, when it tries again */
+        SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+                                  | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    }
+#endif
 #endif
 #ifdef SIGPIPE
     apr_signal(SIGPIPE, SIG_IGN);       /* Ignore writes to connections that
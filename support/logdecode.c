@@ -0,0 +1,463 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * logdecode: turn access logs written by mod_log_config with
+ * "CustomLog ... encoding=binary" back into text.
+ *
+ * Usage: logdecode [-j] [-s] [file ...] > log
+ *
+ * A binary log is a sequence of records, each a 32 bit length (little
+ * endian) followed by that many bytes. The first byte says what the
+ * record is:
+ *
+ *   'S'  a schema: 32 bit schema id, varint field count and per field
+ *        a varint name length, the name and a type byte
+ *   'E'  an entry: 32 bit schema id and per field of that schema a type
+ *        byte and the value: nothing for null (0), a varint length and
+ *        the bytes for a string (1), a zigzag varint for a number (2)
+ *
+ * Each httpd child writes the schema of a log along with its first entry
+ * of every second, so the schemas of all entries are found earlier in
+ * the same file, except for the entries of the first second of a file
+ * cut by a rotation. Schemas can then be taken from the previous file
+ * of the same log by naming it first: the files are read in order and
+ * schemas are kept across them.
+ */
+
+#include "apr.h"
+#include "apr_lib.h"
+#include "apr_hash.h"
+#include "apr_getopt.h"
+#include "apr_strings.h"
+#include "apr_file_io.h"
+
+#if APR_HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#if APR_HAVE_STRING_H
+#include <string.h>
+#endif
+
+#define MAX_RECORD_SIZE  (16*1024*1024)
+
+#define RECORD_SCHEMA   'S'
+#define RECORD_ENTRY    'E'
+#define FIELD_NULL      0
+#define FIELD_STRING    1
+#define FIELD_NUMBER    2
+
+typedef struct {
+    apr_uint32_t id;
+    int nfields;
+    const char **names;
+    unsigned char *types;
+} schema_t;
+
+static apr_file_t *errfile;
+static apr_file_t *outfile;
+static const char *shortname = "logdecode";
+static apr_hash_t *schemas;
+static int json = 0;
+static int show_schemas = 0;
+static int unknown = 0;
+
+#define NL APR_EOL_STR
+static void usage(void)
+{
+    apr_file_printf(errfile,
+    "%s -- Decode binary access logs of mod_log_config."                     NL
+    "Usage: %s [-j] [-s] [FILE ...]"                                         NL
+                                                                             NL
+    "Reads standard input when no FILE is given."                            NL
+                                                                             NL
+    "Options:"                                                               NL
+    "  -j   Write JSON Lines, as encoding=json does."                        NL
+                                                                             NL
+    "  -s   Write the schemas as comment lines as well."                     NL,
+    shortname, shortname);
+    exit(1);
+}
+#undef NL
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} reader_t;
+
+static int get_varint(reader_t *r, apr_uint64_t *v)
+{
+    int shift = 0;
+
+    *v = 0;
+    while (r->p < r->end && shift < 64) {
+        unsigned char c = *r->p++;
+        *v |= (apr_uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+static int get_u32(reader_t *r, apr_uint32_t *v)
+{
+    if (r->end - r->p < 4) {
+        return 0;
+    }
+    *v = r->p[0] | (r->p[1] << 8) | (r->p[2] << 16)
+         | ((apr_uint32_t)r->p[3] << 24);
+    r->p += 4;
+    return 1;
+}
+
+static int get_bytes(reader_t *r, const char **s, apr_size_t *len)
+{
+    apr_uint64_t n;
+
+    if (!get_varint(r, &n) || n > (apr_uint64_t)(r->end - r->p)) {
+        return 0;
+    }
+    *s = (const char *)r->p;
+    *len = (apr_size_t)n;
+    r->p += n;
+    return 1;
+}
+
+static const char *type_name(unsigned char type)
+{
+    return type == FIELD_NUMBER ? "number" : "string";
+}
+
+static int read_schema(apr_pool_t *pool, reader_t *r)
+{
+    schema_t *schema = apr_pcalloc(pool, sizeof(*schema));
+    apr_uint64_t n;
+    const char *name;
+    apr_size_t len;
+    int i;
+
+    if (!get_u32(r, &schema->id) || !get_varint(r, &n)
+        || n > (apr_uint64_t)(r->end - r->p)) {
+        return 0;
+    }
+    schema->nfields = (int)n;
+    schema->names = apr_pcalloc(pool, schema->nfields * sizeof(char *));
+    schema->types = apr_pcalloc(pool, schema->nfields);
+    for (i = 0; i < schema->nfields; ++i) {
+        if (!get_bytes(r, &name, &len) || r->p >= r->end) {
+            return 0;
+        }
+        schema->names[i] = apr_pstrmemdup(pool, name, len);
+        schema->types[i] = *r->p++;
+    }
+    apr_hash_set(schemas, &schema->id, sizeof(schema->id), schema);
+
+    if (show_schemas) {
+        apr_file_printf(outfile, "# schema %08x:", schema->id);
+        for (i = 0; i < schema->nfields; ++i) {
+            apr_file_printf(outfile, " %s(%s)", schema->names[i],
+                            type_name(schema->types[i]));
+        }
+        apr_file_puts(APR_EOL_STR, outfile);
+    }
+    return 1;
+}
+
+/* The length of the valid UTF-8 sequence at s, 0 if there is none,
+ * as in mod_log_config */
+static apr_size_t utf8_len(const unsigned char *s, apr_size_t len)
+{
+    unsigned char lo = 0x80, hi = 0xbf;
+    apr_size_t i, n;
+
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        n = 2;
+    }
+    else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        n = 3;
+        if (s[0] == 0xe0) {
+            lo = 0xa0;
+        }
+        else if (s[0] == 0xed) {
+            hi = 0x9f;
+        }
+    }
+    else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        n = 4;
+        if (s[0] == 0xf0) {
+            lo = 0x90;
+        }
+        else if (s[0] == 0xf4) {
+            hi = 0x8f;
+        }
+    }
+    else {
+        return 0;
+    }
+    if (n > len || s[1] < lo || s[1] > hi) {
+        return 0;
+    }
+    for (i = 2; i < n; ++i) {
+        if (s[i] < 0x80 || s[i] > 0xbf) {
+            return 0;
+        }
+    }
+    return n;
+}
+
+/* As ap_escape_logitem() or as a JSON string, which keeps valid UTF-8 */
+static void put_string(const char *s, apr_size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    char buf[8];
+    apr_size_t i, n;
+
+    if (json) {
+        apr_file_putc('"', outfile);
+    }
+    for (i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)s[i];
+
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+            apr_file_putc(c, outfile);
+            continue;
+        }
+        if (json && c >= 0x80
+            && (n = utf8_len((const unsigned char *)s + i, len - i)) != 0) {
+            apr_file_write_full(outfile, s + i, n, NULL);
+            i += n - 1;
+            continue;
+        }
+        buf[0] = '\\';
+        buf[2] = '\0';
+        switch (c) {
+        case '\b':
+            buf[1] = 'b';
+            break;
+        case '\n':
+            buf[1] = 'n';
+            break;
+        case '\r':
+            buf[1] = 'r';
+            break;
+        case '\t':
+            buf[1] = 't';
+            break;
+        case '\\':
+        case '"':
+            buf[1] = c;
+            break;
+        default:
+            if (json && c == '\f') {
+                buf[1] = 'f';
+            }
+            else if (json) {
+                apr_snprintf(buf + 1, sizeof(buf) - 1, "u00%c%c",
+                             hex[c >> 4], hex[c & 0xf]);
+            }
+            else if (c == '\v') {
+                buf[1] = 'v';
+            }
+            else {
+                apr_snprintf(buf + 1, sizeof(buf) - 1, "x%c%c",
+                             hex[c >> 4], hex[c & 0xf]);
+            }
+            break;
+        }
+        apr_file_puts(buf, outfile);
+    }
+    if (json) {
+        apr_file_putc('"', outfile);
+    }
+}
+
+static int read_entry(reader_t *r)
+{
+    schema_t *schema;
+    apr_uint32_t id;
+    apr_uint64_t n;
+    const char *s;
+    apr_size_t len;
+    int i;
+
+    if (!get_u32(r, &id)) {
+        return 0;
+    }
+    schema = apr_hash_get(schemas, &id, sizeof(id));
+    if (!schema) {
+        if (!unknown++) {
+            apr_file_printf(errfile, "%s: skipping entries of unknown "
+                            "schema %08x" APR_EOL_STR, shortname, id);
+        }
+        return 1;
+    }
+
+    if (json) {
+        apr_file_putc('{', outfile);
+    }
+    for (i = 0; i < schema->nfields; ++i) {
+        if (r->p >= r->end) {
+            return 0;
+        }
+        if (i) {
+            apr_file_putc(json ? ',' : ' ', outfile);
+        }
+        if (json) {
+            put_string(schema->names[i], strlen(schema->names[i]));
+            apr_file_putc(':', outfile);
+        }
+        switch (*r->p++) {
+        case FIELD_NULL:
+            apr_file_puts(json ? "null" : "-", outfile);
+            break;
+        case FIELD_STRING:
+            if (!get_bytes(r, &s, &len)) {
+                return 0;
+            }
+            put_string(s, len);
+            break;
+        case FIELD_NUMBER:
+            if (!get_varint(r, &n)) {
+                return 0;
+            }
+            apr_file_printf(outfile, "%" APR_INT64_T_FMT,
+                            (apr_int64_t)(n >> 1) ^ -(apr_int64_t)(n & 1));
+            break;
+        default:
+            return 0;
+        }
+    }
+    apr_file_puts(json ? "}" APR_EOL_STR : APR_EOL_STR, outfile);
+    return 1;
+}
+
+static int decode(apr_pool_t *pool, apr_file_t *infile, const char *name)
+{
+    unsigned char hdr[4];
+    unsigned char *buf = NULL;
+    apr_size_t bufsize = 0, len;
+    apr_uint32_t size;
+    apr_off_t offset = 0;
+    apr_status_t status;
+    reader_t r;
+
+    for (;;) {
+        len = sizeof(hdr);
+        status = apr_file_read_full(infile, hdr, len, &len);
+        if (status == APR_EOF && len == 0) {
+            return 0;
+        }
+        if (status != APR_SUCCESS) {
+            break;
+        }
+        size = hdr[0] | (hdr[1] << 8) | (hdr[2] << 16)
+               | ((apr_uint32_t)hdr[3] << 24);
+        if (size == 0 || size > MAX_RECORD_SIZE) {
+            apr_file_printf(errfile, "%s: %s: bad record length %u at "
+                            "offset %" APR_OFF_T_FMT APR_EOL_STR,
+                            shortname, name, size, offset);
+            return 1;
+        }
+        if (size > bufsize) {
+            bufsize = size;
+            buf = apr_palloc(pool, bufsize);
+        }
+        status = apr_file_read_full(infile, buf, size, &len);
+        if (status != APR_SUCCESS) {
+            break;
+        }
+
+        r.p = buf + 1;
+        r.end = buf + size;
+        if (!(buf[0] == RECORD_SCHEMA ? read_schema(pool, &r)
+              : buf[0] == RECORD_ENTRY ? read_entry(&r) : 0)) {
+            apr_file_printf(errfile, "%s: %s: bad record at offset %"
+                            APR_OFF_T_FMT APR_EOL_STR, shortname, name,
+                            offset);
+            return 1;
+        }
+        offset += 4 + size;
+    }
+
+    apr_file_printf(errfile, "%s: %s: truncated record at offset %"
+                    APR_OFF_T_FMT APR_EOL_STR, shortname, name, offset);
+    return 1;
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_file_t *infile;
+    apr_getopt_t *o;
+    apr_pool_t *pool;
+    apr_status_t status;
+    const char *arg;
+    char opt;
+    int rc = 0;
+
+    if (apr_app_initialize(&argc, &argv, NULL) != APR_SUCCESS) {
+        return 1;
+    }
+    atexit(apr_terminate);
+
+    if (argc) {
+        shortname = apr_filepath_name_get(argv[0]);
+    }
+
+    if (apr_pool_create(&pool, NULL) != APR_SUCCESS) {
+        return 1;
+    }
+    apr_file_open_stderr(&errfile, pool);
+    apr_file_open_stdout(&outfile, pool);
+    apr_getopt_init(&o, pool, argc, argv);
+
+    while ((status = apr_getopt(o, "js", &opt, &arg)) != APR_EOF) {
+        if (status != APR_SUCCESS) {
+            usage();
+        }
+        switch (opt) {
+        case 'j':
+            json = 1;
+            break;
+        case 's':
+            show_schemas = 1;
+            break;
+        }
+    }
+
+    schemas = apr_hash_make(pool);
+    if (o->ind == argc) {
+        apr_file_open_stdin(&infile, pool);
+        rc = decode(pool, infile, "stdin");
+    }
+    for (; o->ind < argc && !rc; ++o->ind) {
+        status = apr_file_open(&infile, argv[o->ind],
+                               APR_FOPEN_READ | APR_FOPEN_BUFFERED,
+                               APR_OS_DEFAULT, pool);
+        if (status != APR_SUCCESS) {
+            apr_file_printf(errfile, "%s: could not open %s" APR_EOL_STR,
+                            shortname, argv[o->ind]);
+            rc = 1;
+            break;
+        }
+        rc = decode(pool, infile, argv[o->ind]);
+        apr_file_close(infile);
+    }
+
+    apr_file_flush(outfile);
+    return rc;
+}
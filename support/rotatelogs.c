@@ -25,18 +25,46 @@
 #include "apr_getopt.h"
 #include "apr_thread_proc.h"
 #include "apr_signal.h"
+#include "apr_portable.h"
 #if APR_FILES_AS_SOCKETS
 #include "apr_poll.h"
 #endif
+#if APR_HAS_THREADS
+#include "apr_thread_mutex.h"
+#include "apr_thread_cond.h"
+#endif
 
 #if APR_HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
+#if APR_HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#if APR_HAVE_ERRNO_H
+#include <errno.h>
+#endif
 #define APR_WANT_STRFUNC
 #include "apr_want.h"
 
+#if !defined(WIN32) && !defined(NETWARE)
+#include "ap_config_auto.h"
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* splice() needs the poll loop to learn when there is data to move */
+#if defined(HAVE_SPLICE) && !APR_FILES_AS_SOCKETS
+#undef HAVE_SPLICE
+#endif
+
 #define BUFSIZE         65536
 
+/* Size asked for the stdin pipe, so that bursts of log lines fit into
+ * it while a new log is opened or the disk is slow. */
+#define PIPE_SIZE       (1024 * 1024)
+
 #define ROTATE_NONE     0
 #define ROTATE_NEW      1
 #define ROTATE_TIME     2
@@ -72,6 +100,12 @@ struct rotate_config {
 #endif
     int num_files;
     int create_path;
+#ifdef HAVE_ZLIB
+    int compress;
+#endif
+#ifdef HAVE_SPLICE
+    int splice;
+#endif
 };
 
 typedef struct rotate_status rotate_status_t;
@@ -108,11 +142,17 @@ static void usage(const char *argv0, const char *reason)
         fprintf(stderr, "%s\n", reason);
     }
     fprintf(stderr,
+            "Usage: %s [-v] [-l] [-L linkname] [-p prog] [-f] [-D] [-t] [-e] "
 #if APR_FILES_AS_SOCKETS
-            "Usage: %s [-v] [-l] [-L linkname] [-p prog] [-f] [-D] [-t] [-e] [-c] [-n number] <logfile> "
-#else
-            "Usage: %s [-v] [-l] [-L linkname] [-p prog] [-f] [-D] [-t] [-e] [-n number] <logfile> "
+            "[-c] "
+#endif
+#ifdef HAVE_ZLIB
+            "[-z] "
 #endif
+#ifdef HAVE_SPLICE
+            "[-s] "
+#endif
+            "[-n number] <logfile> "
             "{<rotation time in seconds>|<rotation size>(B|K|M|G)} "
             "[offset minutes from UTC]\n\n",
             argv0);
@@ -150,10 +190,21 @@ static void usage(const char *argv0, const char *reason)
             "  -c       Create log even if it is empty.\n"
 #endif
             "  -n num   Rotate file by adding suffixes '.1', '.2', ..., '.num'.\n"
+#ifdef HAVE_ZLIB
+            "  -z       Compress rotated files with gzip in the background.\n"
+#endif
+#ifdef HAVE_SPLICE
+            "  -s       Move data from stdin to the log with splice(), without\n"
+            "           copying it. The log must not be shared with other writers.\n"
+#endif
             "\n"
             "The program for '-p' is invoked as \"[prog] <curfile> [<prevfile>]\"\n"
             "where <curfile> is the filename of the newly opened logfile, and\n"
             "<prevfile>, if given, is the filename of the previously used logfile.\n"
+#ifdef HAVE_ZLIB
+            "With '-z', the program is invoked once <prevfile> is compressed,\n"
+            "and gets <prevfile>.gz instead.\n"
+#endif
             "\n");
     exit(1);
 }
@@ -197,6 +248,349 @@ static void close_logfile(rotate_config_t *config, struct logfile *logfile)
     apr_pool_destroy(logfile->pool);
 }
 
+/*
+ * Run the post-rotate program for the log curname, prevname being the
+ * previous log if any.
+ */
+static void run_postrotate_prog(rotate_config_t *config, const char *curname,
+                                const char *prevname, apr_pool_t *pool)
+{
+    apr_status_t rv;
+    apr_procattr_t *pattr;
+    const char *argv[4];
+    apr_proc_t proc;
+
+    /* Collect any zombies from a previous run, but don't wait. */
+    while (apr_proc_wait_all_procs(&proc, NULL, NULL, APR_NOWAIT, pool) == APR_CHILD_DONE)
+        /* noop */;
+
+    if ((rv = apr_procattr_create(&pattr, pool)) != APR_SUCCESS) {
+        char *error = apr_psprintf(pool, "post_rotate: apr_procattr_create failed " \
+                                         "for '%s': %pm\n", config->postrotate_prog, &rv);
+        fputs(error, stderr);
+        return;
+    }
+
+    rv = apr_procattr_error_check_set(pattr, 1);
+    if (rv == APR_SUCCESS)
+        rv = apr_procattr_cmdtype_set(pattr, APR_PROGRAM_ENV);
+
+    if (rv != APR_SUCCESS) {
+        char *error = apr_psprintf(pool, "post_rotate: could not set up process " \
+                                   "attributes for '%s': %pm\n", config->postrotate_prog,
+                                   &rv);
+        fputs(error, stderr);
+        return;
+    }
+
+    argv[0] = config->postrotate_prog;
+    argv[1] = curname;
+    argv[2] = prevname;
+    argv[3] = NULL;
+
+    if (config->verbose)
+        fprintf(stderr, "Calling post-rotate program: %s\n", argv[0]);
+
+    rv = apr_proc_create(&proc, argv[0], argv, NULL, pattr, pool);
+    if (rv != APR_SUCCESS) {
+        char *error = apr_psprintf(pool, "Could not spawn post-rotate process " \
+                                   "'%s': %pm\n", config->postrotate_prog, &rv);
+        fputs(error, stderr);
+        return;
+    }
+}
+
+#ifdef HAVE_ZLIB
+/*
+ * Compress a rotated log to name.gz and remove it when done.
+ */
+static apr_status_t compress_file(rotate_config_t *config, const char *name,
+                                  apr_pool_t *pool)
+{
+    const char *gzname = apr_pstrcat(pool, name, ".gz", NULL);
+    char *in = apr_palloc(pool, BUFSIZE);
+    char *out = apr_palloc(pool, BUFSIZE);
+    apr_file_t *f_in, *f_out;
+    apr_size_t nRead;
+    apr_status_t rv, rv2;
+    z_stream zs;
+    int flush;
+
+    if (config->verbose) {
+        fprintf(stderr, "Compressing file %s\n", name);
+    }
+    rv = apr_file_open(&f_in, name, APR_READ, APR_OS_DEFAULT, pool);
+    if (rv != APR_SUCCESS) {
+        return rv;
+    }
+    rv = apr_file_open(&f_out, gzname, APR_WRITE | APR_CREATE | APR_TRUNCATE,
+                       APR_OS_DEFAULT, pool);
+    if (rv != APR_SUCCESS) {
+        apr_file_close(f_in);
+        return rv;
+    }
+
+    memset(&zs, 0, sizeof(zs));
+    /* windowBits of 15 + 16 asks for a gzip header and trailer */
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        rv = APR_ENOMEM;
+    }
+    else {
+        do {
+            nRead = BUFSIZE;
+            rv = apr_file_read(f_in, in, &nRead);
+            if (APR_STATUS_IS_EOF(rv)) {
+                nRead = 0;
+                flush = Z_FINISH;
+                rv = APR_SUCCESS;
+            }
+            else if (rv != APR_SUCCESS) {
+                break;
+            }
+            else {
+                flush = Z_NO_FLUSH;
+            }
+            zs.next_in = (Bytef *)in;
+            zs.avail_in = (uInt)nRead;
+            do {
+                zs.next_out = (Bytef *)out;
+                zs.avail_out = BUFSIZE;
+                deflate(&zs, flush);
+                rv = apr_file_write_full(f_out, out, BUFSIZE - zs.avail_out,
+                                         NULL);
+            } while (rv == APR_SUCCESS && zs.avail_out == 0);
+        } while (rv == APR_SUCCESS && flush != Z_FINISH);
+        deflateEnd(&zs);
+    }
+
+    apr_file_close(f_in);
+    rv2 = apr_file_close(f_out);
+    if (rv == APR_SUCCESS) {
+        rv = rv2;
+    }
+    if (rv == APR_SUCCESS) {
+        rv = apr_file_remove(name, pool);
+    }
+    else {
+        apr_file_remove(gzname, pool);
+    }
+    return rv;
+}
+
+/*
+ * Finish the compression of name, rv being its result: run the
+ * post-rotate program for the log curname with the name of the
+ * compressed file, or of the original one if compressing failed.
+ */
+static void compress_done(rotate_config_t *config, const char *curname,
+                          const char *name, apr_status_t rv,
+                          apr_pool_t *pool)
+{
+    if (rv != APR_SUCCESS) {
+        fputs(apr_psprintf(pool, "Error compressing file %s (%pm)\n",
+                           name, &rv), stderr);
+    }
+    if (config->postrotate_prog) {
+        run_postrotate_prog(config, curname, rv == APR_SUCCESS
+                            ? apr_pstrcat(pool, name, ".gz", NULL) : name,
+                            pool);
+    }
+}
+
+#if APR_HAS_THREADS
+/*
+ * Rotated logs are compressed by a thread of their own, so that
+ * reading from httpd goes on while they are.
+ */
+typedef struct compress_job compress_job_t;
+
+struct compress_job {
+    compress_job_t *next;
+    char name[APR_PATH_MAX];
+    /* the log opened when name was rotated, for the post-rotate program */
+    char curname[APR_PATH_MAX];
+};
+
+static struct {
+    apr_thread_t *thread;
+    apr_thread_mutex_t *mutex;
+    apr_thread_cond_t *cond;
+    /* queued logs, the head one is being compressed */
+    compress_job_t *head;
+    compress_job_t *tail;
+    int done;
+} compressor;
+
+static void * APR_THREAD_FUNC compress_thread(apr_thread_t *thd, void *data)
+{
+    rotate_config_t *config = data;
+    apr_pool_t *pool;
+    compress_job_t *job;
+    apr_status_t rv;
+
+    apr_pool_create(&pool, apr_thread_pool_get(thd));
+    apr_thread_mutex_lock(compressor.mutex);
+    for (;;) {
+        while (!compressor.head && !compressor.done) {
+            apr_thread_cond_wait(compressor.cond, compressor.mutex);
+        }
+        if (!(job = compressor.head)) {
+            break;
+        }
+        apr_thread_mutex_unlock(compressor.mutex);
+
+        rv = compress_file(config, job->name, pool);
+        compress_done(config, job->curname, job->name, rv, pool);
+        apr_pool_clear(pool);
+
+        apr_thread_mutex_lock(compressor.mutex);
+        if (!(compressor.head = job->next)) {
+            compressor.tail = NULL;
+        }
+        free(job);
+        apr_thread_cond_broadcast(compressor.cond);
+    }
+    apr_thread_mutex_unlock(compressor.mutex);
+
+    apr_thread_exit(thd, APR_SUCCESS);
+    return NULL;
+}
+
+static void compress_start(rotate_config_t *config, apr_pool_t *pool)
+{
+    apr_status_t rv;
+
+    if ((rv = apr_thread_mutex_create(&compressor.mutex,
+                                      APR_THREAD_MUTEX_DEFAULT,
+                                      pool)) != APR_SUCCESS
+        || (rv = apr_thread_cond_create(&compressor.cond,
+                                        pool)) != APR_SUCCESS
+        || (rv = apr_thread_create(&compressor.thread, NULL, compress_thread,
+                                   config, pool)) != APR_SUCCESS) {
+        fputs(apr_psprintf(pool, "Unable to start compression thread (%pm)\n",
+                           &rv), stderr);
+        exit(1);
+    }
+}
+
+/*
+ * Hand a rotated log over to the compression thread, curname being the
+ * log which replaces it.
+ */
+static void compress_log(rotate_config_t *config, const char *name,
+                         const char *curname, apr_pool_t *pool)
+{
+    compress_job_t *job = malloc(sizeof(*job));
+
+    if (!job) {
+        fprintf(stderr, "Out of memory, not compressing file %s\n", name);
+        return;
+    }
+    job->next = NULL;
+    apr_cpystrn(job->name, name, sizeof(job->name));
+    apr_cpystrn(job->curname, curname, sizeof(job->curname));
+
+    apr_thread_mutex_lock(compressor.mutex);
+    if (compressor.tail) {
+        compressor.tail->next = job;
+    }
+    else {
+        compressor.head = job;
+    }
+    compressor.tail = job;
+    apr_thread_cond_broadcast(compressor.cond);
+    apr_thread_mutex_unlock(compressor.mutex);
+}
+
+/*
+ * Wait until a log about to be reused (-n) is no longer compressed.
+ * That only happens when compressing falls a whole cycle behind.
+ */
+static void compress_wait(const char *name)
+{
+    compress_job_t *job;
+
+    apr_thread_mutex_lock(compressor.mutex);
+    for (;;) {
+        for (job = compressor.head; job; job = job->next) {
+            if (!strcmp(job->name, name)) {
+                break;
+            }
+        }
+        if (!job) {
+            break;
+        }
+        apr_thread_cond_wait(compressor.cond, compressor.mutex);
+    }
+    apr_thread_mutex_unlock(compressor.mutex);
+}
+
+/*
+ * Let the compression thread finish the queued logs and exit.
+ */
+static void compress_stop(void)
+{
+    apr_status_t rv;
+
+    apr_thread_mutex_lock(compressor.mutex);
+    compressor.done = 1;
+    apr_thread_cond_broadcast(compressor.cond);
+    apr_thread_mutex_unlock(compressor.mutex);
+    apr_thread_join(&rv, compressor.thread);
+}
+#else /* APR_HAS_THREADS */
+static void compress_start(rotate_config_t *config, apr_pool_t *pool)
+{
+}
+
+static void compress_log(rotate_config_t *config, const char *name,
+                         const char *curname, apr_pool_t *pool)
+{
+    apr_status_t rv;
+
+    apr_pool_create(&pool, pool);
+    rv = compress_file(config, name, pool);
+    compress_done(config, curname, name, rv, pool);
+    apr_pool_destroy(pool);
+}
+
+static void compress_wait(const char *name)
+{
+}
+
+static void compress_stop(void)
+{
+}
+#endif /* APR_HAS_THREADS */
+#endif /* HAVE_ZLIB */
+
+#ifdef HAVE_SPLICE
+/*
+ * Move what is in the stdin pipe to the log without copying it through
+ * user space. EINVAL means that either side does not support it.
+ */
+static apr_status_t splice_log(apr_file_t *f_in, apr_file_t *f_out,
+                               apr_size_t *nMoved)
+{
+    apr_os_file_t in, out;
+    ssize_t n;
+
+    apr_os_file_get(&in, f_in);
+    apr_os_file_get(&out, f_out);
+    do {
+        n = splice(in, NULL, out, NULL, BUFSIZE, SPLICE_F_MOVE);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        *nMoved = 0;
+        return errno;
+    }
+    *nMoved = n;
+    return n ? APR_SUCCESS : APR_EOF;
+}
+#endif
+
 /*
  * Dump the configuration parsing result to STDERR.
  */
@@ -212,6 +606,12 @@ static void dumpConfig (rotate_config_t *config)
     fprintf(stderr, "Rotation verbose:            %12s\n", config->verbose ? "yes" : "no");
 #if APR_FILES_AS_SOCKETS
     fprintf(stderr, "Rotation create empty logs:  %12s\n", config->create_empty ? "yes" : "no");
+#endif
+#ifdef HAVE_ZLIB
+    fprintf(stderr, "Compress rotated logs:       %12s\n", config->compress ? "yes" : "no");
+#endif
+#ifdef HAVE_SPLICE
+    fprintf(stderr, "Move data with splice():     %12s\n", config->splice ? "yes" : "no");
 #endif
     fprintf(stderr, "Rotation file name: %21s\n", config->szLogRoot);
     fprintf(stderr, "Post-rotation prog: %21s\n", config->postrotate_prog ? config->postrotate_prog : "not used");
@@ -273,9 +673,6 @@ static void post_rotate(apr_pool_t *pool, struct logfile *newlog,
                         rotate_config_t *config, rotate_status_t *status)
 {
     apr_status_t rv;
-    apr_procattr_t *pattr;
-    const char *argv[4];
-    apr_proc_t proc;
 
     /* Handle link file, if configured. */
     if (config->linkfile) {
@@ -297,49 +694,18 @@ static void post_rotate(apr_pool_t *pool, struct logfile *newlog,
         return;
     }
 
-    /* Collect any zombies from a previous run, but don't wait. */
-    while (apr_proc_wait_all_procs(&proc, NULL, NULL, APR_NOWAIT, pool) == APR_CHILD_DONE)
-        /* noop */;
-
-    if ((rv = apr_procattr_create(&pattr, pool)) != APR_SUCCESS) {
-        char *error = apr_psprintf(pool, "post_rotate: apr_procattr_create failed " \
-                                         "for '%s': %pm\n", config->postrotate_prog, &rv);
-        fputs(error, stderr);
+#ifdef HAVE_ZLIB
+    /* The previous log is being compressed, the program gets the name
+     * of the compressed file once it is done, see compress_log(). */
+    if (config->compress && status->current.fd
+        && strcmp(status->current.name, newlog->name)) {
         return;
     }
+#endif
 
-    rv = apr_procattr_error_check_set(pattr, 1);
-    if (rv == APR_SUCCESS)
-        rv = apr_procattr_cmdtype_set(pattr, APR_PROGRAM_ENV);
-
-    if (rv != APR_SUCCESS) {
-        char *error = apr_psprintf(pool, "post_rotate: could not set up process " \
-                                   "attributes for '%s': %pm\n", config->postrotate_prog,
-                                   &rv);
-        fputs(error, stderr);
-        return;
-    }
-
-    argv[0] = config->postrotate_prog;
-    argv[1] = newlog->name;
-    if (status->current.fd) {
-        argv[2] = status->current.name;
-        argv[3] = NULL;
-    }
-    else {
-        argv[2] = NULL;
-    }
-
-    if (config->verbose)
-        fprintf(stderr, "Calling post-rotate program: %s\n", argv[0]);
-
-    rv = apr_proc_create(&proc, argv[0], argv, NULL, pattr, pool);
-    if (rv != APR_SUCCESS) {
-        char *error = apr_psprintf(pool, "Could not spawn post-rotate process " \
-                                   "'%s': %pm\n", config->postrotate_prog, &rv);
-        fputs(error, stderr);
-        return;
-    }
+    run_postrotate_prog(config, newlog->name,
+                        status->current.fd ? status->current.name : NULL,
+                        pool);
 }
 
 /* After a error, truncate the current file and write out an error
@@ -348,11 +714,15 @@ static void post_rotate(apr_pool_t *pool, struct logfile *newlog,
 static void truncate_and_write_error(rotate_status_t *status, const char *message)
 {
     apr_size_t buflen = strlen(message);
+    apr_off_t offset;
 
     if (apr_file_trunc(status->current.fd, 0) != APR_SUCCESS) {
         fprintf(stderr, "Error truncating the file %s\n", status->current.name);
         exit(2);
     }
+    /* Not opened for appending with -s, so go back to the start. */
+    offset = 0;
+    apr_file_seek(status->current.fd, APR_SET, &offset);
     if (apr_file_write_full(status->current.fd, message, buflen, NULL) != APR_SUCCESS) {
         fprintf(stderr, "Error writing error (%s) to the file %s\n", 
                 message, status->current.name);
@@ -360,6 +730,28 @@ static void truncate_and_write_error(rotate_status_t *status, const char *messag
     }
 }
 
+/* Note a failed write to the current file, throwing away its content
+ * so that the error can be written to it. */
+static void write_failed(rotate_status_t *status, apr_status_t rv)
+{
+    apr_off_t cur_offset;
+    apr_pool_t *pool;
+    char *error;
+
+    cur_offset = 0;
+    if (apr_file_seek(status->current.fd, APR_CUR, &cur_offset) != APR_SUCCESS) {
+        cur_offset = -1;
+    }
+    status->nMessCount++;
+    apr_pool_create(&pool, status->pool);
+    error = apr_psprintf(pool, "Error %d writing to log file at offset %"
+                         APR_OFF_T_FMT ". %10d messages lost (%pm)\n",
+                         rv, cur_offset, status->nMessCount, &rv);
+
+    truncate_and_write_error(status, error);
+    apr_pool_destroy(pool);
+}
+
 /*
  * Open a new log file, and if successful
  * also close the old one.
@@ -378,6 +770,7 @@ static void doRotate(rotate_config_t *config, rotate_status_t *status)
     apr_status_t rv;
     struct logfile newlog;
     int thisLogNum = -1;
+    apr_int32_t append;
 
     /* Retrieve local-time-adjusted-Unix-time. */
     now = get_now(config, &offset);
@@ -454,13 +847,30 @@ static void doRotate(rotate_config_t *config, rotate_status_t *status)
             }
         }
     }
+#ifdef HAVE_ZLIB
+    if (config->compress && config->num_files > 0) {
+        compress_wait(newlog.name);
+    }
+#endif
     if (config->verbose) {
         fprintf(stderr, "Opening file %s\n", newlog.name);
     }
-    rv = apr_file_open(&newlog.fd, newlog.name, APR_WRITE | APR_CREATE | APR_APPEND
+    /* splice() refuses to write to files opened for appending. */
+    append = APR_APPEND;
+#ifdef HAVE_SPLICE
+    if (config->splice) {
+        append = 0;
+    }
+#endif
+    rv = apr_file_open(&newlog.fd, newlog.name, APR_WRITE | APR_CREATE | append
                        | (config->truncate || (config->num_files > 0 && status->current.fd) ? APR_TRUNCATE : 0), 
                        APR_OS_DEFAULT, newlog.pool);
     if (rv == APR_SUCCESS) {
+        if (!append) {
+            apr_off_t end = 0;
+            apr_file_seek(newlog.fd, APR_END, &end);
+        }
+
         /* Handle post-rotate processing. */
         post_rotate(newlog.pool, &newlog, config, status);
 
@@ -468,6 +878,12 @@ static void doRotate(rotate_config_t *config, rotate_status_t *status)
         /* Close out old (previously 'current') logfile, if any. */
         if (status->current.fd) {
             close_logfile(config, &status->current);
+#ifdef HAVE_ZLIB
+            if (config->compress && strcmp(status->current.name, newlog.name)) {
+                compress_log(config, status->current.name, newlog.name,
+                             newlog.pool);
+            }
+#endif
         }
 
         /* New log file is now 'current'. */
@@ -571,6 +987,9 @@ int main (int argc, const char * const argv[])
     apr_pollfd_t pollfd = { 0 };
     apr_status_t pollret = APR_SUCCESS;
     long polltimeout;
+#ifdef HAVE_SPLICE
+    apr_int32_t nfds;
+#endif
 #endif
 
     apr_app_initialize(&argc, &argv, NULL);
@@ -582,11 +1001,17 @@ int main (int argc, const char * const argv[])
 
     apr_pool_create(&status.pool, NULL);
     apr_getopt_init(&opt, status.pool, argc, argv);
+    while ((rv = apr_getopt(opt, "lL:p:fDtven:"
 #if APR_FILES_AS_SOCKETS
-    while ((rv = apr_getopt(opt, "lL:p:fDtvecn:", &c, &opt_arg)) == APR_SUCCESS) {
-#else
-    while ((rv = apr_getopt(opt, "lL:p:fDtven:", &c, &opt_arg)) == APR_SUCCESS) {
+                            "c"
 #endif
+#ifdef HAVE_ZLIB
+                            "z"
+#endif
+#ifdef HAVE_SPLICE
+                            "s"
+#endif
+                            , &c, &opt_arg)) == APR_SUCCESS) {
         switch (c) {
         case 'l':
             config.use_localtime = 1;
@@ -625,6 +1050,16 @@ int main (int argc, const char * const argv[])
             config.num_files = atoi(opt_arg);
             status.fileNum = -1;
             break;
+#ifdef HAVE_ZLIB
+        case 'z':
+            config.compress = 1;
+            break;
+#endif
+#ifdef HAVE_SPLICE
+        case 's':
+            config.splice = 1;
+            break;
+#endif
         }
     }
 
@@ -667,6 +1102,20 @@ int main (int argc, const char * const argv[])
         exit(1);
     }
 
+#ifdef HAVE_ZLIB
+    if (config.compress && config.truncate) {
+        fprintf(stderr, "Cannot use -z with -t\n");
+        exit(1);
+    }
+#endif
+
+#ifdef HAVE_SPLICE
+    if (config.splice && config.echo) {
+        fprintf(stderr, "Cannot use -s with -e\n");
+        exit(1);
+    }
+#endif
+
     if (apr_file_open_stdin(&f_stdin, status.pool) != APR_SUCCESS) {
         fprintf(stderr, "Unable to open stdin\n");
         exit(1);
@@ -684,8 +1133,32 @@ int main (int argc, const char * const argv[])
         dumpConfig(&config);
     }
 
+#ifdef F_SETPIPE_SZ
+    {
+        apr_os_file_t fd;
+        int size;
+
+        /* Best effort, stdin may not be a pipe or the size not allowed */
+        apr_os_file_get(&fd, f_stdin);
+        size = fcntl(fd, F_SETPIPE_SZ, PIPE_SIZE);
+        if (size > 0 && config.verbose) {
+            fprintf(stderr, "Stdin pipe size:             %12d\n", size);
+        }
+    }
+#endif
+
+#ifdef HAVE_ZLIB
+    if (config.compress) {
+        compress_start(&config, status.pool);
+    }
+#endif
+
 #if APR_FILES_AS_SOCKETS
+#ifdef HAVE_SPLICE
+    if ((config.create_empty && config.tRotation) || config.splice) {
+#else
     if (config.create_empty && config.tRotation) {
+#endif
         pollfd.p = status.pool;
         pollfd.desc_type = APR_POLL_FILE;
         pollfd.reqevents = APR_POLLIN;
@@ -713,6 +1186,43 @@ int main (int argc, const char * const argv[])
                 pollret = apr_poll(&pollfd, 1, &pollret, apr_time_from_sec(polltimeout));
             }
         }
+#ifdef HAVE_SPLICE
+        else if (config.splice) {
+            /* Wait for data, so that the log is rotated before it is
+             * moved there. */
+            do {
+                pollret = apr_poll(&pollfd, 1, &nfds, -1);
+            } while (APR_STATUS_IS_EINTR(pollret));
+        }
+        if (config.splice && pollret == APR_SUCCESS) {
+            if (!(pollfd.rtnevents & APR_POLLIN)) {
+                break; /* stdin EOF */
+            }
+            checkRotate(&config, &status);
+            if (status.rotateReason != ROTATE_NONE) {
+                doRotate(&config, &status);
+            }
+
+            rv = splice_log(f_stdin, status.current.fd, &nRead);
+            if (rv == APR_SUCCESS) {
+                status.nMessCount++;
+            }
+            else if (APR_STATUS_IS_EOF(rv)) {
+                break;
+            }
+            else if (rv == APR_EINVAL) {
+                /* Not supported here, copy the data from now on. */
+                if (config.verbose) {
+                    fprintf(stderr, "Unable to splice, copying data instead\n");
+                }
+                config.splice = 0;
+            }
+            else {
+                write_failed(&status, rv);
+            }
+            continue;
+        }
+#endif
         if (pollret == APR_SUCCESS) {
             rv = apr_file_read(f_stdin, buf, &nRead);
             if (APR_STATUS_IS_EOF(rv)) {
@@ -747,22 +1257,7 @@ int main (int argc, const char * const argv[])
         nWrite = nRead;
         rv = apr_file_write_full(status.current.fd, buf, nWrite, &nWrite);
         if (nWrite != nRead) {
-            apr_off_t cur_offset;
-            apr_pool_t *pool;
-            char *error;
-
-            cur_offset = 0;
-            if (apr_file_seek(status.current.fd, APR_CUR, &cur_offset) != APR_SUCCESS) {
-                cur_offset = -1;
-            }
-            status.nMessCount++;
-            apr_pool_create(&pool, status.pool);
-            error = apr_psprintf(pool, "Error %d writing to log file at offset %"
-                                 APR_OFF_T_FMT ". %10d messages lost (%pm)\n",
-                                 rv, cur_offset, status.nMessCount, &rv);
-
-            truncate_and_write_error(&status, error);
-            apr_pool_destroy(pool);
+            write_failed(&status, rv);
         }
         else {
             status.nMessCount++;
@@ -775,5 +1270,11 @@ int main (int argc, const char * const argv[])
         }
     }
 
+#ifdef HAVE_ZLIB
+    if (config.compress) {
+        compress_stop();
+    }
+#endif
+
     return 0; /* reached only at stdin EOF. */
 }
@@ -0,0 +1,318 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    h2-headers-bench: measure the cost of getting response headers from
+    an apr_table_t (r->headers_out) into an HPACK encoded HEADERS block,
+    the way mod_http2 does it.
+
+    Three variants are timed for the same, header heavy response:
+
+    h1      the headers are serialized as HTTP/1.1 and parsed back into
+            a table before conversion (mod_http2 with H2SerializeHeaders on)
+    native  the table is converted to nghttp2 name/value pairs directly,
+            names and values are copied and lower cased as nghttp2 does
+            on submit
+    nocopy  like native, but lower case names come from a static table
+            and are not copied (NGHTTP2_NV_FLAG_NO_COPY_NAME), only
+            built with -DH2_NG2_NO_COPY_NV
+
+    Build with something like:
+
+      cc -O2 -DH2_NG2_NO_COPY_NV `apr-1-config --cflags --cppflags \
+         --includes` -o h2-headers-bench h2-headers-bench.c \
+         `apr-1-config --link-ld` -lnghttp2
+
+    and run "h2-headers-bench [iterations [extra-headers]]".
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <apr_general.h>
+#include <apr_lib.h>
+#include <apr_pools.h>
+#include <apr_strings.h>
+#include <apr_tables.h>
+#include <apr_time.h>
+
+#include <nghttp2/nghttp2.h>
+
+#define ALEN(a)     (sizeof(a)/sizeof((a)[0]))
+
+static const char *Headers[][2] = {
+    { "Date", "Thu, 19 Oct 2017 10:42:17 GMT" },
+    { "Server", "Apache/2.5.0-dev (Unix) OpenSSL/1.1.0f" },
+    { "Strict-Transport-Security", "max-age=63072000; includeSubDomains; preload" },
+    { "Content-Security-Policy", "default-src 'self'; script-src 'self' "
+      "https://cdn.example.org; img-src *; frame-ancestors 'none'" },
+    { "X-Content-Type-Options", "nosniff" },
+    { "X-Frame-Options", "DENY" },
+    { "X-XSS-Protection", "1; mode=block" },
+    { "Cache-Control", "private, max-age=0, must-revalidate" },
+    { "Expires", "Thu, 19 Oct 2017 10:42:17 GMT" },
+    { "Last-Modified", "Wed, 18 Oct 2017 21:13:02 GMT" },
+    { "ETag", "\"5ad3-55bd6d2b0ec80\"" },
+    { "Accept-Ranges", "bytes" },
+    { "Vary", "Accept-Encoding,Cookie" },
+    { "Content-Encoding", "gzip" },
+    { "Content-Length", "23251" },
+    { "Content-Type", "text/html; charset=UTF-8" },
+    { "Content-Language", "en" },
+    { "Link", "</css/site.css>; rel=preload; as=style" },
+    { "Link", "</js/app.js>; rel=preload; as=script" },
+    { "Set-Cookie", "session=4f2a1b3c9d8e7f6a5b4c3d2e1f0a9b8c; Path=/; "
+      "Secure; HttpOnly; SameSite=Lax" },
+    { "Set-Cookie", "prefs=lang%3Den%26tz%3DEurope%2FBerlin; Path=/; "
+      "Max-Age=31536000" },
+    { "Set-Cookie", "ab=variant-b; Path=/; Max-Age=86400" },
+    { "X-Request-Id", "WehBqX8AAQEAAB2pKGkAAAAC" },
+    { "X-Backend", "app-07.dc2.example.org" },
+};
+
+static const char *LcNames[] = {
+    "accept-ranges", "cache-control", "content-encoding",
+    "content-language", "content-length", "content-security-policy",
+    "content-type", "date", "etag", "expires", "last-modified", "link",
+    "server", "set-cookie", "strict-transport-security", "vary",
+    "x-content-type-options", "x-frame-options", "x-xss-protection",
+};
+
+typedef struct {
+    apr_pool_t *pool;
+    nghttp2_hd_deflater *deflater;
+    uint8_t *out;
+    size_t outlen;
+    size_t bytes;
+} bench_ctx;
+
+static apr_table_t *make_headers(apr_pool_t *p, int extra)
+{
+    apr_table_t *t = apr_table_make(p, (int)ALEN(Headers) + extra);
+    size_t i;
+    int j;
+
+    for (i = 0; i < ALEN(Headers); ++i) {
+        apr_table_addn(t, Headers[i][0], Headers[i][1]);
+    }
+    for (j = 0; j < extra; ++j) {
+        apr_table_addn(t, apr_psprintf(p, "X-Extra-Header-%d", j),
+                       apr_psprintf(p, "value of extra header number %d", j));
+    }
+    return t;
+}
+
+/* What nghttp2_submit_response() does with the name/value pairs: one
+ * allocation for all that needs copying, lower casing the names. */
+static void *copy_nv(nghttp2_nv *nv, size_t nvlen)
+{
+    size_t i, len = 0;
+    uint8_t *buf, *s;
+
+    for (i = 0; i < nvlen; ++i) {
+        if (!(nv[i].flags & NGHTTP2_NV_FLAG_NO_COPY_NAME)) {
+            len += nv[i].namelen + 1;
+        }
+        len += nv[i].valuelen + 1;
+    }
+    s = buf = malloc(len);
+    for (i = 0; i < nvlen; ++i) {
+        if (!(nv[i].flags & NGHTTP2_NV_FLAG_NO_COPY_NAME)) {
+            size_t j;
+            for (j = 0; j < nv[i].namelen; ++j) {
+                s[j] = (uint8_t)apr_tolower(nv[i].name[j]);
+            }
+            s[j] = 0;
+            nv[i].name = s;
+            s += nv[i].namelen + 1;
+        }
+        memcpy(s, nv[i].value, nv[i].valuelen + 1);
+        nv[i].value = s;
+        s += nv[i].valuelen + 1;
+    }
+    return buf;
+}
+
+static const char *lc_name(const char *name, size_t len)
+{
+    size_t i;
+    for (i = 0; i < ALEN(LcNames); ++i) {
+        if (strlen(LcNames[i]) == len && !strcasecmp(LcNames[i], name)) {
+            return LcNames[i];
+        }
+    }
+    return NULL;
+}
+
+static void encode(bench_ctx *ctx, apr_table_t *headers, int no_copy)
+{
+    const apr_array_header_t *elts = apr_table_elts(headers);
+    const apr_table_entry_t *e = (const apr_table_entry_t *)elts->elts;
+    nghttp2_nv *nv;
+    size_t nvlen = 0;
+    ssize_t rv;
+    void *buf;
+    int i;
+
+    nv = apr_pcalloc(ctx->pool, (elts->nelts + 1) * sizeof(*nv));
+    nv[nvlen].name = (uint8_t *)":status";
+    nv[nvlen].namelen = 7;
+    nv[nvlen].value = (uint8_t *)apr_itoa(ctx->pool, 200);
+    nv[nvlen].valuelen = 3;
+    ++nvlen;
+    for (i = 0; i < elts->nelts; ++i) {
+        const char *name = e[i].key;
+
+        if (!name) {
+            continue;
+        }
+        nv[nvlen].namelen = strlen(name);
+        nv[nvlen].valuelen = strlen(e[i].val);
+        if (no_copy) {
+            const char *lc = lc_name(name, nv[nvlen].namelen);
+            if (lc) {
+                name = lc;
+                nv[nvlen].flags = NGHTTP2_NV_FLAG_NO_COPY_NAME;
+            }
+        }
+        nv[nvlen].name = (uint8_t *)name;
+        nv[nvlen].value = (uint8_t *)e[i].val;
+        ++nvlen;
+    }
+
+    buf = copy_nv(nv, nvlen);
+    rv = nghttp2_hd_deflate_hd(ctx->deflater, ctx->out, ctx->outlen, nv, nvlen);
+    if (rv < 0) {
+        fprintf(stderr, "deflate failed: %s\n", nghttp2_strerror((int)rv));
+        exit(1);
+    }
+    ctx->bytes += (size_t)rv;
+    free(buf);
+}
+
+static apr_table_t *h1_roundtrip(apr_pool_t *p, apr_table_t *headers)
+{
+    const apr_array_header_t *elts = apr_table_elts(headers);
+    const apr_table_entry_t *e = (const apr_table_entry_t *)elts->elts;
+    apr_table_t *parsed = apr_table_make(p, elts->nelts);
+    char *text, *s, *line, *last, *sep;
+    apr_size_t len = sizeof("HTTP/1.1 200 OK\r\n\r\n");
+    int i;
+
+    for (i = 0; i < elts->nelts; ++i) {
+        if (e[i].key) {
+            len += strlen(e[i].key) + strlen(e[i].val) + 4;
+        }
+    }
+    s = text = apr_palloc(p, len);
+    s = apr_cpystrn(s, "HTTP/1.1 200 OK\r\n", len);
+    for (i = 0; i < elts->nelts; ++i) {
+        if (e[i].key) {
+            s = apr_cpystrn(s, e[i].key, len - (s - text));
+            s = apr_cpystrn(s, ": ", len - (s - text));
+            s = apr_cpystrn(s, e[i].val, len - (s - text));
+            s = apr_cpystrn(s, "\r\n", len - (s - text));
+        }
+    }
+    apr_cpystrn(s, "\r\n", len - (s - text));
+
+    /* skip the status line */
+    line = apr_strtok(text, "\r\n", &last);
+    while ((line = apr_strtok(NULL, "\r\n", &last)) != NULL) {
+        sep = strchr(line, ':');
+        if (!sep) {
+            continue;
+        }
+        *sep++ = '\0';
+        while (apr_isspace(*sep)) {
+            ++sep;
+        }
+        apr_table_add(parsed, line, sep);
+    }
+    return parsed;
+}
+
+static void run(const char *name, apr_table_t *headers, int n, int variant)
+{
+    bench_ctx ctx;
+    apr_time_t start, elapsed;
+    int i;
+
+    apr_pool_create(&ctx.pool, NULL);
+    nghttp2_hd_deflate_new(&ctx.deflater, 4096);
+    ctx.outlen = 64 * 1024;
+    ctx.out = malloc(ctx.outlen);
+    ctx.bytes = 0;
+
+    start = apr_time_now();
+    for (i = 0; i < n; ++i) {
+        switch (variant) {
+            case 0:
+                encode(&ctx, h1_roundtrip(ctx.pool, headers), 0);
+                break;
+            case 1:
+                encode(&ctx, headers, 0);
+                break;
+            default:
+                encode(&ctx, headers, 1);
+                break;
+        }
+        apr_pool_clear(ctx.pool);
+    }
+    elapsed = apr_time_now() - start;
+
+    printf("%-8s %8d responses, %8.3f us/response, %6.1f bytes HPACK/response\n",
+           name, n, (double)elapsed / n, (double)ctx.bytes / n);
+
+    free(ctx.out);
+    nghttp2_hd_deflate_del(ctx.deflater);
+    apr_pool_destroy(ctx.pool);
+}
+
+int main(int argc, const char * const argv[])
+{
+    apr_pool_t *pool;
+    apr_table_t *headers;
+    int n = 100000, extra = 0;
+
+    if (argc > 1) {
+        n = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        extra = atoi(argv[2]);
+    }
+    if (n <= 0 || extra < 0) {
+        fprintf(stderr, "usage: %s [iterations [extra-headers]]\n", argv[0]);
+        return 1;
+    }
+
+    apr_app_initialize(&argc, &argv, NULL);
+    apr_pool_create(&pool, NULL);
+    headers = make_headers(pool, extra);
+    printf("%d header fields per response\n",
+           apr_table_elts(headers)->nelts + 1);
+
+    run("h1", headers, n, 0);
+    run("native", headers, n, 1);
+#ifdef H2_NG2_NO_COPY_NV
+    run("nocopy", headers, n, 2);
+#endif
+
+    apr_pool_destroy(pool);
+    apr_terminate();
+    return 0;
+}
@@ -0,0 +1,276 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+    log-format-bench: measure the cost of formatting one access log line
+    in the "combined" format, the two ways mod_log_config does it.
+
+    pool      every item is escaped into a copy from the request pool,
+              the pieces are measured and copied once more into the
+              line (process_item() and ap_default_log_writer())
+    inline    the items are escaped straight into a buffer on the stack
+              and the CLF time comes from a per second cache
+              (format_item())
+
+    Build with something like:
+
+      cc -O2 `apr-1-config --cflags --cppflags --includes` \
+         -o log-format-bench log-format-bench.c `apr-1-config --link-ld`
+
+    and run "log-format-bench [iterations]".
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <apr_general.h>
+#include <apr_pools.h>
+#include <apr_strings.h>
+#include <apr_time.h>
+
+#define LINE_SIZE   2048
+
+typedef struct {
+    const char *host;
+    const char *user;
+    const char *request;
+    int status;
+    apr_off_t bytes;
+    const char *referer;
+    const char *agent;
+    apr_time_t time;
+} fake_request;
+
+#define ESCAPE(c) \
+    ((c) < 0x20 || (c) >= 0x7f || (c) == '"' || (c) == '\\')
+
+/* As ap_escape_logitem() */
+static char *escape_pool(apr_pool_t *p, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *s;
+    unsigned char *d;
+    apr_size_t n = 0;
+    char *ret;
+
+    if (!str) {
+        return NULL;
+    }
+    for (s = (const unsigned char *)str; *s; ++s) {
+        if (ESCAPE(*s)) {
+            ++n;
+        }
+    }
+    if (!n) {
+        return apr_pmemdup(p, str, (const char *)s - str + 1);
+    }
+    d = (unsigned char *)(ret = apr_palloc(p, (const char *)s - str + 3 * n + 1));
+    for (s = (const unsigned char *)str; *s; ++s) {
+        if (ESCAPE(*s)) {
+            *d++ = '\\';
+            *d++ = 'x';
+            *d++ = hex[*s >> 4];
+            *d++ = hex[*s & 0xf];
+        }
+        else {
+            *d++ = *s;
+        }
+    }
+    *d = '\0';
+    return ret;
+}
+
+static const char *clf_time(apr_pool_t *p, apr_time_t t)
+{
+    apr_time_exp_t xt;
+
+    apr_time_exp_lt(&xt, t);
+    return apr_psprintf(p, "[%02d/%s/%d:%02d:%02d:%02d %c%.2d%.2d]",
+                        xt.tm_mday, apr_month_snames[xt.tm_mon],
+                        xt.tm_year + 1900, xt.tm_hour, xt.tm_min, xt.tm_sec,
+                        xt.tm_gmtoff < 0 ? '-' : '+',
+                        abs(xt.tm_gmtoff) / 3600, abs(xt.tm_gmtoff) % 3600 / 60);
+}
+
+static apr_size_t format_pool(apr_pool_t *p, const fake_request *r)
+{
+    const char *strs[16];
+    int strl[16], i, n = 0;
+    apr_size_t len = 0;
+    char *str, *s;
+
+    strs[n++] = escape_pool(p, r->host);
+    strs[n++] = " - ";
+    strs[n++] = escape_pool(p, r->user);
+    strs[n++] = " ";
+    strs[n++] = clf_time(p, r->time);
+    strs[n++] = " \"";
+    strs[n++] = escape_pool(p, r->request);
+    strs[n++] = "\" ";
+    strs[n++] = apr_itoa(p, r->status);
+    strs[n++] = " ";
+    strs[n++] = apr_off_t_toa(p, r->bytes);
+    strs[n++] = " \"";
+    strs[n++] = escape_pool(p, r->referer);
+    strs[n++] = "\" \"";
+    strs[n++] = escape_pool(p, r->agent);
+    strs[n++] = "\"\n";
+
+    for (i = 0; i < n; ++i) {
+        len += strl[i] = strlen(strs[i]);
+    }
+    s = str = apr_palloc(p, len + 1);
+    for (i = 0; i < n; ++i) {
+        memcpy(s, strs[i], strl[i]);
+        s += strl[i];
+    }
+    return len;
+}
+
+typedef struct {
+    char *buf;
+    apr_size_t len;
+} line_t;
+
+static void add(line_t *l, const char *s, apr_size_t n)
+{
+    if (l->len + n <= LINE_SIZE) {
+        memcpy(l->buf + l->len, s, n);
+        l->len += n;
+    }
+}
+
+static void add_escaped(line_t *l, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    const unsigned char *s = (const unsigned char *)str, *start;
+    char esc[4];
+
+    for (;;) {
+        start = s;
+        while (*s && !ESCAPE(*s)) {
+            ++s;
+        }
+        add(l, (const char *)start, s - start);
+        if (!*s) {
+            break;
+        }
+        esc[0] = '\\';
+        esc[1] = 'x';
+        esc[2] = hex[*s >> 4];
+        esc[3] = hex[*s & 0xf];
+        add(l, esc, 4);
+        ++s;
+    }
+}
+
+static void add_num(line_t *l, apr_int64_t n)
+{
+    char digits[24], *d = digits + sizeof(digits);
+
+    do {
+        *--d = '0' + (char)(n % 10);
+        n /= 10;
+    } while (n);
+    add(l, d, digits + sizeof(digits) - d);
+}
+
+static apr_size_t format_inline(apr_pool_t *p, const fake_request *r)
+{
+    static char cached[32];
+    static apr_time_t cached_sec = -1;
+    char buf[LINE_SIZE];
+    line_t l;
+
+    l.buf = buf;
+    l.len = 0;
+    if (apr_time_sec(r->time) != cached_sec) {
+        apr_cpystrn(cached, clf_time(p, r->time), sizeof(cached));
+        cached_sec = apr_time_sec(r->time);
+    }
+
+    add_escaped(&l, r->host);
+    add(&l, " - ", 3);
+    add_escaped(&l, r->user);
+    add(&l, " ", 1);
+    add(&l, cached, strlen(cached));
+    add(&l, " \"", 2);
+    add_escaped(&l, r->request);
+    add(&l, "\" ", 2);
+    add_num(&l, r->status);
+    add(&l, " ", 1);
+    add_num(&l, r->bytes);
+    add(&l, " \"", 2);
+    add_escaped(&l, r->referer);
+    add(&l, "\" \"", 3);
+    add_escaped(&l, r->agent);
+    add(&l, "\"\n", 2);
+    return l.len;
+}
+
+static void run(const char *name, const fake_request *r, int n,
+                apr_size_t (*fn)(apr_pool_t *, const fake_request *))
+{
+    apr_pool_t *pool;
+    apr_time_t start, elapsed;
+    apr_size_t bytes = 0;
+    int i;
+
+    apr_pool_create(&pool, NULL);
+    start = apr_time_now();
+    for (i = 0; i < n; ++i) {
+        bytes += fn(pool, r);
+        apr_pool_clear(pool);
+    }
+    elapsed = apr_time_now() - start;
+
+    printf("%-8s %8d lines, %8.3f us/line, %6.1f bytes/line\n",
+           name, n, (double)elapsed / n, (double)bytes / n);
+    apr_pool_destroy(pool);
+}
+
+int main(int argc, const char * const argv[])
+{
+    fake_request r;
+    int n = 1000000;
+
+    if (argc > 1) {
+        n = atoi(argv[1]);
+    }
+    if (n <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    apr_app_initialize(&argc, &argv, NULL);
+
+    r.host = "2001:db8:85a3::8a2e:370:7334";
+    r.user = "-";
+    r.request = "GET /search?q=apache+httpd+%22log+format%22&page=2 HTTP/1.1";
+    r.status = 200;
+    r.bytes = 23251;
+    r.referer = "https://www.example.org/search?q=apache+httpd";
+    r.agent = "Mozilla/5.0 (X11; Linux x86_64; rv:56.0) Gecko/20100101 "
+              "Firefox/56.0";
+    r.time = apr_time_now();
+
+    run("pool", &r, n, format_pool);
+    run("inline", &r, n, format_inline);
+
+    apr_terminate();
+    return 0;
+}
@@ -0,0 +1,210 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../httpdunit.h"
+
+#include "ap_config.h"
+
+/* mod_http2 can only be built, and tested, with nghttp2. HAVE_NGHTTP2 comes
+ * from ap_config_auto.h when configure found it for mod_http2 or
+ * mod_proxy_http2, or from CMake when NGHTTP2_FOUND. Without it none of the
+ * tests below are compiled nor added to the test case, rather than passing
+ * without checking anything.
+ */
+#ifdef HAVE_NGHTTP2
+
+#include <nghttp2/nghttp2.h>
+
+/* Test the no-copy path whenever nghttp2 has the flags (1.5.0 and later),
+ * even if configure did not enable it for the module.
+ */
+#if !defined(H2_NG2_NO_COPY_NV) && NGHTTP2_VERSION_NUM >= 0x010500
+#define H2_NG2_NO_COPY_NV
+#endif
+
+/* XXX Same headaches as with the mod_auth_digest tests: the module's static
+ * helpers are only reachable by pulling in its source.
+ */
+#include "../../modules/http2/h2_util.c"
+
+#endif /* HAVE_NGHTTP2 */
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+
+static void h2_util_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+}
+
+static void h2_util_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+#ifdef HAVE_NGHTTP2
+
+static h2_headers *make_headers(int status)
+{
+    h2_headers *h = apr_pcalloc(g_pool, sizeof(*h));
+
+    h->status = status;
+    h->headers = apr_table_make(g_pool, 5);
+    h->notes = apr_table_make(g_pool, 1);
+    return h;
+}
+
+static void assert_nv(const nghttp2_nv *nv, const char *name,
+                      const char *value)
+{
+    /* names are only lower cased with no-copy, see assert_nv_name() */
+    ck_assert_int_eq(nv->namelen, strlen(name));
+    ck_assert(!ap_cstr_casecmpn((const char *)nv->name, name, nv->namelen));
+    ck_assert_int_eq(nv->valuelen, strlen(value));
+    ck_assert(!memcmp(nv->value, value, nv->valuelen));
+    /* values live in the request's pool, nghttp2 must copy them */
+    ck_assert(!(nv->flags & NGHTTP2_NV_FLAG_NO_COPY_VALUE));
+}
+
+/* Check the name of a header field the way nghttp2 is going to take it:
+ * names it does not copy must already be lower case.
+ */
+static void assert_nv_name(const nghttp2_nv *nv, const char *name,
+                           const char *lc)
+{
+#ifdef H2_NG2_NO_COPY_NV
+    if (nv->flags & NGHTTP2_NV_FLAG_NO_COPY_NAME) {
+        ck_assert_int_eq(nv->namelen, strlen(lc));
+        ck_assert(!memcmp(nv->name, lc, nv->namelen));
+    }
+    else {
+        /* only names that are lower case already are left as they are */
+        ck_assert_str_eq(name, lc);
+        ck_assert(nv->name == (const uint8_t *)name);
+    }
+    if (strcmp(name, lc)) {
+        ck_assert(nv->flags & NGHTTP2_NV_FLAG_NO_COPY_NAME);
+    }
+#else
+    /* nghttp2 copies the name and lower cases it itself */
+    ck_assert(nv->name == (const uint8_t *)name);
+    ck_assert_int_eq(nv->flags, NGHTTP2_NV_FLAG_NONE);
+#endif
+}
+
+/*
+ * h2_res_create_ngheader() and h2_res_create_ngtrailer()
+ */
+
+static const struct {
+    const char *name;
+    const char *lc;
+} ngheader_name_cases[] = {
+    /* in the table of common response header names */
+    { "Content-Type",           "content-type" },
+    { "content-type",           "content-type" },
+    { "ETag",                   "etag" },
+    { "SET-COOKIE",             "set-cookie" },
+    { "X-Content-Type-Options", "x-content-type-options" },
+    /* not in the table */
+    { "X-Powered-By",           "x-powered-by" },
+    { "x-lower-case",           "x-lower-case" },
+    { "X",                      "x" },
+};
+static const size_t ngheader_name_cases_len = sizeof(ngheader_name_cases) /
+                                              sizeof(ngheader_name_cases[0]);
+
+HTTPD_START_LOOP_TEST(ngheader_lower_cases_names, ngheader_name_cases_len)
+{
+    const char *name = ngheader_name_cases[_i].name;
+    h2_headers *h = make_headers(200);
+    h2_ngheader *ngh;
+
+    apr_table_setn(h->headers, name, "v");
+    ck_assert_int_eq(h2_res_create_ngheader(&ngh, g_pool, h), APR_SUCCESS);
+
+    ck_assert_int_eq(ngh->nvlen, 2);
+    assert_nv(&ngh->nv[0], ":status", "200");
+    assert_nv(&ngh->nv[1], ngheader_name_cases[_i].lc, "v");
+    assert_nv_name(&ngh->nv[1], name, ngheader_name_cases[_i].lc);
+}
+END_TEST
+
+HTTPD_START_LOOP_TEST(ngtrailer_lower_cases_names, ngheader_name_cases_len)
+{
+    const char *name = ngheader_name_cases[_i].name;
+    h2_headers *h = make_headers(200);
+    h2_ngheader *ngh;
+
+    apr_table_setn(h->headers, name, "v");
+    ck_assert_int_eq(h2_res_create_ngtrailer(&ngh, g_pool, h), APR_SUCCESS);
+
+    ck_assert_int_eq(ngh->nvlen, 1);
+    assert_nv(&ngh->nv[0], ngheader_name_cases[_i].lc, "v");
+    assert_nv_name(&ngh->nv[0], name, ngheader_name_cases[_i].lc);
+}
+END_TEST
+
+START_TEST(ngheader_keeps_order_and_drops_connection_headers)
+{
+    h2_headers *h = make_headers(404);
+    h2_ngheader *ngh;
+
+    apr_table_setn(h->headers, "Content-Type", "text/html");
+    apr_table_setn(h->headers, "Connection", "close");
+    apr_table_addn(h->headers, "Set-Cookie", "a=1");
+    apr_table_setn(h->headers, "Transfer-Encoding", "chunked");
+    apr_table_addn(h->headers, "Set-Cookie", "b=2");
+    apr_table_setn(h->headers, "Keep-Alive", "timeout=5");
+    ck_assert_int_eq(h2_res_create_ngheader(&ngh, g_pool, h), APR_SUCCESS);
+
+    ck_assert_int_eq(ngh->nvlen, 4);
+    assert_nv(&ngh->nv[0], ":status", "404");
+    assert_nv(&ngh->nv[1], "content-type", "text/html");
+    assert_nv(&ngh->nv[2], "set-cookie", "a=1");
+    assert_nv(&ngh->nv[3], "set-cookie", "b=2");
+}
+END_TEST
+
+START_TEST(ngheader_rejects_invalid_fields_unless_unsafe)
+{
+    h2_headers *h = make_headers(200);
+    h2_ngheader *ngh;
+
+    apr_table_setn(h->headers, "Bad Name", "v");
+    ck_assert_int_eq(h2_res_create_ngheader(&ngh, g_pool, h), APR_EINVAL);
+
+    apr_table_setn(h->notes, H2_HDR_CONFORMANCE, H2_HDR_CONFORMANCE_UNSAFE);
+    ck_assert_int_eq(h2_res_create_ngheader(&ngh, g_pool, h), APR_SUCCESS);
+    ck_assert_int_eq(ngh->nvlen, 2);
+}
+END_TEST
+
+#endif /* HAVE_NGHTTP2 */
+
+/*
+ * Test Case Boilerplate
+ */
+HTTPD_BEGIN_TEST_CASE_WITH_FIXTURE(h2_util, h2_util_setup, h2_util_teardown)
+#ifdef HAVE_NGHTTP2
+#include "test/unit/h2_util.tests"
+#endif
+HTTPD_END_TEST_CASE
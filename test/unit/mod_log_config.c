@@ -0,0 +1,289 @@
+/* Licensed to the Apache Software Foundation (ASF) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * The ASF licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../httpdunit.h"
+
+/* XXX Same headaches as with the mod_auth_digest tests: the module's static
+ * helpers are only reachable by pulling in its source.
+ */
+#include "../../modules/loggers/mod_log_config.c"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+
+static void mod_log_config_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS) {
+        exit(1);
+    }
+}
+
+static void mod_log_config_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+/* Start a line in a buffer small enough for it to have to grow. */
+static void line_init(log_line *line, char *buf, apr_size_t size)
+{
+    line->buf = buf;
+    line->len = 0;
+    line->size = size;
+    line->pool = g_pool;
+}
+
+/*
+ * log_line_escape()
+ */
+
+HTTPD_START_LOOP_TEST(escape_matches_ap_escape_logitem, 256)
+{
+    char buf[4];
+    log_line line;
+    const char *expected;
+    char str[4];
+
+    /* the byte between two others, 0 ends the string right away */
+    str[0] = 'a';
+    str[1] = (char)_i;
+    str[2] = 'b';
+    str[3] = '\0';
+    expected = ap_escape_logitem(g_pool, str);
+
+    line_init(&line, buf, sizeof(buf));
+    log_line_escape(&line, str);
+
+    ck_assert_int_eq(line.len, strlen(expected));
+    ck_assert(!memcmp(line.buf, expected, line.len));
+}
+END_TEST
+
+START_TEST(escape_matches_ap_escape_logitem_for_whole_strings)
+{
+    char buf[8];
+    log_line line;
+    char str[256];
+    const char *expected;
+    int i;
+
+    /* all bytes at once, so that escapes and runs of plain text alternate */
+    for (i = 1; i < 256; ++i) {
+        str[i - 1] = (char)i;
+    }
+    str[255] = '\0';
+    expected = ap_escape_logitem(g_pool, str);
+
+    line_init(&line, buf, sizeof(buf));
+    log_line_escape(&line, str);
+
+    ck_assert_int_eq(line.len, strlen(expected));
+    ck_assert(!memcmp(line.buf, expected, line.len));
+}
+END_TEST
+
+START_TEST(escape_logs_null_as_dash)
+{
+    char buf[8];
+    log_line line;
+
+    line_init(&line, buf, sizeof(buf));
+    log_line_escape(&line, NULL);
+
+    ck_assert_int_eq(line.len, 1);
+    ck_assert(line.buf[0] == '-');
+}
+END_TEST
+
+START_TEST(escape_appends_nothing_for_empty_strings)
+{
+    char buf[8];
+    log_line line;
+
+    line_init(&line, buf, sizeof(buf));
+    log_line_escape(&line, "");
+
+    ck_assert_int_eq(line.len, 0);
+}
+END_TEST
+
+/*
+ * log_line_json()
+ */
+
+static void assert_json(const char *str, const char *expected)
+{
+    char buf[4];
+    log_line line;
+
+    line_init(&line, buf, sizeof(buf));
+    log_line_json(&line, str);
+
+    ck_assert_int_eq(line.len, strlen(expected));
+    ck_assert(!memcmp(line.buf, expected, line.len));
+}
+
+START_TEST(json_keeps_valid_utf8)
+{
+    assert_json("caf\xc3\xa9", "\"caf\xc3\xa9\"");
+    assert_json("\xe2\x82\xac \xf0\x9f\x98\x80",
+                "\"\xe2\x82\xac \xf0\x9f\x98\x80\"");
+    assert_json("\xef\xbf\xbf\xf4\x8f\xbf\xbf",
+                "\"\xef\xbf\xbf\xf4\x8f\xbf\xbf\"");
+}
+END_TEST
+
+START_TEST(json_escapes_invalid_utf8)
+{
+    /* latin-1, overlong, surrogate, beyond U+10FFFF, cut short */
+    assert_json("caf\xe9", "\"caf\\u00e9\"");
+    assert_json("\xc0\xaf", "\"\\u00c0\\u00af\"");
+    assert_json("\xed\xa0\x80", "\"\\u00ed\\u00a0\\u0080\"");
+    assert_json("\xf4\x90\x80\x80",
+                "\"\\u00f4\\u0090\\u0080\\u0080\"");
+    assert_json("\xe2\x82", "\"\\u00e2\\u0082\"");
+}
+END_TEST
+
+START_TEST(json_escapes_controls_and_quotes)
+{
+    assert_json("a\"b\\c\n\x01\x7f", "\"a\\\"b\\\\c\\n\\u0001\\u007f\"");
+}
+END_TEST
+
+/*
+ * log_line_varint() and log_line_zigzag()
+ */
+
+/* Decode like support/logdecode does, returns the number of bytes used
+ * or 0 if the varint does not end in time. */
+static apr_size_t get_varint(const char *buf, apr_size_t len,
+                             apr_uint64_t *v)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+    apr_size_t n = 0;
+    int shift = 0;
+
+    *v = 0;
+    while (n < len && shift < 64) {
+        *v |= (apr_uint64_t)(p[n] & 0x7f) << shift;
+        if (!(p[n++] & 0x80)) {
+            return n;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+static const struct {
+    apr_uint64_t value;
+    apr_size_t len;
+} varint_cases[] = {
+    { 0,                                 1 },
+    { 1,                                 1 },
+    { 0x7f,                              1 },
+    { 0x80,                              2 },
+    { 300,                               2 },
+    { 0x3fff,                            2 },
+    { 0x4000,                            3 },
+    { APR_UINT64_C(0xffffffff),          5 },
+    { APR_UINT64_C(0x7fffffffffffffff),  9 },
+    { APR_UINT64_C(0x8000000000000000), 10 },
+    { APR_UINT64_C(0xffffffffffffffff), 10 },
+};
+static const size_t varint_cases_len = sizeof(varint_cases) /
+                                       sizeof(varint_cases[0]);
+
+HTTPD_START_LOOP_TEST(varint_round_trips, varint_cases_len)
+{
+    char buf[4];
+    log_line line;
+    apr_uint64_t v;
+
+    line_init(&line, buf, sizeof(buf));
+    log_line_varint(&line, varint_cases[_i].value);
+
+    ck_assert_int_eq(line.len, varint_cases[_i].len);
+    ck_assert_int_eq(get_varint(line.buf, line.len, &v), line.len);
+    ck_assert(v == varint_cases[_i].value);
+}
+END_TEST
+
+static const struct {
+    apr_int64_t value;
+    apr_uint64_t encoded;
+} zigzag_cases[] = {
+    { 0,                                  0 },
+    { -1,                                 1 },
+    { 1,                                  2 },
+    { -2,                                 3 },
+    { 2,                                  4 },
+    { -300,                             599 },
+    { APR_INT64_C(0x7fffffffffffffff),    APR_UINT64_C(0xfffffffffffffffe) },
+    { -APR_INT64_C(0x7fffffffffffffff) - 1,
+                                          APR_UINT64_C(0xffffffffffffffff) },
+};
+static const size_t zigzag_cases_len = sizeof(zigzag_cases) /
+                                       sizeof(zigzag_cases[0]);
+
+HTTPD_START_LOOP_TEST(zigzag_round_trips, zigzag_cases_len)
+{
+    char buf[4];
+    log_line line;
+    apr_uint64_t v;
+    apr_int64_t n;
+
+    line_init(&line, buf, sizeof(buf));
+    log_line_zigzag(&line, zigzag_cases[_i].value);
+
+    ck_assert_int_eq(get_varint(line.buf, line.len, &v), line.len);
+    ck_assert(v == zigzag_cases[_i].encoded);
+
+    n = (apr_int64_t)(v >> 1) ^ -(apr_int64_t)(v & 1);
+    ck_assert(n == zigzag_cases[_i].value);
+}
+END_TEST
+
+START_TEST(varints_follow_each_other)
+{
+    char buf[4];
+    log_line line;
+    apr_uint64_t v;
+    apr_size_t pos = 0, n;
+    size_t i;
+
+    line_init(&line, buf, sizeof(buf));
+    for (i = 0; i < varint_cases_len; ++i) {
+        log_line_varint(&line, varint_cases[i].value);
+    }
+    for (i = 0; i < varint_cases_len; ++i) {
+        n = get_varint(line.buf + pos, line.len - pos, &v);
+        ck_assert_int_eq(n, varint_cases[i].len);
+        ck_assert(v == varint_cases[i].value);
+        pos += n;
+    }
+    ck_assert_int_eq(pos, line.len);
+}
+END_TEST
+
+/*
+ * Test Case Boilerplate
+ */
+HTTPD_BEGIN_TEST_CASE_WITH_FIXTURE(mod_log_config, mod_log_config_setup, mod_log_config_teardown)
+#include "test/unit/mod_log_config.tests"
+HTTPD_END_TEST_CASE